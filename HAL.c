@@ -1,33 +1,184 @@
 /*******************************************************************************
 * Includes
 ******************************************************************************/
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE                             /* SEEK_DATA/SEEK_HOLE with glibc */
+#endif
+#define _FILE_OFFSET_BITS 64                    /* 64-bit off_t on 32-bit systems, images > 2 GiB */
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include "HAL_direct.h"
+
+#if defined(__linux__) || defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#define KMC_POSITIONAL_IO
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+#define KMC_SPARSE_FILES
+#endif
+#else
+#include <pthread.h>
+#endif
 
 /*******************************************************************************
 * Definitions
 ******************************************************************************/
 #define KMC_DEFAULT_SECTOR_SIZE (512U)
+#define KMC_EXTENT_GROW         (256U)          /* data regions added per realloc() */
+
+/* fdatasync() skips the metadata a write doesn't need, macOS only has fsync() */
+#if defined(__APPLE__)
+#define KMC_DATASYNC(fd)        fsync(fd)
+#else
+#define KMC_DATASYNC(fd)        fdatasync(fd)
+#endif
+
+/* fseek() takes a long, which is 32 bits on Windows */
+#if defined(_WIN32)
+#define KMC_SEEK(file,offset)   _fseeki64((file),(long long)(offset),SEEK_SET)
+#else
+#define KMC_SEEK(file,offset)   fseek((file),(long)(offset),SEEK_SET)
+#endif
+
+enum Kmc_Backend
+{
+    KMC_BACKEND_STDIO = 0,
+    KMC_BACKEND_DIRECT = 1
+};
+
+typedef struct
+{
+    uint64_t start;                             /* first byte of a data region of the file  */
+    uint64_t end;                               /* first byte after it                      */
+} kmc_extent_t;
 
 /*******************************************************************************
 * Variables
 ******************************************************************************/
 FILE* floppy = NULL;
 static uint16_t kmc_sector_size = KMC_DEFAULT_SECTOR_SIZE;
+static uint8_t kmc_backend_wanted = KMC_BACKEND_STDIO;   /* set by kmc_use_direct_io()          */
+static uint8_t kmc_backend = KMC_BACKEND_STDIO;          /* backend of the open file            */
+static uint64_t kmc_volume_offset = 0;                   /* byte offset of the volume in the file */
+static kmc_extent_t* kmc_extents = NULL;                 /* data regions of a sparse file, sorted */
+static uint32_t kmc_extent_count = 0;
+static uint64_t kmc_file_size = 0;
+static bool kmc_sparse = false;                          /* the open file has holes in kmc_extents */
+#if !defined(KMC_POSITIONAL_IO)
+static pthread_mutex_t kmc_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/*******************************************************************************
+* Prototypes
+******************************************************************************/
+
+/** @brief This function moves bytes between an array and the file at a sector
+ * of the volume (kmc_volume_offset is added). pread()/pwrite() don't use the shared file position, so several threads can
+ * read at once; other systems serialize seek and transfer with a lock.
+ * @param index - first sector.
+ * @param bytes - number of bytes.
+ * @param buff - source or destination array.
+ * @param write - 1 to write buff, 0 to read into buff.
+ * @return - Return a number of total bytes moved.
+ */
+static int32_t kmc_transfer(uint32_t index, uint32_t bytes, uint8_t* buff, bool write);
+
+
+/** @brief This function moves bytes between an array and an open file at a byte offset
+ * (stdio backend of kmc_transfer() and of the handles of kmc_open_handle()).
+ * @param file - open file.
+ * @param offset - byte offset in the file.
+ * @param bytes - number of bytes.
+ * @param buff - source or destination array.
+ * @param write - 1 to write buff, 0 to read into buff.
+ * @return - Return a number of total bytes moved.
+ */
+static int32_t kmc_file_transfer(FILE* file, uint64_t offset, uint32_t bytes, uint8_t* buff, bool write);
+
+
+/** @brief This function moves bytes between an array and the open file through its backend.
+ * @param offset - byte offset in the file.
+ * @param bytes - number of bytes.
+ * @param buff - source or destination array.
+ * @param write - 1 to write buff, 0 to read into buff.
+ * @return - Return a number of total bytes moved.
+ */
+static int32_t kmc_backend_transfer(uint64_t offset, uint32_t bytes, uint8_t* buff, bool write);
+
+
+/** @brief This function reads bytes of a sparse file: data regions are read, holes are
+ * filled with zeros without I/O.
+ * @param offset - byte offset in the file.
+ * @param bytes - number of bytes.
+ * @param buff - an array to store byte values after reading.
+ * @return - Return a number of total bytes read.
+ */
+static int32_t kmc_read_sparse(uint64_t offset, uint32_t bytes, uint8_t* buff);
+
+
+/** @brief This function finds the data regions of a file with SEEK_DATA/SEEK_HOLE. A file
+ * without holes, or a file system that can't tell, leaves kmc_sparse at 0.
+ * @param buff - file path.
+ */
+static void kmc_map_holes(uint8_t* buff);
+
+
+/** @brief This function finds the first data region that ends after a byte.
+ * @param offset - byte offset in the file.
+ * @return - Return its number, kmc_extent_count if there is none.
+ */
+static uint32_t kmc_find_extent(uint64_t offset);
+
+
+/** @brief This function forgets the data regions of the closed file.
+ */
+static void kmc_free_holes(void);
 
 /*******************************************************************************
 * Code
 ******************************************************************************/
+void kmc_use_direct_io(bool enable)
+{
+    kmc_backend_wanted = (enable == true) ? KMC_BACKEND_DIRECT : KMC_BACKEND_STDIO;
+}
+
+bool kmc_direct_io_active(void)
+{
+    return (kmc_backend == KMC_BACKEND_DIRECT);
+}
+
+void kmc_set_volume_offset(uint64_t offset)
+{
+    kmc_volume_offset = offset;
+}
+
 bool kmc_open_file(uint8_t* buff)
 {
     bool condition = true;
 
-    floppy = fopen(buff,"rb");
-    if(floppy == NULL)
+    /* file systems without O_DIRECT support (tmpfs, ...) keep the stdio backend */
+    kmc_backend = KMC_BACKEND_STDIO;
+    if((kmc_backend_wanted == KMC_BACKEND_DIRECT) && (kmc_direct_open(buff,false) == true))
     {
-        condition = false;
+        kmc_backend = KMC_BACKEND_DIRECT;
+    }
+    else
+    {
+        floppy = fopen(buff,"rb");
+        if(floppy == NULL)
+        {
+            condition = false;
+        }
+    }
+    /* only read-only files use the map, a write would have to update it */
+    kmc_free_holes();
+    if(condition == true)
+    {
+        kmc_map_holes(buff);
     }
     /*
      * if users read multiple files in one program's lifetime,
@@ -38,6 +189,28 @@ bool kmc_open_file(uint8_t* buff)
     return condition;
 }
 
+bool kmc_open_file_rw(uint8_t* buff)
+{
+    bool condition = true;
+
+    kmc_backend = KMC_BACKEND_STDIO;
+    if((kmc_backend_wanted == KMC_BACKEND_DIRECT) && (kmc_direct_open(buff,true) == true))
+    {
+        kmc_backend = KMC_BACKEND_DIRECT;
+    }
+    else
+    {
+        floppy = fopen(buff,"r+b");
+        if(floppy == NULL)
+        {
+            condition = false;
+        }
+    }
+    kmc_free_holes();
+    kmc_sector_size = KMC_DEFAULT_SECTOR_SIZE;
+    return condition;
+}
+
 uint16_t kmc_update_sector_size (uint16_t size)
 {
     uint16_t retVal  = 0;
@@ -45,41 +218,346 @@ uint16_t kmc_update_sector_size (uint16_t size)
     if((size % kmc_sector_size) == 0)
     {
         kmc_sector_size = size;
+        if(kmc_backend == KMC_BACKEND_DIRECT)
+        {
+            kmc_direct_set_sector_size(size);
+        }
     }
     return retVal;
 }
 
-int32_t kmc_read_sector(uint32_t index, uint8_t* buff)
+static int32_t kmc_file_transfer(FILE* file, uint64_t offset, uint32_t bytes, uint8_t* buff, bool write)
 {
-    uint32_t ret_value = 0;
+    int32_t ret_value = 0;
+#if defined(KMC_POSITIONAL_IO)
+    ssize_t done = 0;
+    uint32_t total = 0;
 
-    rewind(floppy);
-    if((fseek(floppy,1l*index*kmc_sector_size,SEEK_CUR)) == 0)
+    /* short transfers are legal for pread()/pwrite(), finish them like fread() does */
+    while(total < bytes)
     {
-        ret_value = fread(buff,sizeof(uint8_t),kmc_sector_size,floppy);
+        if(write == true)
+        {
+            done = pwrite(fileno(file),buff + total,bytes - total,(off_t)(offset + total));
+        }
+        else
+        {
+            done = pread(fileno(file),buff + total,bytes - total,(off_t)(offset + total));
+        }
+        if(done <= 0)
+        {
+            break;
+        }
+        total += (uint32_t)done;
     }
+    ret_value = total;
+#else
+    pthread_mutex_lock(&kmc_lock);
+    if(KMC_SEEK(file,offset) == 0)
+    {
+        if(write == true)
+        {
+            ret_value = fwrite(buff,sizeof(uint8_t),bytes,file);
+        }
+        else
+        {
+            ret_value = fread(buff,sizeof(uint8_t),bytes,file);
+        }
+    }
+    pthread_mutex_unlock(&kmc_lock);
+#endif
     return ret_value;
 }
 
-int32_t kmc_read_multi_sector(uint32_t index, uint32_t num, uint8_t* buff)
+static int32_t kmc_backend_transfer(uint64_t offset, uint32_t bytes, uint8_t* buff, bool write)
 {
-    uint32_t ret_value = 0;
+    int32_t ret_value = 0;
 
-    rewind(floppy);
-    if((fseek(floppy,1l*index*kmc_sector_size,SEEK_CUR)) == 0)
+    if(kmc_backend == KMC_BACKEND_DIRECT)
     {
-        ret_value = fread(buff,sizeof(uint8_t),kmc_sector_size*num,floppy);
+        if(write == true)
+        {
+            ret_value = kmc_direct_write(offset,bytes,buff);
+        }
+        else
+        {
+            ret_value = kmc_direct_read(offset,bytes,buff);
+        }
+    }
+    else
+    {
+        ret_value = kmc_file_transfer(floppy,offset,bytes,buff,write);
     }
     return ret_value;
 }
 
+static int32_t kmc_transfer(uint32_t index, uint32_t bytes, uint8_t* buff, bool write)
+{
+    int32_t ret_value = 0;
+    uint64_t offset = kmc_volume_offset + (uint64_t)index * kmc_sector_size;
+
+    if((write == false) && (kmc_sparse == true))
+    {
+        ret_value = kmc_read_sparse(offset,bytes,buff);
+    }
+    else
+    {
+        ret_value = kmc_backend_transfer(offset,bytes,buff,write);
+    }
+    return ret_value;
+}
+
+static int32_t kmc_read_sparse(uint64_t offset, uint32_t bytes, uint8_t* buff)
+{
+    uint32_t total = 0;
+    uint32_t n = 0;
+    int32_t done = 0;
+    uint64_t position = offset;
+    uint64_t limit = 0;
+    uint32_t i = kmc_find_extent(offset);
+
+    /* like a read, nothing past the end of the file */
+    while((total < bytes) && (position < kmc_file_size))
+    {
+        if((i < kmc_extent_count) && (kmc_extents[i].start <= position))
+        {
+            limit = kmc_extents[i].end;
+        }
+        else
+        {
+            limit = (i < kmc_extent_count) ? kmc_extents[i].start : kmc_file_size;
+        }
+        n = ((limit - position) < (bytes - total)) ? (uint32_t)(limit - position) : (bytes - total);
+        if((i < kmc_extent_count) && (kmc_extents[i].start <= position))
+        {
+            done = kmc_backend_transfer(position,n,buff + total,false);
+            if(done > 0)
+            {
+                total += (uint32_t)done;
+            }
+            if(done != (int32_t)n)
+            {
+                break;
+            }
+            i += 1;
+        }
+        else
+        {
+            memset(buff + total,0,n);
+            total += n;
+        }
+        position = offset + total;
+    }
+    return total;
+}
+
+static uint32_t kmc_find_extent(uint64_t offset)
+{
+    uint32_t low = 0;
+    uint32_t high = kmc_extent_count;
+    uint32_t middle = 0;
+
+    while(low < high)
+    {
+        middle = low + (high - low) / 2;
+        if(kmc_extents[middle].end <= offset)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+static void kmc_map_holes(uint8_t* buff)
+{
+#if defined(KMC_SPARSE_FILES)
+    bool condition = true;
+    uint32_t capacity = 0;
+    off_t size = 0;
+    off_t offset = 0;
+    off_t data = 0;
+    off_t hole = 0;
+    int fd = open((const char*)buff,O_RDONLY);
+
+    if(fd >= 0)
+    {
+        size = lseek(fd,0,SEEK_END);
+        while((condition == true) && (size > 0) && (offset < size))
+        {
+            data = lseek(fd,offset,SEEK_DATA);
+            if(data < 0)
+            {
+                /* ENXIO: the rest of the file is a hole, anything else: no hole support */
+                condition = (errno == ENXIO);
+                break;
+            }
+            hole = lseek(fd,data,SEEK_HOLE);
+            if(hole < 0)
+            {
+                condition = false;
+                break;
+            }
+            if(kmc_extent_count == capacity)
+            {
+                capacity += KMC_EXTENT_GROW;
+                kmc_extents = (kmc_extent_t*)realloc(kmc_extents,sizeof(kmc_extent_t)*capacity);
+                if(kmc_extents == NULL)
+                {
+                    exit(1);
+                }
+            }
+            kmc_extents[kmc_extent_count].start = (uint64_t)data;
+            kmc_extents[kmc_extent_count].end = (uint64_t)hole;
+            kmc_extent_count += 1;
+            offset = hole;
+        }
+        close(fd);
+
+        /* one region that covers the file: no holes, plain reads */
+        if((condition == true) && (size > 0) &&
+           ((kmc_extent_count != 1) || (kmc_extents[0].start != 0) || (kmc_extents[0].end < (uint64_t)size)))
+        {
+            kmc_file_size = (uint64_t)size;
+            kmc_sparse = true;
+        }
+        else
+        {
+            kmc_free_holes();
+        }
+    }
+#endif
+}
+
+static void kmc_free_holes(void)
+{
+    free(kmc_extents);
+    kmc_extents = NULL;
+    kmc_extent_count = 0;
+    kmc_file_size = 0;
+    kmc_sparse = false;
+}
+
+bool kmc_is_hole(uint32_t index, uint32_t num, uint32_t* run)
+{
+    bool condition = false;
+    uint64_t first = kmc_volume_offset + (uint64_t)index * kmc_sector_size;
+    uint64_t last = first + (uint64_t)num * kmc_sector_size;
+    uint64_t limit = last;
+    uint32_t i = 0;
+
+    *run = num;
+    if((kmc_sparse == true) && (first < kmc_file_size))
+    {
+        i = kmc_find_extent(first);
+        if((i < kmc_extent_count) && (kmc_extents[i].start <= first))
+        {
+            /* data up to the end of the region, a sector that touches it is data */
+            limit = (kmc_extents[i].end < last) ? kmc_extents[i].end : last;
+            *run = (uint32_t)((limit - first + kmc_sector_size - 1) / kmc_sector_size);
+        }
+        else
+        {
+            limit = (i < kmc_extent_count) ? kmc_extents[i].start : kmc_file_size;
+            limit = (limit < last) ? limit : last;
+            *run = (uint32_t)((limit - first) / kmc_sector_size);
+            condition = true;
+            if(*run == 0) /* less than a sector of hole before data */
+            {
+                *run = 1;
+                condition = false;
+            }
+        }
+    }
+    return condition;
+}
+
+int32_t kmc_read_sector(uint32_t index, uint8_t* buff)
+{
+    return kmc_transfer(index,kmc_sector_size,buff,false);
+}
+
+int32_t kmc_read_multi_sector(uint32_t index, uint32_t num, uint8_t* buff)
+{
+    return kmc_transfer(index,kmc_sector_size*num,buff,false);
+}
+
+int32_t kmc_write_sector(uint32_t index, uint8_t* buff)
+{
+    return kmc_transfer(index,kmc_sector_size,buff,true);
+}
+
+int32_t kmc_write_multi_sector(uint32_t index, uint32_t num, uint8_t* buff)
+{
+    return kmc_transfer(index,kmc_sector_size*num,buff,true);
+}
+
+bool kmc_flush(void)
+{
+    bool condition = true;
+
+    if(kmc_backend == KMC_BACKEND_DIRECT)
+    {
+        condition = kmc_direct_flush();
+    }
+    else
+    {
+        condition = (fflush(floppy) == 0);
+    }
+    return condition;
+}
+
+bool kmc_sync(void)
+{
+    bool condition = true;
+
+    if(kmc_backend == KMC_BACKEND_DIRECT)
+    {
+        condition = kmc_direct_flush();
+    }
+    else
+    {
+        condition = (fflush(floppy) == 0);
+#if defined(KMC_POSITIONAL_IO)
+        if((condition == true) && (KMC_DATASYNC(fileno(floppy)) != 0))
+        {
+            condition = false;
+        }
+#endif
+    }
+    return condition;
+}
+
 bool kmc_close_file(uint8_t* buff)
 {
     bool condition = true;
 
-    if(fclose(floppy) != 0)
+    if(kmc_backend == KMC_BACKEND_DIRECT)
+    {
+        condition = kmc_direct_close();
+    }
+    else if(fclose(floppy) != 0)
     {
         condition = false;
     }
+    kmc_free_holes();
     return condition;
-}
\ No newline at end of file
+}
+
+FILE* kmc_open_handle(uint8_t* buff)
+{
+    return fopen(buff,"rb");
+}
+
+int32_t kmc_read_handle(FILE* handle, uint64_t offset, uint32_t bytes, uint8_t* buff)
+{
+    return kmc_file_transfer(handle,offset,bytes,buff,false);
+}
+
+bool kmc_close_handle(FILE* handle)
+{
+    return (fclose(handle) == 0);
+}
@@ -5,13 +5,43 @@
 * API
 ******************************************************************************/
 
-/** @brief This function is used to open file.
+/** @brief This function selects the backend of the next kmc_open_file()/kmc_open_file_rw():
+ * stdio (default) or O_DIRECT through aligned buffers (HAL_direct.c), which bypasses the
+ * page cache. If the file system refuses O_DIRECT the stdio backend is used.
+ * @param enable - 1 for O_DIRECT.
+ */
+void kmc_use_direct_io(bool enable);
+
+
+/** @brief This function tells which backend the open file uses.
+ * @return - Return 1 if the file was opened with O_DIRECT.
+ */
+bool kmc_direct_io_active(void);
+
+
+/** @brief This function sets where the volume starts in the file (a partition of a
+ * disk image). Sector numbers of the read and write functions count from there,
+ * handles of kmc_open_handle() are not affected.
+ * @param offset - byte offset of the volume, 0 for an image of one volume.
+ */
+void kmc_set_volume_offset(uint64_t offset);
+
+
+/** @brief This function is used to open file. The data regions of a sparse file are
+ * found with SEEK_DATA/SEEK_HOLE, reads of its holes return zeros without I/O.
  * @param buff - file path from user.
  * @return - Return 1 if file was opened successfully or 0 if failed to open file.
  */
 bool kmc_open_file(uint8_t* buff);
 
 
+/** @brief This function is used to open file for reading and writing.
+ * @param buff - file path from user.
+ * @return - Return 1 if file was opened successfully or 0 if failed to open file.
+ */
+bool kmc_open_file_rw(uint8_t* buff);
+
+
 /** @brief This function is used to read data from a sector into an array.
  * @param index - sector number that you want to read
  * @param buff - an array to store byte values after reading.
@@ -29,6 +59,46 @@ int32_t kmc_read_sector(uint32_t index, uint8_t* buff);
 int32_t kmc_read_multi_sector(uint32_t index, uint32_t num, uint8_t* buff);
 
 
+/** @brief This function is used to write data from an array into a sector.
+ * @param index - sector number that you want to write.
+ * @param buff - an array that stores byte values to be written.
+ * @return - Return a number of total bytes written.
+ */
+int32_t kmc_write_sector(uint32_t index, uint8_t* buff);
+
+
+/** @brief This function is used to write data from an array into multiple sectors.
+ * @param index - starting sector to write to.
+ * @param num - number of sectors.
+ * @param buff - an array that stores byte values to be written.
+ * @return - Return a number of total bytes written.
+ */
+int32_t kmc_write_multi_sector(uint32_t index, uint32_t num, uint8_t* buff);
+
+
+/** @brief This function tells if sectors lie in a hole of the open file (a sparse file
+ * opened by kmc_open_file(), never written there, read as zeros).
+ * @param index - first sector.
+ * @param num - number of sectors.
+ * @param run - stores how many sectors from index (at most num) are all hole, or hold data.
+ * @return - Return 1 if sector index is in a hole, 0 if it holds data or holes are unknown.
+ */
+bool kmc_is_hole(uint32_t index, uint32_t num, uint32_t* run);
+
+
+/** @brief This function is used to push buffered writes to the file.
+ * @return - Return 1 if data was flushed successfully or 0 if failed.
+ */
+bool kmc_flush(void);
+
+
+/** @brief This function waits until the writes done so far are on the disk (fdatasync(),
+ * fsync() of the O_DIRECT backend), writes done after it can't reach the disk before them.
+ * @return - Return 1 if data was synced successfully or 0 if failed.
+ */
+bool kmc_sync(void);
+
+
 /** @brief This function is used to update sector size after reading boot sector.
  * @param size - sector size (read from boot sector).
  * @return - Return value is not used.
@@ -42,4 +112,31 @@ uint32_t kmc_update_sector_size (uint32_t size);
  */
 bool kmc_close_file(uint8_t* buff);
 
+
+
+/** @brief This function opens an image for reading with its own handle, independent
+ * of the file opened by kmc_open_file(). Several images can be open at once and a
+ * handle can be read by several threads at once.
+ * @param buff - file path.
+ * @return - Return the handle or NULL if failed to open file.
+ */
+FILE* kmc_open_handle(uint8_t* buff);
+
+
+/** @brief This function reads bytes from a handle of kmc_open_handle().
+ * @param handle - open handle.
+ * @param offset - byte offset in the image.
+ * @param bytes - number of bytes.
+ * @param buff - an array to store byte values after reading.
+ * @return - Return a number of total bytes read.
+ */
+int32_t kmc_read_handle(FILE* handle, uint64_t offset, uint32_t bytes, uint8_t* buff);
+
+
+/** @brief This function closes a handle of kmc_open_handle().
+ * @param handle - open handle.
+ * @return - Return 1 if file was closed successfully or 0 if failed to close file.
+ */
+bool kmc_close_handle(FILE* handle);
+
 #endif /* _HAL_H_ */
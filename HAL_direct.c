@@ -0,0 +1,388 @@
+/*******************************************************************************
+* Includes
+******************************************************************************/
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE                             /* O_DIRECT, statx() */
+#endif
+#define _FILE_OFFSET_BITS 64                    /* 64-bit off_t on 32-bit systems */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "HAL_direct.h"
+
+#if defined(__linux__) || defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#if defined(__linux__)
+#include <linux/fs.h>                           /* BLKSSZGET, BLKGETSIZE64 */
+#endif
+#define KMC_DIRECT_SUPPORTED
+#endif
+
+/*******************************************************************************
+* Definitions
+******************************************************************************/
+#define KMC_DIRECT_POOL             (8U)        /* buffers, one per concurrent request            */
+#define KMC_DIRECT_PAYLOAD          (1048576U)  /* bytes a buffer serves per request              */
+#define KMC_DIRECT_MEMORY_ALIGN     (4096U)     /* buffer address alignment (page)                */
+#define KMC_DIRECT_DEFAULT_ALIGN    (4096U)     /* offset/length alignment if it can't be queried */
+#define KMC_ROUND_UP(a,b)           ((((a) + (b) - 1) / (b)) * (b))
+
+/*******************************************************************************
+* Variables
+******************************************************************************/
+#if defined(KMC_DIRECT_SUPPORTED)
+static int kmc_direct_fd = -1;
+static bool kmc_direct_regular = false;         /* regular file (not a block device)        */
+static uint64_t kmc_direct_size = 0;            /* size of the image or device              */
+static uint32_t kmc_direct_align = KMC_DIRECT_DEFAULT_ALIGN;
+static uint32_t kmc_direct_sector = 512;
+static uint32_t kmc_direct_payload = 0;         /* bytes served per buffer                  */
+static uint32_t kmc_direct_buffer_size = 0;     /* payload + one alignment block            */
+static uint8_t* kmc_direct_buffers[KMC_DIRECT_POOL];
+static bool kmc_direct_busy[KMC_DIRECT_POOL];
+static pthread_mutex_t kmc_direct_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t kmc_direct_free = PTHREAD_COND_INITIALIZER;
+
+/*******************************************************************************
+* Prototypes
+******************************************************************************/
+
+/** @brief This function (re)allocates the buffer pool for the current alignment and sector size.
+ * It is called while no request is running (open, sector size update).
+ */
+static void kmc_direct_pool_init(void);
+
+
+/** @brief This function releases the buffer pool.
+ */
+static void kmc_direct_pool_free(void);
+
+
+/** @brief This function takes a free buffer of the pool, waiting if all are in use.
+ * @return - Return the index of the buffer.
+ */
+static uint32_t kmc_direct_acquire(void);
+
+
+/** @brief This function gives a buffer back to the pool.
+ * @param index - index of the buffer.
+ */
+static void kmc_direct_release(uint32_t index);
+
+
+/** @brief This function moves an aligned range between the file and a pool buffer.
+ * @param buff - aligned buffer.
+ * @param bytes - aligned length.
+ * @param offset - aligned offset.
+ * @param write - 1 to write, 0 to read.
+ * @return - Return a number of total bytes moved.
+ */
+static uint32_t kmc_direct_io(uint8_t* buff, uint32_t bytes, uint64_t offset, bool write);
+
+/*******************************************************************************
+* Code
+******************************************************************************/
+static void kmc_direct_pool_init(void)
+{
+    uint32_t block = (kmc_direct_align > kmc_direct_sector) ? kmc_direct_align : kmc_direct_sector;
+    uint32_t i = 0;
+
+    kmc_direct_pool_free();
+    /* whole sectors and whole alignment blocks, plus one block for an unaligned head */
+    kmc_direct_payload = KMC_ROUND_UP(KMC_DIRECT_PAYLOAD,block);
+    kmc_direct_buffer_size = kmc_direct_payload + block;
+    for(i = 0;i < KMC_DIRECT_POOL;i++)
+    {
+        if(posix_memalign((void**)&kmc_direct_buffers[i],KMC_DIRECT_MEMORY_ALIGN,kmc_direct_buffer_size) != 0)
+        {
+            exit(1);
+        }
+        kmc_direct_busy[i] = false;
+    }
+}
+
+static void kmc_direct_pool_free(void)
+{
+    uint32_t i = 0;
+
+    for(i = 0;i < KMC_DIRECT_POOL;i++)
+    {
+        free(kmc_direct_buffers[i]);
+        kmc_direct_buffers[i] = NULL;
+    }
+}
+
+static uint32_t kmc_direct_acquire(void)
+{
+    uint32_t index = 0;
+
+    pthread_mutex_lock(&kmc_direct_lock);
+    while(true)
+    {
+        for(index = 0;(index < KMC_DIRECT_POOL) && (kmc_direct_busy[index] == true);index++)
+        {
+            /* just check, don't do anything */
+        }
+        if(index < KMC_DIRECT_POOL)
+        {
+            break;
+        }
+        pthread_cond_wait(&kmc_direct_free,&kmc_direct_lock);
+    }
+    kmc_direct_busy[index] = true;
+    pthread_mutex_unlock(&kmc_direct_lock);
+    return index;
+}
+
+static void kmc_direct_release(uint32_t index)
+{
+    pthread_mutex_lock(&kmc_direct_lock);
+    kmc_direct_busy[index] = false;
+    pthread_cond_signal(&kmc_direct_free);
+    pthread_mutex_unlock(&kmc_direct_lock);
+}
+
+bool kmc_direct_open(uint8_t* buff, bool writable)
+{
+    bool condition = false;
+    struct stat info;
+    int flags = writable ? O_RDWR : O_RDONLY;
+#if defined(__linux__)
+    int logical = 0;
+    uint64_t device_size = 0;
+#if defined(STATX_DIOALIGN)
+    struct statx dio;
+#endif
+#endif
+
+#if defined(O_DIRECT)
+    flags |= O_DIRECT;
+#endif
+    kmc_direct_fd = open((const char*)buff,flags);
+    if((kmc_direct_fd >= 0) && (fstat(kmc_direct_fd,&info) == 0))
+    {
+        condition = true;
+        kmc_direct_regular = S_ISREG(info.st_mode);
+        kmc_direct_size = info.st_size;
+        kmc_direct_align = KMC_DIRECT_DEFAULT_ALIGN;
+        kmc_direct_sector = 512;
+#if defined(__APPLE__)
+        fcntl(kmc_direct_fd,F_NOCACHE,1);
+#endif
+#if defined(__linux__)
+        if(kmc_direct_regular == false)
+        {
+            if((ioctl(kmc_direct_fd,BLKSSZGET,&logical) == 0) && (logical > 0))
+            {
+                kmc_direct_align = logical;
+            }
+            if(ioctl(kmc_direct_fd,BLKGETSIZE64,&device_size) == 0)
+            {
+                kmc_direct_size = device_size;
+            }
+        }
+#if defined(STATX_DIOALIGN)
+        else if((statx(kmc_direct_fd,"",AT_EMPTY_PATH,STATX_DIOALIGN,&dio) == 0) &&
+                ((dio.stx_mask & STATX_DIOALIGN) != 0) && (dio.stx_dio_offset_align > 0))
+        {
+            kmc_direct_align = dio.stx_dio_offset_align;
+        }
+#endif
+#endif
+        kmc_direct_pool_init();
+    }
+    else if(kmc_direct_fd >= 0)
+    {
+        close(kmc_direct_fd);
+        kmc_direct_fd = -1;
+    }
+    return condition;
+}
+
+void kmc_direct_set_sector_size(uint32_t size)
+{
+    if((size != 0) && (size != kmc_direct_sector))
+    {
+        kmc_direct_sector = size;
+        kmc_direct_pool_init();
+    }
+}
+
+static uint32_t kmc_direct_io(uint8_t* buff, uint32_t bytes, uint64_t offset, bool write)
+{
+    ssize_t done = 0;
+    uint32_t total = 0;
+
+    while(total < bytes)
+    {
+        if(write == true)
+        {
+            done = pwrite(kmc_direct_fd,buff + total,bytes - total,offset + total);
+        }
+        else
+        {
+            done = pread(kmc_direct_fd,buff + total,bytes - total,offset + total);
+        }
+        if((done < 0) && (errno == EINTR))
+        {
+            continue;
+        }
+        if(done <= 0)
+        {
+            break;
+        }
+        total += (uint32_t)done;
+        /* short transfer at the end of the file: what is left is not aligned any more */
+        if((total % kmc_direct_align) != 0)
+        {
+            break;
+        }
+    }
+    return total;
+}
+
+int32_t kmc_direct_read(uint64_t offset, uint32_t bytes, uint8_t* buff)
+{
+    uint32_t done = 0;
+    uint32_t index = 0;
+    uint64_t start = 0;
+    uint32_t head = 0;
+    uint32_t n = 0;
+    uint32_t got = 0;
+
+    while(done < bytes)
+    {
+        start = offset + done;
+        head = start % kmc_direct_align;
+        n = bytes - done;
+        if(n > kmc_direct_payload)
+        {
+            n = kmc_direct_payload;
+        }
+        index = kmc_direct_acquire();
+        got = kmc_direct_io(kmc_direct_buffers[index],KMC_ROUND_UP(head + n,kmc_direct_align),start - head,false);
+        got = (got > head) ? (got - head) : 0;
+        if(got > n)
+        {
+            got = n;
+        }
+        memcpy(buff + done,kmc_direct_buffers[index] + head,got);
+        kmc_direct_release(index);
+        done += got;
+        if(got < n)
+        {
+            break;
+        }
+    }
+    return done;
+}
+
+int32_t kmc_direct_write(uint64_t offset, uint32_t bytes, uint8_t* buff)
+{
+    uint32_t done = 0;
+    uint32_t index = 0;
+    uint64_t start = 0;
+    uint32_t head = 0;
+    uint32_t n = 0;
+    uint32_t length = 0;
+    uint32_t got = 0;
+    uint8_t* p_block = NULL;
+    bool grown = false;
+
+    while(done < bytes)
+    {
+        start = offset + done;
+        head = start % kmc_direct_align;
+        n = bytes - done;
+        if(n > kmc_direct_payload)
+        {
+            n = kmc_direct_payload;
+        }
+        length = KMC_ROUND_UP(head + n,kmc_direct_align);
+        index = kmc_direct_acquire();
+        p_block = kmc_direct_buffers[index];
+        if((head != 0) || (length != n))
+        {
+            /* read-modify-write of the partial blocks, past the end reads as zeros */
+            got = kmc_direct_io(p_block,length,start - head,false);
+            memset(p_block + got,0,length - got);
+        }
+        memcpy(p_block + head,buff + done,n);
+        got = kmc_direct_io(p_block,length,start - head,true);
+        kmc_direct_release(index);
+        if((start - head + length) > kmc_direct_size)
+        {
+            grown = true;
+        }
+        if(got < (head + n))
+        {
+            break;
+        }
+        done += n;
+    }
+    /* the last aligned block can go past the end of an image, cut it back */
+    if((kmc_direct_regular == true) && (grown == true))
+    {
+        if((offset + done) > kmc_direct_size)
+        {
+            kmc_direct_size = offset + done;
+        }
+        if(ftruncate(kmc_direct_fd,kmc_direct_size) != 0)
+        {
+            done = 0;
+        }
+    }
+    return done;
+}
+
+bool kmc_direct_flush(void)
+{
+    return (fsync(kmc_direct_fd) == 0);
+}
+
+bool kmc_direct_close(void)
+{
+    bool condition = (close(kmc_direct_fd) == 0);
+
+    kmc_direct_fd = -1;
+    kmc_direct_pool_free();
+    return condition;
+}
+#else
+/* no direct I/O on this system, HAL.c keeps the stdio backend */
+bool kmc_direct_open(uint8_t* buff, bool writable)
+{
+    return false;
+}
+
+void kmc_direct_set_sector_size(uint32_t size)
+{
+}
+
+int32_t kmc_direct_read(uint64_t offset, uint32_t bytes, uint8_t* buff)
+{
+    return 0;
+}
+
+int32_t kmc_direct_write(uint64_t offset, uint32_t bytes, uint8_t* buff)
+{
+    return 0;
+}
+
+bool kmc_direct_flush(void)
+{
+    return false;
+}
+
+bool kmc_direct_close(void)
+{
+    return false;
+}
+#endif
@@ -0,0 +1,53 @@
+#ifndef _HAL_DIRECT_H_
+#define _HAL_DIRECT_H_
+
+/*******************************************************************************
+* API
+******************************************************************************/
+
+/** @brief This function opens an image or a block device with O_DIRECT (page cache bypassed).
+ * @param buff - file path from user.
+ * @param writable - open for reading and writing.
+ * @return - Return 1 if the file was opened or 0 if it (or its file system) doesn't allow direct I/O.
+ */
+bool kmc_direct_open(uint8_t* buff, bool writable);
+
+
+/** @brief This function sizes the buffer pool for the sector size of the volume
+ * (buffers hold whole sectors and whole alignment blocks).
+ * @param size - sector size (read from boot sector).
+ */
+void kmc_direct_set_sector_size(uint32_t size);
+
+
+/** @brief This function reads bytes through an aligned buffer of the pool.
+ * @param offset - byte offset in the file.
+ * @param bytes - number of bytes.
+ * @param buff - an array to store byte values after reading.
+ * @return - Return a number of total bytes read.
+ */
+int32_t kmc_direct_read(uint64_t offset, uint32_t bytes, uint8_t* buff);
+
+
+/** @brief This function writes bytes through an aligned buffer of the pool, partial
+ * blocks are read first.
+ * @param offset - byte offset in the file.
+ * @param bytes - number of bytes.
+ * @param buff - an array that stores byte values to be written.
+ * @return - Return a number of total bytes written.
+ */
+int32_t kmc_direct_write(uint64_t offset, uint32_t bytes, uint8_t* buff);
+
+
+/** @brief This function waits until written data is on the device.
+ * @return - Return 1 if data was flushed successfully or 0 if failed.
+ */
+bool kmc_direct_flush(void);
+
+
+/** @brief This function closes the file and releases the buffer pool.
+ * @return - Return 1 if file was closed successfully or 0 if failed to close file.
+ */
+bool kmc_direct_close(void);
+
+#endif /* _HAL_DIRECT_H_ */
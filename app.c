@@ -6,12 +6,46 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
+#include <time.h>
 #include "fat.h"
+#include "hash.h"
+#include "pool.h"
+#include "manifest.h"
+#include "diff.h"
+#include "undelete.h"
+#include "daemon.h"
+#include "fsck.h"
+#include "partition.h"
+#include "find.h"
 
 /*******************************************************************************
 * Definitions
 ******************************************************************************/
 #define MAX_LENGTH 50
+#define APP_COPY_CHUNK (65536U)         /* bytes copied per fat_write_file() call */
+
+typedef struct
+{
+    uint32_t files;                             /* files and directories visited            */
+    uint32_t chains;                            /* entries that own at least one cluster    */
+    uint32_t fragmented;                        /* entries with more than one fragment      */
+    uint32_t fragments;                         /* sum of fragments of all entries          */
+    uint32_t clusters;                          /* sum of clusters of all entries           */
+} app_frag_struct_t;
+
+typedef struct
+{
+    uint8_t* file_path;                         /* disk image                               */
+    uint8_t mode;                               /* App_Scan_Mode                            */
+    uint32_t threads;                           /* threads per partition                    */
+} app_scan_struct_t;
+
+enum App_Scan_Mode
+{
+    APP_SCAN_LIST = 0,
+    APP_SCAN_HASH = 1,
+    APP_SCAN_FSCK = 2
+};
 
 /*******************************************************************************
 * Prototypes
@@ -34,6 +68,49 @@ static void read_dir(fat_entry* head_temp);
  */
 static void read_file(uint8_t* buff,uint32_t size);
 
+
+/** @brief This function prints the fragment count of one entry and adds it to the totals.
+ * @param path - full path of the entry.
+ * @param entry - directory entry.
+ * @param arg - pointer to an app_frag_struct_t.
+ */
+static void df_entry(const uint8_t* path,const fat_entry* entry,void* arg);
+
+
+/** @brief This function builds a host file path for a recovered file.
+ * @param out_dir - output directory.
+ * @param number - number of the file (keeps names unique).
+ * @param name - name of the file in the volume.
+ * @param host_path - an array of FAT_MAX_PATH bytes to store the result.
+ */
+static void recovered_path(uint8_t* out_dir,uint32_t number,const uint8_t* name,uint8_t* host_path);
+
+
+/** @brief This function mounts one partition of a disk image and lists, hashes or checks it
+ * (callback of partition_scan(), runs in its own process).
+ * @param partition - partition to scan.
+ * @param out - where the report goes.
+ * @param arg - pointer to an app_scan_struct_t.
+ * @return - Return 1 if the partition was mounted and scanned without problems.
+ */
+static bool scan_partition(const partition_struct_t* partition,FILE* out,void* arg);
+
+
+/** @brief This function prints one entry of a partition listing.
+ * @param path - full path of the entry.
+ * @param entry - directory entry.
+ * @param arg - output stream.
+ */
+static void list_entry(const uint8_t* path,const fat_entry* entry,void* arg);
+
+
+/** @brief This function runs one query on a name index and prints what it finds.
+ * @param index - index.
+ * @param pattern - substring, or glob if it holds '*', '?' or '['.
+ * @param ignore_case - 1 to ignore the case of ASCII letters.
+ */
+static void find_pattern(const find_index_struct_t* index,const uint8_t* pattern,bool ignore_case);
+
 /*******************************************************************************
 * Code
 ******************************************************************************/
@@ -116,6 +193,37 @@ void menu(void)
     }
 }
 
+void app_set_direct_io(bool enable)
+{
+    fat_set_direct_io(enable);
+}
+
+bool app_set_partition(uint8_t* file_path,uint32_t number)
+{
+    bool retValue = false;
+    partition_table_struct_t table;
+    const partition_struct_t* partition = NULL;
+
+    if(partition_read(file_path,&table) == false)
+    {
+        printf("failed to read the partition table of %s!\n",file_path);
+    }
+    else if((partition = partition_find(&table,number)) == NULL)
+    {
+        printf("%s has no partition %u!\n",file_path,number);
+    }
+    else if(partition->fat == false)
+    {
+        printf("partition %u of %s is not a FAT volume!\n",number,file_path);
+    }
+    else
+    {
+        fat_set_volume_offset(partition->offset);
+        retValue = true;
+    }
+    return retValue;
+}
+
 static void clear(){
     #if defined(__linux__) || defined(__unix__) || defined(__APPLE__)
         system("clear");
@@ -129,7 +237,8 @@ static void clear(){
 static void read_file(uint8_t* buff,uint32_t size)
 {
     uint16_t i = 0;
-    for(i = 0;i < size;i++)
+    /* an empty chain has no buffer */
+    for(i = 0;(buff != NULL) && (i < size);i++)
     {
         if( (i >= 16) && (i % 16 == 0))
         {
@@ -191,4 +300,753 @@ static void read_dir(fat_entry* head_temp)
         index+=1;
         temp = temp->next;
     }
-}
\ No newline at end of file
+}
+
+bool app_df(uint8_t* file_path)
+{
+    fat_entry* entry_head = NULL;
+    uint8_t boot_info[512];
+    fat_volume_stat_struct_t stat;
+    app_frag_struct_t frag;
+    uint32_t score = 0;
+    uint32_t free_score = 0;
+    bool retValue = true;
+
+    if(fat_init(file_path,&entry_head,&boot_info[0]) == false)
+    {
+        printf("failed to open file!\n");
+        return false;
+    }
+
+    /* an up to date snapshot saves the FAT decode and the tree walk */
+    fat_snapshot_attach(file_path,false);
+    memset(&frag,0,sizeof(frag));
+    if(fat_get_volume_stat(&stat) == false)
+    {
+        printf("failed to read FAT!\n");
+        retValue = false;
+    }
+    else
+    {
+        printf("fragments  clusters  path\n");
+        fat_walk(df_entry,&frag);
+
+        /*
+         * fragmentation score: share of cluster boundaries inside files that are not contiguous,
+         * 0 = every file is contiguous, 100 = no two clusters of a file are adjacent.
+         */
+        if(frag.clusters > frag.chains)
+        {
+            score = (uint32_t)((100ULL * (frag.fragments - frag.chains)) / (frag.clusters - frag.chains));
+        }
+        /* free space fragmentation: 0 = all free clusters in one run */
+        if(stat.free_clusters > 0)
+        {
+            free_score = 100 - (uint32_t)((100ULL * stat.largest_free_run) / stat.free_clusters);
+        }
+
+        printf("\nvolume: %s\n",file_path);
+        printf("cluster size:           %u bytes\n",stat.bytes_per_cluster);
+        printf("total clusters:         %u (%llu bytes)\n",stat.total_clusters,1ULL*stat.total_clusters*stat.bytes_per_cluster);
+        printf("used clusters:          %u (%llu bytes)\n",stat.used_clusters,1ULL*stat.used_clusters*stat.bytes_per_cluster);
+        printf("free clusters:          %u (%llu bytes)\n",stat.free_clusters,1ULL*stat.free_clusters*stat.bytes_per_cluster);
+        printf("bad clusters:           %u\n",stat.bad_clusters);
+        printf("chains (EOC):           %u\n",stat.eoc_clusters);
+        printf("free extents:           %u\n",stat.free_runs);
+        printf("largest free run:       %u clusters at cluster %u\n",stat.largest_free_run,stat.largest_free_run_start);
+        printf("files and directories:  %u (%u fragmented)\n",frag.files,frag.fragmented);
+        printf("fragmentation score:    %u/100\n",score);
+        printf("free space score:       %u/100\n",free_score);
+    }
+    fat_deinit(file_path);
+    return retValue;
+}
+
+static void df_entry(const uint8_t* path,const fat_entry* entry,void* arg)
+{
+    app_frag_struct_t* frag = (app_frag_struct_t*)arg;
+    uint32_t fragments = 0;
+    uint32_t clusters = 0;
+
+    fragments = fat_count_fragments(fat_entry_cluster(entry),&clusters);
+    frag->files += 1;
+    if(clusters > 0)
+    {
+        frag->chains += 1;
+        frag->fragments += fragments;
+        frag->clusters += clusters;
+    }
+    if(fragments > 1)
+    {
+        frag->fragmented += 1;
+    }
+    printf("%9u  %8u  %s%s\n",fragments,clusters,path,((entry->attribute & 0x10) != 0) ? "/" : "");
+}
+
+bool app_put(uint8_t* file_path,uint8_t* host_path,uint8_t* path)
+{
+    fat_entry* entry_head = NULL;
+    uint8_t boot_info[512];
+    uint8_t* buff = NULL;
+    uint32_t offset = 0;
+    uint32_t n = 0;
+    bool condition = true;
+    FILE* host = NULL;
+
+    host = fopen(host_path,"rb");
+    if(host == NULL)
+    {
+        printf("failed to open %s!\n",host_path);
+        return false;
+    }
+    if(fat_init_rw(file_path,&entry_head,&boot_info[0]) == false)
+    {
+        printf("failed to open file!\n");
+        fclose(host);
+        return false;
+    }
+
+    /* replace the content of an existing file */
+    if((fat_create(path) == false) && (fat_truncate(path,0) == false))
+    {
+        condition = false;
+    }
+    buff = (uint8_t*)malloc(APP_COPY_CHUNK);
+    if(buff == NULL)
+    {
+        condition = false;
+    }
+    while((condition == true) && ((n = fread(buff,sizeof(uint8_t),APP_COPY_CHUNK,host)) > 0))
+    {
+        condition = fat_write_file(path,offset,buff,n);
+        offset += n;
+    }
+    free(buff);
+    fclose(host);
+
+    condition = (fat_deinit(file_path) == true) && (condition == true);
+    if(condition == true)
+    {
+        printf("%s: %u bytes written.\n",path,offset);
+    }
+    else
+    {
+        printf("failed to write %s!\n",path);
+    }
+    return condition;
+}
+
+bool app_mkdir(uint8_t* file_path,uint8_t* path)
+{
+    fat_entry* entry_head = NULL;
+    uint8_t boot_info[512];
+    bool condition = false;
+
+    if(fat_init_rw(file_path,&entry_head,&boot_info[0]) == false)
+    {
+        printf("failed to open file!\n");
+        return false;
+    }
+    condition = fat_mkdir(path);
+    condition = (fat_deinit(file_path) == true) && (condition == true);
+    if(condition == false)
+    {
+        printf("failed to create %s!\n",path);
+    }
+    return condition;
+}
+
+bool app_rm(uint8_t* file_path,uint8_t* path)
+{
+    fat_entry* entry_head = NULL;
+    uint8_t boot_info[512];
+    bool condition = false;
+
+    if(fat_init_rw(file_path,&entry_head,&boot_info[0]) == false)
+    {
+        printf("failed to open file!\n");
+        return false;
+    }
+    condition = fat_delete(path);
+    condition = (fat_deinit(file_path) == true) && (condition == true);
+    if(condition == false)
+    {
+        printf("failed to delete %s!\n",path);
+    }
+    return condition;
+}
+
+bool app_truncate(uint8_t* file_path,uint8_t* path,uint32_t size)
+{
+    fat_entry* entry_head = NULL;
+    uint8_t boot_info[512];
+    bool condition = false;
+
+    if(fat_init_rw(file_path,&entry_head,&boot_info[0]) == false)
+    {
+        printf("failed to open file!\n");
+        return false;
+    }
+    condition = fat_truncate(path,size);
+    condition = (fat_deinit(file_path) == true) && (condition == true);
+    if(condition == false)
+    {
+        printf("failed to truncate %s!\n",path);
+    }
+    return condition;
+}
+
+bool app_snapshot(uint8_t* file_path)
+{
+    fat_entry* entry_head = NULL;
+    uint8_t boot_info[512];
+    const uint8_t* names = NULL;
+    uint32_t count = 0;
+    fat_geometry_struct_t geometry;
+    bool retValue = false;
+
+    if(fat_init(file_path,&entry_head,&boot_info[0]) == false)
+    {
+        printf("failed to open file!\n");
+        return false;
+    }
+    retValue = fat_snapshot_attach(file_path,true);
+    if(retValue == true)
+    {
+        fat_get_nodes(&count,&names);
+        fat_get_geometry(&geometry);
+        if(geometry.volume_offset != 0)
+        {
+            printf("%s@%llu.snap: %u files and directories.\n",file_path,(unsigned long long)geometry.volume_offset,count - 1);
+        }
+        else
+        {
+            printf("%s.snap: %u files and directories.\n",file_path,count - 1);
+        }
+    }
+    else
+    {
+        printf("failed to create snapshot!\n");
+    }
+    fat_deinit(file_path);
+    return retValue;
+}
+
+bool app_manifest(uint8_t* file_path,uint8_t* out_path,uint32_t threads)
+{
+    fat_entry* entry_head = NULL;
+    uint8_t boot_info[512];
+    manifest_struct_t manifest;
+    bool condition = true;
+    bool retValue = true;
+    uint32_t i = 0;
+
+    if(fat_init(file_path,&entry_head,&boot_info[0]) == false)
+    {
+        printf("failed to open file!\n");
+        return false;
+    }
+    fat_snapshot_attach(file_path,false);
+    condition = manifest_build(&manifest,threads);
+    if(manifest_save(&manifest,out_path) == false)
+    {
+        printf("failed to write %s!\n",out_path);
+        retValue = false;
+    }
+    else
+    {
+        for(i = 0;i < manifest.count;i++)
+        {
+            if(manifest.files[i].damaged == true)
+            {
+                printf("damaged:      %s\n",manifest.files[i].path);
+            }
+            else if(manifest.files[i].duplicate != 0)
+            {
+                printf("duplicate %u: %s\n",manifest.files[i].duplicate,manifest.files[i].path);
+            }
+        }
+        printf("%s: %u files, %llu bytes, %u duplicate groups (%u files), %u damaged, crc32c %s\n",
+               out_path,manifest.count,(unsigned long long)manifest.bytes,manifest.duplicate_groups,
+               manifest.duplicate_files,manifest.damaged,(hash_crc32c_hardware() == true) ? "hardware" : "software");
+    }
+    if(condition == false)
+    {
+        printf("some directories could not be read!\n");
+        retValue = false;
+    }
+    manifest_free(&manifest);
+    fat_deinit(file_path);
+    return retValue;
+}
+
+bool app_diff(uint8_t* old_path,uint8_t* new_path,uint32_t threads)
+{
+    diff_struct_t diff;
+    const diff_change_struct_t* change = NULL;
+    bool retValue = false;
+    uint32_t i = 0;
+
+    retValue = diff_images(old_path,new_path,threads,&diff);
+    if(retValue == false)
+    {
+        printf("failed to compare images!\n");
+    }
+    else
+    {
+        for(i = 0;i < diff.change_count;i++)
+        {
+            change = &diff.changes[i];
+            if(change->status == DIFF_ADDED)
+            {
+                printf("+ %s%s\n",change->file->path,((change->file->attribute & 0x10) != 0) ? "/" : "");
+            }
+            else if(change->status == DIFF_REMOVED)
+            {
+                printf("- %s%s\n",change->file->path,((change->file->attribute & 0x10) != 0) ? "/" : "");
+            }
+            else
+            {
+                printf("M %s (%u clusters changed)\n",change->file->path,change->changed_clusters);
+            }
+        }
+        printf("\nchanged clusters of %s:\n",new_path);
+        for(i = 0;i < diff.range_count;i++)
+        {
+            printf("    %u-%u (%u)\n",diff.ranges[i].start,diff.ranges[i].start + diff.ranges[i].count - 1,diff.ranges[i].count);
+        }
+        if(diff.same_layout == false)
+        {
+            printf("images have a different layout, changed files are compared as a whole.\n");
+        }
+        printf("%u added, %u removed, %u modified, %u clusters changed (%llu bytes), %llu clusters read\n",
+               diff.added,diff.removed,diff.modified,diff.changed_clusters,
+               1ULL * diff.changed_clusters * diff.new_image.cluster_size,(unsigned long long)diff.clusters_read);
+    }
+    diff_free(&diff);
+    return retValue;
+}
+
+static void recovered_path(uint8_t* out_dir,uint32_t number,const uint8_t* name,uint8_t* host_path)
+{
+    uint32_t i = 0;
+
+    snprintf((char*)host_path,FAT_MAX_PATH,"%s/%u_%s",out_dir,number,name);
+    /* names come from the image, they must not leave out_dir */
+    for(i = strlen((const char*)out_dir) + 1;host_path[i] != '\0';i++)
+    {
+        if((host_path[i] == '/') || (host_path[i] == '\\') || (host_path[i] == ':') || (host_path[i] < 0x20))
+        {
+            host_path[i] = '_';
+        }
+    }
+}
+
+bool app_undelete(uint8_t* file_path,uint8_t* out_dir)
+{
+    fat_entry* entry_head = NULL;
+    uint8_t boot_info[512];
+    uint8_t host_path[FAT_MAX_PATH];
+    undelete_struct_t list;
+    const undelete_file_struct_t* file = NULL;
+    const char* status[] = {"empty","contiguous","guessed","partial","overwritten"};
+    bool retValue = true;
+    uint32_t recovered = 0;
+    uint32_t i = 0;
+
+    if(fat_init(file_path,&entry_head,&boot_info[0]) == false)
+    {
+        printf("failed to open file!\n");
+        return false;
+    }
+    if(undelete_scan(&list) == false)
+    {
+        printf("some directories could not be read!\n");
+        retValue = false;
+    }
+    printf("status       clusters  size        lfn  path\n");
+    for(i = 0;i < list.count;i++)
+    {
+        file = &list.files[i];
+        printf("%-11s  %4u/%-4u %-10u  %3u  %s%s%s\n",status[file->status],file->found,file->clusters,file->entry.size,
+               file->entry.lfn_parts,file->path,((file->entry.attribute & 0x10) != 0) ? "/" : "",
+               (file->entry.first_char_known == false) ? "  (first character lost)" : "");
+        if((out_dir != NULL) && ((file->entry.attribute & 0x10) == 0) && (file->found > 0))
+        {
+            recovered_path(out_dir,i,file->entry.name,host_path);
+            if(undelete_recover(file,host_path) == true)
+            {
+                recovered += 1;
+            }
+            else
+            {
+                printf("failed to write %s!\n",host_path);
+                retValue = false;
+            }
+        }
+    }
+    printf("%u deleted entries",list.count);
+    if(out_dir != NULL)
+    {
+        printf(", %u files recovered to %s",recovered,out_dir);
+    }
+    printf("\n");
+    undelete_free(&list);
+    fat_deinit(file_path);
+    return retValue;
+}
+
+bool app_carve(uint8_t* file_path,uint8_t* out_dir,uint32_t threads)
+{
+    fat_entry* entry_head = NULL;
+    uint8_t boot_info[512];
+    uint8_t host_path[FAT_MAX_PATH];
+    uint8_t name[32];
+    undelete_carve_struct_t carve;
+    const undelete_hit_struct_t* hit = NULL;
+    bool retValue = true;
+    uint32_t i = 0;
+
+    if(fat_init(file_path,&entry_head,&boot_info[0]) == false)
+    {
+        printf("failed to open file!\n");
+        return false;
+    }
+    if(undelete_carve(&carve,threads) == false)
+    {
+        printf("failed to scan free clusters!\n");
+        retValue = false;
+    }
+    printf("cluster     clusters  size        type\n");
+    for(i = 0;i < carve.count;i++)
+    {
+        hit = &carve.hits[i];
+        printf("%-10u  %-8u  %-10u  %s\n",hit->cluster,hit->clusters,hit->size,undelete_carve_type(hit->type));
+        if(out_dir != NULL)
+        {
+            snprintf((char*)name,sizeof(name),"carved_%u.%s",hit->cluster,undelete_carve_type(hit->type));
+            recovered_path(out_dir,i,name,host_path);
+            if(undelete_carve_save(hit,host_path) == false)
+            {
+                printf("failed to write %s!\n",host_path);
+                retValue = false;
+            }
+        }
+    }
+    printf("%u signatures in %llu free clusters",carve.count,(unsigned long long)carve.clusters_scanned);
+    if(carve.clusters_skipped != 0)
+    {
+        printf(" (%llu more in holes of the image, not read)",(unsigned long long)carve.clusters_skipped);
+    }
+    printf("\n");
+    undelete_carve_free(&carve);
+    fat_deinit(file_path);
+    return retValue;
+}
+
+bool app_parts(uint8_t* file_path)
+{
+    partition_table_struct_t table;
+    const partition_struct_t* partition = NULL;
+    uint8_t type[40];
+    uint32_t i = 0;
+
+    if(partition_read(file_path,&table) == false)
+    {
+        printf("failed to read the partition table of %s!\n",file_path);
+        return false;
+    }
+    if(table.scheme == PARTITION_NONE)
+    {
+        printf("%s: no partition table, one FAT volume\n",file_path);
+    }
+    else
+    {
+        printf("%s: %s partition table, %u byte sectors\n",file_path,partition_scheme_name(table.scheme),table.sector_size);
+    }
+    printf("  #          offset            size  type                                  FAT  name\n");
+    for(i = 0;i < table.count;i++)
+    {
+        partition = &table.partitions[i];
+        if(table.scheme == PARTITION_GPT)
+        {
+            strcpy((char*)type,(const char*)partition->type_guid);
+        }
+        else
+        {
+            sprintf((char*)type,"0x%02X",partition->type);
+        }
+        printf("%3u  %14llu  %14llu  %-36s  %-3s  %s\n",partition->number,(unsigned long long)partition->offset,
+               (unsigned long long)partition->size,type,(partition->fat == true) ? "yes" : "no",partition->name);
+    }
+    return true;
+}
+
+bool app_scan(uint8_t* file_path,uint8_t* mode,uint32_t threads)
+{
+    partition_table_struct_t table;
+    app_scan_struct_t scan;
+    bool retValue = false;
+    uint32_t volumes = 0;
+    uint32_t i = 0;
+
+    scan.file_path = file_path;
+    if(strcmp((const char*)mode,"list") == 0)
+    {
+        scan.mode = APP_SCAN_LIST;
+    }
+    else if(strcmp((const char*)mode,"hash") == 0)
+    {
+        scan.mode = APP_SCAN_HASH;
+    }
+    else if(strcmp((const char*)mode,"fsck") == 0)
+    {
+        scan.mode = APP_SCAN_FSCK;
+    }
+    else
+    {
+        printf("unknown scan mode %s (list, hash or fsck)!\n",mode);
+        return false;
+    }
+    if(partition_read(file_path,&table) == false)
+    {
+        printf("failed to read the partition table of %s!\n",file_path);
+        return false;
+    }
+    for(i = 0;i < table.count;i++)
+    {
+        volumes += (table.partitions[i].fat == true);
+    }
+    if(volumes == 0)
+    {
+        printf("%s has no FAT partition!\n",file_path);
+        return false;
+    }
+
+    /* the threads are shared by the partitions scanned at once */
+    if(threads == 0)
+    {
+        threads = pool_default_threads();
+    }
+    scan.threads = (threads > volumes) ? (threads / volumes) : 1;
+    retValue = partition_scan(&table,threads,scan_partition,&scan);
+    if(retValue == false)
+    {
+        printf("some partitions could not be scanned or have problems!\n");
+    }
+    return retValue;
+}
+
+static bool scan_partition(const partition_struct_t* partition,FILE* out,void* arg)
+{
+    app_scan_struct_t* scan = (app_scan_struct_t*)arg;
+    fat_entry* entry_head = NULL;
+    uint8_t boot_info[512];
+    manifest_struct_t manifest;
+    fsck_struct_t report;
+    bool condition = true;
+    uint32_t i = 0;
+
+    fprintf(out,"== partition %u: offset %llu, %llu bytes\n",partition->number,
+            (unsigned long long)partition->offset,(unsigned long long)partition->size);
+    fat_set_volume_offset(partition->offset);
+    if(fat_init(scan->file_path,&entry_head,&boot_info[0]) == false)
+    {
+        fprintf(out,"failed to mount the partition!\n");
+        return false;
+    }
+
+    if(scan->mode == APP_SCAN_LIST)
+    {
+        fat_snapshot_attach(scan->file_path,false);
+        condition = fat_walk(list_entry,out);
+    }
+    else if(scan->mode == APP_SCAN_HASH)
+    {
+        fat_snapshot_attach(scan->file_path,false);
+        condition = manifest_build(&manifest,scan->threads);
+        manifest_write(&manifest,out);
+        fprintf(out,"%u files, %llu bytes, %u duplicate groups, %u damaged\n",manifest.count,
+                (unsigned long long)manifest.bytes,manifest.duplicate_groups,manifest.damaged);
+        condition = condition && (manifest.damaged == 0);
+        manifest_free(&manifest);
+    }
+    else
+    {
+        /* no snapshot: the check reads the directories themselves */
+        condition = fsck_run(&report);
+        for(i = 0;i < report.message_count;i++)
+        {
+            fprintf(out,"%s\n",fsck_message(&report,i));
+        }
+        if(report.message_count == FSCK_MAX_MESSAGES)
+        {
+            fprintf(out,"(only the first %u problems are listed)\n",report.message_count);
+        }
+        fprintf(out,"%u files, %u directories, %u clusters in use: ",report.files,report.directories,report.clusters);
+        if(condition == true)
+        {
+            fprintf(out,"clean\n");
+        }
+        else
+        {
+            fprintf(out,"%u problems (%u layout, %u FAT sectors differ, %u bad entries, %u broken chains, %u cross-linked, "
+                        "%u loops, %u size mismatches, %u lost clusters)\n",report.problems,report.layout_errors,report.fat_mismatch,
+                    report.bad_entries,report.broken_chains,report.cross_links,report.loops,report.size_mismatch,
+                    report.lost_clusters);
+        }
+        fsck_free(&report);
+    }
+    if((condition == false) && (scan->mode != APP_SCAN_FSCK))
+    {
+        fprintf(out,"some files or directories could not be read!\n");
+    }
+    fat_deinit(scan->file_path);
+    return condition;
+}
+
+static void list_entry(const uint8_t* path,const fat_entry* entry,void* arg)
+{
+    FILE* out = (FILE*)arg;
+
+    fprintf(out,"%c %10u %s\n",((entry->attribute & 0x10) != 0) ? 'd' : 'f',
+            READ_32_BITS((uint32_t)entry->size[0],(uint32_t)entry->size[1],(uint32_t)entry->size[2],(uint32_t)entry->size[3]),path);
+}
+
+bool app_find(uint8_t* file_path,uint32_t count,uint8_t** patterns)
+{
+    fat_entry* entry_head = NULL;
+    uint8_t boot_info[512];
+    uint8_t line[FAT_MAX_PATH];
+    find_index_struct_t index;
+    bool condition = true;
+    bool ignore_case = true;
+    clock_t start = 0;
+    uint32_t i = 0;
+
+    if(fat_init(file_path,&entry_head,&boot_info[0]) == false)
+    {
+        printf("failed to open file!\n");
+        return false;
+    }
+    start = clock();
+    if(find_load(&index,file_path) == true)
+    {
+        printf("index: %u entries, %u trigrams, loaded in %.1f ms\n",index.count - 1,index.trigram_count,
+               (double)(clock() - start) * 1000.0 / CLOCKS_PER_SEC);
+    }
+    else
+    {
+        fat_snapshot_attach(file_path,false);
+        condition = find_build(&index,0);
+        printf("index: %u entries, %u trigrams, built in %.1f ms\n",index.count - 1,index.trigram_count,
+               (double)(clock() - start) * 1000.0 / CLOCKS_PER_SEC);
+        if(condition == false)
+        {
+            printf("some directories could not be read!\n");
+        }
+        else if(find_save(&index,file_path) == false)
+        {
+            printf("failed to save the index!\n");
+            condition = false;
+        }
+    }
+
+    for(i = 0;i < count;i++)
+    {
+        if(strcmp((const char*)patterns[i],"-c") == 0)
+        {
+            ignore_case = false;
+        }
+        else if(strcmp((const char*)patterns[i],"-") == 0)
+        {
+            /* one pattern per line */
+            while(fgets((char*)line,sizeof(line),stdin) != NULL)
+            {
+                line[strcspn((const char*)line,"\r\n")] = '\0';
+                find_pattern(&index,line,ignore_case);
+            }
+        }
+        else
+        {
+            find_pattern(&index,patterns[i],ignore_case);
+        }
+    }
+    find_free(&index);
+    fat_deinit(file_path);
+    return condition;
+}
+
+static void find_pattern(const find_index_struct_t* index,const uint8_t* pattern,bool ignore_case)
+{
+    const find_entry_struct_t* entry = NULL;
+    uint32_t* results = NULL;
+    uint32_t flags = 0;
+    uint32_t count = 0;
+    uint32_t i = 0;
+    clock_t start = 0;
+    double elapsed = 0;
+
+    if(strpbrk((const char*)pattern,"*?[") != NULL)
+    {
+        flags |= FIND_GLOB;
+    }
+    if(ignore_case == true)
+    {
+        flags |= FIND_IGNORE_CASE;
+    }
+    start = clock();
+    count = find_query(index,pattern,flags,&results);
+    elapsed = (double)(clock() - start) * 1000000.0 / CLOCKS_PER_SEC;
+    for(i = 0;i < count;i++)
+    {
+        entry = &index->entries[results[i]];
+        printf("%c %10u %s\n",((entry->attribute & 0x10) != 0) ? 'd' : 'f',entry->size,index->text + entry->path);
+    }
+    printf("%s: %u matches in %.0f us\n",pattern,count,elapsed);
+    free(results);
+}
+
+bool app_serve(uint8_t* socket_path,uint32_t threads)
+{
+    bool retValue = false;
+
+    printf("serving on %s\n",socket_path);
+    fflush(stdout);
+    retValue = daemon_serve(socket_path,threads);
+    if(retValue == false)
+    {
+        printf("failed to serve on %s!\n",socket_path);
+    }
+    return retValue;
+}
+
+bool app_query(uint8_t* socket_path,uint32_t count,uint8_t** fields)
+{
+    uint8_t request[DAEMON_LINE_MAX];
+    bool retValue = false;
+    uint32_t length = 0;
+    uint32_t i = 0;
+
+    request[0] = '\0';
+    for(i = 0;i < count;i++)
+    {
+        length += strlen(fields[i]) + 1;
+        if(length >= DAEMON_LINE_MAX)
+        {
+            printf("request too long!\n");
+            return false;
+        }
+        if(i != 0)
+        {
+            strcat(request,"\t");
+        }
+        strcat(request,fields[i]);
+    }
+    retValue = daemon_query(socket_path,request);
+    if(retValue == false)
+    {
+        printf("failed to connect to %s!\n",socket_path);
+    }
+    return retValue;
+}
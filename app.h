@@ -6,4 +6,152 @@
 ******************************************************************************/
 void menu(void);
 
+
+/** @brief This function makes the next commands bypass the page cache (O_DIRECT).
+ * @param enable - 1 for direct I/O.
+ */
+void app_set_direct_io(bool enable);
+
+
+/** @brief This function makes the next commands use one partition of a disk image.
+ * @param file_path - disk image.
+ * @param number - partition number as printed by app_parts().
+ * @return - Return 1 if the partition exists and holds a FAT volume.
+ */
+bool app_set_partition(uint8_t* file_path,uint32_t number);
+
+
+/** @brief This function prints free space and fragmentation report of a volume
+ * (one FAT scan plus one directory tree walk).
+ * @param file_path - file path from user.
+ * @return - Return 1 if the FAT was read.
+ */
+bool app_df(uint8_t* file_path);
+
+
+/** @brief This function creates (or checks) the metadata snapshot of a volume,
+ * later mounts of the unchanged image map it instead of walking the tree.
+ * @param file_path - file path from user.
+ * @return - Return 1 if the snapshot is up to date.
+ */
+bool app_snapshot(uint8_t* file_path);
+
+
+/** @brief This function writes the content manifest of a volume (SHA-256 and CRC32C
+ * of every file, hashed in parallel) and lists files with identical content.
+ * @param file_path - file path from user.
+ * @param out_path - manifest file to write.
+ * @param threads - number of threads (0 = one per CPU).
+ * @return - Return 1 if every directory was read and the manifest was written.
+ */
+bool app_manifest(uint8_t* file_path,uint8_t* out_path,uint32_t threads);
+
+
+/** @brief This function prints the files added, removed and modified between two images
+ * and the cluster ranges of the new image that changed.
+ * @param old_path - older image.
+ * @param new_path - newer image.
+ * @param threads - number of threads (0 = one per CPU).
+ * @return - Return 1 if both images were compared.
+ */
+bool app_diff(uint8_t* old_path,uint8_t* new_path,uint32_t threads);
+
+
+/** @brief This function lists the deleted entries of a volume with a guess of their chains
+ * and optionally writes the guessed data of deleted files to a host directory.
+ * @param file_path - file path from user.
+ * @param out_dir - existing host directory for recovered files (NULL = list only).
+ * @return - Return 1 if every directory was read and every recovered file was written.
+ */
+bool app_undelete(uint8_t* file_path,uint8_t* out_dir);
+
+
+/** @brief This function scans the free clusters of a volume for known file signatures
+ * (parallel over cluster ranges) and optionally writes what it finds to a host directory.
+ * @param file_path - file path from user.
+ * @param out_dir - existing host directory for carved files (NULL = list only).
+ * @param threads - number of threads (0 = one per CPU).
+ * @return - Return 1 if the free clusters were scanned and every carved file was written.
+ */
+bool app_carve(uint8_t* file_path,uint8_t* out_dir,uint32_t threads);
+
+
+/** @brief This function prints the partition table of a disk image.
+ * @param file_path - disk image.
+ * @return - Return 1 if the partition table was read.
+ */
+bool app_parts(uint8_t* file_path);
+
+
+/** @brief This function mounts every FAT partition of a disk image, several at once,
+ * and lists their files, hashes them (manifest format) or checks them (fsck).
+ * @param file_path - disk image (an image of one volume is one partition).
+ * @param mode - "list", "hash" or "fsck".
+ * @param threads - partitions scanned at once, shared by their hashing threads (0 = one per CPU).
+ * @return - Return 1 if every FAT partition was scanned without problems.
+ */
+bool app_scan(uint8_t* file_path,uint8_t* mode,uint32_t threads);
+
+
+/** @brief This function finds files and directories by name with the index of the
+ * volume (find.h), loaded from "<image>.find" or built and saved there.
+ * @param file_path - file path from user.
+ * @param count - number of patterns.
+ * @param patterns - substrings or globs ('*', '?', '[' make a glob), "-" reads one pattern
+ * per line from stdin, "-c" makes the following patterns case sensitive.
+ * @return - Return 1 if the index was loaded or built and saved.
+ */
+bool app_find(uint8_t* file_path,uint32_t count,uint8_t** patterns);
+
+
+/** @brief This function runs the query daemon (see daemon.h) until it is stopped.
+ * @param socket_path - path of the Unix domain socket.
+ * @param threads - number of worker threads (0 = one per CPU).
+ * @return - Return 1 if the daemon stopped normally.
+ */
+bool app_serve(uint8_t* socket_path,uint32_t threads);
+
+
+/** @brief This function sends one request to the query daemon and prints the answer.
+ * @param socket_path - path of the Unix domain socket.
+ * @param count - number of request fields.
+ * @param fields - command and its arguments.
+ * @return - Return 1 if the answer was received.
+ */
+bool app_query(uint8_t* socket_path,uint32_t count,uint8_t** fields);
+
+
+/** @brief This function copies a file from the host into the volume (replacing it if it exists).
+ * @param file_path - file path from user.
+ * @param host_path - file to copy.
+ * @param path - full path of the file in the volume.
+ * @return - Return 1 if the whole file was written.
+ */
+bool app_put(uint8_t* file_path,uint8_t* host_path,uint8_t* path);
+
+
+/** @brief This function creates a directory in the volume.
+ * @param file_path - file path from user.
+ * @param path - full path of the new directory.
+ * @return - Return 1 if the directory was created.
+ */
+bool app_mkdir(uint8_t* file_path,uint8_t* path);
+
+
+/** @brief This function deletes a file or an empty directory of the volume.
+ * @param file_path - file path from user.
+ * @param path - full path of the entry.
+ * @return - Return 1 if the entry was deleted.
+ */
+bool app_rm(uint8_t* file_path,uint8_t* path);
+
+
+/** @brief This function changes the size of a file of the volume.
+ * @param file_path - file path from user.
+ * @param path - full path of the file.
+ * @param size - new size (bytes).
+ * @return - Return 1 if the size was changed.
+ */
+bool app_truncate(uint8_t* file_path,uint8_t* path,uint32_t size);
+
 #endif /* _APP_H_ */
@@ -0,0 +1,1196 @@
+/*******************************************************************************
+* Includes
+******************************************************************************/
+#define _FILE_OFFSET_BITS 64                    /* st_size of images over 2 GiB on 32-bit systems */
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdarg.h>
+#include "fat.h"
+#include "HAL.h"
+#include "pool.h"
+#include "partition.h"
+#include "daemon.h"
+
+#if defined(__linux__) || defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <strings.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#define DAEMON_SUPPORTED
+#endif
+
+#if defined(DAEMON_SUPPORTED)
+/*******************************************************************************
+* Definitions
+******************************************************************************/
+#define DAEMON_MAX_FIELDS           (5U)        /* command, image, path, offset, length     */
+#define DAEMON_LISTEN_BACKLOG       (128)
+#define DAEMON_ANSWER_GROW          (4096U)     /* bytes added to an answer per realloc()   */
+#define DAEMON_HEADER_MAX           (32U)       /* longest "OK <n>" line                    */
+#define DAEMON_SEND_TIMEOUT         (10000)     /* ms a client may stop reading an answer   */
+
+/* nanoseconds of the times of stat() */
+#if defined(__APPLE__)
+#define DAEMON_MTIME_NS(info)       ((info).st_mtimespec.tv_nsec)
+#define DAEMON_CTIME_NS(info)       ((info).st_ctimespec.tv_nsec)
+#else
+#define DAEMON_MTIME_NS(info)       ((info).st_mtim.tv_nsec)
+#define DAEMON_CTIME_NS(info)       ((info).st_ctim.tv_nsec)
+#endif
+
+typedef struct
+{
+    uint8_t path[FAT_MAX_PATH];                 /* image path as sent by clients (key)      */
+    uint8_t file_path[FAT_MAX_PATH];            /* image file, path without "@<n>"          */
+    uint32_t partition;                         /* partition of a disk image, 0 = the file  */
+    uint32_t users;                             /* requests holding the volume              */
+    bool removed;                               /* unmounted, freed by the last user        */
+    pthread_rwlock_t lock;                      /* readers: requests, writer: remount       */
+    bool loaded;                                /* caches below are valid                   */
+    bool present;                               /* image file existed at the last load      */
+    int64_t image_size;                         /* size of the image at the last load       */
+    int64_t image_mtime;                        /* modified time of the image at the last load */
+    int64_t image_mtime_ns;                     /* nanoseconds of the modified time         */
+    int64_t image_ctime;                        /* status change time of the image          */
+    int64_t image_ctime_ns;                     /* nanoseconds of the status change time    */
+    FILE* file;                                 /* read handle (kmc_open_handle())          */
+    fat_geometry_struct_t geometry;
+    uint32_t* fat;                              /* decoded FAT                              */
+    uint32_t fat_entries;
+    fat_node_struct_t* nodes;                   /* directory tree, node 0 is the root       */
+    uint32_t node_count;
+    uint8_t* names;                             /* display names, node.name is an offset    */
+} daemon_volume_struct_t;
+
+typedef struct
+{
+    int fd;                                     /* -1 = free slot                           */
+    bool busy;                                  /* a worker is answering a request          */
+    bool closing;                               /* peer closed its side                     */
+    uint32_t length;                            /* bytes in buffer                          */
+    uint8_t buffer[DAEMON_LINE_MAX];            /* bytes received, not a whole line yet     */
+    uint8_t line[DAEMON_LINE_MAX];              /* request given to the worker              */
+} daemon_client_struct_t;
+
+typedef struct
+{
+    uint8_t* data;
+    uint32_t length;
+    uint32_t capacity;
+} daemon_answer_struct_t;
+
+/*******************************************************************************
+* Prototypes
+******************************************************************************/
+
+/** @brief This function finds a mounted image, mounting it if needed, and takes a reference.
+ * @param path - image path.
+ * @param error - stores a message if the image can't be used.
+ * @return - Return the volume (read locked and up to date) or NULL.
+ */
+static daemon_volume_struct_t* acquire_volume(const uint8_t* path,const char** error);
+
+
+/** @brief This function splits an image of a request into the image file and the partition
+ * ("disk.img@2" is partition 2 of disk.img). A file whose name really ends in "@<n>" is used as is.
+ * @param path - image as sent by the client.
+ * @param file_path - stores the path of the image file.
+ * @param partition - stores the partition number (0 = the whole file).
+ */
+static void split_image(const uint8_t* path,uint8_t* file_path,uint32_t* partition);
+
+
+/** @brief This function takes an image out of the volume table.
+ * @param path - image path.
+ * @param volume - only remove this volume (NULL = whatever volume has the path).
+ * @return - Return 1 if the image was in the table.
+ */
+static bool remove_volume(const uint8_t* path,const daemon_volume_struct_t* volume);
+
+
+/** @brief This function gives back a volume of acquire_volume().
+ * @param volume - volume.
+ */
+static void release_volume(daemon_volume_struct_t* volume);
+
+
+/** @brief This function checks if the image file changed since the caches were built.
+ * @param volume - volume.
+ * @return - Return 1 if size, modified or status change time, or existence changed.
+ */
+static bool volume_changed(const daemon_volume_struct_t* volume);
+
+
+/** @brief This function mounts an image through fat.c and copies FAT, tree and layout
+ * into the caches of the volume. fat.c holds one volume at a time, so mounts are serialized;
+ * requests only use the copies.
+ * @param volume - volume (write locked).
+ */
+static void load_volume(daemon_volume_struct_t* volume);
+
+
+/** @brief This function releases the caches of a volume.
+ * @param volume - volume (write locked or unused).
+ */
+static void unload_volume(daemon_volume_struct_t* volume);
+
+
+/** @brief This function finds the node of a path ("/DIR/FILE.TXT" or "#<node>").
+ * @param volume - volume.
+ * @param path - path in the volume.
+ * @param node - stores the node.
+ * @return - Return 1 if the path exists.
+ */
+static bool resolve_path(const daemon_volume_struct_t* volume,const uint8_t* path,uint32_t* node);
+
+
+/** @brief This function appends an entry line of a node to an answer.
+ * @param volume - volume.
+ * @param node - node.
+ * @param answer - answer.
+ */
+static void append_node(const daemon_volume_struct_t* volume,uint32_t node,daemon_answer_struct_t* answer);
+
+
+/** @brief This function reads part of a file by following the cached FAT.
+ * @param volume - volume.
+ * @param node - node of the file.
+ * @param offset - first byte.
+ * @param length - number of bytes (already limited to the file size).
+ * @param buff - an array of at least length bytes.
+ * @return - Return a number of total bytes read.
+ */
+static uint32_t read_node(const daemon_volume_struct_t* volume,uint32_t node,uint64_t offset,uint32_t length,uint8_t* buff);
+
+
+/** @brief This function answers one request line.
+ * @param line - request without the new line.
+ * @param answer - stores the answer.
+ */
+static void handle_request(uint8_t* line,daemon_answer_struct_t* answer);
+
+
+/** @brief This function appends formatted text to an answer.
+ * @param answer - answer.
+ * @param format - printf() format.
+ */
+static void answer_printf(daemon_answer_struct_t* answer,const char* format,...);
+
+
+/** @brief This function makes room for more bytes in an answer.
+ * @param answer - answer.
+ * @param bytes - bytes that will be appended.
+ */
+static void answer_reserve(daemon_answer_struct_t* answer,uint32_t bytes);
+
+
+/** @brief This function writes a whole buffer to a non blocking socket. A client that
+ * doesn't read for DAEMON_SEND_TIMEOUT ms fails the write, so it can't hold a worker.
+ * @param fd - socket.
+ * @param buff - data.
+ * @param bytes - number of bytes.
+ * @return - Return 1 if everything was written.
+ */
+static bool send_all(int fd,const uint8_t* buff,uint32_t bytes);
+
+
+/** @brief This function hands the next whole request line of a client to the workers,
+ * or closes the client if it has nothing left to send.
+ * @param slot - client slot.
+ */
+static void dispatch_client(uint32_t slot);
+
+
+/** @brief This function closes a client and frees its slot.
+ * @param slot - client slot.
+ */
+static void close_client(uint32_t slot);
+
+
+/** @brief This function is the body of a worker thread: it answers queued requests.
+ * @param arg - not used.
+ * @return - Return NULL.
+ */
+static void* worker_main(void* arg);
+
+
+/** @brief Signal handler of SIGINT and SIGTERM, stops the event loop.
+ * @param signal_number - signal.
+ */
+static void stop_handler(int signal_number);
+
+
+/** @brief This function checks the malloc value.
+ * @param ptr - pointer of malloc.
+ */
+static void check_null(void* ptr);
+
+/*******************************************************************************
+* Variables
+******************************************************************************/
+static daemon_volume_struct_t* g_volumes[DAEMON_MAX_VOLUMES];
+static uint32_t g_volume_count = 0;
+static pthread_mutex_t g_volume_lock = PTHREAD_MUTEX_INITIALIZER;  /* volume table and users   */
+static pthread_mutex_t g_mount_lock = PTHREAD_MUTEX_INITIALIZER;   /* fat.c mounts one image   */
+
+static daemon_client_struct_t* g_clients = NULL;
+static uint32_t g_queue[DAEMON_MAX_CLIENTS];    /* client slots with a request to answer      */
+static uint32_t g_queue_head = 0;
+static uint32_t g_queue_count = 0;
+static bool g_queue_stop = false;
+static pthread_mutex_t g_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_queue_ready = PTHREAD_COND_INITIALIZER;
+static int g_wake_pipe[2] = {-1,-1};            /* workers send back the slot they answered   */
+static volatile sig_atomic_t g_stop = 0;
+
+/*******************************************************************************
+* Code
+******************************************************************************/
+static daemon_volume_struct_t* acquire_volume(const uint8_t* path,const char** error)
+{
+    daemon_volume_struct_t* volume = NULL;
+    uint32_t i = 0;
+
+    *error = "image not mounted";
+    if(strlen(path) >= FAT_MAX_PATH)
+    {
+        *error = "path too long";
+        return NULL;
+    }
+    pthread_mutex_lock(&g_volume_lock);
+    for(i = 0;(i < g_volume_count) && (strcmp(g_volumes[i]->path,path) != 0);i++)
+    {
+        /* just check, don't do anything */
+    }
+    if(i < g_volume_count)
+    {
+        volume = g_volumes[i];
+    }
+    else if(g_volume_count < DAEMON_MAX_VOLUMES)
+    {
+        /* first request for this image: the caches are built below, with the lock released */
+        volume = (daemon_volume_struct_t*)calloc(1,sizeof(daemon_volume_struct_t));
+        check_null(volume);
+        strcpy(volume->path,path);
+        split_image(path,volume->file_path,&volume->partition);
+        volume->present = true;
+        volume->image_size = -1;
+        pthread_rwlock_init(&volume->lock,NULL);
+        g_volumes[g_volume_count] = volume;
+        g_volume_count += 1;
+    }
+    else
+    {
+        *error = "too many images";
+    }
+    if(volume != NULL)
+    {
+        volume->users += 1;
+    }
+    pthread_mutex_unlock(&g_volume_lock);
+
+    if(volume != NULL)
+    {
+        pthread_rwlock_rdlock(&volume->lock);
+        while(volume_changed(volume) == true)
+        {
+            pthread_rwlock_unlock(&volume->lock);
+            pthread_rwlock_wrlock(&volume->lock);
+            /* another request may have remounted it while this one waited */
+            if(volume_changed(volume) == true)
+            {
+                load_volume(volume);
+            }
+            pthread_rwlock_unlock(&volume->lock);
+            pthread_rwlock_rdlock(&volume->lock);
+        }
+        if(volume->loaded == false)
+        {
+            pthread_rwlock_unlock(&volume->lock);
+            /* don't keep images that can't be mounted in the table */
+            remove_volume(path,volume);
+            release_volume(volume);
+            *error = "failed to mount image";
+            volume = NULL;
+        }
+    }
+    return volume;
+}
+
+static void split_image(const uint8_t* path,uint8_t* file_path,uint32_t* partition)
+{
+    const uint8_t* at = (const uint8_t*)strrchr((const char*)path,'@');
+    struct stat info;
+    uint32_t i = 0;
+
+    strcpy(file_path,path);
+    *partition = 0;
+    if((at != NULL) && (at[1] != '\0') && (stat(path,&info) != 0))
+    {
+        for(i = 1;(at[i] >= '0') && (at[i] <= '9');i++)
+        {
+            /* just check, don't do anything */
+        }
+        if(at[i] == '\0')
+        {
+            file_path[at - path] = '\0';
+            *partition = strtoul(&at[1],NULL,10);
+        }
+    }
+}
+
+static bool remove_volume(const uint8_t* path,const daemon_volume_struct_t* volume)
+{
+    daemon_volume_struct_t* removed = NULL;
+    uint32_t i = 0;
+
+    pthread_mutex_lock(&g_volume_lock);
+    for(i = 0;(i < g_volume_count) && (strcmp(g_volumes[i]->path,path) != 0);i++)
+    {
+        /* just check, don't do anything */
+    }
+    if((i < g_volume_count) && ((volume == NULL) || (g_volumes[i] == volume)))
+    {
+        removed = g_volumes[i];
+        g_volumes[i] = g_volumes[g_volume_count - 1];
+        g_volume_count -= 1;
+        removed->removed = true;
+        removed->users += 1;
+    }
+    pthread_mutex_unlock(&g_volume_lock);
+    if(removed != NULL)
+    {
+        /* the caches are freed by the last request that still uses them */
+        release_volume(removed);
+    }
+    return (removed != NULL);
+}
+
+static void release_volume(daemon_volume_struct_t* volume)
+{
+    bool last = false;
+
+    pthread_mutex_lock(&g_volume_lock);
+    volume->users -= 1;
+    last = (volume->removed == true) && (volume->users == 0);
+    pthread_mutex_unlock(&g_volume_lock);
+    if(last == true)
+    {
+        unload_volume(volume);
+        pthread_rwlock_destroy(&volume->lock);
+        free(volume);
+    }
+}
+
+static bool volume_changed(const daemon_volume_struct_t* volume)
+{
+    bool retValue = false;
+    struct stat info;
+
+    if(stat(volume->file_path,&info) != 0)
+    {
+        retValue = (volume->present == true);
+    }
+    else
+    {
+        retValue = (volume->present == false) || (volume->image_size != (int64_t)info.st_size) ||
+                   (volume->image_mtime != (int64_t)info.st_mtime) ||
+                   (volume->image_mtime_ns != (int64_t)DAEMON_MTIME_NS(info)) ||
+                   (volume->image_ctime != (int64_t)info.st_ctime) ||
+                   (volume->image_ctime_ns != (int64_t)DAEMON_CTIME_NS(info));
+    }
+    return retValue;
+}
+
+static void load_volume(daemon_volume_struct_t* volume)
+{
+    fat_entry* entry_head = NULL;
+    uint8_t boot_info[512];
+    uint8_t name[256];
+    struct stat info;
+    const uint32_t* table = NULL;
+    const fat_node_struct_t* nodes = NULL;
+    const uint8_t* names = NULL;
+    uint32_t names_size = 0;
+    uint32_t length = 0;
+    uint32_t i = 0;
+    partition_table_struct_t partitions;
+    const partition_struct_t* partition = NULL;
+    bool found = true;
+
+    unload_volume(volume);
+    volume->present = (stat(volume->file_path,&info) == 0);
+    volume->image_size = (volume->present == true) ? (int64_t)info.st_size : -1;
+    volume->image_mtime = (volume->present == true) ? (int64_t)info.st_mtime : 0;
+    volume->image_mtime_ns = (volume->present == true) ? (int64_t)DAEMON_MTIME_NS(info) : 0;
+    volume->image_ctime = (volume->present == true) ? (int64_t)info.st_ctime : 0;
+    volume->image_ctime_ns = (volume->present == true) ? (int64_t)DAEMON_CTIME_NS(info) : 0;
+    if(volume->present == false)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&g_mount_lock);
+    /* the offset of the partition is read at every load, the table may have changed too */
+    if(volume->partition != 0)
+    {
+        partition = (partition_read(volume->file_path,&partitions) == true) ? partition_find(&partitions,volume->partition) : NULL;
+        found = (partition != NULL) && (partition->fat == true);
+        if(found == true)
+        {
+            fat_set_volume_offset(partition->offset);
+        }
+    }
+    if((found == true) && (fat_init(volume->file_path,&entry_head,&boot_info[0]) == true))
+    {
+        /* the snapshot holds FAT and tree, and makes the next mount of this image instant */
+        fat_snapshot_attach(volume->file_path,true);
+        table = fat_get_table(&volume->fat_entries);
+        nodes = fat_get_nodes(&volume->node_count,&names);
+        if((table != NULL) && (nodes != NULL) && (volume->node_count != 0))
+        {
+            fat_get_geometry(&volume->geometry);
+            volume->fat = (uint32_t*)malloc(volume->fat_entries * sizeof(uint32_t));
+            check_null(volume->fat);
+            memcpy(volume->fat,table,volume->fat_entries * sizeof(uint32_t));
+            volume->nodes = (fat_node_struct_t*)malloc(volume->node_count * sizeof(fat_node_struct_t));
+            check_null(volume->nodes);
+            memcpy(volume->nodes,nodes,volume->node_count * sizeof(fat_node_struct_t));
+
+            /* names are kept as displayed, lookups compare them directly */
+            volume->names = (uint8_t*)malloc(1);
+            check_null(volume->names);
+            for(i = 0;i < volume->node_count;i++)
+            {
+                name[0] = '\0';
+                if(i != 0)
+                {
+                    fat_node_name(&nodes[i],names,name);
+                }
+                length = strlen(name) + 1;
+                volume->names = (uint8_t*)realloc(volume->names,names_size + length);
+                check_null(volume->names);
+                memcpy(&volume->names[names_size],name,length);
+                volume->nodes[i].name = names_size;
+                names_size += length;
+            }
+            volume->loaded = true;
+        }
+        fat_deinit(volume->file_path);
+    }
+    fat_set_volume_offset(0);
+    pthread_mutex_unlock(&g_mount_lock);
+
+    if(volume->loaded == true)
+    {
+        volume->file = kmc_open_handle(volume->file_path);
+        if(volume->file == NULL)
+        {
+            unload_volume(volume);
+        }
+    }
+}
+
+static void unload_volume(daemon_volume_struct_t* volume)
+{
+    if(volume->file != NULL)
+    {
+        kmc_close_handle(volume->file);
+    }
+    free(volume->fat);
+    free(volume->nodes);
+    free(volume->names);
+    volume->file = NULL;
+    volume->fat = NULL;
+    volume->nodes = NULL;
+    volume->names = NULL;
+    volume->fat_entries = 0;
+    volume->node_count = 0;
+    volume->loaded = false;
+}
+
+static bool resolve_path(const daemon_volume_struct_t* volume,const uint8_t* path,uint32_t* node)
+{
+    bool retValue = true;
+    const fat_node_struct_t* dir = NULL;
+    const fat_node_struct_t* child = NULL;
+    uint8_t part[256];
+    uint8_t short_name[13];
+    uint32_t length = 0;
+    uint32_t current = 0;
+    uint32_t i = 0;
+    uint32_t j = 0;
+    uint32_t k = 0;
+    char* end = NULL;
+
+    if(path[0] == '#')
+    {
+        current = strtoul(&path[1],&end,10);
+        retValue = (end != (char*)&path[1]) && (*end == '\0') && (current < volume->node_count);
+    }
+    while((retValue == true) && (path[0] != '#') && (*path != '\0'))
+    {
+        while(*path == '/')
+        {
+            path++;
+        }
+        for(length = 0;(path[length] != '/') && (path[length] != '\0');length++)
+        {
+            /* just check, don't do anything */
+        }
+        if(length == 0)
+        {
+            break;
+        }
+        if(length >= sizeof(part))
+        {
+            retValue = false;
+            break;
+        }
+        memcpy(part,path,length);
+        part[length] = '\0';
+        path += length;
+
+        dir = &volume->nodes[current];
+        retValue = false;
+        if(((dir->attribute & 0x10) != 0) && (dir->first_child <= volume->node_count) &&
+           (dir->child_count <= (volume->node_count - dir->first_child)))
+        {
+            for(i = dir->first_child;i < (dir->first_child + dir->child_count);i++)
+            {
+                child = &volume->nodes[i];
+                if(strcasecmp(&volume->names[child->name],part) == 0)
+                {
+                    retValue = true;
+                }
+                else
+                {
+                    /* the 8.3 alias of a long name works too */
+                    for(j = 0,k = 0;(j < 8) && (child->short_name[j] != ' ');j++)
+                    {
+                        short_name[k++] = child->short_name[j];
+                    }
+                    if(child->short_name[8] != ' ')
+                    {
+                        short_name[k++] = '.';
+                        for(j = 8;(j < 11) && (child->short_name[j] != ' ');j++)
+                        {
+                            short_name[k++] = child->short_name[j];
+                        }
+                    }
+                    short_name[k] = '\0';
+                    retValue = (strcasecmp(short_name,part) == 0);
+                }
+                if(retValue == true)
+                {
+                    current = i;
+                    break;
+                }
+            }
+        }
+    }
+    *node = current;
+    return retValue;
+}
+
+static void append_node(const daemon_volume_struct_t* volume,uint32_t node,daemon_answer_struct_t* answer)
+{
+    const fat_node_struct_t* entry = &volume->nodes[node];
+
+    answer_printf(answer,"%u\t%c\t%u\t%u\t%04u-%02u-%02u %02u:%02u:%02u\t0x%02X\t%s\n",
+                  node,((entry->attribute & 0x10) != 0) ? 'd' : 'f',entry->size,entry->first_cluster,
+                  1980 + (entry->modified_date >> 9),(entry->modified_date >> 5) & 0x0F,entry->modified_date & 0x1F,
+                  entry->modified_time >> 11,(entry->modified_time >> 5) & 0x3F,(entry->modified_time & 0x1F) * 2,
+                  entry->attribute,(node == 0) ? (const uint8_t*)"/" : &volume->names[entry->name]);
+}
+
+static uint32_t read_node(const daemon_volume_struct_t* volume,uint32_t node,uint64_t offset,uint32_t length,uint8_t* buff)
+{
+    const fat_geometry_struct_t* geometry = &volume->geometry;
+    uint32_t cluster_size = geometry->bytes_per_sector * geometry->sectors_per_cluster;
+    uint32_t cluster = volume->nodes[node].first_cluster;
+    uint32_t skip = offset / cluster_size;
+    uint32_t within = offset % cluster_size;
+    uint32_t steps = 0;
+    uint32_t done = 0;
+    uint32_t run = 0;
+    uint32_t bytes = 0;
+    uint32_t got = 0;
+    uint64_t position = 0;
+
+    /* a chain can't be longer than the volume, that also stops on looped chains */
+    while((skip != 0) && (cluster >= 2) && (cluster < volume->fat_entries) && (steps < geometry->total_clusters))
+    {
+        cluster = volume->fat[cluster];
+        skip -= 1;
+        steps += 1;
+    }
+    while((done < length) && (cluster >= 2) && (cluster < volume->fat_entries) && (steps < geometry->total_clusters))
+    {
+        /* contiguous clusters are read with one request */
+        run = 1;
+        while((((uint64_t)run * cluster_size - within) < (length - done)) && ((cluster + run) < volume->fat_entries) &&
+              (volume->fat[cluster + run - 1] == (cluster + run)))
+        {
+            run += 1;
+        }
+        bytes = run * cluster_size - within;
+        if(bytes > (length - done))
+        {
+            bytes = length - done;
+        }
+        position = ((uint64_t)geometry->data_first_sector + (uint64_t)(cluster - 2) * geometry->sectors_per_cluster) *
+                   geometry->bytes_per_sector + within + geometry->volume_offset;
+        got = kmc_read_handle(volume->file,position,bytes,buff + done);
+        done += got;
+        if(got < bytes)
+        {
+            break;
+        }
+        within = 0;
+        steps += run;
+        cluster = volume->fat[cluster + run - 1];
+    }
+    return done;
+}
+
+static void handle_request(uint8_t* line,daemon_answer_struct_t* answer)
+{
+    uint8_t* field[DAEMON_MAX_FIELDS];
+    uint32_t count = 0;
+    daemon_volume_struct_t* volume = NULL;
+    const char* error = NULL;
+    const fat_node_struct_t* dir = NULL;
+    uint32_t node = 0;
+    uint32_t i = 0;
+    uint64_t offset = 0;
+    uint64_t length = 0;
+    uint32_t got = 0;
+
+    field[0] = line;
+    count = 1;
+    for(i = 0;(line[i] != '\0') && (count < DAEMON_MAX_FIELDS);i++)
+    {
+        if(line[i] == '\t')
+        {
+            line[i] = '\0';
+            field[count] = &line[i + 1];
+            count += 1;
+        }
+    }
+
+    if(strcmp(field[0],"images") == 0)
+    {
+        pthread_mutex_lock(&g_volume_lock);
+        answer_printf(answer,"OK\t%u\n",g_volume_count);
+        for(i = 0;i < g_volume_count;i++)
+        {
+            /* a remount may be running, node_count is only a hint here */
+            answer_printf(answer,"%s\t%u\n",g_volumes[i]->path,g_volumes[i]->node_count);
+        }
+        pthread_mutex_unlock(&g_volume_lock);
+    }
+    else if((strcmp(field[0],"unmount") == 0) && (count >= 2))
+    {
+        if(remove_volume(field[1],NULL) == true)
+        {
+            answer_printf(answer,"OK\n");
+        }
+        else
+        {
+            answer_printf(answer,"ERR\timage not mounted\n");
+        }
+    }
+    else if((strcmp(field[0],"mount") == 0) && (count >= 2))
+    {
+        volume = acquire_volume(field[1],&error);
+        if(volume != NULL)
+        {
+            answer_printf(answer,"OK\t%u\t%u\n",volume->node_count,volume->geometry.total_clusters);
+        }
+    }
+    else if(((strcmp(field[0],"lookup") == 0) || (strcmp(field[0],"stat") == 0) ||
+             (strcmp(field[0],"list") == 0)) && (count >= 3))
+    {
+        volume = acquire_volume(field[1],&error);
+        if((volume != NULL) && (resolve_path(volume,field[2],&node) == false))
+        {
+            error = "no such file or directory";
+        }
+        else if((volume != NULL) && (strcmp(field[0],"lookup") == 0))
+        {
+            answer_printf(answer,"OK\t%u\n",node);
+        }
+        else if((volume != NULL) && (strcmp(field[0],"stat") == 0))
+        {
+            answer_printf(answer,"OK\t");
+            append_node(volume,node,answer);
+        }
+        else if(volume != NULL)
+        {
+            dir = &volume->nodes[node];
+            if((dir->attribute & 0x10) == 0)
+            {
+                error = "not a directory";
+            }
+            else
+            {
+                answer_printf(answer,"OK\t%u\n",dir->child_count);
+                for(i = dir->first_child;i < (dir->first_child + dir->child_count);i++)
+                {
+                    append_node(volume,i,answer);
+                }
+            }
+        }
+    }
+    else if((strcmp(field[0],"read") == 0) && (count >= 5))
+    {
+        offset = strtoull(field[3],NULL,10);
+        length = strtoull(field[4],NULL,10);
+        volume = acquire_volume(field[1],&error);
+        if((volume != NULL) && (resolve_path(volume,field[2],&node) == false))
+        {
+            error = "no such file or directory";
+        }
+        else if((volume != NULL) && ((volume->nodes[node].attribute & 0x10) != 0))
+        {
+            error = "is a directory";
+        }
+        else if((volume != NULL) && (length > DAEMON_MAX_READ))
+        {
+            error = "read too large";
+        }
+        else if(volume != NULL)
+        {
+            if(offset >= volume->nodes[node].size)
+            {
+                length = 0;
+            }
+            else if(length > (volume->nodes[node].size - offset))
+            {
+                length = volume->nodes[node].size - offset;
+            }
+            /* the header needs the number of bytes read, data is moved behind it afterwards */
+            answer_reserve(answer,DAEMON_HEADER_MAX + length);
+            got = read_node(volume,node,offset,length,&answer->data[DAEMON_HEADER_MAX]);
+            answer_printf(answer,"OK\t%u\n",got);
+            memmove(&answer->data[answer->length],&answer->data[DAEMON_HEADER_MAX],got);
+            answer->length += got;
+        }
+    }
+    else
+    {
+        error = "bad request";
+    }
+
+    if((volume != NULL) && (strcmp(field[0],"unmount") != 0))
+    {
+        pthread_rwlock_unlock(&volume->lock);
+        release_volume(volume);
+    }
+    if((error != NULL) && (answer->length == 0))
+    {
+        answer_printf(answer,"ERR\t%s\n",error);
+    }
+}
+
+static void answer_printf(daemon_answer_struct_t* answer,const char* format,...)
+{
+    va_list args;
+    int32_t length = 0;
+
+    va_start(args,format);
+    length = vsnprintf(NULL,0,format,args);
+    va_end(args);
+    answer_reserve(answer,length + 1);
+    va_start(args,format);
+    vsnprintf(&answer->data[answer->length],length + 1,format,args);
+    va_end(args);
+    answer->length += length;
+}
+
+static void answer_reserve(daemon_answer_struct_t* answer,uint32_t bytes)
+{
+    if((answer->length + bytes) > answer->capacity)
+    {
+        answer->capacity = answer->length + bytes + DAEMON_ANSWER_GROW;
+        answer->data = (uint8_t*)realloc(answer->data,answer->capacity);
+        check_null(answer->data);
+    }
+}
+
+static bool send_all(int fd,const uint8_t* buff,uint32_t bytes)
+{
+    bool retValue = true;
+    struct pollfd wait_fd;
+    ssize_t done = 0;
+    uint32_t total = 0;
+
+    while((retValue == true) && (total < bytes))
+    {
+        done = write(fd,buff + total,bytes - total);
+        if(done > 0)
+        {
+            total += (uint32_t)done;
+        }
+        else if((done < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+        {
+            /* the client reads slower than the answer is produced */
+            wait_fd.fd = fd;
+            wait_fd.events = POLLOUT;
+            if(poll(&wait_fd,1,DAEMON_SEND_TIMEOUT) == 0)
+            {
+                /* the client stopped reading, drop it */
+                retValue = false;
+            }
+        }
+        else if((done < 0) && (errno == EINTR))
+        {
+            /* just retry */
+        }
+        else
+        {
+            retValue = false;
+        }
+    }
+    return retValue;
+}
+
+static void dispatch_client(uint32_t slot)
+{
+    daemon_client_struct_t* client = &g_clients[slot];
+    uint8_t* end = memchr(client->buffer,'\n',client->length);
+    uint32_t length = 0;
+
+    if(end != NULL)
+    {
+        length = end - client->buffer;
+        memcpy(client->line,client->buffer,length);
+        if((length != 0) && (client->line[length - 1] == '\r'))
+        {
+            length -= 1;
+        }
+        client->line[length] = '\0';
+        client->length -= (end - client->buffer) + 1;
+        memmove(client->buffer,end + 1,client->length);
+        client->busy = true;
+        pthread_mutex_lock(&g_queue_lock);
+        g_queue[(g_queue_head + g_queue_count) % DAEMON_MAX_CLIENTS] = slot;
+        g_queue_count += 1;
+        pthread_cond_signal(&g_queue_ready);
+        pthread_mutex_unlock(&g_queue_lock);
+    }
+    else if(client->length == DAEMON_LINE_MAX)
+    {
+        send_all(client->fd,"ERR\trequest too long\n",21);
+        close_client(slot);
+    }
+    else if(client->closing == true)
+    {
+        close_client(slot);
+    }
+}
+
+static void close_client(uint32_t slot)
+{
+    close(g_clients[slot].fd);
+    g_clients[slot].fd = -1;
+    g_clients[slot].busy = false;
+    g_clients[slot].closing = false;
+    g_clients[slot].length = 0;
+}
+
+static void* worker_main(void* arg)
+{
+    daemon_answer_struct_t answer = {NULL,0,0};
+    uint32_t slot = 0;
+    bool stop = false;
+
+    while(stop == false)
+    {
+        pthread_mutex_lock(&g_queue_lock);
+        while((g_queue_count == 0) && (g_queue_stop == false))
+        {
+            pthread_cond_wait(&g_queue_ready,&g_queue_lock);
+        }
+        stop = (g_queue_count == 0);
+        if(stop == false)
+        {
+            slot = g_queue[g_queue_head];
+            g_queue_head = (g_queue_head + 1) % DAEMON_MAX_CLIENTS;
+            g_queue_count -= 1;
+        }
+        pthread_mutex_unlock(&g_queue_lock);
+
+        if(stop == false)
+        {
+            answer.length = 0;
+            handle_request(g_clients[slot].line,&answer);
+            if(send_all(g_clients[slot].fd,answer.data,answer.length) == false)
+            {
+                g_clients[slot].closing = true;
+                g_clients[slot].length = 0;
+            }
+            /* the event loop owns the client again */
+            while((write(g_wake_pipe[1],&slot,sizeof(slot)) < 0) && (errno == EINTR))
+            {
+                /* just retry */
+            }
+        }
+    }
+    free(answer.data);
+    return NULL;
+}
+
+static void stop_handler(int signal_number)
+{
+    g_stop = 1;
+}
+
+bool daemon_serve(const uint8_t* socket_path,uint32_t threads)
+{
+    bool retValue = false;
+    struct sockaddr_un address;
+    struct pollfd* fds = NULL;
+    uint32_t* fd_slot = NULL;
+    pthread_t workers[POOL_MAX_THREADS];
+    sigset_t signals;
+    sigset_t old_signals;
+    int listen_fd = -1;
+    int fd = -1;
+    uint32_t worker_count = (threads == 0) ? pool_default_threads() : threads;
+    uint32_t fd_count = 0;
+    uint32_t slot = 0;
+    uint32_t i = 0;
+    ssize_t got = 0;
+    daemon_client_struct_t* client = NULL;
+
+    if(worker_count > POOL_MAX_THREADS)
+    {
+        worker_count = POOL_MAX_THREADS;
+    }
+    memset(&address,0,sizeof(address));
+    address.sun_family = AF_UNIX;
+    if(strlen(socket_path) >= sizeof(address.sun_path))
+    {
+        return false;
+    }
+    strcpy(address.sun_path,socket_path);
+    unlink(socket_path);
+    listen_fd = socket(AF_UNIX,SOCK_STREAM,0);
+    if((listen_fd < 0) || (bind(listen_fd,(struct sockaddr*)&address,sizeof(address)) != 0) ||
+       (listen(listen_fd,DAEMON_LISTEN_BACKLOG) != 0) || (pipe(g_wake_pipe) != 0))
+    {
+        if(listen_fd >= 0)
+        {
+            close(listen_fd);
+        }
+        return false;
+    }
+    fcntl(listen_fd,F_SETFL,fcntl(listen_fd,F_GETFL) | O_NONBLOCK);
+    fcntl(g_wake_pipe[0],F_SETFL,fcntl(g_wake_pipe[0],F_GETFL) | O_NONBLOCK);
+
+    g_clients = (daemon_client_struct_t*)malloc(DAEMON_MAX_CLIENTS * sizeof(daemon_client_struct_t));
+    check_null(g_clients);
+    fds = (struct pollfd*)malloc((DAEMON_MAX_CLIENTS + 2) * sizeof(struct pollfd));
+    check_null(fds);
+    fd_slot = (uint32_t*)malloc((DAEMON_MAX_CLIENTS + 2) * sizeof(uint32_t));
+    check_null(fd_slot);
+    for(i = 0;i < DAEMON_MAX_CLIENTS;i++)
+    {
+        g_clients[i].fd = -1;
+        g_clients[i].busy = false;
+        g_clients[i].closing = false;
+        g_clients[i].length = 0;
+    }
+    g_stop = 0;
+    g_queue_stop = false;
+    g_queue_head = 0;
+    g_queue_count = 0;
+
+    /* only the event loop gets the signals, so that they wake poll() */
+    signal(SIGPIPE,SIG_IGN);
+    signal(SIGINT,stop_handler);
+    signal(SIGTERM,stop_handler);
+    sigemptyset(&signals);
+    sigaddset(&signals,SIGINT);
+    sigaddset(&signals,SIGTERM);
+    pthread_sigmask(SIG_BLOCK,&signals,&old_signals);
+    for(i = 0;i < worker_count;i++)
+    {
+        if(pthread_create(&workers[i],NULL,worker_main,NULL) != 0)
+        {
+            break;
+        }
+    }
+    worker_count = i;
+    pthread_sigmask(SIG_SETMASK,&old_signals,NULL);
+
+    while((g_stop == 0) && (worker_count != 0))
+    {
+        fds[0].fd = listen_fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = g_wake_pipe[0];
+        fds[1].events = POLLIN;
+        fd_count = 2;
+        for(i = 0;i < DAEMON_MAX_CLIENTS;i++)
+        {
+            /* a client waiting for its answer is not read, requests stay in order */
+            if((g_clients[i].fd >= 0) && (g_clients[i].busy == false))
+            {
+                fds[fd_count].fd = g_clients[i].fd;
+                fds[fd_count].events = POLLIN;
+                fd_slot[fd_count] = i;
+                fd_count += 1;
+            }
+        }
+        if(poll(fds,fd_count,-1) < 0)
+        {
+            continue;
+        }
+
+        if((fds[1].revents & POLLIN) != 0)
+        {
+            while(read(g_wake_pipe[0],&slot,sizeof(slot)) == sizeof(slot))
+            {
+                g_clients[slot].busy = false;
+                dispatch_client(slot);
+            }
+        }
+        for(i = 2;i < fd_count;i++)
+        {
+            if(fds[i].revents == 0)
+            {
+                continue;
+            }
+            slot = fd_slot[i];
+            client = &g_clients[slot];
+            got = read(client->fd,&client->buffer[client->length],DAEMON_LINE_MAX - client->length);
+            if(got > 0)
+            {
+                client->length += (uint32_t)got;
+            }
+            else if((got == 0) || ((errno != EAGAIN) && (errno != EINTR)))
+            {
+                client->closing = true;
+            }
+            dispatch_client(slot);
+        }
+        if((fds[0].revents & POLLIN) != 0)
+        {
+            while((fd = accept(listen_fd,NULL,NULL)) >= 0)
+            {
+                for(slot = 0;(slot < DAEMON_MAX_CLIENTS) && (g_clients[slot].fd >= 0);slot++)
+                {
+                    /* just check, don't do anything */
+                }
+                if(slot == DAEMON_MAX_CLIENTS)
+                {
+                    close(fd);
+                    continue;
+                }
+                fcntl(fd,F_SETFL,fcntl(fd,F_GETFL) | O_NONBLOCK);
+                g_clients[slot].fd = fd;
+            }
+        }
+    }
+    retValue = (worker_count != 0);
+
+    /* workers finish the queued requests, then the clients are closed */
+    pthread_mutex_lock(&g_queue_lock);
+    g_queue_stop = true;
+    pthread_cond_broadcast(&g_queue_ready);
+    pthread_mutex_unlock(&g_queue_lock);
+    for(i = 0;i < worker_count;i++)
+    {
+        pthread_join(workers[i],NULL);
+    }
+    for(i = 0;i < DAEMON_MAX_CLIENTS;i++)
+    {
+        if(g_clients[i].fd >= 0)
+        {
+            close_client(i);
+        }
+    }
+    for(i = 0;i < g_volume_count;i++)
+    {
+        unload_volume(g_volumes[i]);
+        pthread_rwlock_destroy(&g_volumes[i]->lock);
+        free(g_volumes[i]);
+    }
+    g_volume_count = 0;
+    close(g_wake_pipe[0]);
+    close(g_wake_pipe[1]);
+    close(listen_fd);
+    unlink(socket_path);
+    free(fds);
+    free(fd_slot);
+    free(g_clients);
+    g_clients = NULL;
+    return retValue;
+}
+
+bool daemon_query(const uint8_t* socket_path,const uint8_t* request)
+{
+    bool retValue = false;
+    struct sockaddr_un address;
+    uint8_t buff[65536];
+    ssize_t got = 0;
+    int fd = -1;
+
+    memset(&address,0,sizeof(address));
+    address.sun_family = AF_UNIX;
+    if(strlen(socket_path) < sizeof(address.sun_path))
+    {
+        strcpy(address.sun_path,socket_path);
+        fd = socket(AF_UNIX,SOCK_STREAM,0);
+    }
+    if((fd >= 0) && (connect(fd,(struct sockaddr*)&address,sizeof(address)) == 0))
+    {
+        signal(SIGPIPE,SIG_IGN);
+        /* one request, then end of input: the daemon closes after answering */
+        if((send_all(fd,request,strlen(request)) == true) && (send_all(fd,"\n",1) == true))
+        {
+            shutdown(fd,SHUT_WR);
+            retValue = true;
+            while((got = read(fd,buff,sizeof(buff))) > 0)
+            {
+                fwrite(buff,sizeof(uint8_t),got,stdout);
+            }
+        }
+    }
+    if(fd >= 0)
+    {
+        close(fd);
+    }
+    return retValue;
+}
+
+static void check_null(void* ptr)
+{
+    if(ptr == NULL)
+    {
+        exit(1);
+    }
+}
+#else
+/* no Unix domain sockets on this system */
+bool daemon_serve(const uint8_t* socket_path,uint32_t threads)
+{
+    return false;
+}
+
+bool daemon_query(const uint8_t* socket_path,const uint8_t* request)
+{
+    return false;
+}
+#endif
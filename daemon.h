@@ -0,0 +1,53 @@
+#ifndef _DAEMON_H_
+#define _DAEMON_H_
+
+/*******************************************************************************
+* Definitions
+******************************************************************************/
+#define DAEMON_MAX_VOLUMES          (256U)      /* images mounted at once                   */
+#define DAEMON_MAX_CLIENTS          (1024U)     /* connections served at once               */
+#define DAEMON_LINE_MAX             (4096U)     /* longest request line (bytes)             */
+#define DAEMON_MAX_READ             (16777216U) /* largest answer of one read request       */
+
+/*
+ * Protocol: one request per line, fields separated by tabs, answers start with
+ * "OK" or "ERR\t<message>". A connection can send any number of requests, they are
+ * answered in order. <image> is an image file or "<disk image>@<n>" for partition n of a
+ * disk image (numbers as printed by "parts"). <path> is a full path in the volume
+ * ("/DIR/FILE.TXT", long or 8.3 names, any case) or "#<node>" as returned by lookup.
+ *
+ *   mount   <image>                            OK <nodes> <clusters>
+ *   unmount <image>                            OK
+ *   images                                     OK <n>, then n lines "<image> <nodes>"
+ *   lookup  <image> <path>                     OK <node>
+ *   stat    <image> <path>                     OK <entry>
+ *   list    <image> <path>                     OK <n>, then n lines "<entry>"
+ *   read    <image> <path> <offset> <length>   OK <n>, then n bytes of the file
+ *
+ * <entry> is "<node> <d|f> <size> <first cluster> <YYYY-MM-DD hh:mm:ss> <attribute> <name>".
+ * Images are mounted by the first request that names them and mounted again when the
+ * image file changes; node numbers are valid until then.
+ */
+
+/*******************************************************************************
+* API
+******************************************************************************/
+
+/** @brief This function runs the query daemon until SIGINT or SIGTERM: an event loop
+ * accepts connections and reads requests on a Unix domain socket, worker threads
+ * answer them from the decoded FAT and directory tree of every mounted image.
+ * @param socket_path - path of the socket (an old socket file is replaced).
+ * @param threads - number of worker threads (0 = one per CPU).
+ * @return - Return 1 if the daemon stopped normally or 0 if the socket could not be used.
+ */
+bool daemon_serve(const uint8_t* socket_path,uint32_t threads);
+
+
+/** @brief This function sends one request to a running daemon and copies the answer to stdout.
+ * @param socket_path - path of the daemon socket.
+ * @param request - request line without the new line (fields separated by tabs).
+ * @return - Return 1 if the answer was received.
+ */
+bool daemon_query(const uint8_t* socket_path,const uint8_t* request);
+
+#endif /* _DAEMON_H_ */
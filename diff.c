@@ -0,0 +1,691 @@
+/*******************************************************************************
+* Includes
+******************************************************************************/
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include "fat.h"
+#include "HAL.h"
+#include "hash.h"
+#include "pool.h"
+#include "diff.h"
+
+/*******************************************************************************
+* Definitions
+******************************************************************************/
+#define DIFF_CHUNK                  (1048576U)  /* bytes read per request while streaming a file */
+#define DIFF_GROW                   (256U)      /* entries added to a list per realloc()         */
+#define DIFF_FAT_WINDOW             (16384U)    /* FAT entries of an image kept in memory         */
+
+typedef struct
+{
+    diff_image_struct_t* image;
+    uint32_t* order;                            /* files to read                            */
+    uint32_t unit;                              /* bytes per digest, 0 = one per file       */
+    uint8_t** buffers;                          /* one read buffer per thread               */
+    uint32_t chunk_clusters;                    /* clusters per read buffer                 */
+} diff_job_struct_t;
+
+/*******************************************************************************
+* Prototypes
+******************************************************************************/
+
+/** @brief This function adds an entry found by fat_walk() to an image.
+ * @param path - full path of the entry.
+ * @param entry - directory entry.
+ * @param arg - pointer to a diff_image_struct_t.
+ */
+static void collect_entry(const uint8_t* path,const fat_entry* entry,void* arg);
+
+
+/** @brief This function appends an entry to an image.
+ * @param image - image.
+ * @param path - full path.
+ * @return - Return the new entry.
+ */
+static diff_file_struct_t* add_file(diff_image_struct_t* image,const uint8_t* path);
+
+
+/** @brief This function mounts an image, keeps its tree and opens a handle to read its FAT.
+ * @param file_path - image.
+ * @param image - structure to fill.
+ * @return - Return 1 if the image was read.
+ */
+static bool load_image(uint8_t* file_path,diff_image_struct_t* image);
+
+
+/** @brief This function mounts an image again and hashes some of its files in parallel.
+ * @param file_path - image.
+ * @param image - image loaded by load_image().
+ * @param order - indices of the files to hash.
+ * @param count - number of files.
+ * @param unit - bytes per digest (0 = one digest per file).
+ * @param threads - number of threads.
+ * @return - Return 1 if every file was hashed.
+ */
+static bool hash_files(uint8_t* file_path,diff_image_struct_t* image,uint32_t* order,uint32_t count,uint32_t unit,uint32_t threads);
+
+
+/** @brief This function hashes one file (pool task).
+ * @param index - position in job->order.
+ * @param worker - thread number, selects the read buffer.
+ * @param arg - pointer to a diff_job_struct_t.
+ */
+static void hash_file(uint32_t index,uint32_t worker,void* arg);
+
+
+/** @brief This function returns a FAT entry of an image, read a window at a time
+ * through the handle of the image (the image doesn't have to be mounted).
+ * @param image - image.
+ * @param cluster - cluster number.
+ * @return - Return the FAT entry or 0 if it could not be read.
+ */
+static uint32_t image_entry(diff_image_struct_t* image,uint32_t cluster);
+
+
+/** @brief This function follows a chain in the FAT of an image.
+ * @param image - image.
+ * @param cluster - current cluster.
+ * @return - Return the next cluster or 0 at the end of the chain.
+ */
+static uint32_t chain_next(diff_image_struct_t* image,uint32_t cluster);
+
+
+/** @brief This function checks if an entry has to be read to know if it changed.
+ * @param diff - diff (both images loaded).
+ * @param old_file - entry in the old image.
+ * @param new_file - entry with the same path in the new image.
+ * @return - Return 1 if metadata or cluster chain are different.
+ */
+static bool need_read(diff_struct_t* diff,const diff_file_struct_t* old_file,const diff_file_struct_t* new_file);
+
+
+/** @brief This function marks the changed clusters of a pair of hashed entries.
+ * @param diff - diff.
+ * @param old_file - entry in the old image.
+ * @param new_file - entry in the new image.
+ * @param changed - one byte per cluster of the new image.
+ * @return - Return the number of clusters of new_file with other content (0 = same content).
+ */
+static uint32_t compare_files(diff_struct_t* diff,const diff_file_struct_t* old_file,const diff_file_struct_t* new_file,uint8_t* changed);
+
+
+/** @brief This function marks every cluster of a chain of the new image.
+ * @param diff - diff.
+ * @param file - entry in the new image.
+ * @param changed - one byte per cluster of the new image.
+ */
+static void mark_chain(diff_struct_t* diff,const diff_file_struct_t* file,uint8_t* changed);
+
+
+/** @brief This function adds a change to the diff.
+ * @param diff - diff.
+ * @param status - DIFF_ADDED, DIFF_REMOVED, DIFF_MODIFIED (or DIFF_SAME until compared).
+ * @param file - entry.
+ * @return - Return the index of the change.
+ */
+static uint32_t add_change(diff_struct_t* diff,uint8_t status,const diff_file_struct_t* file);
+
+
+/** @brief This function releases an image.
+ * @param image - image.
+ */
+static void free_image(diff_image_struct_t* image);
+
+
+/** @brief qsort() helper, sorts entries by path. */
+static int compare_path(const void* a,const void* b);
+
+
+/** @brief This function checks the malloc value.
+ * @param ptr - pointer of malloc.
+ */
+static void check_null(void* ptr);
+
+/*******************************************************************************
+* Code
+******************************************************************************/
+static diff_file_struct_t* add_file(diff_image_struct_t* image,const uint8_t* path)
+{
+    diff_file_struct_t* file = NULL;
+    uint32_t length = strlen((const char*)path);
+
+    if(image->count == image->capacity)
+    {
+        image->capacity += DIFF_GROW;
+        image->files = (diff_file_struct_t*)realloc(image->files,image->capacity * sizeof(diff_file_struct_t));
+        check_null(image->files);
+    }
+    file = &image->files[image->count];
+    memset(file,0,sizeof(diff_file_struct_t));
+    file->path = (uint8_t*)malloc(length + 1);
+    check_null(file->path);
+    memcpy(file->path,path,length + 1);
+    image->count += 1;
+    return file;
+}
+
+static void collect_entry(const uint8_t* path,const fat_entry* entry,void* arg)
+{
+    diff_image_struct_t* image = (diff_image_struct_t*)arg;
+    diff_file_struct_t* file = NULL;
+    uint32_t clusters = 0;
+
+    file = add_file(image,path);
+    file->first_cluster = fat_entry_cluster(entry);
+    file->attribute = entry->attribute;
+    file->modified_time = READ_16_BITS((uint16_t)entry->modified_time[0],(uint16_t)entry->modified_time[1]);
+    file->modified_date = READ_16_BITS((uint16_t)entry->modified_date[0],(uint16_t)entry->modified_date[1]);
+    if((entry->attribute & 0x10) != 0)
+    {
+        /* directories have no size, their content is the whole chain */
+        fat_count_fragments(file->first_cluster,&clusters);
+        file->size = clusters * fat_cluster_size();
+    }
+    else
+    {
+        file->size = READ_32_BITS((uint32_t)entry->size[0],(uint32_t)entry->size[1],(uint32_t)entry->size[2],(uint32_t)entry->size[3]);
+    }
+}
+
+static int compare_path(const void* a,const void* b)
+{
+    return strcmp((const char*)((const diff_file_struct_t*)a)->path,(const char*)((const diff_file_struct_t*)b)->path);
+}
+
+static bool load_image(uint8_t* file_path,diff_image_struct_t* image)
+{
+    bool retValue = false;
+    fat_entry* entry_head = NULL;
+    uint8_t boot_info[512];
+    diff_file_struct_t* root = NULL;
+    uint32_t clusters = 0;
+
+    if(fat_init(file_path,&entry_head,&boot_info[0]) == true)
+    {
+        fat_snapshot_attach(file_path,false);
+        image->file = kmc_open_handle(file_path);
+        if(image->file != NULL)
+        {
+            fat_get_geometry(&image->geometry);
+            image->fat_entries = image->geometry.fat_entries;
+            image->window = (uint32_t*)malloc(DIFF_FAT_WINDOW * sizeof(uint32_t));
+            check_null(image->window);
+            image->cluster_size = fat_cluster_size();
+
+            /* a FAT32 root lives in the data region, its clusters change like any directory */
+            if(fat_root_cluster() != 0)
+            {
+                root = add_file(image,(const uint8_t*)"/");
+                root->first_cluster = fat_root_cluster();
+                root->attribute = 0x10;
+                fat_count_fragments(root->first_cluster,&clusters);
+                root->size = clusters * image->cluster_size;
+            }
+            retValue = fat_walk(collect_entry,image);
+            qsort(image->files,image->count,sizeof(diff_file_struct_t),compare_path);
+        }
+        fat_deinit(file_path);
+    }
+    return retValue;
+}
+
+static uint32_t image_entry(diff_image_struct_t* image,uint32_t cluster)
+{
+    uint32_t retValue = 0;
+
+    if((cluster < image->window_first) || (cluster >= (image->window_first + image->window_count)))
+    {
+        image->window_first = cluster - (cluster % DIFF_FAT_WINDOW);
+        image->window_count = fat_read_handle_entries(image->file,&image->geometry,image->window_first,DIFF_FAT_WINDOW,image->window);
+    }
+    if((cluster >= image->window_first) && (cluster < (image->window_first + image->window_count)))
+    {
+        retValue = image->window[cluster - image->window_first];
+    }
+    return retValue;
+}
+
+static uint32_t chain_next(diff_image_struct_t* image,uint32_t cluster)
+{
+    uint32_t next = image_entry(image,cluster);
+
+    /* EOC and bad cluster markers are always past the last entry */
+    if((next < 2) || (next >= image->fat_entries))
+    {
+        next = 0;
+    }
+    return next;
+}
+
+static void hash_file(uint32_t index,uint32_t worker,void* arg)
+{
+    diff_job_struct_t* job = (diff_job_struct_t*)arg;
+    diff_file_struct_t* file = &job->image->files[job->order[index]];
+    uint8_t* buff = job->buffers[worker];
+    uint8_t* p_data = NULL;
+    hash_sha256_struct_t sha;
+    uint32_t cluster = file->first_cluster;
+    uint32_t remaining = file->size;
+    uint32_t cluster_size = job->image->cluster_size;
+    uint32_t max_units = 1;
+    uint32_t max_clusters = 0;
+    uint32_t bytes = 0;
+    uint32_t fill = 0;
+    uint32_t n = 0;
+
+    if(job->unit != 0)
+    {
+        max_units = (file->size + job->unit - 1) / job->unit;
+    }
+    file->digests = (uint8_t*)malloc((max_units + 1) * HASH_SHA256_SIZE);
+    check_null(file->digests);
+    file->units = 0;
+    hash_sha256_init(&sha);
+    while((remaining > 0) && (cluster != 0))
+    {
+        max_clusters = (remaining + cluster_size - 1) / cluster_size;
+        if(max_clusters > job->chunk_clusters)
+        {
+            max_clusters = job->chunk_clusters;
+        }
+        bytes = fat_read_clusters(&cluster,buff,max_clusters);
+        if(bytes == 0)
+        {
+            break;
+        }
+        if(bytes > remaining)
+        {
+            bytes = remaining;
+        }
+        remaining -= bytes;
+        p_data = buff;
+        /* units don't have to line up with the read buffer */
+        while(bytes > 0)
+        {
+            n = bytes;
+            if((job->unit != 0) && (n > (job->unit - fill)))
+            {
+                n = job->unit - fill;
+            }
+            hash_sha256_update(&sha,p_data,n);
+            p_data += n;
+            bytes -= n;
+            fill += n;
+            if((job->unit != 0) && (fill == job->unit))
+            {
+                hash_sha256_final(&sha,&file->digests[file->units * HASH_SHA256_SIZE]);
+                file->units += 1;
+                hash_sha256_init(&sha);
+                fill = 0;
+            }
+        }
+    }
+    if(fill > 0)
+    {
+        hash_sha256_final(&sha,&file->digests[file->units * HASH_SHA256_SIZE]);
+        file->units += 1;
+    }
+}
+
+static bool hash_files(uint8_t* file_path,diff_image_struct_t* image,uint32_t* order,uint32_t count,uint32_t unit,uint32_t threads)
+{
+    bool retValue = false;
+    fat_entry* entry_head = NULL;
+    uint8_t boot_info[512];
+    diff_job_struct_t job;
+    uint32_t i = 0;
+
+    if(count == 0)
+    {
+        retValue = true;
+    }
+    else if(fat_init(file_path,&entry_head,&boot_info[0]) == true)
+    {
+        fat_snapshot_attach(file_path,false);
+        job.image = image;
+        job.order = order;
+        job.unit = unit;
+        job.chunk_clusters = DIFF_CHUNK / image->cluster_size;
+        if(job.chunk_clusters == 0)
+        {
+            job.chunk_clusters = 1;
+        }
+        job.buffers = (uint8_t**)calloc(threads,sizeof(uint8_t*));
+        check_null(job.buffers);
+        for(i = 0;i < threads;i++)
+        {
+            job.buffers[i] = (uint8_t*)malloc(job.chunk_clusters * image->cluster_size);
+            check_null(job.buffers[i]);
+        }
+        retValue = pool_run(count,threads,hash_file,&job);
+        for(i = 0;i < threads;i++)
+        {
+            free(job.buffers[i]);
+        }
+        free(job.buffers);
+        fat_deinit(file_path);
+    }
+    return retValue;
+}
+
+static bool need_read(diff_struct_t* diff,const diff_file_struct_t* old_file,const diff_file_struct_t* new_file)
+{
+    bool retValue = false;
+    uint32_t cluster = new_file->first_cluster;
+    uint32_t count = 0;
+
+    if((diff->same_layout == false) || ((new_file->attribute & 0x10) != 0))
+    {
+        /* directories are rewritten in place without touching the FAT or a time stamp */
+        retValue = true;
+    }
+    else if((old_file->size != new_file->size) || (old_file->first_cluster != new_file->first_cluster) ||
+            (old_file->modified_time != new_file->modified_time) || (old_file->modified_date != new_file->modified_date) ||
+            (old_file->attribute != new_file->attribute))
+    {
+        retValue = true;
+    }
+    else
+    {
+        /* same first cluster: the chain is the same if no FAT entry on it changed */
+        while((cluster >= 2) && (cluster < diff->new_image.fat_entries) && (count < diff->new_image.fat_entries))
+        {
+            if(image_entry(&diff->old_image,cluster) != image_entry(&diff->new_image,cluster))
+            {
+                retValue = true;
+                break;
+            }
+            cluster = chain_next(&diff->new_image,cluster);
+            count += 1;
+        }
+    }
+    return retValue;
+}
+
+static void mark_chain(diff_struct_t* diff,const diff_file_struct_t* file,uint8_t* changed)
+{
+    uint32_t cluster = file->first_cluster;
+    uint32_t count = 0;
+
+    while((cluster >= 2) && (cluster < diff->new_image.fat_entries) && (count < diff->new_image.fat_entries))
+    {
+        changed[cluster] = 1;
+        cluster = chain_next(&diff->new_image,cluster);
+        count += 1;
+    }
+}
+
+static uint32_t compare_files(diff_struct_t* diff,const diff_file_struct_t* old_file,const diff_file_struct_t* new_file,uint8_t* changed)
+{
+    uint32_t retValue = 0;
+    uint32_t old_cluster = old_file->first_cluster;
+    uint32_t new_cluster = new_file->first_cluster;
+    uint32_t i = 0;
+
+    if(diff->same_layout == false)
+    {
+        /* one digest per file, all clusters of a changed file are reported */
+        if((old_file->size != new_file->size) || (old_file->units != new_file->units) ||
+           (memcmp(old_file->digests,new_file->digests,new_file->units * HASH_SHA256_SIZE) != 0))
+        {
+            retValue = (new_file->size + diff->new_image.cluster_size - 1) / diff->new_image.cluster_size;
+            if(retValue == 0)
+            {
+                retValue = 1;
+            }
+            mark_chain(diff,new_file,changed);
+        }
+    }
+    else
+    {
+        /*
+         * digest i belongs to the i-th cluster of the chain: a cluster of the new image is
+         * unchanged only if the same cluster held the same data in the old image.
+         */
+        for(i = 0;(i < new_file->units) && (new_cluster != 0);i++)
+        {
+            if((i >= old_file->units) || (old_cluster != new_cluster) ||
+               (memcmp(&old_file->digests[i * HASH_SHA256_SIZE],&new_file->digests[i * HASH_SHA256_SIZE],HASH_SHA256_SIZE) != 0))
+            {
+                changed[new_cluster] = 1;
+                retValue += 1;
+            }
+            new_cluster = chain_next(&diff->new_image,new_cluster);
+            old_cluster = (old_cluster != 0) ? chain_next(&diff->old_image,old_cluster) : 0;
+        }
+        /* moved but identical data is not a content change of the file */
+        if((old_file->size == new_file->size) && (old_file->units == new_file->units) &&
+           (memcmp(old_file->digests,new_file->digests,new_file->units * HASH_SHA256_SIZE) == 0))
+        {
+            retValue = 0;
+        }
+        else if(retValue == 0)
+        {
+            /* shrunk file: every remaining cluster is the same, the lost ones show in the FAT */
+            retValue = 1;
+        }
+    }
+    return retValue;
+}
+
+static uint32_t add_change(diff_struct_t* diff,uint8_t status,const diff_file_struct_t* file)
+{
+    diff->changes[diff->change_count].status = status;
+    diff->changes[diff->change_count].file = file;
+    diff->changes[diff->change_count].changed_clusters = 0;
+    diff->change_count += 1;
+    return diff->change_count - 1;
+}
+
+bool diff_images(uint8_t* old_path,uint8_t* new_path,uint32_t threads,diff_struct_t* diff)
+{
+    bool retValue = false;
+    diff_image_struct_t* old_image = &diff->old_image;
+    diff_image_struct_t* new_image = &diff->new_image;
+    uint32_t* old_order = NULL;
+    uint32_t* new_order = NULL;
+    uint32_t* pair_change = NULL;
+    uint32_t pair_count = 0;
+    uint8_t* changed = NULL;
+    uint32_t unit = 0;
+    uint32_t kept = 0;
+    uint32_t i = 0;
+    uint32_t j = 0;
+    int order = 0;
+
+    memset(diff,0,sizeof(diff_struct_t));
+    hash_init();
+    if(threads == 0)
+    {
+        threads = pool_default_threads();
+    }
+    if(threads > POOL_MAX_THREADS)
+    {
+        threads = POOL_MAX_THREADS;
+    }
+    if((load_image(old_path,old_image) == true) && (load_image(new_path,new_image) == true))
+    {
+        retValue = true;
+        diff->same_layout = (old_image->cluster_size == new_image->cluster_size) && (old_image->fat_entries == new_image->fat_entries);
+        unit = (diff->same_layout == true) ? new_image->cluster_size : 0;
+
+        diff->changes = (diff_change_struct_t*)malloc((old_image->count + new_image->count + 1) * sizeof(diff_change_struct_t));
+        check_null(diff->changes);
+        old_order = (uint32_t*)malloc((old_image->count + 1) * sizeof(uint32_t));
+        check_null(old_order);
+        new_order = (uint32_t*)malloc((new_image->count + 1) * sizeof(uint32_t));
+        check_null(new_order);
+        pair_change = (uint32_t*)malloc((new_image->count + 1) * sizeof(uint32_t));
+        check_null(pair_change);
+
+        /* both lists are sorted by path, one merge pass matches them */
+        i = 0;
+        j = 0;
+        while((i < old_image->count) || (j < new_image->count))
+        {
+            if(i == old_image->count)
+            {
+                order = 1;
+            }
+            else if(j == new_image->count)
+            {
+                order = -1;
+            }
+            else
+            {
+                order = strcmp((const char*)old_image->files[i].path,(const char*)new_image->files[j].path);
+            }
+
+            if(order < 0)
+            {
+                add_change(diff,DIFF_REMOVED,&old_image->files[i]);
+                i++;
+            }
+            else if(order > 0)
+            {
+                add_change(diff,DIFF_ADDED,&new_image->files[j]);
+                j++;
+            }
+            else
+            {
+                if(((old_image->files[i].attribute ^ new_image->files[j].attribute) & 0x10) != 0)
+                {
+                    /* a file replaced by a directory (or the other way round) */
+                    add_change(diff,DIFF_REMOVED,&old_image->files[i]);
+                    add_change(diff,DIFF_ADDED,&new_image->files[j]);
+                }
+                else if(need_read(diff,&old_image->files[i],&new_image->files[j]) == true)
+                {
+                    old_order[pair_count] = i;
+                    new_order[pair_count] = j;
+                    pair_change[pair_count] = add_change(diff,DIFF_SAME,&new_image->files[j]);
+                    pair_count += 1;
+                }
+                i++;
+                j++;
+            }
+        }
+
+        if((hash_files(new_path,new_image,new_order,pair_count,unit,threads) == false) ||
+           (hash_files(old_path,old_image,old_order,pair_count,unit,threads) == false))
+        {
+            retValue = false;
+        }
+
+        changed = (uint8_t*)calloc(new_image->fat_entries + 1,sizeof(uint8_t));
+        check_null(changed);
+        if(diff->same_layout == true)
+        {
+            /* freed clusters only change in the FAT, their data is not needed */
+            for(i = 2;i < new_image->fat_entries;i++)
+            {
+                j = image_entry(new_image,i);
+                if((j != 0) && (image_entry(old_image,i) != j))
+                {
+                    changed[i] = 1;
+                }
+            }
+        }
+        for(i = 0;i < pair_count;i++)
+        {
+            diff->clusters_read += (old_image->files[old_order[i]].size + old_image->cluster_size - 1) / old_image->cluster_size;
+            diff->clusters_read += (new_image->files[new_order[i]].size + new_image->cluster_size - 1) / new_image->cluster_size;
+            j = compare_files(diff,&old_image->files[old_order[i]],&new_image->files[new_order[i]],changed);
+            /* directories only contribute clusters, their entries are reported one by one */
+            if((j > 0) && ((new_image->files[new_order[i]].attribute & 0x10) == 0))
+            {
+                diff->changes[pair_change[i]].status = DIFF_MODIFIED;
+                diff->changes[pair_change[i]].changed_clusters = j;
+            }
+        }
+
+        kept = 0;
+        for(i = 0;i < diff->change_count;i++)
+        {
+            if(diff->changes[i].status == DIFF_ADDED)
+            {
+                mark_chain(diff,diff->changes[i].file,changed);
+                diff->changes[i].changed_clusters = (diff->changes[i].file->size + new_image->cluster_size - 1) / new_image->cluster_size;
+                diff->added += 1;
+            }
+            else if(diff->changes[i].status == DIFF_REMOVED)
+            {
+                diff->removed += 1;
+            }
+            else if(diff->changes[i].status == DIFF_MODIFIED)
+            {
+                diff->modified += 1;
+            }
+            if(diff->changes[i].status != DIFF_SAME)
+            {
+                diff->changes[kept] = diff->changes[i];
+                kept += 1;
+            }
+        }
+        diff->change_count = kept;
+
+        /* turn the cluster map into ranges */
+        for(i = 2;i < new_image->fat_entries;i++)
+        {
+            if(changed[i] != 0)
+            {
+                if((diff->range_count == 0) || ((diff->ranges[diff->range_count - 1].start + diff->ranges[diff->range_count - 1].count) != i))
+                {
+                    if((diff->range_count % DIFF_GROW) == 0)
+                    {
+                        diff->ranges = (diff_range_struct_t*)realloc(diff->ranges,(diff->range_count + DIFF_GROW) * sizeof(diff_range_struct_t));
+                        check_null(diff->ranges);
+                    }
+                    diff->ranges[diff->range_count].start = i;
+                    diff->ranges[diff->range_count].count = 0;
+                    diff->range_count += 1;
+                }
+                diff->ranges[diff->range_count - 1].count += 1;
+                diff->changed_clusters += 1;
+            }
+        }
+        free(changed);
+        free(old_order);
+        free(new_order);
+        free(pair_change);
+    }
+    return retValue;
+}
+
+static void free_image(diff_image_struct_t* image)
+{
+    uint32_t i = 0;
+
+    for(i = 0;i < image->count;i++)
+    {
+        free(image->files[i].path);
+        free(image->files[i].digests);
+    }
+    free(image->files);
+    free(image->window);
+    if(image->file != NULL)
+    {
+        kmc_close_handle(image->file);
+    }
+    memset(image,0,sizeof(diff_image_struct_t));
+}
+
+void diff_free(diff_struct_t* diff)
+{
+    free_image(&diff->old_image);
+    free_image(&diff->new_image);
+    free(diff->changes);
+    free(diff->ranges);
+    memset(diff,0,sizeof(diff_struct_t));
+}
+
+static void check_null(void* ptr)
+{
+    if(ptr == NULL)
+    {
+        exit(1);
+    }
+}
@@ -0,0 +1,93 @@
+#ifndef _DIFF_H_
+#define _DIFF_H_
+
+/*******************************************************************************
+* Definitions
+******************************************************************************/
+enum Diff_Status
+{
+    DIFF_SAME = 0,
+    DIFF_ADDED = 1,
+    DIFF_REMOVED = 2,
+    DIFF_MODIFIED = 3
+};
+
+typedef struct
+{
+    uint8_t* path;                              /* full path in the volume                  */
+    uint32_t first_cluster;                     /* first cluster of the data                */
+    uint32_t size;                              /* bytes (chain length for directories)     */
+    uint16_t modified_time;                     /* raw FAT time                             */
+    uint16_t modified_date;                     /* raw FAT date                             */
+    uint8_t attribute;                          /* attribute byte                           */
+    uint32_t units;                             /* number of digests (0 = not read)         */
+    uint8_t* digests;                           /* SHA-256 of every cluster (or whole file) */
+} diff_file_struct_t;
+
+typedef struct
+{
+    diff_file_struct_t* files;                  /* entries sorted by path                   */
+    uint32_t count;                             /* number of entries                        */
+    uint32_t capacity;                          /* allocated entries                        */
+    FILE* file;                                 /* read handle, the FAT is read through it  */
+    fat_geometry_struct_t geometry;             /* layout of the volume                     */
+    uint32_t* window;                           /* FAT entries from window_first            */
+    uint32_t window_first;
+    uint32_t window_count;                      /* entries in window, 0 = none read yet     */
+    uint32_t fat_entries;                       /* entries of the FAT                       */
+    uint32_t cluster_size;                      /* bytes per cluster                        */
+} diff_image_struct_t;
+
+typedef struct
+{
+    uint8_t status;                             /* DIFF_ADDED, DIFF_REMOVED, DIFF_MODIFIED  */
+    const diff_file_struct_t* file;             /* entry in the new image (old if removed)  */
+    uint32_t changed_clusters;                  /* modified: clusters with other content    */
+} diff_change_struct_t;
+
+typedef struct
+{
+    uint32_t start;                             /* first cluster                            */
+    uint32_t count;                             /* number of clusters                       */
+} diff_range_struct_t;
+
+typedef struct
+{
+    diff_image_struct_t old_image;
+    diff_image_struct_t new_image;
+    diff_change_struct_t* changes;              /* changes in path order                    */
+    uint32_t change_count;
+    diff_range_struct_t* ranges;                /* changed clusters of the new image        */
+    uint32_t range_count;
+    uint32_t changed_clusters;                  /* clusters in all ranges                   */
+    uint32_t added;
+    uint32_t removed;
+    uint32_t modified;
+    uint64_t clusters_read;                     /* data clusters read from both images      */
+    bool same_layout;                           /* same cluster size and cluster count      */
+} diff_struct_t;
+
+/*******************************************************************************
+* API
+******************************************************************************/
+
+/** @brief This function compares two images. FATs and directory trees are compared
+ * first, only files whose size, time or cluster chain changed are read (both images,
+ * hashed in parallel) to tell if their content changed. Changed cluster ranges are
+ * the clusters of the new image that differ from the old one: FAT entry changed,
+ * owned by an added file or holding other data. Free clusters are not reported.
+ * @param old_path - first (older) image.
+ * @param new_path - second (newer) image.
+ * @param threads - number of threads (0 = one per CPU).
+ * @param diff - structure to store the result (release it with diff_free()).
+ * @return - Return 1 if both images were compared.
+ */
+bool diff_images(uint8_t* old_path,uint8_t* new_path,uint32_t threads,diff_struct_t* diff);
+
+
+/** @brief This function releases a diff.
+ * @param diff - diff built by diff_images().
+ */
+void diff_free(diff_struct_t* diff);
+
+#endif /* _DIFF_H_ */
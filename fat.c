@@ -1,11 +1,20 @@
 /*******************************************************************************
 * Includes
 ******************************************************************************/
+#define _FILE_OFFSET_BITS 64                    /* stat() of images over 2 GiB on 32-bit systems */
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
 #include <stdbool.h>
+#include <ctype.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#if defined(__linux__) || defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#endif
 #include "fat.h"
 #include "HAL.h"
 
@@ -28,6 +37,91 @@ enum Fat_EOF
     FAT_EOF_32 = 0x0FFFFFF8
 };
 
+#define FAT_SCAN_CHUNK      (4096U)     /* FAT entries counted per pass in fat_get_volume_stat() */
+#define FAT_MAX_DEPTH       (64U)       /* deepest directory visited by fat_walk()               */
+#define FAT_CACHE_SLOTS     (64U)       /* cluster sized blocks kept by the write-back cache      */
+#define FAT_DIR_ENTRY_SIZE  (32U)       /* bytes per directory entry                              */
+#define FAT_LFN_CHARS       (13U)       /* characters stored in one long filename entry           */
+#define FAT_SHORT_NAME_TAILS (999999U)  /* largest numeric tail "~N" of a short name              */
+#define FAT_WINDOW_ENTRIES  (16384U)    /* FAT entries decoded per window                         */
+#define FAT_WINDOW_SLOTS    (16U)       /* windows kept in memory (1 MiB of decoded entries)      */
+
+typedef struct
+{
+    uint32_t first;                             /* first cluster of the window              */
+    uint32_t count;                             /* decoded entries, 0 = unused slot         */
+    atomic_uint last_use;                       /* LRU clock, the least recent slot is reused */
+    bool dirty;                                 /* changed by a write, not in the FAT yet   */
+    uint8_t padding[3];                         /* entries stay 4-byte aligned (pack(1))    */
+    uint32_t entries[FAT_WINDOW_ENTRIES];
+} fat_window_t;
+
+typedef struct
+{
+    uint32_t sector;                            /* first sector of the block                */
+    uint32_t sectors;                           /* block size (sectors), 0 = unused slot    */
+    uint32_t last_use;                          /* LRU counter                              */
+    bool dirty;                                 /* modified, not written yet                */
+    bool directory;                             /* directory blocks are written last        */
+    uint8_t* data;
+} fat_cache_block_t;
+
+typedef struct
+{
+    uint32_t cluster;                           /* first cluster, 0 = root directory        */
+    uint32_t block_count;                       /* number of blocks (clusters or sectors)   */
+    uint32_t block_sectors;                     /* sectors per block                        */
+    uint32_t* block_sector;                     /* first sector of every block              */
+} fat_dir_t;
+
+typedef struct
+{
+    uint32_t dir_cluster;                       /* directory holding the entry, 0 = root    */
+    uint32_t index;                             /* slot of the short entry                  */
+    uint32_t lfn_count;                         /* long filename slots before it            */
+    uint32_t first_cluster;
+    uint32_t size;
+    uint8_t attribute;
+} fat_location_t;
+
+typedef struct
+{
+    uint8_t path[FAT_MAX_PATH];                 /* file of the last write, "" = none        */
+    fat_location_t location;                    /* its entry after the last write           */
+    uint32_t first_cluster;                     /* chain described below                    */
+    uint32_t clusters;                          /* length of the chain, 0 = unknown         */
+    uint32_t last_cluster;
+    uint32_t index;                             /* position of cluster in the chain         */
+    uint32_t cluster;
+} fat_write_cursor_t;
+
+#define FAT_SNAPSHOT_MAGIC  "KMCSNAP2"
+#define FAT_HASH_CHUNK      (64U)       /* FAT sectors hashed per read                            */
+
+/* nanoseconds of the times of stat() */
+#if defined(__APPLE__)
+#define FAT_MTIME_NS(info)  ((info).st_mtimespec.tv_nsec)
+#define FAT_CTIME_NS(info)  ((info).st_ctimespec.tv_nsec)
+#elif defined(__linux__) || defined(__unix__)
+#define FAT_MTIME_NS(info)  ((info).st_mtim.tv_nsec)
+#define FAT_CTIME_NS(info)  ((info).st_ctim.tv_nsec)
+#else
+#define FAT_MTIME_NS(info)  (0)
+#define FAT_CTIME_NS(info)  (0)
+#endif
+
+typedef struct
+{
+    uint8_t magic[8];                           /* FAT_SNAPSHOT_MAGIC                       */
+    fat_volume_key_struct_t key;                /* volume the snapshot was made from        */
+    uint32_t fat_entries;                       /* decoded FAT: uint32_t[fat_entries]       */
+    uint32_t node_count;                        /* tree: fat_node_struct_t[node_count]      */
+    uint32_t names_size;                        /* name table (bytes)                       */
+    uint32_t fat_offset;                        /* offsets from the start of the file       */
+    uint32_t node_offset;
+    uint32_t names_offset;
+} fat_snapshot_header_t;
+
 /*******************************************************************************
 * Prototypes
 ******************************************************************************/
@@ -54,6 +148,467 @@ static void read_root();
 static void read_entries(uint8_t* buff,uint32_t bytes_count);
 
 
+/** @brief This function parses directory entries from an array and appends them
+ * to the given linked list.
+ * @param buff - an array to be read from.
+ * @param bytes_count - total number of bytes to be read.
+ * @param head_temp - head of the linked list.
+ * This function does not return a value.
+ */
+static void parse_entries(uint8_t* buff,uint32_t bytes_count,fat_entry** head_temp);
+
+
+/** @brief This function reads FAT table 1 once and decodes every entry
+ * (FAT12/FAT16/FAT32) into g_fat_table. Only used when all of the FAT is needed
+ * (fat_get_table(), building a snapshot), lookups and writes use windows.
+ * @return - Return 1 if the table is loaded.
+ */
+static bool load_fat_table(void);
+
+
+/** @brief This function frees the decoded FAT table.
+ * This function does not return a value.
+ */
+static void free_fat_table(void);
+
+
+/** @brief This function checks that FAT entries can be read: from the decoded table or
+ * from windows of FAT table 1 that are read on demand, so mounting a large volume
+ * doesn't read or decode the whole FAT.
+ * @return - Return 1 if the volume has a FAT.
+ */
+static bool fat_table_ready(void);
+
+
+/** @brief This function returns one FAT entry (decoded table, snapshot or window).
+ * It can be called from several threads at once.
+ * @param cluster - cluster number.
+ * @return - Return the entry, 0 for clusters outside of the table.
+ */
+static uint32_t read_fat_entry(uint32_t cluster);
+
+
+/** @brief This function finds the window that holds a cluster if it is decoded and
+ * marks it used. The caller holds g_window_lock (read or write).
+ * @param cluster - cluster number (< g_fat_entries).
+ * @return - Return the window or NULL if it is not in memory.
+ */
+static fat_window_t* find_window(uint32_t cluster);
+
+
+/** @brief This function finds the window that holds a cluster, reading it if needed.
+ * A clean slot is reused before a dirty one, which is written back first.
+ * The caller holds g_window_lock for writing.
+ * @param cluster - cluster number (< g_fat_entries).
+ * @return - Return the window or NULL if FAT table 1 could not be read.
+ */
+static fat_window_t* load_window(uint32_t cluster);
+
+
+/** @brief This function finds the sectors of a FAT table that hold some entries. Windows
+ * start at a multiple of FAT_WINDOW_ENTRIES, so two windows never share a sector.
+ * @param first - first cluster.
+ * @param count - number of entries.
+ * @param end_of_file - FAT_EOF_12, FAT_EOF_16 or FAT_EOF_32.
+ * @param bytes_per_sector - sector size.
+ * @param sector_first - stores the first sector (from the start of the table).
+ * @return - Return the number of sectors.
+ */
+static uint32_t entry_sectors(uint32_t first,uint32_t count,uint32_t end_of_file,uint32_t bytes_per_sector,uint32_t* sector_first);
+
+
+/** @brief This function writes a dirty window into every FAT copy. The caller
+ * holds g_window_lock for writing and has written the data the window points to.
+ * @param window - window to write.
+ * @return - Return 1 if every copy was written.
+ */
+static bool write_window(fat_window_t* window);
+
+
+/** @brief This function decodes FAT12/FAT16/FAT32 entries.
+ * @param buff - raw FAT bytes.
+ * @param buff_offset - offset of buff[0] in FAT table 1 (bytes).
+ * @param first - first cluster to decode.
+ * @param count - number of entries.
+ * @param table - stores the entries.
+ * @param end_of_file - FAT_EOF_12, FAT_EOF_16 or FAT_EOF_32.
+ * This function does not return a value.
+ */
+static void decode_fat(const uint8_t* buff,uint32_t buff_offset,uint32_t first,uint32_t count,uint32_t* table,uint32_t end_of_file);
+
+
+/** @brief This function encodes FAT12/FAT16/FAT32 entries, the reserved upper 4 bits
+ * of FAT32 entries and the bytes around the entries are kept.
+ * @param buff - raw FAT bytes.
+ * @param buff_offset - offset of buff[0] in FAT table 1 (bytes).
+ * @param first - first cluster to encode.
+ * @param count - number of entries.
+ * @param table - entries to store.
+ * This function does not return a value.
+ */
+static void encode_fat(uint8_t* buff,uint32_t buff_offset,uint32_t first,uint32_t count,const uint32_t* table);
+
+
+/** @brief This function drops every window (new volume or volume closed).
+ * This function does not return a value.
+ */
+static void free_windows(void);
+
+
+/** @brief This function converts a cluster number into its first sector.
+ * @param cluster - cluster number (>= 2).
+ * @return - Return the first sector of the cluster.
+ */
+static uint32_t cluster_to_sector(uint32_t cluster);
+
+
+/** @brief This function reads a whole cluster chain into a new array,
+ * merging contiguous clusters into one read.
+ * @param first_cluster - first cluster of the chain.
+ * @param buff - pointer to store the allocated array (NULL for an empty chain).
+ * @return - Return a number of total bytes read.
+ */
+static uint32_t read_chain(uint32_t first_cluster,uint8_t** buff);
+
+
+/** @brief This function reads a directory (root if cluster is 0) into a new array.
+ * @param cluster - first cluster of the directory.
+ * @param buff - pointer to store the allocated array.
+ * @return - Return a number of total bytes read.
+ */
+static uint32_t read_dir_buffer(uint32_t cluster,uint8_t** buff);
+
+
+/** @brief This function visits a directory and its sub directories for fat_walk().
+ * @param cluster - first cluster of the directory (0 for root).
+ * @param path - path of the directory, entry names are appended to it.
+ * @param depth - current depth.
+ * @param callback - function called for each entry.
+ * @param arg - user pointer passed to the callback.
+ * @return - Return 1 if the whole directory was visited.
+ */
+static bool walk_dir(uint32_t cluster,uint8_t* path,uint8_t depth,fat_walk_callback_t callback,void* arg);
+
+
+/** @brief This function reports the deleted entries of a directory for fat_walk_deleted().
+ * @param buff - directory data.
+ * @param bytes - size of buff.
+ * @param path - path of the directory, entry names are appended to it.
+ * @param depth - current depth.
+ * @param deleted_dir - the directory itself is deleted, every entry counts as deleted.
+ * @param callback - function called for each deleted entry.
+ * @param arg - user pointer passed to the callback.
+ * @return - Return 1 if every deleted sub directory could be searched.
+ */
+static bool scan_deleted(uint8_t* buff,uint32_t bytes,uint8_t* path,uint8_t depth,bool deleted_dir,fat_deleted_callback_t callback,void* arg);
+
+
+/** @brief This function visits a live directory and its sub directories for fat_walk_deleted().
+ * @param cluster - first cluster of the directory (0 for root).
+ * @param path - path of the directory.
+ * @param depth - current depth.
+ * @param callback - function called for each deleted entry.
+ * @param arg - user pointer passed to the callback.
+ * @return - Return 1 if the whole directory was visited.
+ */
+static bool walk_deleted(uint32_t cluster,uint8_t* path,uint8_t depth,fat_deleted_callback_t callback,void* arg);
+
+
+/** @brief This function rebuilds a deleted entry from its short entry and the deleted
+ * long filename entries in front of it.
+ * @param buff - directory data.
+ * @param index - offset of the short entry.
+ * @param lfn_offsets - offsets of the long filename entries, in disk order.
+ * @param lfn_count - number of long filename entries.
+ * @param entry - structure to store the result.
+ */
+static void recover_entry(const uint8_t* buff,uint32_t index,const uint32_t* lfn_offsets,uint8_t lfn_count,fat_deleted_struct_t* entry);
+
+
+/** @brief This function opens a volume for fat_init() and fat_init_rw().
+ * @param file_path - file path from user.
+ * @param head_temp - a pointer to the linked list in fat.c for first time reading root.
+ * @param boot_info - store boot info data for further uses.
+ * @param writable - open the file for writing.
+ * @return - Return 1 if file was opened successfully or 0 if failed to open file.
+ */
+static bool mount(uint8_t* file_path,fat_entry** head_temp,uint8_t* boot_info,bool writable);
+
+
+/** @brief This function returns a block of the write-back cache, reading it on a miss.
+ * @param sector - first sector of the block.
+ * @param sectors - block size (sectors).
+ * @param directory - block holds directory entries.
+ * @param load - read the block from disk on a miss (zero filled if 0).
+ * @param dirty - the caller is going to modify the block.
+ * @return - Return a pointer to the cached data.
+ */
+static uint8_t* cache_get(uint32_t sector,uint32_t sectors,bool directory,bool load,bool dirty);
+
+
+/** @brief This function drops a block from the cache without writing it (freed cluster).
+ * @param sector - first sector of the block.
+ * This function does not return a value.
+ */
+static void cache_discard(uint32_t sector);
+
+
+/** @brief This function writes dirty cache blocks of one kind, sorted by sector and
+ * merged into multi sector writes when contiguous.
+ * @param directory - write directory blocks (1) or data blocks (0).
+ * @return - Return 1 if every block was written.
+ */
+static bool cache_flush(bool directory);
+
+
+/** @brief This function frees every block of the cache.
+ * This function does not return a value.
+ */
+static void cache_free(void);
+
+
+/** @brief This function changes a FAT entry in its window and marks the window dirty.
+ * @param cluster - cluster number.
+ * @param value - new FAT entry.
+ * This function does not return a value.
+ */
+static void set_fat_entry(uint32_t cluster,uint32_t value);
+
+
+/** @brief This function writes dirty FAT windows into every FAT copy.
+ * @return - Return 1 if every window was written.
+ */
+static bool flush_fat(void);
+
+
+/** @brief This function checks that a writable volume can be changed and counts its
+ * free clusters once (one pass over the FAT windows).
+ * @return - Return 1 if the volume is writable and its FAT can be read.
+ */
+static bool prepare_write(void);
+
+
+/** @brief This function allocates a chain of free clusters, preferring one contiguous
+ * run starting at the hint, then any run large enough, then the largest runs.
+ * @param count - number of clusters.
+ * @param hint - preferred first cluster (0 for none).
+ * @param last_cluster - stores the last cluster of the chain (NULL if not needed).
+ * @return - Return the first cluster of the chain or 0 if the volume is full.
+ */
+static uint32_t alloc_chain(uint32_t count,uint32_t hint,uint32_t* last_cluster);
+
+
+/** @brief This function frees a cluster chain and drops its cached blocks.
+ * @param first_cluster - first cluster of the chain.
+ * This function does not return a value.
+ */
+static void free_chain(uint32_t first_cluster);
+
+
+/** @brief This function returns the n-th cluster of a chain.
+ * @param first_cluster - first cluster of the chain.
+ * @param n - position in the chain.
+ * @return - Return the cluster or 0 if the chain is shorter.
+ */
+static uint32_t chain_cluster(uint32_t first_cluster,uint32_t n);
+
+
+/** @brief This function reads the block list of a directory.
+ * @param cluster - first cluster of the directory (0 for root).
+ * @param dir - structure to store the block list.
+ * This function does not return a value.
+ */
+static void dir_open(uint32_t cluster,fat_dir_t* dir);
+
+
+/** @brief This function frees the block list of a directory.
+ * @param dir - directory.
+ * This function does not return a value.
+ */
+static void dir_close(fat_dir_t* dir);
+
+
+/** @brief This function returns a directory slot from the cache.
+ * @param dir - directory.
+ * @param index - slot number.
+ * @param dirty - the caller is going to modify the slot.
+ * @return - Return a pointer to the 32 bytes of the slot or NULL after the last slot.
+ */
+static uint8_t* dir_slot(fat_dir_t* dir,uint32_t index,bool dirty);
+
+
+/** @brief This function adds a zero filled cluster to a sub directory or FAT32 root.
+ * @param dir - directory.
+ * @return - Return 1 if the directory was extended.
+ */
+static bool dir_extend(fat_dir_t* dir);
+
+
+/** @brief This function looks for an entry by long or short name (case insensitive).
+ * @param dir_cluster - directory to search (0 for root).
+ * @param name - name of the entry.
+ * @param location - structure to store the position of the entry.
+ * @return - Return 1 if the entry was found.
+ */
+static bool dir_find(uint32_t dir_cluster,const uint8_t* name,fat_location_t* location);
+
+
+/** @brief This function resolves a full path ("/DIR/FILE.TXT").
+ * @param path - path of the entry.
+ * @param location - structure to store the position of the entry.
+ * @return - Return 1 if the entry was found.
+ */
+static bool path_lookup(const uint8_t* path,fat_location_t* location);
+
+
+/** @brief This function splits a path into its parent directory and last name.
+ * @param path - path of the entry.
+ * @param dir_cluster - first cluster of the parent directory (0 for root).
+ * @param name - an array (at least 256 bytes) to store the last name.
+ * @return - Return 1 if the parent directory exists.
+ */
+static bool path_parent(const uint8_t* path,uint32_t* dir_cluster,uint8_t* name);
+
+
+/** @brief This function builds a unique 8.3 name for a new entry.
+ * @param dir_cluster - directory of the new entry.
+ * @param name - long name of the new entry.
+ * @param short_name - an array of 11 bytes to store the short name.
+ * @param lossy - stores 1 if long filename entries are needed.
+ * @return - Return 1 if the short name is unique, 0 if every numeric tail is taken.
+ */
+static bool make_short_name(uint32_t dir_cluster,const uint8_t* name,uint8_t* short_name,bool* lossy);
+
+
+/** @brief This function marks the numeric tails "~N" taken by the short names of a directory
+ * that only differ from a new short name by their tail (one pass over the directory).
+ * @param dir_cluster - directory.
+ * @param short_name - 11 bytes, the new short name without its tail.
+ * @param base_length - characters of the name before the tail.
+ * @param used - bitmap of FAT_SHORT_NAME_TAILS + 1 bits, cleared by the caller.
+ */
+static void mark_used_tails(uint32_t dir_cluster,const uint8_t* short_name,uint8_t base_length,uint8_t* used);
+
+
+/** @brief This function adds a new entry (and its long filename entries) to a directory.
+ * @param dir_cluster - directory of the new entry (0 for root).
+ * @param name - name of the new entry.
+ * @param attribute - attribute of the new entry.
+ * @param first_cluster - first cluster of the new entry.
+ * @param location - structure to store the position of the entry.
+ * @return - Return 1 if the entry was added.
+ */
+static bool dir_add(uint32_t dir_cluster,const uint8_t* name,uint8_t attribute,uint32_t first_cluster,fat_location_t* location);
+
+
+/** @brief This function updates first cluster, size and modified time of an entry.
+ * @param location - position of the entry.
+ * This function does not return a value.
+ */
+static void dir_update(const fat_location_t* location);
+
+
+/** @brief This function writes data (or zeros) into the clusters of a file,
+ * allocating clusters when the file grows. The chain position of the last write is
+ * kept in g_cursor, so sequential writes don't walk the chain again.
+ * @param location - position of the entry, first cluster is updated.
+ * @param offset - first byte to write.
+ * @param buff - data to write, NULL to write zeros.
+ * @param size - number of bytes.
+ * @return - Return 1 if the data was written into the cache.
+ */
+static bool write_range(fat_location_t* location,uint32_t offset,const uint8_t* buff,uint32_t size);
+
+
+/** @brief This function stores the current date and time in FAT format.
+ * @param entry - 32 bytes of a short entry.
+ * @param created - also set creation date and time.
+ * This function does not return a value.
+ */
+static void set_entry_time(uint8_t* entry,bool created);
+
+
+/** @brief This function computes the snapshot key of the mounted image.
+ * @param file_path - file path from user.
+ * @param key - header to store image size, modified time and hash.
+ * @return - Return 1 if the key was computed.
+ */
+static bool snapshot_key(uint8_t* file_path,fat_snapshot_header_t* key);
+
+
+/** @brief This function maps a snapshot file if its key matches.
+ * @param snapshot_path - path of the snapshot file.
+ * @param key - expected key.
+ * @return - Return 1 if the snapshot was mapped.
+ */
+static bool snapshot_load(const uint8_t* snapshot_path,const fat_snapshot_header_t* key);
+
+
+/** @brief This function reads the whole directory tree (breadth first, so that the
+ * children of a directory are contiguous) and builds a snapshot in memory.
+ * @param key - key of the image.
+ * This function does not return a value.
+ */
+static void snapshot_build(const fat_snapshot_header_t* key);
+
+
+/** @brief This function releases the attached snapshot.
+ * This function does not return a value.
+ */
+static void free_snapshot(void);
+
+
+/** @brief This function converts a snapshot node into a directory entry.
+ * @param node - snapshot node.
+ * @param names - name table of the node.
+ * @param entry - entry to fill.
+ * This function does not return a value.
+ */
+static void node_to_entry(const fat_node_struct_t* node,const uint8_t* names,fat_entry* entry);
+
+
+/** @brief This function visits the children of a snapshot node for fat_walk().
+ * @param node - node of the directory.
+ * @param path - path of the directory, entry names are appended to it.
+ * @param depth - current depth.
+ * @param callback - function called for each entry.
+ * @param arg - user pointer passed to the callback.
+ * @return - Return 1 if the whole directory was visited.
+ */
+static bool walk_nodes(uint32_t node,uint8_t* path,uint8_t depth,fat_walk_callback_t callback,void* arg);
+
+
+/** @brief This function counts free clusters in a row.
+ * @param cluster - first cluster to check.
+ * @param max - stop counting at this length.
+ * @return - Return the number of free clusters in a row.
+ */
+static uint32_t free_run_length(uint32_t cluster,uint32_t max);
+
+
+/** @brief This function converts an 11 byte short name into "NAME.EXT".
+ * @param short_name - 11 bytes of a short entry.
+ * @param name - an array (at least 13 bytes) to store the name.
+ * This function does not return a value.
+ */
+static void short_to_name(const uint8_t* short_name,uint8_t* name);
+
+
+/** @brief This function compares two names without case.
+ * @param a - first name.
+ * @param b - second name.
+ * @return - Return 1 if the names are equal.
+ */
+static bool name_equal(const uint8_t* a,const uint8_t* b);
+
+
+/** @brief This function computes the short name checksum stored in long filename entries.
+ * @param short_name - 11 bytes of a short entry.
+ * @return - Return the checksum.
+ */
+static uint8_t lfn_checksum(const uint8_t* short_name);
+
+
 /** @brief This function will delete a linked list.
  * @param head_temp - head of the linked list.
  * This function does not return a value.
@@ -78,7 +633,34 @@ static uint32_t g_root_first_cluster = 0;         /* 0 for FAT12/FAT16 - 2 for F
 static uint32_t g_data_first_index = 0;
 static uint32_t g_root_size = 0;                  /* number of sectors in root (FAT12/FAT16 only)    */
 static uint32_t g_end_of_file = 0;
+static uint32_t g_total_clusters = 0;             /* number of data clusters                         */
+static uint32_t* g_fat_table = NULL;              /* decoded FAT table 1, only when all of it is used */
+static uint32_t g_fat_entries = 0;                /* number of FAT entries (total clusters + 2)       */
+static fat_window_t* g_windows = NULL;            /* parts of FAT table 1, read on demand             */
+static uint8_t* g_window_raw = NULL;              /* raw sectors of the window being decoded          */
+static uint32_t g_window_clock = 0;
+static pthread_rwlock_t g_window_lock = PTHREAD_RWLOCK_INITIALIZER; /* readers: lookups, writer: loads */
 static fat_boot_info_struct_t fat;
+static bool g_writable = false;                   /* volume opened with fat_init_rw()                 */
+static uint8_t g_image_path[FAT_MAX_PATH];        /* file path of the mounted image                   */
+static bool g_sidecars_removed = false;           /* snapshot and index dropped before the first write */
+static uint64_t g_volume_offset = 0;              /* byte offset of the volume in the image           */
+static uint32_t g_next_free = 2;                  /* where the allocator starts looking               */
+static uint32_t g_free_clusters = 0;              /* free clusters, kept up to date by set_fat_entry() */
+static bool g_free_counted = false;               /* g_free_clusters is valid                         */
+static bool g_fat_lost = false;                   /* a FAT change could not be written                */
+static fat_write_cursor_t g_cursor;               /* where the last fat_write_file() stopped          */
+static fat_cache_block_t g_cache[FAT_CACHE_SLOTS];
+static uint32_t g_cache_clock = 0;
+static bool g_fat_changed = false;                /* FAT modified since the last sync                 */
+static const uint8_t g_lfn_offsets[FAT_LFN_CHARS] = {0x01,0x03,0x05,0x07,0x09,0x0E,0x10,0x12,0x14,0x16,0x18,0x1C,0x1E};
+static uint8_t* g_snapshot = NULL;                /* attached snapshot (header, FAT, nodes, names)    */
+static uint64_t g_snapshot_size = 0;
+static bool g_snapshot_mapped = false;            /* mmap()ed (1) or malloc()ed (0)                   */
+static const fat_node_struct_t* g_nodes = NULL;
+static uint32_t g_node_count = 0;
+static const uint8_t* g_names = NULL;
+static uint32_t g_names_size = 0;
 fat_entry* entry_head = NULL;
 
 /*******************************************************************************
@@ -86,13 +668,67 @@ fat_entry* entry_head = NULL;
 ******************************************************************************/
 
 bool fat_init(uint8_t* file_path,fat_entry** head_temp,uint8_t* boot_info)
+{
+    return mount(file_path,head_temp,boot_info,false);
+}
+
+bool fat_init_rw(uint8_t* file_path,fat_entry** head_temp,uint8_t* boot_info)
+{
+    return mount(file_path,head_temp,boot_info,true);
+}
+
+void fat_set_direct_io(bool enable)
+{
+    kmc_use_direct_io(enable);
+}
+
+void fat_set_volume_offset(uint64_t offset)
+{
+    g_volume_offset = offset;
+    kmc_set_volume_offset(offset);
+}
+
+static bool mount(uint8_t* file_path,fat_entry** head_temp,uint8_t* boot_info,bool writable)
 {
     bool retValue = true;
+    bool opened = false;
     uint16_t i = 0;
 
-    if(kmc_open_file(file_path) == true)
+    if(writable == true)
+    {
+        opened = kmc_open_file_rw(file_path);
+    }
+    else
+    {
+        opened = kmc_open_file(file_path);
+    }
+
+    if(opened == true)
     {
+        free_fat_table();
+        free_snapshot();
+        free_windows();
+        cache_free();
+        g_writable = writable;
+        g_sidecars_removed = false;
+        strncpy(g_image_path,file_path,FAT_MAX_PATH - 1);
+        g_image_path[FAT_MAX_PATH - 1] = '\0';
+        g_fat_changed = false;
+        g_next_free = 2;
+        g_free_counted = false;
+        g_fat_lost = false;
+        memset(&g_cursor,0,sizeof(g_cursor));
         read_boot_info();
+    }
+    if((opened == true) && ((fat.bytes_per_sector == 0) || (fat.sectors_per_cluster == 0)))
+    {
+        /* no FAT boot sector there (e.g. the partition table of a whole disk image) */
+        kmc_close_file(file_path);
+        opened = false;
+    }
+
+    if(opened == true)
+    {
         read_root();
         *head_temp = entry_head;
         for(i = 0;i < 512;i++)
@@ -109,6 +745,9 @@ bool fat_init(uint8_t* file_path,fat_entry** head_temp,uint8_t* boot_info)
 
 static void read_boot_info(void)
 {
+    uint64_t fat_bytes = 0;
+    uint64_t max_entries = 0;
+
     kmc_read_sector(0,&g_boot_info[0]);
     /* jump to bootstrap */
     strncpy(fat.jump,g_boot_info,3);
@@ -137,15 +776,27 @@ static void read_boot_info(void)
         fat.fat_size = READ_16_BITS(g_boot_info[0x16],g_boot_info[0x17]);
         /* total number of sectors in floppy disk */
         fat.total_sectors = READ_16_BITS(g_boot_info[0x13],g_boot_info[0x14]);
+        if(fat.total_sectors == 0)
+        {
+            /* more than 65535 sectors (FAT16 volumes over 32 MiB) */
+            fat.total_sectors = READ_32_BITS((uint32_t)g_boot_info[0x20],(uint32_t)g_boot_info[0x21],\
+                                             (uint32_t)g_boot_info[0x22],(uint32_t)g_boot_info[0x23]);
+        }
     }
     else if(fat.max_root_entries == 0) /* FAT32 */
     {
         /* size of FAT tables (sectors) */
-        fat.fat_size = READ_32_BITS(g_boot_info[0x24],g_boot_info[0x25],g_boot_info[0x26],g_boot_info[0x27]);
+        fat.fat_size = READ_32_BITS((uint32_t)g_boot_info[0x24],(uint32_t)g_boot_info[0x25],\
+                                    (uint32_t)g_boot_info[0x26],(uint32_t)g_boot_info[0x27]);
         /* total number of sectors in floppy disk */
-        fat.total_sectors = READ_32_BITS(g_boot_info[0x20],g_boot_info[0x21],g_boot_info[0x22],g_boot_info[0x23]);
+        fat.total_sectors = READ_32_BITS((uint32_t)g_boot_info[0x20],(uint32_t)g_boot_info[0x21],\
+                                         (uint32_t)g_boot_info[0x22],(uint32_t)g_boot_info[0x23]);
     }
 
+    /* sectors in front of the volume (partitions) */
+    fat.number_of_hidden_sectors = READ_32_BITS((uint32_t)g_boot_info[0x1C],(uint32_t)g_boot_info[0x1D],\
+                                                (uint32_t)g_boot_info[0x1E],(uint32_t)g_boot_info[0x1F]);
+
     /* update sector size in HAL.c */
     kmc_update_sector_size(fat.bytes_per_sector);
 
@@ -166,10 +817,22 @@ static void read_boot_info(void)
     else if(fat.max_root_entries == 0) /* FAT32 */
     {
         g_data_first_index = g_fat2_first_index + fat.fat_size;
-        g_root_first_cluster = READ_32_BITS(g_boot_info[0x2C],g_boot_info[0x2D],g_boot_info[0x2E],g_boot_info[0x2F]); /* important */
+        g_root_first_cluster = READ_32_BITS((uint32_t)g_boot_info[0x2C],(uint32_t)g_boot_info[0x2D],\
+                                            (uint32_t)g_boot_info[0x2E],(uint32_t)g_boot_info[0x2F]); /* important */
+    }
+
+    /* number of data clusters, numbered from 2 */
+    g_total_clusters = 0;
+    if((fat.sectors_per_cluster != 0) && (fat.total_sectors > g_data_first_index))
+    {
+        g_total_clusters = (fat.total_sectors - g_data_first_index)/fat.sectors_per_cluster;
     }
 
-    if((fat.total_sectors/fat.sectors_per_cluster) < 4085) /* find total clusters,FAT12 */
+    if(fat.sectors_per_cluster == 0) /* not a FAT volume, mount() gives up */
+    {
+        g_end_of_file = FAT_EOF_12;
+    }
+    else if((fat.total_sectors/fat.sectors_per_cluster) < 4085) /* find total clusters,FAT12 */
     {
         g_end_of_file = FAT_EOF_12;
     }
@@ -181,103 +844,93 @@ static void read_boot_info(void)
     {
         g_end_of_file = FAT_EOF_32;
     }
+
+    /* one entry per data cluster plus the 2 reserved ones, as far as FAT table 1 can hold */
+    fat_bytes = (uint64_t)fat.fat_size * fat.bytes_per_sector;
+    if(g_end_of_file == FAT_EOF_12)
+    {
+        max_entries = (fat_bytes * 2) / 3;
+    }
+    else if(g_end_of_file == FAT_EOF_16)
+    {
+        max_entries = fat_bytes / 2;
+    }
+    else
+    {
+        max_entries = fat_bytes / 4;
+    }
+    g_fat_entries = g_total_clusters + 2;
+    if(g_fat_entries > max_entries)
+    {
+        g_fat_entries = max_entries;
+    }
 }
 
 static void read_root(void)
 {
     uint8_t* p_buff_root = NULL;
-    uint8_t* p_buff_FAT = NULL;
-    uint16_t i = 0;
-    uint32_t current_cluster = 0;
-    uint32_t fat_index = 0;
-    uint32_t next_cluster = 0;
-    uint32_t first_sector = 0;
-    uint32_t count = 1;
     uint32_t total_bytes_read = 0;
 
-    if(g_end_of_file == FAT_EOF_12 || g_end_of_file == FAT_EOF_16)
-    {
-        p_buff_root = (uint8_t*)malloc((sizeof(uint8_t)*g_root_size*fat.bytes_per_sector));
-        check_null(p_buff_root);
-        total_bytes_read = kmc_read_multi_sector(g_root_first_index,g_root_size,p_buff_root);
-    }
-    else if (g_end_of_file == FAT_EOF_32)
-    {
-        p_buff_FAT = (uint8_t*)malloc(sizeof(uint8_t)*fat.bytes_per_sector*fat.sectors_per_cluster*fat.fat_size);
-        check_null(p_buff_FAT);
-        p_buff_root = (uint8_t*)malloc(sizeof(uint8_t)*fat.bytes_per_sector*fat.sectors_per_cluster*count);
-        check_null(p_buff_root);
-
-        /* read data from FAT table1 into p_buff_FAT */
-        kmc_read_multi_sector(g_fat1_first_index,fat.fat_size,p_buff_FAT);
+    /* FAT12/FAT16: fixed root area, FAT32: cluster chain followed through the FAT windows */
+    total_bytes_read = read_dir_buffer(0,&p_buff_root);
+    read_entries(p_buff_root,total_bytes_read);
+    free(p_buff_root);
+    p_buff_root = NULL;
+}
 
-        current_cluster = g_root_first_cluster;
-        fat_index = current_cluster * 4;
-        first_sector = fat.size_of_reserved_area + fat.fat_size * 2 + (current_cluster-2) * fat.sectors_per_cluster;
-        total_bytes_read = kmc_read_multi_sector(first_sector,fat.sectors_per_cluster,p_buff_root);
-        next_cluster = READ_32_BITS(p_buff_FAT[fat_index],p_buff_FAT[fat_index+1],p_buff_FAT[fat_index+2],p_buff_FAT[fat_index+3]);
+static void read_entries(uint8_t* buff,uint32_t bytes_count)
+{
+    /* free linked list before reading new data */
+    free_entries(&entry_head);
+    parse_entries(buff,bytes_count,&entry_head);
+}
 
-        /*
-         * WARNING
-         * EOC of FAT32 can be anywhere between 0x0FFFFFF8-0x0FFFFFFF.
-         * and EOC of a floppy disk can have different EOC values so in order for next cluster
-         * to be valid, it needs to be outside of the given range.
-         */ 
-        while(next_cluster < g_end_of_file)
-        {
-            count += 1;
-            current_cluster = next_cluster;
-            fat_index = current_cluster * 4;
-            first_sector = fat.size_of_reserved_area + fat.fat_size * 2 + (current_cluster-2) * fat.sectors_per_cluster;
-            p_buff_root = realloc(p_buff_root,sizeof(uint8_t)*fat.bytes_per_sector*fat.sectors_per_cluster*count);
-            check_null(p_buff_root);
-            total_bytes_read += kmc_read_multi_sector(first_sector,fat.sectors_per_cluster,p_buff_root + fat.bytes_per_sector*fat.sectors_per_cluster);
-            next_cluster = READ_32_BITS(p_buff_FAT[fat_index],p_buff_FAT[fat_index+1],p_buff_FAT[fat_index+2],p_buff_FAT[fat_index+3]);
-        }
-    }
-    read_entries(p_buff_root,total_bytes_read);
-    free(p_buff_root);
-    p_buff_root = NULL;
-}
-
-void read_entries(uint8_t* buff,uint32_t bytes_count)
+static void parse_entries(uint8_t* buff,uint32_t bytes_count,fat_entry** head_temp)
 {
     uint32_t i = 0;
     uint32_t j = 0;
     uint8_t k = 0;
     uint8_t LFN_entries = 0;
+    uint8_t LFN_length = 0;
     fat_entry* temp = NULL;
     fat_entry* new_entry = NULL;
 
-    /* free linked list before reading new data */
-    free_entries(&entry_head);
+    /* find the tail so that entries are appended in disk order */
+    temp = *head_temp;
+    while((temp != NULL) && (temp->next != NULL))
+    {
+        temp = temp->next;
+    }
+
     while(i < bytes_count)
     {
         if(buff[i] == 0x00 || buff[i] == 0xE5) /* empty entry or deleted entry */
         {
             /* just check, don't do anything */
         }
+        else if((buff[i + 0x0B] == 0x0F) && ((i + ((buff[i] & 0x1F) * 32)) >= bytes_count))
+        {
+            /* long filename without its short entry (end of buffer), ignore it */
+            i = bytes_count;
+        }
         else
         {
             new_entry = (fat_entry*)malloc(sizeof(fat_entry));
             check_null(new_entry);
-            temp = entry_head;
             new_entry->next = NULL;
 
-            if(entry_head == NULL)
+            if(temp == NULL)
             {
-                entry_head = new_entry;
+                *head_temp = new_entry;
             }
             else
             {
-                while(temp->next != NULL)
-                {
-                    temp = temp->next;
-                }
                 temp->next = new_entry;
             }
+            temp = new_entry;
 
             strcpy(new_entry->LFN,"");
+            LFN_length = 0;
             if(buff[i + 0x0B] == 0x0F) /* long filename */
             {
                 j = i;
@@ -291,9 +944,11 @@ void read_entries(uint8_t* buff,uint32_t bytes_count)
                         {
                             /* just check, don't do anything */
                         }
-                        else
+                        else if(LFN_length < 255)
                         {
-                            strncat(new_entry->LFN,&buff[j + (LFN_entries - 1)*32 + k],1);
+                            new_entry->LFN[LFN_length] = buff[j + (LFN_entries - 1)*32 + k];
+                            LFN_length += 1;
+                            new_entry->LFN[LFN_length] = '\0';
                         }
                     }
 
@@ -303,9 +958,11 @@ void read_entries(uint8_t* buff,uint32_t bytes_count)
                         {
                             /* just check, don't do anything */
                         }
-                        else
+                        else if(LFN_length < 255)
                         {
-                            strncat(new_entry->LFN,&buff[j + (LFN_entries - 1)*32 + k],1);
+                            new_entry->LFN[LFN_length] = buff[j + (LFN_entries - 1)*32 + k];
+                            LFN_length += 1;
+                            new_entry->LFN[LFN_length] = '\0';
                         }
                     }
 
@@ -315,9 +972,11 @@ void read_entries(uint8_t* buff,uint32_t bytes_count)
                         {
                             /* just check, don't do anything */
                         }
-                        else
+                        else if(LFN_length < 255)
                         {
-                            strncat(new_entry->LFN,&buff[j + (LFN_entries - 1)*32 + k],1);
+                            new_entry->LFN[LFN_length] = buff[j + (LFN_entries - 1)*32 + k];
+                            LFN_length += 1;
+                            new_entry->LFN[LFN_length] = '\0';
                         }
                     }
                     LFN_entries = LFN_entries - 1;
@@ -334,11 +993,11 @@ void read_entries(uint8_t* buff,uint32_t bytes_count)
                 new_entry->LFN[8] = '\0';
             }
             new_entry->attribute = buff[i + 0x0b];
-            strncpy(new_entry->high_first_cluster,&buff[i + 0x14],2);
-            strncpy(new_entry->modified_time,&buff[i + 0x16],2);
-            strncpy(new_entry->modified_date,&buff[i + 0x18],2);
-            strncpy(new_entry->low_first_cluster,&buff[i + 0x1A],2);
-            /* don't use "strncpy(new_entry->size,&buff[i+0x1C],4);" here, it will cause undefined behavior */
+            /* don't use strncpy() for binary fields, a 0x00 byte would stop the copy */
+            memcpy(new_entry->high_first_cluster,&buff[i + 0x14],2);
+            memcpy(new_entry->modified_time,&buff[i + 0x16],2);
+            memcpy(new_entry->modified_date,&buff[i + 0x18],2);
+            memcpy(new_entry->low_first_cluster,&buff[i + 0x1A],2);
             new_entry->size[0] = buff[i + 0x1C];
             new_entry->size[1] = buff[i + 0x1D];
             new_entry->size[2] = buff[i + 0x1E];
@@ -352,13 +1011,8 @@ uint8_t fat_read(uint32_t option,fat_entry** head_temp,uint8_t** buff_file)
 {
     uint8_t retValue = 0;
     uint8_t* p_buff = NULL;
-    uint8_t* p_buff_FAT = NULL;
     uint16_t i = 0;
     uint32_t current_cluster = 0;
-    uint32_t fat_index = 0;
-    uint32_t next_cluster = 0;
-    uint32_t first_sector = 0;
-    uint32_t count = 1;
     uint32_t total_bytes_read = 0;
     fat_entry* temp = entry_head;
 
@@ -368,7 +1022,8 @@ uint8_t fat_read(uint32_t option,fat_entry** head_temp,uint8_t** buff_file)
     }
     current_cluster = READ_32_BITS(temp->low_first_cluster[0],temp->low_first_cluster[1],temp->high_first_cluster[0],temp->high_first_cluster[1]);
 
-    if(current_cluster == g_root_first_cluster)
+    /* ".." of a first level directory points to cluster 0 on FAT32 too */
+    if((current_cluster == g_root_first_cluster) || (((temp->attribute & 0x10) != 0) && (current_cluster == 0)))
     {
         read_root();
         *head_temp = entry_head;
@@ -376,131 +1031,2953 @@ uint8_t fat_read(uint32_t option,fat_entry** head_temp,uint8_t** buff_file)
     }
     else
     {
-        p_buff_FAT = (uint8_t*)malloc(sizeof(uint8_t)*fat.bytes_per_sector*fat.sectors_per_cluster*fat.fat_size);
+        /*
+         * WARNING
+         * EOC of FAT12 can be anywhere between 0xFF8-0xFFF.
+         * EOC of FAT16 can be anywhere between 0xFFF8-0xFFFF.
+         * EOC of FAT32 can be anywhere between 0x0FFFFFF8-0x0FFFFFFF.
+         * read_chain() stops on all of them (fat_is_eoc()).
+         */
+        total_bytes_read = read_chain(current_cluster,&p_buff);
+        if((temp->attribute & 0x10)  != 0)
+        {
+            read_entries(p_buff,total_bytes_read);
+            retValue = FAT_SUB_DIR;
+        }
+        else if ((temp->attribute & 0x10)  == 0)
+        {
+            retValue = FAT_FILE;
+        }
+
+        *head_temp = entry_head;
+        *buff_file = p_buff;
+        p_buff = NULL;
+    }
+    return retValue;
+}
+
+static bool load_fat_table(void)
+{
+    bool retValue = true;
+    uint8_t* p_buff_FAT = NULL;
+    uint32_t fat_bytes = 0;
+    uint32_t i = 0;
+
+    if(g_fat_table == NULL)
+    {
+        fat_bytes = fat.fat_size * fat.bytes_per_sector;
+        p_buff_FAT = (uint8_t*)malloc(sizeof(uint8_t)*fat_bytes);
         check_null(p_buff_FAT);
-        p_buff = (uint8_t*)malloc(sizeof(uint8_t)*fat.bytes_per_sector*fat.sectors_per_cluster*count);
-        check_null(p_buff);
-        kmc_read_multi_sector(g_fat1_first_index,fat.fat_size,p_buff_FAT); /* stores data read from FAT table 1 in p_buff_FAT */
+        if((fat_bytes == 0) || (g_fat_entries == 0) || (kmc_read_multi_sector(g_fat1_first_index,fat.fat_size,p_buff_FAT) != fat_bytes))
+        {
+            retValue = false;
+        }
+        else
+        {
+            g_fat_table = (uint32_t*)malloc(sizeof(uint32_t)*g_fat_entries);
+            check_null(g_fat_table);
+            decode_fat(p_buff_FAT,0,0,g_fat_entries,g_fat_table,g_end_of_file);
 
-        /* read next cluster according to FAT12 or FAT 16 or FAT 32 */
-        if(g_end_of_file == FAT_EOF_12)
+            /* entries changed by writes are only in their windows until the next sync */
+            pthread_rwlock_rdlock(&g_window_lock);
+            for(i = 0;(g_windows != NULL) && (i < FAT_WINDOW_SLOTS);i++)
+            {
+                if((g_windows[i].count != 0) && (g_windows[i].dirty == true))
+                {
+                    memcpy(&g_fat_table[g_windows[i].first],g_windows[i].entries,g_windows[i].count * sizeof(uint32_t));
+                }
+            }
+            pthread_rwlock_unlock(&g_window_lock);
+        }
+        free(p_buff_FAT);
+        p_buff_FAT = NULL;
+    }
+    return retValue;
+}
+
+static void decode_fat(const uint8_t* buff,uint32_t buff_offset,uint32_t first,uint32_t count,uint32_t* table,uint32_t end_of_file)
+{
+    uint32_t fat_index = 0;
+    uint32_t cluster = 0;
+    uint32_t i = 0;
+
+    for(i = 0;i < count;i++)
+    {
+        cluster = first + i;
+        if(end_of_file == FAT_EOF_12)
         {
-            fat_index = current_cluster * 1.5;
-            first_sector = fat.size_of_reserved_area + fat.fat_size * 2 + g_root_size + (current_cluster-2) * fat.sectors_per_cluster;
-            if((current_cluster % 2) == 0)
+            fat_index = cluster + (cluster >> 1) - buff_offset; /* cluster * 1.5 */
+            if((cluster % 2) == 0)
             {
-                next_cluster = READ_12_BITS_EVEN(p_buff_FAT[fat_index],p_buff_FAT[fat_index+1]);
+                table[i] = READ_12_BITS_EVEN(buff[fat_index],buff[fat_index+1]);
             }
-            else if ((current_cluster % 2) != 0)
+            else
             {
-                next_cluster = READ_12_BITS_ODD(p_buff_FAT[fat_index],p_buff_FAT[fat_index+1]);
+                table[i] = READ_12_BITS_ODD(buff[fat_index],buff[fat_index+1]);
             }
         }
-
-        else if (g_end_of_file == FAT_EOF_16)
+        else if(end_of_file == FAT_EOF_16)
         {
-            fat_index = current_cluster * 2;
-            first_sector = fat.size_of_reserved_area + fat.fat_size * 2 + g_root_size + (current_cluster-2) * fat.sectors_per_cluster;
-            next_cluster = READ_16_BITS(p_buff_FAT[fat_index],p_buff_FAT[fat_index+1]);
+            fat_index = cluster * 2 - buff_offset;
+            table[i] = READ_16_BITS(buff[fat_index],buff[fat_index+1]);
         }
-
-        else if (g_end_of_file == FAT_EOF_32)
+        else
         {
-            fat_index = current_cluster * 4;
-            first_sector = fat.size_of_reserved_area + fat.fat_size * 2 + (current_cluster-2) * fat.sectors_per_cluster;
-            next_cluster = READ_32_BITS(p_buff_FAT[fat_index],p_buff_FAT[fat_index+1],p_buff_FAT[fat_index+2],p_buff_FAT[fat_index+3]);
+            /* the upper 4 bits of a FAT32 entry are reserved */
+            fat_index = cluster * 4 - buff_offset;
+            table[i] = READ_32_BITS((uint32_t)buff[fat_index],(uint32_t)buff[fat_index+1],\
+                                    (uint32_t)buff[fat_index+2],(uint32_t)buff[fat_index+3]) & 0x0FFFFFFF;
         }
-        total_bytes_read = kmc_read_multi_sector(first_sector,fat.sectors_per_cluster,p_buff);
+    }
+}
 
-        /*
-         * WARNING
-         * EOC of FAT12 can be anywhere between 0xFF8-0xFFF.
-         * EOC of FAT16 can be anywhere between 0xFFF8-0xFFFF.
-         * EOC of FAT32 can be anywhere between 0x0FFFFFF8-0x0FFFFFFF.
-         * and EOC of a floppy disk can have different EOC values so in order for next cluster
-         * to be valid, it needs to be outside of the given range.
-         */ 
-        while(next_cluster < g_end_of_file)
-        {
-            count += 1;
-            current_cluster = next_cluster;
+static void encode_fat(uint8_t* buff,uint32_t buff_offset,uint32_t first,uint32_t count,const uint32_t* table)
+{
+    uint32_t fat_index = 0;
+    uint32_t cluster = 0;
+    uint32_t value = 0;
+    uint32_t i = 0;
 
-            if(g_end_of_file == FAT_EOF_12)
-            {
-                fat_index = current_cluster * 1.5;
-                first_sector = fat.size_of_reserved_area + fat.fat_size * 2 + g_root_size + (current_cluster-2) * fat.sectors_per_cluster;
-                if((current_cluster % 2) == 0)
-                {
-                    next_cluster = READ_12_BITS_EVEN(p_buff_FAT[fat_index],p_buff_FAT[fat_index+1]);
-                }
-                else if ((current_cluster % 2) != 0)
-                {
-                    next_cluster = READ_12_BITS_ODD(p_buff_FAT[fat_index],p_buff_FAT[fat_index+1]);
-                }
-            }
-            else if (g_end_of_file == FAT_EOF_16)
+    for(i = 0;i < count;i++)
+    {
+        cluster = first + i;
+        value = table[i];
+        if(g_end_of_file == FAT_EOF_12)
+        {
+            fat_index = cluster + (cluster >> 1) - buff_offset; /* cluster * 1.5 */
+            if((cluster % 2) == 0)
             {
-                fat_index = current_cluster * 2;
-                first_sector = fat.size_of_reserved_area + fat.fat_size * 2 + g_root_size + (current_cluster-2) * fat.sectors_per_cluster;
-                next_cluster = READ_16_BITS(p_buff_FAT[fat_index],p_buff_FAT[fat_index+1]);
+                buff[fat_index] = value & 0xFF;
+                buff[fat_index + 1] = (buff[fat_index + 1] & 0xF0) | ((value >> 8) & 0x0F);
             }
-            else if (g_end_of_file == FAT_EOF_32)
+            else
             {
-                fat_index = current_cluster * 4;
-                first_sector = fat.size_of_reserved_area + fat.fat_size * 2 + (current_cluster-2) * fat.sectors_per_cluster;
-                next_cluster = READ_32_BITS(p_buff_FAT[fat_index],p_buff_FAT[fat_index+1],p_buff_FAT[fat_index+2],p_buff_FAT[fat_index+3]);
+                buff[fat_index] = (buff[fat_index] & 0x0F) | ((value << 4) & 0xF0);
+                buff[fat_index + 1] = (value >> 4) & 0xFF;
             }
+        }
+        else if(g_end_of_file == FAT_EOF_16)
+        {
+            fat_index = cluster * 2 - buff_offset;
+            buff[fat_index] = value & 0xFF;
+            buff[fat_index + 1] = (value >> 8) & 0xFF;
+        }
+        else
+        {
+            /* keep the reserved upper 4 bits of a FAT32 entry */
+            fat_index = cluster * 4 - buff_offset;
+            buff[fat_index] = value & 0xFF;
+            buff[fat_index + 1] = (value >> 8) & 0xFF;
+            buff[fat_index + 2] = (value >> 16) & 0xFF;
+            buff[fat_index + 3] = (buff[fat_index + 3] & 0xF0) | ((value >> 24) & 0x0F);
+        }
+    }
+}
 
-            p_buff = realloc(p_buff,sizeof(uint8_t)*fat.bytes_per_sector*fat.sectors_per_cluster*count);
-            check_null(p_buff);
-            total_bytes_read += kmc_read_multi_sector(first_sector,fat.sectors_per_cluster,p_buff + fat.bytes_per_sector*fat.sectors_per_cluster);
+static void free_fat_table(void)
+{
+    if((g_snapshot == NULL) || (g_fat_table != (uint32_t*)(g_snapshot + ((fat_snapshot_header_t*)g_snapshot)->fat_offset)))
+    {
+        free(g_fat_table);
+    }
+    g_fat_table = NULL;
+}
+
+static bool fat_table_ready(void)
+{
+    return (g_fat_table != NULL) || ((g_fat_entries != 0) && (fat.bytes_per_sector != 0));
+}
+
+static fat_window_t* find_window(uint32_t cluster)
+{
+    fat_window_t* retValue = NULL;
+    uint32_t first = cluster - (cluster % FAT_WINDOW_ENTRIES);
+    uint32_t i = 0;
+
+    for(i = 0;(g_windows != NULL) && (i < FAT_WINDOW_SLOTS) && (retValue == NULL);i++)
+    {
+        if((g_windows[i].count != 0) && (g_windows[i].first == first))
+        {
+            retValue = &g_windows[i];
         }
-        if((temp->attribute & 0x10)  != 0)
+    }
+    /* readers share the lock, the clock only moves under the write lock */
+    if((retValue != NULL) && (atomic_load_explicit(&retValue->last_use,memory_order_relaxed) != g_window_clock))
+    {
+        atomic_store_explicit(&retValue->last_use,g_window_clock,memory_order_relaxed);
+    }
+    return retValue;
+}
+
+static fat_window_t* load_window(uint32_t cluster)
+{
+    fat_window_t* window = NULL;
+    fat_window_t* found = NULL;
+    uint32_t first = cluster - (cluster % FAT_WINDOW_ENTRIES);
+    uint32_t count = g_fat_entries - first;
+    uint32_t sector_first = 0;
+    uint32_t sectors = 0;
+    uint32_t i = 0;
+
+    /* another thread may have read it while this one waited for the lock */
+    found = find_window(cluster);
+    if(found != NULL)
+    {
+        return found;
+    }
+    if(g_windows == NULL)
+    {
+        g_windows = (fat_window_t*)calloc(FAT_WINDOW_SLOTS,sizeof(fat_window_t));
+        check_null(g_windows);
+        /* a window of FAT32 entries plus the sectors cut at both ends */
+        g_window_raw = (uint8_t*)malloc(FAT_WINDOW_ENTRIES * 4 + 2 * fat.bytes_per_sector);
+        check_null(g_window_raw);
+    }
+    /* an unused slot, else the least recently used one, clean before dirty */
+    for(i = 0;i < FAT_WINDOW_SLOTS;i++)
+    {
+        if((window == NULL) || (g_windows[i].count == 0))
         {
-            read_entries(p_buff,total_bytes_read);
-            retValue = FAT_SUB_DIR;
+            window = &g_windows[i];
         }
-        else if ((temp->attribute & 0x10)  == 0)
+        else if((window->count != 0) && (((g_windows[i].dirty == false) && (window->dirty == true)) ||
+                ((g_windows[i].dirty == window->dirty) && (atomic_load_explicit(&g_windows[i].last_use,memory_order_relaxed) <
+                                                          atomic_load_explicit(&window->last_use,memory_order_relaxed)))))
         {
-            retValue = FAT_FILE;
+            window = &g_windows[i];
+        }
+    }
+    if((window->count != 0) && (window->dirty == true))
+    {
+        /* the FAT may only point to data that is on the disk */
+        if((cache_flush(false) == false) || (kmc_sync() == false) || (write_window(window) == false))
+        {
+            g_fat_lost = true;
         }
+    }
+    g_window_clock += 1;
+    if(count > FAT_WINDOW_ENTRIES)
+    {
+        count = FAT_WINDOW_ENTRIES;
+    }
+    sectors = entry_sectors(first,count,g_end_of_file,fat.bytes_per_sector,&sector_first);
+    if((sector_first + sectors) > fat.fat_size)
+    {
+        sectors = fat.fat_size - sector_first;
+    }
+    window->count = 0;
+    window->dirty = false;
+    if(kmc_read_multi_sector(g_fat1_first_index + sector_first,sectors,g_window_raw) == (sectors * fat.bytes_per_sector))
+    {
+        decode_fat(g_window_raw,sector_first * fat.bytes_per_sector,first,count,window->entries,g_end_of_file);
+        window->first = first;
+        window->count = count;
+        atomic_store_explicit(&window->last_use,g_window_clock,memory_order_relaxed);
+    }
+    else
+    {
+        window = NULL;
+    }
+    return window;
+}
 
-        *head_temp = entry_head;
-        *buff_file = p_buff;
-        free(p_buff_FAT);
-        p_buff = NULL;
-        p_buff_FAT = NULL;
+static uint32_t entry_sectors(uint32_t first,uint32_t count,uint32_t end_of_file,uint32_t bytes_per_sector,uint32_t* sector_first)
+{
+    uint32_t byte_first = 0;
+    uint32_t byte_end = 0;
+
+    if(end_of_file == FAT_EOF_12)
+    {
+        byte_first = first + (first >> 1);
+        byte_end = (first + count - 1) + ((first + count - 1) >> 1) + 2;
+    }
+    else
+    {
+        byte_first = first * ((end_of_file == FAT_EOF_16) ? 2 : 4);
+        byte_end = (first + count) * ((end_of_file == FAT_EOF_16) ? 2 : 4);
+    }
+    *sector_first = byte_first / bytes_per_sector;
+    return (byte_end + bytes_per_sector - 1) / bytes_per_sector - *sector_first;
+}
+
+static bool write_window(fat_window_t* window)
+{
+    bool retValue = true;
+    uint32_t sector_first = 0;
+    uint32_t sectors = 0;
+    uint32_t copy = 0;
+
+    /* read back FAT table 1 so the bytes around the entries are kept */
+    sectors = entry_sectors(window->first,window->count,g_end_of_file,fat.bytes_per_sector,&sector_first);
+    if((sector_first + sectors) > fat.fat_size)
+    {
+        sectors = fat.fat_size - sector_first;
     }
+    if(kmc_read_multi_sector(g_fat1_first_index + sector_first,sectors,g_window_raw) != (sectors * fat.bytes_per_sector))
+    {
+        retValue = false;
+    }
+    else
+    {
+        encode_fat(g_window_raw,sector_first * fat.bytes_per_sector,window->first,window->count,window->entries);
+        for(copy = 0;copy < fat.numbers_of_fats;copy++)
+        {
+            if(kmc_write_multi_sector(g_fat1_first_index + copy * fat.fat_size + sector_first,sectors,g_window_raw) != (sectors * fat.bytes_per_sector))
+            {
+                retValue = false;
+            }
+        }
+    }
+    window->dirty = false;
     return retValue;
 }
 
-static void free_entries(fat_entry** head_temp)
+static uint32_t read_fat_entry(uint32_t cluster)
 {
-    fat_entry* current = *head_temp;
-    fat_entry* next = NULL;
+    uint32_t retValue = 0;
+    const fat_window_t* window = NULL;
 
-    while(current != NULL)
+    if(cluster >= g_fat_entries)
     {
-        next = current->next;
-        free(current);
-        current = next;
+        retValue = 0;
+    }
+    else if(g_fat_table != NULL)
+    {
+        retValue = g_fat_table[cluster];
+    }
+    else
+    {
+        pthread_rwlock_rdlock(&g_window_lock);
+        window = find_window(cluster);
+        if(window != NULL)
+        {
+            retValue = window->entries[cluster - window->first];
+        }
+        pthread_rwlock_unlock(&g_window_lock);
+        if(window == NULL)
+        {
+            /* not decoded yet: lookups wait while one thread reads the window */
+            pthread_rwlock_wrlock(&g_window_lock);
+            window = load_window(cluster);
+            if(window != NULL)
+            {
+                retValue = window->entries[cluster - window->first];
+            }
+            pthread_rwlock_unlock(&g_window_lock);
+        }
     }
+    return retValue;
+}
 
-    *head_temp = NULL;
+uint32_t fat_entry_count(void)
+{
+    return g_fat_entries;
 }
 
-static void check_null(void* ptr)
+uint32_t fat_compare_copies(void)
 {
-    if(ptr == NULL)
+    uint32_t retValue = 0;
+    uint8_t* p_first = NULL;
+    uint8_t* p_other = NULL;
+    uint32_t copy = 0;
+    uint32_t sector = 0;
+    uint32_t n = 0;
+    uint32_t i = 0;
+    uint32_t bytes = 0;
+    uint32_t other_bytes = 0;
+    uint32_t run = 0;
+    bool first_hole = false;
+
+    if(fat.numbers_of_fats > 1)
     {
-        exit(1);
+        p_first = (uint8_t*)malloc(sizeof(uint8_t)*FAT_HASH_CHUNK*fat.bytes_per_sector);
+        check_null(p_first);
+        p_other = (uint8_t*)malloc(sizeof(uint8_t)*FAT_HASH_CHUNK*fat.bytes_per_sector);
+        check_null(p_other);
+        for(sector = 0;sector < fat.fat_size;sector += n)
+        {
+            n = fat.fat_size - sector;
+            if(n > FAT_HASH_CHUNK)
+            {
+                n = FAT_HASH_CHUNK;
+            }
+            /* copies that both lie in a hole of a sparse image are zeros, nothing to compare */
+            first_hole = (kmc_is_hole(g_fat1_first_index + sector,n,&run) == true) && (run == n);
+            bytes = kmc_read_multi_sector(g_fat1_first_index + sector,n,p_first);
+            for(copy = 1;copy < fat.numbers_of_fats;copy++)
+            {
+                if((first_hole == true) && (kmc_is_hole(g_fat1_first_index + copy * fat.fat_size + sector,n,&run) == true) && (run == n))
+                {
+                    continue;
+                }
+                other_bytes = kmc_read_multi_sector(g_fat1_first_index + copy * fat.fat_size + sector,n,p_other);
+                for(i = 0;i < n;i++)
+                {
+                    /* sectors missing from either copy count as different */
+                    if((((i + 1) * fat.bytes_per_sector) > bytes) || (((i + 1) * fat.bytes_per_sector) > other_bytes) ||
+                       (memcmp(p_first + i * fat.bytes_per_sector,p_other + i * fat.bytes_per_sector,fat.bytes_per_sector) != 0))
+                    {
+                        retValue += 1;
+                    }
+                }
+            }
+        }
+        free(p_first);
+        free(p_other);
     }
+    return retValue;
 }
 
-bool fat_deinit(uint8_t* file_path)
+uint32_t fat_get_entries(uint32_t first,uint32_t count,uint32_t* table)
 {
-    bool retValue = true;
+    uint32_t done = 0;
+    uint32_t n = 0;
+    const fat_window_t* window = NULL;
+
+    if(first >= g_fat_entries)
+    {
+        count = 0;
+    }
+    else if(count > (g_fat_entries - first))
+    {
+        count = g_fat_entries - first;
+    }
+    if(g_fat_table != NULL)
+    {
+        memcpy(table,&g_fat_table[first],count * sizeof(uint32_t));
+        done = count;
+    }
+    else if(fat_table_ready() == true)
+    {
+        pthread_rwlock_wrlock(&g_window_lock);
+        while(done < count)
+        {
+            window = load_window(first + done);
+            if(window == NULL)
+            {
+                break;
+            }
+            n = window->first + window->count - (first + done);
+            if(n > (count - done))
+            {
+                n = count - done;
+            }
+            memcpy(&table[done],&window->entries[first + done - window->first],n * sizeof(uint32_t));
+            done += n;
+        }
+        pthread_rwlock_unlock(&g_window_lock);
+    }
+    return done;
+}
 
+uint32_t fat_read_handle_entries(FILE* handle,const fat_geometry_struct_t* geometry,uint32_t first,uint32_t count,uint32_t* table)
+{
+    uint32_t done = 0;
+    uint32_t end_of_file = (geometry->fat_bits == 12) ? FAT_EOF_12 : ((geometry->fat_bits == 16) ? FAT_EOF_16 : FAT_EOF_32);
+    uint32_t sector_first = 0;
+    uint32_t sectors = 0;
+    uint8_t* p_buff = NULL;
+
+    if(first >= geometry->fat_entries)
+    {
+        count = 0;
+    }
+    else if(count > (geometry->fat_entries - first))
+    {
+        count = geometry->fat_entries - first;
+    }
+    if(count != 0)
+    {
+        sectors = entry_sectors(first,count,end_of_file,geometry->bytes_per_sector,&sector_first);
+        if((sector_first + sectors) > geometry->fat_sectors)
+        {
+            sectors = geometry->fat_sectors - sector_first;
+        }
+        p_buff = (uint8_t*)malloc(sizeof(uint8_t)*sectors*geometry->bytes_per_sector);
+        check_null(p_buff);
+        if(kmc_read_handle(handle,geometry->volume_offset + (uint64_t)(geometry->fat_first_sector + sector_first) * geometry->bytes_per_sector,
+                           sectors * geometry->bytes_per_sector,p_buff) == (int32_t)(sectors * geometry->bytes_per_sector))
+        {
+            decode_fat(p_buff,sector_first * geometry->bytes_per_sector,first,count,table,end_of_file);
+            done = count;
+        }
+        free(p_buff);
+        p_buff = NULL;
+    }
+    return done;
+}
+
+static void free_windows(void)
+{
+    pthread_rwlock_wrlock(&g_window_lock);
+    free(g_windows);
+    free(g_window_raw);
+    g_windows = NULL;
+    g_window_raw = NULL;
+    g_window_clock = 0;
+    pthread_rwlock_unlock(&g_window_lock);
+}
+
+uint32_t fat_next_cluster(uint32_t cluster)
+{
+    uint32_t retValue = 0;
+
+    if((fat_table_ready() == true) && (cluster < g_fat_entries))
+    {
+        retValue = read_fat_entry(cluster);
+    }
+    return retValue;
+}
+
+const uint32_t* fat_get_table(uint32_t* entries)
+{
+    const uint32_t* retValue = NULL;
+
+    *entries = 0;
+    if(load_fat_table() == true)
+    {
+        retValue = g_fat_table;
+        *entries = g_fat_entries;
+    }
+    return retValue;
+}
+
+bool fat_is_eoc(uint32_t value)
+{
+    /*
+     * anything that can't be followed ends the chain: EOC, bad cluster (EOC - 1),
+     * free/reserved entries and clusters outside of the data region.
+     */
+    return (value < 2) || (value >= (g_end_of_file - 1)) || (value >= g_fat_entries);
+}
+
+static uint32_t cluster_to_sector(uint32_t cluster)
+{
+    return g_data_first_index + (cluster - 2) * fat.sectors_per_cluster;
+}
+
+uint32_t fat_count_fragments(uint32_t first_cluster,uint32_t* clusters)
+{
+    uint32_t fragments = 0;
+    uint32_t count = 0;
+    uint32_t current_cluster = first_cluster;
+    uint32_t next_cluster = 0;
+
+    if((fat_table_ready() == true) && (fat_is_eoc(first_cluster) == false))
+    {
+        fragments = 1;
+        count = 1;
+        next_cluster = read_fat_entry(current_cluster);
+        /* count is bounded by the number of clusters to stop on looped chains */
+        while((fat_is_eoc(next_cluster) == false) && (count < g_total_clusters))
+        {
+            if(next_cluster != (current_cluster + 1))
+            {
+                fragments += 1;
+            }
+            count += 1;
+            current_cluster = next_cluster;
+            next_cluster = read_fat_entry(current_cluster);
+        }
+    }
+    if(clusters != NULL)
+    {
+        *clusters = count;
+    }
+    return fragments;
+}
+
+uint32_t fat_cluster_size(void)
+{
+    return fat.bytes_per_sector * fat.sectors_per_cluster;
+}
+
+uint32_t fat_root_cluster(void)
+{
+    return g_root_first_cluster;
+}
+
+void fat_get_geometry(fat_geometry_struct_t* geometry)
+{
+    geometry->bytes_per_sector = fat.bytes_per_sector;
+    geometry->sectors_per_cluster = fat.sectors_per_cluster;
+    geometry->data_first_sector = g_data_first_index;
+    geometry->total_clusters = g_total_clusters;
+    geometry->fat_bits = (g_end_of_file == FAT_EOF_12) ? 12 : ((g_end_of_file == FAT_EOF_16) ? 16 : 32);
+    geometry->fat_count = fat.numbers_of_fats;
+    geometry->volume_offset = g_volume_offset;
+    geometry->fat_first_sector = g_fat1_first_index;
+    geometry->fat_sectors = fat.fat_size;
+    geometry->fat_entries = g_fat_entries;
+}
+
+uint32_t fat_read_clusters(uint32_t* cluster,uint8_t* buff,uint32_t max_clusters)
+{
+    uint32_t bytes = 0;
+    uint32_t count = 0;
+    uint32_t run = 0;
+    uint32_t current_cluster = *cluster;
+    uint32_t cluster_size = fat_cluster_size();
+
+    if(fat_table_ready() == true)
+    {
+        while((count < max_clusters) && (fat_is_eoc(current_cluster) == false))
+        {
+            run = 1;
+            while(((count + run) < max_clusters) && (read_fat_entry(current_cluster + run - 1) == (current_cluster + run)))
+            {
+                run += 1;
+            }
+            bytes += kmc_read_multi_sector(cluster_to_sector(current_cluster),run * fat.sectors_per_cluster,buff + count * cluster_size);
+            count += run;
+            current_cluster = read_fat_entry(current_cluster + run - 1);
+        }
+    }
+    if(fat_is_eoc(current_cluster) == true)
+    {
+        current_cluster = 0;
+    }
+    *cluster = current_cluster;
+    return bytes;
+}
+
+bool fat_get_volume_stat(fat_volume_stat_struct_t* stat)
+{
+    bool retValue = false;
+    uint32_t bad_marker = g_end_of_file - 1;
+    uint32_t start = 0;
+    uint32_t n = 0;
+    uint32_t i = 0;
+    uint32_t free_count = 0;
+    uint32_t bad_count = 0;
+    uint32_t eoc_count = 0;
+    uint32_t run = 0;
+    uint32_t run_start = 0;
+    const uint32_t* p_table = NULL;
+    uint32_t chunk[FAT_SCAN_CHUNK];
+
+    memset(stat,0,sizeof(fat_volume_stat_struct_t));
+    if(fat_table_ready() == true)
+    {
+        retValue = true;
+        stat->bytes_per_cluster = fat.bytes_per_sector * fat.sectors_per_cluster;
+        stat->total_clusters = (g_fat_entries > 2) ? (g_fat_entries - 2) : 0;
+
+        for(start = 2;start < g_fat_entries;start += n)
+        {
+            n = g_fat_entries - start;
+            if(n > FAT_SCAN_CHUNK)
+            {
+                n = FAT_SCAN_CHUNK;
+            }
+            /* without a decoded table the FAT is streamed through the windows */
+            if(g_fat_table != NULL)
+            {
+                p_table = &g_fat_table[start];
+            }
+            else if(fat_get_entries(start,n,chunk) == n)
+            {
+                p_table = chunk;
+            }
+            else
+            {
+                retValue = false;
+                break;
+            }
+
+            /* branchless counting, the compiler turns this loop into SIMD code */
+            free_count = 0;
+            bad_count = 0;
+            eoc_count = 0;
+            for(i = 0;i < n;i++)
+            {
+                free_count += (p_table[i] == 0);
+                bad_count += (p_table[i] == bad_marker);
+                eoc_count += (p_table[i] >= g_end_of_file);
+            }
+            stat->free_clusters += free_count;
+            stat->bad_clusters += bad_count;
+            stat->eoc_clusters += eoc_count;
+
+            /* free runs: only chunks that mix free and used entries need a second look */
+            if(free_count == 0)
+            {
+                run = 0;
+            }
+            else if(free_count == n)
+            {
+                if(run == 0)
+                {
+                    run_start = start;
+                    stat->free_runs += 1;
+                }
+                run += n;
+            }
+            else
+            {
+                for(i = 0;i < n;i++)
+                {
+                    if(p_table[i] != 0)
+                    {
+                        run = 0;
+                    }
+                    else
+                    {
+                        if(run == 0)
+                        {
+                            run_start = start + i;
+                            stat->free_runs += 1;
+                        }
+                        run += 1;
+                        if(run > stat->largest_free_run)
+                        {
+                            stat->largest_free_run = run;
+                            stat->largest_free_run_start = run_start;
+                        }
+                    }
+                }
+            }
+            if(run > stat->largest_free_run)
+            {
+                stat->largest_free_run = run;
+                stat->largest_free_run_start = run_start;
+            }
+        }
+        stat->used_clusters = stat->total_clusters - stat->free_clusters - stat->bad_clusters;
+    }
+    return retValue;
+}
+
+static uint32_t read_chain(uint32_t first_cluster,uint8_t** buff)
+{
+    uint32_t cluster_bytes = fat.bytes_per_sector * fat.sectors_per_cluster;
+    uint32_t chain_length = 0;
+    uint32_t count = 0;
+    uint32_t run = 0;
+    uint32_t current_cluster = first_cluster;
+    uint32_t total_bytes_read = 0;
+
+    *buff = NULL;
+    fat_count_fragments(first_cluster,&chain_length);
+    if(chain_length > 0)
+    {
+        *buff = (uint8_t*)malloc(sizeof(uint8_t)*cluster_bytes*chain_length);
+        check_null(*buff);
+
+        while(count < chain_length)
+        {
+            /* merge contiguous clusters into one read */
+            run = 1;
+            while(((count + run) < chain_length) && (read_fat_entry(current_cluster + run - 1) == (current_cluster + run)))
+            {
+                run += 1;
+            }
+            total_bytes_read += kmc_read_multi_sector(cluster_to_sector(current_cluster),run * fat.sectors_per_cluster,\
+                                                      *buff + cluster_bytes * count);
+            count += run;
+            current_cluster = read_fat_entry(current_cluster + run - 1);
+        }
+    }
+    return total_bytes_read;
+}
+
+static uint32_t read_dir_buffer(uint32_t cluster,uint8_t** buff)
+{
+    uint32_t total_bytes_read = 0;
+
+    if((cluster == 0) && (g_end_of_file != FAT_EOF_32))
+    {
+        *buff = (uint8_t*)malloc(sizeof(uint8_t)*g_root_size*fat.bytes_per_sector);
+        check_null(*buff);
+        total_bytes_read = kmc_read_multi_sector(g_root_first_index,g_root_size,*buff);
+    }
+    else if(cluster == 0)
+    {
+        total_bytes_read = read_chain(g_root_first_cluster,buff);
+    }
+    else
+    {
+        total_bytes_read = read_chain(cluster,buff);
+    }
+    return total_bytes_read;
+}
+
+uint32_t fat_entry_cluster(const fat_entry* entry)
+{
+    return READ_32_BITS((uint32_t)entry->low_first_cluster[0],(uint32_t)entry->low_first_cluster[1],\
+                        (uint32_t)entry->high_first_cluster[0],(uint32_t)entry->high_first_cluster[1]);
+}
+
+void fat_entry_name(const fat_entry* entry,uint8_t* name)
+{
+    int16_t i = 0;
+
+    if((strlen(entry->LFN) == 8) && (strncmp(entry->LFN,entry->SFN,8) == 0)) /* no long filename */
+    {
+        strcpy(name,entry->SFN);
+        for(i = strlen(name) - 1;(i >= 0) && (name[i] == ' ');i--)
+        {
+            name[i] = '\0';
+        }
+        if((entry->extension[0] != ' ') && (entry->extension[0] != '\0'))
+        {
+            strcat(name,".");
+            strcat(name,entry->extension);
+            for(i = strlen(name) - 1;(i >= 0) && (name[i] == ' ');i--)
+            {
+                name[i] = '\0';
+            }
+        }
+    }
+    else
+    {
+        strcpy(name,entry->LFN);
+    }
+}
+
+uint32_t fat_list_dir(uint32_t cluster,fat_entry** head_temp)
+{
+    uint8_t* p_buff = NULL;
+    uint32_t total_bytes_read = 0;
+
+    *head_temp = NULL;
+    total_bytes_read = read_dir_buffer(cluster,&p_buff);
+    parse_entries(p_buff,total_bytes_read,head_temp);
+    free(p_buff);
+    return total_bytes_read;
+}
+
+void fat_free_entries(fat_entry** head_temp)
+{
+    free_entries(head_temp);
+}
+
+bool fat_walk(fat_walk_callback_t callback,void* arg)
+{
+    bool retValue = true;
+    uint8_t path[FAT_MAX_PATH];
+
+    /* pending writes must reach the disk, the walk reads directories directly */
+    fat_sync();
+    path[0] = '\0';
+    if(g_nodes != NULL)
+    {
+        retValue = walk_nodes(0,path,0,callback,arg);
+    }
+    else
+    {
+        retValue = walk_dir(0,path,0,callback,arg);
+    }
+    return retValue;
+}
+
+static bool walk_dir(uint32_t cluster,uint8_t* path,uint8_t depth,fat_walk_callback_t callback,void* arg)
+{
+    bool retValue = true;
+    uint8_t* p_buff = NULL;
+    uint8_t name[256];
+    uint32_t path_length = strlen(path);
+    uint32_t total_bytes_read = 0;
+    uint32_t sub_cluster = 0;
+    fat_entry* head = NULL;
+    fat_entry* temp = NULL;
+
+    if(depth >= FAT_MAX_DEPTH) /* looped directories on a damaged volume */
+    {
+        retValue = false;
+    }
+    else
+    {
+        total_bytes_read = read_dir_buffer(cluster,&p_buff);
+        parse_entries(p_buff,total_bytes_read,&head);
+        free(p_buff);
+        p_buff = NULL;
+
+        for(temp = head;temp != NULL;temp = temp->next)
+        {
+            fat_entry_name(temp,name);
+            if(((temp->attribute & 0x08) != 0) || (temp->SFN[0] == '.')) /* volume label, "." and ".." */
+            {
+                /* just check, don't do anything */
+            }
+            else if((path_length + 1 + strlen(name)) >= FAT_MAX_PATH)
+            {
+                retValue = false;
+            }
+            else
+            {
+                path[path_length] = '/';
+                strcpy(&path[path_length + 1],name);
+                callback(path,temp,arg);
+
+                sub_cluster = fat_entry_cluster(temp);
+                if(((temp->attribute & 0x10) != 0) && (sub_cluster >= 2))
+                {
+                    if(walk_dir(sub_cluster,path,depth + 1,callback,arg) == false)
+                    {
+                        retValue = false;
+                    }
+                }
+                path[path_length] = '\0';
+            }
+        }
+        free_entries(&head);
+    }
+    return retValue;
+}
+
+bool fat_walk_deleted(fat_deleted_callback_t callback,void* arg)
+{
+    uint8_t path[FAT_MAX_PATH];
+
+    fat_sync();
+    path[0] = '\0';
+    return (fat_table_ready() == true) && walk_deleted(0,path,0,callback,arg);
+}
+
+static bool walk_deleted(uint32_t cluster,uint8_t* path,uint8_t depth,fat_deleted_callback_t callback,void* arg)
+{
+    bool retValue = true;
+    uint8_t* p_buff = NULL;
+    uint8_t name[256];
+    uint32_t path_length = strlen(path);
+    uint32_t total_bytes_read = 0;
+    uint32_t sub_cluster = 0;
+    fat_entry* head = NULL;
+    fat_entry* temp = NULL;
+
+    if(depth >= FAT_MAX_DEPTH) /* looped directories on a damaged volume */
+    {
+        retValue = false;
+    }
+    else
+    {
+        total_bytes_read = read_dir_buffer(cluster,&p_buff);
+        retValue = scan_deleted(p_buff,total_bytes_read,path,depth,false,callback,arg);
+        parse_entries(p_buff,total_bytes_read,&head);
+        free(p_buff);
+        p_buff = NULL;
+
+        for(temp = head;temp != NULL;temp = temp->next)
+        {
+            fat_entry_name(temp,name);
+            sub_cluster = fat_entry_cluster(temp);
+            if(((temp->attribute & 0x08) != 0) || (temp->SFN[0] == '.') || ((temp->attribute & 0x10) == 0) || (sub_cluster < 2))
+            {
+                /* just check, don't do anything */
+            }
+            else if((path_length + 1 + strlen(name)) >= FAT_MAX_PATH)
+            {
+                retValue = false;
+            }
+            else
+            {
+                path[path_length] = '/';
+                strcpy(&path[path_length + 1],name);
+                if(walk_deleted(sub_cluster,path,depth + 1,callback,arg) == false)
+                {
+                    retValue = false;
+                }
+                path[path_length] = '\0';
+            }
+        }
+        free_entries(&head);
+    }
+    return retValue;
+}
+
+static bool scan_deleted(uint8_t* buff,uint32_t bytes,uint8_t* path,uint8_t depth,bool deleted_dir,fat_deleted_callback_t callback,void* arg)
+{
+    bool retValue = true;
+    fat_deleted_struct_t entry;
+    uint8_t* p_slot = NULL;
+    uint8_t* p_dir = NULL;
+    uint32_t lfn_offsets[20];
+    uint8_t lfn_count = 0;
+    uint32_t path_length = strlen(path);
+    uint32_t cluster_size = fat.bytes_per_sector * fat.sectors_per_cluster;
+    uint32_t i = 0;
+
+    for(i = 0;(i + FAT_DIR_ENTRY_SIZE) <= bytes;i += FAT_DIR_ENTRY_SIZE)
+    {
+        p_slot = &buff[i];
+        if(p_slot[0] == 0x00) /* end of directory, nothing was ever stored after it */
+        {
+            break;
+        }
+        else if(p_slot[0x0B] == 0x0F) /* long filename */
+        {
+            if((p_slot[0] == 0xE5) || (deleted_dir == true))
+            {
+                if(lfn_count == 20)
+                {
+                    memmove(&lfn_offsets[0],&lfn_offsets[1],19 * sizeof(uint32_t));
+                    lfn_count -= 1;
+                }
+                lfn_offsets[lfn_count] = i;
+                lfn_count += 1;
+            }
+            else
+            {
+                lfn_count = 0;
+            }
+        }
+        else if(((p_slot[0] == 0xE5) || (deleted_dir == true)) && (p_slot[0] != '.') && ((p_slot[0x0B] & 0x08) == 0))
+        {
+            recover_entry(buff,i,lfn_offsets,lfn_count,&entry);
+            entry.in_deleted_dir = deleted_dir;
+            callback(path,&entry,arg);
+            lfn_count = 0;
+
+            /* a deleted directory can be searched while its first cluster is free and untouched */
+            if(((entry.attribute & 0x10) != 0) && (entry.first_cluster >= 2) && (entry.first_cluster < g_fat_entries) &&
+               (read_fat_entry(entry.first_cluster) == 0) && (depth + 1 < FAT_MAX_DEPTH) &&
+               ((path_length + 1 + strlen(entry.name)) < FAT_MAX_PATH))
+            {
+                p_dir = (uint8_t*)malloc(sizeof(uint8_t)*cluster_size);
+                check_null(p_dir);
+                if((fat_read_raw_clusters(entry.first_cluster,1,p_dir) == cluster_size) &&
+                   (p_dir[0] == '.') && (p_dir[1] == ' ') && ((p_dir[0x0B] & 0x10) != 0))
+                {
+                    path[path_length] = '/';
+                    strcpy(&path[path_length + 1],entry.name);
+                    if(scan_deleted(p_dir,cluster_size,path,depth + 1,true,callback,arg) == false)
+                    {
+                        retValue = false;
+                    }
+                    path[path_length] = '\0';
+                }
+                free(p_dir);
+                p_dir = NULL;
+            }
+        }
+        else
+        {
+            lfn_count = 0;
+        }
+    }
+    return retValue;
+}
+
+static void recover_entry(const uint8_t* buff,uint32_t index,const uint32_t* lfn_offsets,uint8_t lfn_count,fat_deleted_struct_t* entry)
+{
+    const uint8_t* p_slot = &buff[index];
+    const uint8_t* p_lfn = NULL;
+    uint8_t checksum = 0;
+    uint32_t length = 0;
+    uint32_t c = 0;
+    uint8_t k = 0;
+    bool end = false;
+
+    memset(entry,0,sizeof(fat_deleted_struct_t));
+    memcpy(entry->short_name,p_slot,11);
+    entry->attribute = p_slot[0x0B];
+    entry->first_cluster = READ_32_BITS((uint32_t)p_slot[0x1A],(uint32_t)p_slot[0x1B],(uint32_t)p_slot[0x14],(uint32_t)p_slot[0x15]);
+    entry->size = READ_32_BITS((uint32_t)p_slot[0x1C],(uint32_t)p_slot[0x1D],(uint32_t)p_slot[0x1E],(uint32_t)p_slot[0x1F]);
+    entry->modified_time = READ_16_BITS((uint16_t)p_slot[0x16],(uint16_t)p_slot[0x17]);
+    entry->modified_date = READ_16_BITS((uint16_t)p_slot[0x18],(uint16_t)p_slot[0x19]);
+    if(g_end_of_file != FAT_EOF_32) /* high word is reserved (EA index) on FAT12/FAT16 */
+    {
+        entry->first_cluster &= 0xFFFF;
+    }
+
+    if(p_slot[0] != 0xE5)
+    {
+        entry->first_char_known = true;
+    }
+    else if(lfn_count > 0)
+    {
+        /*
+         * each step of the checksum is a bijection, so exactly one first character
+         * gives the checksum stored in the long filename entries.
+         */
+        checksum = buff[lfn_offsets[lfn_count - 1] + 0x0D];
+        for(c = 0;c < 256;c++)
+        {
+            entry->short_name[0] = c;
+            if(lfn_checksum(entry->short_name) == checksum)
+            {
+                entry->first_char_known = true;
+                break;
+            }
+        }
+    }
+    if(entry->first_char_known == false)
+    {
+        entry->short_name[0] = '_';
+    }
+
+    /* the part next to the short entry comes first, the sequence numbers are lost */
+    checksum = lfn_checksum(entry->short_name);
+    while((lfn_count > 0) && (end == false))
+    {
+        lfn_count -= 1;
+        p_lfn = &buff[lfn_offsets[lfn_count]];
+        if((entry->first_char_known == false) || (p_lfn[0x0D] != checksum))
+        {
+            break;
+        }
+        for(k = 0;(k < FAT_LFN_CHARS) && (end == false) && (length < 255);k++)
+        {
+            if(((p_lfn[g_lfn_offsets[k]] == 0x00) && (p_lfn[g_lfn_offsets[k] + 1] == 0x00)) ||
+               ((p_lfn[g_lfn_offsets[k]] == 0xFF) && (p_lfn[g_lfn_offsets[k] + 1] == 0xFF)))
+            {
+                end = true;
+            }
+            else
+            {
+                entry->name[length] = p_lfn[g_lfn_offsets[k]];
+                length += 1;
+            }
+        }
+        entry->lfn_parts += 1;
+    }
+    entry->name[length] = '\0';
+    if(length == 0)
+    {
+        short_to_name(entry->short_name,entry->name);
+    }
+}
+
+uint32_t fat_read_raw_clusters(uint32_t cluster,uint32_t count,uint8_t* buff)
+{
+    uint32_t retValue = 0;
+
+    if((cluster >= 2) && (count > 0) && ((cluster - 2 + count) <= g_total_clusters))
+    {
+        retValue = kmc_read_multi_sector(cluster_to_sector(cluster),count * fat.sectors_per_cluster,buff);
+    }
+    return retValue;
+}
+
+bool fat_cluster_hole(uint32_t cluster,uint32_t count,uint32_t* run)
+{
+    bool retValue = false;
+    uint32_t sectors = 0;
+
+    *run = count;
+    if((cluster >= 2) && (count > 0) && ((cluster - 2 + count) <= g_total_clusters))
+    {
+        retValue = kmc_is_hole(cluster_to_sector(cluster),count * fat.sectors_per_cluster,&sectors);
+        if(retValue == true)
+        {
+            *run = sectors / fat.sectors_per_cluster;
+            if(*run == 0) /* the hole ends inside the cluster */
+            {
+                *run = 1;
+                retValue = false;
+            }
+        }
+        else
+        {
+            *run = (sectors + fat.sectors_per_cluster - 1) / fat.sectors_per_cluster;
+        }
+    }
+    return retValue;
+}
+
+bool fat_volume_key(uint8_t* file_path,fat_volume_key_struct_t* key)
+{
+    bool retValue = true;
+    struct stat info;
+    uint8_t* p_buff = NULL;
+    uint64_t hash = 14695981039346656037ULL; /* FNV-1a offset basis */
+    uint32_t sector = 0;
+    uint32_t n = 0;
+    uint32_t bytes = 0;
+    uint32_t i = 0;
+
+    memset(key,0,sizeof(fat_volume_key_struct_t));
+    if(stat(file_path,&info) != 0)
+    {
+        retValue = false;
+    }
+    else
+    {
+        /* a write in the same second still changes the nanoseconds or the change time */
+        key->image_size = info.st_size;
+        key->image_mtime = info.st_mtime;
+        key->image_mtime_ns = FAT_MTIME_NS(info);
+        key->image_ctime = info.st_ctime;
+        key->image_ctime_ns = FAT_CTIME_NS(info);
+        key->image_inode = info.st_ino;
+
+        for(i = 0;i < 512;i++)
+        {
+            hash = (hash ^ g_boot_info[i]) * 1099511628211ULL;
+        }
+        /* FAT table 1 is hashed a few sectors at a time */
+        p_buff = (uint8_t*)malloc(sizeof(uint8_t)*FAT_HASH_CHUNK*fat.bytes_per_sector);
+        check_null(p_buff);
+        for(sector = 0;(retValue == true) && (sector < fat.fat_size);sector += n)
+        {
+            n = fat.fat_size - sector;
+            if(n > FAT_HASH_CHUNK)
+            {
+                n = FAT_HASH_CHUNK;
+            }
+            bytes = kmc_read_multi_sector(g_fat1_first_index + sector,n,p_buff);
+            if(bytes != (n * fat.bytes_per_sector))
+            {
+                retValue = false;
+            }
+            for(i = 0;i < bytes;i++)
+            {
+                hash = (hash ^ p_buff[i]) * 1099511628211ULL;
+            }
+        }
+        free(p_buff);
+        key->hash = hash;
+    }
+    return retValue;
+}
+
+bool fat_sidecar_path(uint8_t* file_path,const uint8_t* extension,uint8_t* path)
+{
+    bool retValue = false;
+
+    if((strlen(file_path) + strlen(extension)) < (FAT_MAX_PATH - 32))
+    {
+        if(g_volume_offset != 0) /* one file per partition of a disk image */
+        {
+            sprintf(path,"%s@%llu%s",file_path,(unsigned long long)g_volume_offset,extension);
+        }
+        else
+        {
+            sprintf(path,"%s%s",file_path,extension);
+        }
+        retValue = true;
+    }
+    return retValue;
+}
+
+void fat_remove_sidecars(uint8_t* file_path)
+{
+    uint8_t path[FAT_MAX_PATH];
+
+    if(fat_sidecar_path(file_path,".snap",path) == true)
+    {
+        remove(path);
+    }
+    if(fat_sidecar_path(file_path,".find",path) == true)
+    {
+        remove(path);
+    }
+}
+
+static bool snapshot_key(uint8_t* file_path,fat_snapshot_header_t* key)
+{
+    bool retValue = false;
+    fat_volume_key_struct_t volume_key;
+
+    memset(key,0,sizeof(fat_snapshot_header_t));
+    memcpy(key->magic,FAT_SNAPSHOT_MAGIC,8);
+    if(fat_volume_key(file_path,&volume_key) == true)
+    {
+        key->key = volume_key;
+        retValue = true;
+    }
+    return retValue;
+}
+
+static bool snapshot_load(const uint8_t* snapshot_path,const fat_snapshot_header_t* key)
+{
+    bool retValue = false;
+    fat_snapshot_header_t header;
+    uint8_t* p_map = NULL;
+    uint64_t size = 0;
+    FILE* file = NULL;
+
+    file = fopen(snapshot_path,"rb");
+    if(file == NULL)
+    {
+        return false;
+    }
+    if((fread(&header,sizeof(header),1,file) == 1) && (memcmp(header.magic,key->magic,8) == 0) &&\
+       (memcmp(&header.key,&key->key,sizeof(fat_volume_key_struct_t)) == 0))
+    {
+        fseek(file,0,SEEK_END);
+        size = ftell(file);
+#if defined(__linux__) || defined(__unix__) || defined(__APPLE__)
+        p_map = (uint8_t*)mmap(NULL,size,PROT_READ,MAP_PRIVATE,fileno(file),0);
+        if(p_map == MAP_FAILED)
+        {
+            p_map = NULL;
+        }
+#else
+        p_map = (uint8_t*)malloc(size);
+        check_null(p_map);
+        rewind(file);
+        if(fread(p_map,sizeof(uint8_t),size,file) != size)
+        {
+            free(p_map);
+            p_map = NULL;
+        }
+#endif
+        /* the key matches, the layout still has to fit in the file */
+        if((p_map != NULL) &&\
+           ((header.fat_offset + 4ULL * header.fat_entries) <= size) &&\
+           ((header.node_offset + 1ULL * sizeof(fat_node_struct_t) * header.node_count) <= size) &&\
+           ((header.names_offset + 1ULL * header.names_size) <= size) &&\
+           (header.node_count > 0) && (header.names_size > 0) && (p_map[header.names_offset + header.names_size - 1] == '\0'))
+        {
+            g_snapshot = p_map;
+            g_snapshot_size = size;
+#if defined(__linux__) || defined(__unix__) || defined(__APPLE__)
+            g_snapshot_mapped = true;
+#endif
+            retValue = true;
+        }
+        else if(p_map != NULL)
+        {
+#if defined(__linux__) || defined(__unix__) || defined(__APPLE__)
+            munmap(p_map,size);
+#else
+            free(p_map);
+#endif
+        }
+    }
+    fclose(file);
+    return retValue;
+}
+
+static void snapshot_build(const fat_snapshot_header_t* key)
+{
+    fat_node_struct_t* nodes = NULL;
+    uint8_t* names = NULL;
+    uint8_t* p_buff = NULL;
+    uint32_t node_count = 1;
+    uint32_t node_capacity = 64;
+    uint32_t names_size = 1;
+    uint32_t names_capacity = 1024;
+    uint32_t total_bytes_read = 0;
+    uint32_t i = 0;
+    uint32_t parent = 0;
+    uint32_t depth = 0;
+    uint32_t length = 0;
+    bool descend = true;
+    fat_entry* head = NULL;
+    fat_entry* temp = NULL;
+    fat_snapshot_header_t* header = NULL;
+
+    nodes = (fat_node_struct_t*)malloc(sizeof(fat_node_struct_t)*node_capacity);
+    check_null(nodes);
+    names = (uint8_t*)malloc(sizeof(uint8_t)*names_capacity);
+    check_null(names);
+
+    /* node 0: root directory, name "" */
+    memset(&nodes[0],0,sizeof(fat_node_struct_t));
+    memset(nodes[0].short_name,' ',11);
+    nodes[0].attribute = 0x10;
+    names[0] = '\0';
+
+    for(i = 0;i < node_count;i++)
+    {
+        /* don't follow a directory that points back to one of its parents */
+        descend = ((nodes[i].attribute & 0x10) != 0) && ((i == 0) || (nodes[i].first_cluster >= 2));
+        depth = 0;
+        for(parent = i;(descend == true) && (parent != 0);parent = nodes[parent].parent)
+        {
+            depth++;
+            if(((parent != i) && (nodes[parent].first_cluster == nodes[i].first_cluster)) || (depth >= FAT_MAX_DEPTH))
+            {
+                descend = false;
+            }
+        }
+
+        nodes[i].first_child = node_count;
+        nodes[i].child_count = 0;
+        if(descend == true)
+        {
+            total_bytes_read = read_dir_buffer((i == 0) ? 0 : nodes[i].first_cluster,&p_buff);
+            parse_entries(p_buff,total_bytes_read,&head);
+            free(p_buff);
+            p_buff = NULL;
+
+            for(temp = head;temp != NULL;temp = temp->next)
+            {
+                if(((temp->attribute & 0x08) != 0) || (temp->SFN[0] == '.')) /* volume label, "." and ".." */
+                {
+                    /* just check, don't do anything */
+                }
+                else
+                {
+                    if(node_count == node_capacity)
+                    {
+                        node_capacity *= 2;
+                        nodes = (fat_node_struct_t*)realloc(nodes,sizeof(fat_node_struct_t)*node_capacity);
+                        check_null(nodes);
+                    }
+                    length = strlen(temp->LFN) + 1;
+                    while((names_size + length) > names_capacity)
+                    {
+                        names_capacity *= 2;
+                        names = (uint8_t*)realloc(names,sizeof(uint8_t)*names_capacity);
+                        check_null(names);
+                    }
+
+                    memset(&nodes[node_count],0,sizeof(fat_node_struct_t));
+                    nodes[node_count].parent = i;
+                    nodes[node_count].name = names_size;
+                    nodes[node_count].first_cluster = fat_entry_cluster(temp);
+                    nodes[node_count].size = READ_32_BITS((uint32_t)temp->size[0],(uint32_t)temp->size[1],(uint32_t)temp->size[2],(uint32_t)temp->size[3]);
+                    nodes[node_count].modified_time = READ_16_BITS(temp->modified_time[0],temp->modified_time[1]);
+                    nodes[node_count].modified_date = READ_16_BITS(temp->modified_date[0],temp->modified_date[1]);
+                    nodes[node_count].attribute = temp->attribute;
+                    memcpy(nodes[node_count].short_name,temp->SFN,8);
+                    memcpy(&nodes[node_count].short_name[8],temp->extension,3);
+                    memcpy(&names[names_size],temp->LFN,length);
+                    names_size += length;
+                    node_count += 1;
+                }
+            }
+            free_entries(&head);
+        }
+        nodes[i].child_count = node_count - nodes[i].first_child;
+    }
+
+    /* one block laid out exactly like the file: header, FAT, nodes, names */
+    g_snapshot_size = sizeof(fat_snapshot_header_t) + 4ULL * g_fat_entries + sizeof(fat_node_struct_t) * node_count + names_size;
+    g_snapshot = (uint8_t*)malloc(g_snapshot_size);
+    check_null(g_snapshot);
+    g_snapshot_mapped = false;
+    header = (fat_snapshot_header_t*)g_snapshot;
+    *header = *key;
+    header->fat_entries = g_fat_entries;
+    header->node_count = node_count;
+    header->names_size = names_size;
+    header->fat_offset = sizeof(fat_snapshot_header_t);
+    header->node_offset = header->fat_offset + 4 * g_fat_entries;
+    header->names_offset = header->node_offset + sizeof(fat_node_struct_t) * node_count;
+    memcpy(g_snapshot + header->fat_offset,g_fat_table,4 * g_fat_entries);
+    memcpy(g_snapshot + header->node_offset,nodes,sizeof(fat_node_struct_t) * node_count);
+    memcpy(g_snapshot + header->names_offset,names,names_size);
+    free(nodes);
+    free(names);
+}
+
+static void free_snapshot(void)
+{
+    if(g_snapshot != NULL)
+    {
+        if(g_fat_table == (uint32_t*)(g_snapshot + ((fat_snapshot_header_t*)g_snapshot)->fat_offset))
+        {
+            g_fat_table = NULL;
+        }
+#if defined(__linux__) || defined(__unix__) || defined(__APPLE__)
+        if(g_snapshot_mapped == true)
+        {
+            munmap(g_snapshot,g_snapshot_size);
+        }
+        else
+        {
+            free(g_snapshot);
+        }
+#else
+        free(g_snapshot);
+#endif
+    }
+    g_snapshot = NULL;
+    g_snapshot_size = 0;
+    g_snapshot_mapped = false;
+    g_nodes = NULL;
+    g_node_count = 0;
+    g_names = NULL;
+    g_names_size = 0;
+}
+
+bool fat_snapshot_attach(uint8_t* file_path,bool create)
+{
+    bool retValue = false;
+    uint8_t snapshot_path[FAT_MAX_PATH];
+    uint8_t temp_path[FAT_MAX_PATH];
+    fat_snapshot_header_t key;
+    fat_snapshot_header_t* header = NULL;
+    FILE* file = NULL;
+
+    if((g_writable == false) && (fat_sidecar_path(file_path,".snap",snapshot_path) == true) && (snapshot_key(file_path,&key) == true))
+    {
+        free_snapshot();
+        retValue = snapshot_load(snapshot_path,&key);
+
+        if((retValue == false) && (create == true) && (load_fat_table() == true))
+        {
+            snapshot_build(&key);
+            /* write a temporary file and rename it, readers never map a partial snapshot */
+            strcpy(temp_path,snapshot_path);
+            strcat(temp_path,".tmp");
+            file = fopen(temp_path,"wb");
+            if(file != NULL)
+            {
+                if((fwrite(g_snapshot,sizeof(uint8_t),g_snapshot_size,file) == g_snapshot_size) && (fclose(file) == 0))
+                {
+                    remove(snapshot_path);
+                    rename(temp_path,snapshot_path);
+                }
+                else
+                {
+                    remove(temp_path);
+                }
+            }
+            retValue = true;
+        }
+
+        if(retValue == true)
+        {
+            /* the snapshot replaces the decoded FAT table */
+            header = (fat_snapshot_header_t*)g_snapshot;
+            if(g_fat_table != (uint32_t*)(g_snapshot + header->fat_offset))
+            {
+                free(g_fat_table);
+            }
+            g_fat_table = (uint32_t*)(g_snapshot + header->fat_offset);
+            g_fat_entries = header->fat_entries;
+            g_nodes = (const fat_node_struct_t*)(g_snapshot + header->node_offset);
+            g_node_count = header->node_count;
+            g_names = g_snapshot + header->names_offset;
+            g_names_size = header->names_size;
+        }
+    }
+    return retValue;
+}
+
+const fat_node_struct_t* fat_get_nodes(uint32_t* count,const uint8_t** names)
+{
+    *count = g_node_count;
+    *names = g_names;
+    return g_nodes;
+}
+
+void fat_node_name(const fat_node_struct_t* node,const uint8_t* names,uint8_t* name)
+{
+    fat_entry entry;
+
+    node_to_entry(node,names,&entry);
+    fat_entry_name(&entry,name);
+}
+
+static void node_to_entry(const fat_node_struct_t* node,const uint8_t* names,fat_entry* entry)
+{
+    memset(entry,0,sizeof(fat_entry));
+    strncpy(entry->LFN,&names[node->name],255);
+    memcpy(entry->SFN,node->short_name,8);
+    memcpy(entry->extension,&node->short_name[8],3);
+    entry->attribute = node->attribute;
+    entry->low_first_cluster[0] = node->first_cluster & 0xFF;
+    entry->low_first_cluster[1] = (node->first_cluster >> 8) & 0xFF;
+    entry->high_first_cluster[0] = (node->first_cluster >> 16) & 0xFF;
+    entry->high_first_cluster[1] = (node->first_cluster >> 24) & 0xFF;
+    entry->modified_time[0] = node->modified_time & 0xFF;
+    entry->modified_time[1] = node->modified_time >> 8;
+    entry->modified_date[0] = node->modified_date & 0xFF;
+    entry->modified_date[1] = node->modified_date >> 8;
+    entry->size[0] = node->size & 0xFF;
+    entry->size[1] = (node->size >> 8) & 0xFF;
+    entry->size[2] = (node->size >> 16) & 0xFF;
+    entry->size[3] = (node->size >> 24) & 0xFF;
+}
+
+static bool walk_nodes(uint32_t node,uint8_t* path,uint8_t depth,fat_walk_callback_t callback,void* arg)
+{
+    bool retValue = true;
+    uint8_t name[256];
+    uint32_t path_length = strlen(path);
+    uint32_t i = 0;
+    const fat_node_struct_t* dir = &g_nodes[node];
+    fat_entry entry;
+
+    /* a mapped file is not trusted blindly, indexes are checked before use */
+    if((depth >= FAT_MAX_DEPTH) || (dir->first_child > g_node_count) || (dir->child_count > (g_node_count - dir->first_child)))
+    {
+        return false;
+    }
+    for(i = dir->first_child;i < (dir->first_child + dir->child_count);i++)
+    {
+        if(g_nodes[i].name >= g_names_size)
+        {
+            retValue = false;
+        }
+        else
+        {
+            node_to_entry(&g_nodes[i],g_names,&entry);
+            fat_entry_name(&entry,name);
+            if((path_length + 1 + strlen(name)) >= FAT_MAX_PATH)
+            {
+                retValue = false;
+            }
+            else
+            {
+                path[path_length] = '/';
+                strcpy(&path[path_length + 1],name);
+                callback(path,&entry,arg);
+                if(((g_nodes[i].attribute & 0x10) != 0) && (i != node) && (walk_nodes(i,path,depth + 1,callback,arg) == false))
+                {
+                    retValue = false;
+                }
+                path[path_length] = '\0';
+            }
+        }
+    }
+    return retValue;
+}
+
+static uint8_t* cache_get(uint32_t sector,uint32_t sectors,bool directory,bool load,bool dirty)
+{
+    uint32_t i = 0;
+    uint32_t slot = FAT_CACHE_SLOTS;
+    uint32_t bytes_read = 0;
+    fat_cache_block_t* block = NULL;
+
+    for(i = 0;(i < FAT_CACHE_SLOTS) && (slot == FAT_CACHE_SLOTS);i++)
+    {
+        if((g_cache[i].sectors != 0) && (g_cache[i].sector == sector))
+        {
+            slot = i;
+        }
+    }
+
+    if(slot == FAT_CACHE_SLOTS) /* miss */
+    {
+        /* unused slot first, then the least recently used one that is not a dirty directory block */
+        for(i = 0;i < FAT_CACHE_SLOTS;i++)
+        {
+            if(g_cache[i].sectors == 0)
+            {
+                slot = i;
+                break;
+            }
+            else if((g_cache[i].dirty && g_cache[i].directory) == false)
+            {
+                if((slot == FAT_CACHE_SLOTS) || (g_cache[i].last_use < g_cache[slot].last_use))
+                {
+                    slot = i;
+                }
+            }
+        }
+
+        /*
+         * directory blocks may only reach the disk after the FAT, so when the cache is full
+         * of them do a full ordered write-out instead of writing one alone.
+         */
+        if(slot == FAT_CACHE_SLOTS)
+        {
+            fat_sync();
+            slot = 0;
+            for(i = 1;i < FAT_CACHE_SLOTS;i++)
+            {
+                if(g_cache[i].last_use < g_cache[slot].last_use)
+                {
+                    slot = i;
+                }
+            }
+        }
+        else if(g_cache[slot].dirty == true)
+        {
+            /* write every dirty data block at once, most of them are contiguous */
+            cache_flush(false);
+        }
+
+        block = &g_cache[slot];
+        if(block->data == NULL)
+        {
+            block->data = (uint8_t*)malloc(sizeof(uint8_t)*fat.bytes_per_sector*fat.sectors_per_cluster);
+            check_null(block->data);
+        }
+        block->sector = sector;
+        block->sectors = sectors;
+        block->dirty = false;
+        block->directory = directory;
+
+        if(load == true)
+        {
+            bytes_read = kmc_read_multi_sector(sector,sectors,block->data);
+        }
+        if(bytes_read < (sectors * fat.bytes_per_sector))
+        {
+            memset(block->data + bytes_read,0,(sectors * fat.bytes_per_sector) - bytes_read);
+        }
+    }
+
+    block = &g_cache[slot];
+    g_cache_clock += 1;
+    block->last_use = g_cache_clock;
+    if(dirty == true)
+    {
+        block->dirty = true;
+    }
+    return block->data;
+}
+
+static void cache_discard(uint32_t sector)
+{
+    uint32_t i = 0;
+
+    for(i = 0;i < FAT_CACHE_SLOTS;i++)
+    {
+        if((g_cache[i].sectors != 0) && (g_cache[i].sector == sector))
+        {
+            g_cache[i].sectors = 0;
+            g_cache[i].dirty = false;
+        }
+    }
+}
+
+static bool cache_flush(bool directory)
+{
+    bool retValue = true;
+    uint32_t order[FAT_CACHE_SLOTS];
+    uint32_t count = 0;
+    uint32_t i = 0;
+    uint32_t j = 0;
+    uint32_t k = 0;
+    uint32_t run_sectors = 0;
+    uint8_t* p_buff = NULL;
+    fat_cache_block_t* block = NULL;
+
+    /* dirty blocks of the requested kind, sorted by sector (insertion sort, small array) */
+    for(i = 0;i < FAT_CACHE_SLOTS;i++)
+    {
+        if((g_cache[i].sectors != 0) && (g_cache[i].dirty == true) && (g_cache[i].directory == directory))
+        {
+            j = count;
+            while((j > 0) && (g_cache[order[j - 1]].sector > g_cache[i].sector))
+            {
+                order[j] = order[j - 1];
+                j--;
+            }
+            order[j] = i;
+            count += 1;
+        }
+    }
+
+    i = 0;
+    while(i < count)
+    {
+        /* blocks i..j are contiguous on disk */
+        j = i;
+        run_sectors = g_cache[order[i]].sectors;
+        while(((j + 1) < count) && (g_cache[order[j + 1]].sector == (g_cache[order[j]].sector + g_cache[order[j]].sectors)))
+        {
+            j++;
+            run_sectors += g_cache[order[j]].sectors;
+        }
+
+        if(j == i)
+        {
+            block = &g_cache[order[i]];
+            if(kmc_write_multi_sector(block->sector,block->sectors,block->data) != (block->sectors * fat.bytes_per_sector))
+            {
+                retValue = false;
+            }
+        }
+        else
+        {
+            p_buff = (uint8_t*)malloc(sizeof(uint8_t)*run_sectors*fat.bytes_per_sector);
+            check_null(p_buff);
+            run_sectors = 0;
+            for(k = i;k <= j;k++)
+            {
+                block = &g_cache[order[k]];
+                memcpy(p_buff + run_sectors * fat.bytes_per_sector,block->data,block->sectors * fat.bytes_per_sector);
+                run_sectors += block->sectors;
+            }
+            if(kmc_write_multi_sector(g_cache[order[i]].sector,run_sectors,p_buff) != (run_sectors * fat.bytes_per_sector))
+            {
+                retValue = false;
+            }
+            free(p_buff);
+            p_buff = NULL;
+        }
+
+        for(k = i;k <= j;k++)
+        {
+            g_cache[order[k]].dirty = false;
+        }
+        i = j + 1;
+    }
+    return retValue;
+}
+
+static void cache_free(void)
+{
+    uint32_t i = 0;
+
+    for(i = 0;i < FAT_CACHE_SLOTS;i++)
+    {
+        free(g_cache[i].data);
+    }
+    memset(g_cache,0,sizeof(g_cache));
+    g_cache_clock = 0;
+}
+
+static void set_fat_entry(uint32_t cluster,uint32_t value)
+{
+    fat_window_t* window = NULL;
+    uint32_t* p_entry = NULL;
+
+    pthread_rwlock_wrlock(&g_window_lock);
+    window = load_window(cluster);
+    if(window == NULL)
+    {
+        g_fat_lost = true;
+    }
+    else
+    {
+        p_entry = &window->entries[cluster - window->first];
+        if((*p_entry == 0) && (value != 0))
+        {
+            g_free_clusters -= 1;
+        }
+        else if((*p_entry != 0) && (value == 0))
+        {
+            g_free_clusters += 1;
+        }
+        *p_entry = value;
+        window->dirty = true;
+    }
+    pthread_rwlock_unlock(&g_window_lock);
+    if(g_fat_table != NULL)
+    {
+        g_fat_table[cluster] = value;
+    }
+    g_fat_changed = true;
+}
+
+static bool flush_fat(void)
+{
+    bool retValue = true;
+    uint32_t i = 0;
+
+    pthread_rwlock_wrlock(&g_window_lock);
+    for(i = 0;(g_windows != NULL) && (i < FAT_WINDOW_SLOTS);i++)
+    {
+        if((g_windows[i].count != 0) && (g_windows[i].dirty == true) && (write_window(&g_windows[i]) == false))
+        {
+            retValue = false;
+        }
+    }
+    pthread_rwlock_unlock(&g_window_lock);
+    return retValue;
+}
+
+static bool prepare_write(void)
+{
+    bool retValue = false;
+    fat_volume_stat_struct_t stat;
+
+    if((g_writable == true) && (fat_table_ready() == true))
+    {
+        retValue = true;
+        if(g_free_counted == false)
+        {
+            retValue = fat_get_volume_stat(&stat);
+            g_free_clusters = stat.free_clusters;
+            g_free_counted = retValue;
+        }
+    }
+    return retValue;
+}
+
+static uint32_t free_run_length(uint32_t cluster,uint32_t max)
+{
+    uint32_t run = 0;
+
+    while((run < max) && ((cluster + run) < g_fat_entries) && (read_fat_entry(cluster + run) == 0))
+    {
+        run++;
+    }
+    return run;
+}
+
+static uint32_t alloc_chain(uint32_t count,uint32_t hint,uint32_t* last_cluster)
+{
+    uint32_t first_cluster = 0;
+    uint32_t previous = 0;
+    uint32_t start = 0;
+    uint32_t run = 0;
+    uint32_t best = 0;
+    uint32_t best_run = 0;
+    uint32_t taken = 0;
+    uint32_t i = 0;
+    uint32_t cluster = 0;
+
+    if((count == 0) || (g_free_clusters < count))
+    {
+        return 0;
+    }
+
+    /* 1. contiguous run at the hint (appending to a chain) */
+    if((hint >= 2) && (free_run_length(hint,count) == count))
+    {
+        start = hint;
+    }
+
+    /* 2. first run large enough, starting at the allocation pointer */
+    i = 0;
+    while((start == 0) && (i < (g_fat_entries - 2)))
+    {
+        cluster = 2 + ((g_next_free - 2 + i) % (g_fat_entries - 2));
+        run = free_run_length(cluster,count);
+        if(run == count)
+        {
+            start = cluster;
+        }
+        i += run + 1;
+    }
+
+    while(taken < count)
+    {
+        if(start != 0)
+        {
+            best = start;
+            best_run = count;
+        }
+        else
+        {
+            /* 3. no single run is large enough, take the largest runs first */
+            best = 0;
+            best_run = 0;
+            for(cluster = 2;(cluster < g_fat_entries) && (best_run < (count - taken));cluster += run + 1)
+            {
+                run = free_run_length(cluster,count - taken);
+                if(run > best_run)
+                {
+                    best = cluster;
+                    best_run = run;
+                }
+            }
+        }
+
+        for(i = 0;i < best_run;i++)
+        {
+            cluster = best + i;
+            set_fat_entry(cluster,g_end_of_file + 7); /* EOC until linked, so it is not found free again */
+            if(previous == 0)
+            {
+                first_cluster = cluster;
+            }
+            else
+            {
+                set_fat_entry(previous,cluster);
+            }
+            previous = cluster;
+        }
+        taken += best_run;
+        g_next_free = best + best_run;
+    }
+    if(g_next_free >= g_fat_entries)
+    {
+        g_next_free = 2;
+    }
+    if(last_cluster != NULL)
+    {
+        *last_cluster = previous;
+    }
+    return first_cluster;
+}
+
+static void free_chain(uint32_t first_cluster)
+{
+    uint32_t current_cluster = first_cluster;
+    uint32_t next_cluster = 0;
+    uint32_t count = 0;
+
+    /* the chain of the last write may be the one freed */
+    g_cursor.clusters = 0;
+    while((fat_is_eoc(current_cluster) == false) && (count < g_total_clusters))
+    {
+        next_cluster = read_fat_entry(current_cluster);
+        set_fat_entry(current_cluster,0);
+        cache_discard(cluster_to_sector(current_cluster));
+        if(current_cluster < g_next_free)
+        {
+            g_next_free = current_cluster;
+        }
+        current_cluster = next_cluster;
+        count++;
+    }
+}
+
+static uint32_t chain_cluster(uint32_t first_cluster,uint32_t n)
+{
+    uint32_t current_cluster = first_cluster;
+    uint32_t i = 0;
+
+    for(i = 0;(i < n) && (fat_is_eoc(current_cluster) == false);i++)
+    {
+        current_cluster = read_fat_entry(current_cluster);
+    }
+    if(fat_is_eoc(current_cluster) == true)
+    {
+        current_cluster = 0;
+    }
+    return current_cluster;
+}
+
+static void dir_open(uint32_t cluster,fat_dir_t* dir)
+{
+    uint32_t i = 0;
+    uint32_t current_cluster = 0;
+
+    dir->cluster = cluster;
+    if((cluster == 0) && (g_end_of_file != FAT_EOF_32))
+    {
+        dir->block_sectors = 1;
+        dir->block_count = g_root_size;
+        dir->block_sector = (uint32_t*)malloc(sizeof(uint32_t)*(dir->block_count + 1));
+        check_null(dir->block_sector);
+        for(i = 0;i < dir->block_count;i++)
+        {
+            dir->block_sector[i] = g_root_first_index + i;
+        }
+    }
+    else
+    {
+        current_cluster = (cluster == 0) ? g_root_first_cluster : cluster;
+        dir->block_sectors = fat.sectors_per_cluster;
+        fat_count_fragments(current_cluster,&dir->block_count);
+        dir->block_sector = (uint32_t*)malloc(sizeof(uint32_t)*(dir->block_count + 1));
+        check_null(dir->block_sector);
+        for(i = 0;i < dir->block_count;i++)
+        {
+            dir->block_sector[i] = cluster_to_sector(current_cluster);
+            current_cluster = read_fat_entry(current_cluster);
+        }
+    }
+}
+
+static void dir_close(fat_dir_t* dir)
+{
+    free(dir->block_sector);
+    dir->block_sector = NULL;
+    dir->block_count = 0;
+}
+
+static uint8_t* dir_slot(fat_dir_t* dir,uint32_t index,bool dirty)
+{
+    uint8_t* retValue = NULL;
+    uint32_t slots_per_block = (dir->block_sectors * fat.bytes_per_sector) / FAT_DIR_ENTRY_SIZE;
+    uint32_t block = index / slots_per_block;
+
+    if(block < dir->block_count)
+    {
+        retValue = cache_get(dir->block_sector[block],dir->block_sectors,true,true,dirty);
+        retValue += (index % slots_per_block) * FAT_DIR_ENTRY_SIZE;
+    }
+    return retValue;
+}
+
+static bool dir_extend(fat_dir_t* dir)
+{
+    bool retValue = false;
+    uint32_t last_cluster = 0;
+    uint32_t new_cluster = 0;
+
+    if((dir->cluster != 0) || (g_end_of_file == FAT_EOF_32)) /* FAT12/16 root has a fixed size */
+    {
+        last_cluster = ((dir->block_sector[dir->block_count - 1] - g_data_first_index) / fat.sectors_per_cluster) + 2;
+        new_cluster = alloc_chain(1,last_cluster + 1,NULL);
+        if(new_cluster != 0)
+        {
+            set_fat_entry(last_cluster,new_cluster);
+            cache_get(cluster_to_sector(new_cluster),fat.sectors_per_cluster,true,false,true);
+            dir->block_sector = (uint32_t*)realloc(dir->block_sector,sizeof(uint32_t)*(dir->block_count + 1));
+            check_null(dir->block_sector);
+            dir->block_sector[dir->block_count] = cluster_to_sector(new_cluster);
+            dir->block_count += 1;
+            retValue = true;
+        }
+    }
+    return retValue;
+}
+
+static void short_to_name(const uint8_t* short_name,uint8_t* name)
+{
+    uint8_t i = 0;
+    uint8_t length = 0;
+
+    for(i = 0;(i < 8) && (short_name[i] != ' ');i++)
+    {
+        name[length++] = short_name[i];
+    }
+    if(name[0] == 0x05) /* first character 0xE5 is stored as 0x05 */
+    {
+        name[0] = 0xE5;
+    }
+    if(short_name[8] != ' ')
+    {
+        name[length++] = '.';
+        for(i = 8;(i < 11) && (short_name[i] != ' ');i++)
+        {
+            name[length++] = short_name[i];
+        }
+    }
+    name[length] = '\0';
+}
+
+static bool name_equal(const uint8_t* a,const uint8_t* b)
+{
+    while((*a != '\0') && (toupper(*a) == toupper(*b)))
+    {
+        a++;
+        b++;
+    }
+    return (toupper(*a) == toupper(*b));
+}
+
+static uint8_t lfn_checksum(const uint8_t* short_name)
+{
+    uint8_t sum = 0;
+    uint8_t i = 0;
+
+    for(i = 0;i < 11;i++)
+    {
+        sum = ((sum & 1) << 7) + (sum >> 1) + short_name[i];
+    }
+    return sum;
+}
+
+static bool dir_find(uint32_t dir_cluster,const uint8_t* name,fat_location_t* location)
+{
+    bool found = false;
+    fat_dir_t dir;
+    uint8_t* p_slot = NULL;
+    uint8_t long_name[FAT_LFN_CHARS * 20 + 1];
+    uint8_t short_name[13];
+    uint8_t checksum = 0;
+    uint8_t order = 0;
+    uint8_t lfn_count = 0;
+    uint32_t index = 0;
+    uint32_t k = 0;
+
+    dir_open(dir_cluster,&dir);
+    p_slot = dir_slot(&dir,0,false);
+    while((found == false) && (p_slot != NULL) && (p_slot[0] != 0x00)) /* 0x00: end of directory */
+    {
+        if(p_slot[0] == 0xE5) /* deleted entry */
+        {
+            lfn_count = 0;
+        }
+        else if(p_slot[0x0B] == 0x0F) /* long filename */
+        {
+            order = p_slot[0] & 0x1F;
+            if((p_slot[0] & 0x40) != 0)
+            {
+                memset(long_name,0,sizeof(long_name));
+                checksum = p_slot[0x0D];
+                lfn_count = 0;
+            }
+            if((order >= 1) && (order <= 20))
+            {
+                for(k = 0;k < FAT_LFN_CHARS;k++)
+                {
+                    if((p_slot[g_lfn_offsets[k]] != 0xFF) && (p_slot[g_lfn_offsets[k] + 1] != 0xFF))
+                    {
+                        long_name[(order - 1) * FAT_LFN_CHARS + k] = p_slot[g_lfn_offsets[k]];
+                    }
+                }
+                lfn_count += 1;
+            }
+        }
+        else if((p_slot[0x0B] & 0x08) == 0) /* not a volume label */
+        {
+            short_to_name(p_slot,short_name);
+            if((lfn_count == 0) || (lfn_checksum(p_slot) != checksum))
+            {
+                lfn_count = 0;
+                long_name[0] = '\0';
+            }
+            if(name_equal(short_name,name) || ((lfn_count != 0) && name_equal(long_name,name)))
+            {
+                found = true;
+                location->dir_cluster = dir_cluster;
+                location->index = index;
+                location->lfn_count = lfn_count;
+                location->attribute = p_slot[0x0B];
+                location->first_cluster = READ_32_BITS((uint32_t)p_slot[0x1A],(uint32_t)p_slot[0x1B],(uint32_t)p_slot[0x14],(uint32_t)p_slot[0x15]);
+                location->size = READ_32_BITS((uint32_t)p_slot[0x1C],(uint32_t)p_slot[0x1D],(uint32_t)p_slot[0x1E],(uint32_t)p_slot[0x1F]);
+            }
+            lfn_count = 0;
+        }
+        index += 1;
+        p_slot = dir_slot(&dir,index,false);
+    }
+    dir_close(&dir);
+    return found;
+}
+
+static bool path_lookup(const uint8_t* path,fat_location_t* location)
+{
+    bool retValue = true;
+    uint8_t name[256];
+    uint32_t dir_cluster = 0;
+    uint32_t length = 0;
+
+    /* the root directory has no entry of its own */
+    memset(location,0,sizeof(fat_location_t));
+    location->attribute = 0x10;
+
+    while((retValue == true) && (*path != '\0'))
+    {
+        while(*path == '/')
+        {
+            path++;
+        }
+        length = 0;
+        while((*path != '\0') && (*path != '/') && (length < 255))
+        {
+            name[length++] = *path++;
+        }
+        name[length] = '\0';
+
+        if(length == 0)
+        {
+            /* trailing '/' */
+        }
+        else if((location->attribute & 0x10) == 0) /* a file in the middle of the path */
+        {
+            retValue = false;
+        }
+        else if(dir_find(dir_cluster,name,location) == false)
+        {
+            retValue = false;
+        }
+        else
+        {
+            dir_cluster = location->first_cluster;
+        }
+    }
+    return retValue;
+}
+
+static bool path_parent(const uint8_t* path,uint32_t* dir_cluster,uint8_t* name)
+{
+    bool retValue = false;
+    uint8_t parent[FAT_MAX_PATH];
+    uint32_t length = strlen(path);
+    uint32_t slash = 0;
+    fat_location_t location;
+
+    while((length > 0) && (path[length - 1] == '/'))
+    {
+        length--;
+    }
+    slash = length;
+    while((slash > 0) && (path[slash - 1] != '/'))
+    {
+        slash--;
+    }
+
+    if((length > slash) && ((length - slash) < 256) && (slash < FAT_MAX_PATH))
+    {
+        memcpy(parent,path,slash);
+        parent[slash] = '\0';
+        memcpy(name,&path[slash],length - slash);
+        name[length - slash] = '\0';
+        if((path_lookup(parent,&location) == true) && ((location.attribute & 0x10) != 0))
+        {
+            *dir_cluster = location.first_cluster;
+            retValue = true;
+        }
+    }
+    return retValue;
+}
+
+static bool make_short_name(uint32_t dir_cluster,const uint8_t* name,uint8_t* short_name,bool* lossy)
+{
+    bool retValue = true;
+    uint8_t* used = NULL;
+    uint8_t base_length = 0;
+    uint8_t extension_length = 0;
+    uint8_t tail[8];
+    uint8_t tail_length = 0;
+    uint8_t test_name[13];
+    uint32_t n = 0;
+    uint32_t i = 0;
+    uint32_t dot = strlen(name);
+    uint8_t c = 0;
+    fat_location_t location;
+
+    *lossy = false;
+    memset(short_name,' ',11);
+    for(i = strlen(name);i > 1;i--)
+    {
+        if(name[i - 1] == '.')
+        {
+            dot = i - 1;
+            break;
+        }
+    }
+
+    for(i = 0;name[i] != '\0';i++)
+    {
+        c = toupper(name[i]);
+        if((i == dot) || ((i > dot) && (extension_length >= 3)) || ((i < dot) && (base_length >= 8)))
+        {
+            *lossy = (*lossy == true) || (i != dot);
+        }
+        else if((c == ' ') || (c == '.'))
+        {
+            *lossy = true;
+        }
+        else
+        {
+            if((c < 0x20) || (strchr("\"*+,/:;<=>?[\\]|",c) != NULL))
+            {
+                c = '_';
+            }
+            if(c != name[i])
+            {
+                *lossy = true;
+            }
+            if(i < dot)
+            {
+                short_name[base_length++] = c;
+            }
+            else
+            {
+                short_name[8 + extension_length++] = c;
+            }
+        }
+    }
+    if(base_length == 0)
+    {
+        short_name[base_length++] = '_';
+        *lossy = true;
+    }
+
+    /* lossy names get the lowest numeric tail "~N" that no short name of the directory has */
+    if(*lossy == true)
+    {
+        used = (uint8_t*)calloc(FAT_SHORT_NAME_TAILS / 8 + 1,sizeof(uint8_t));
+        check_null(used);
+        mark_used_tails(dir_cluster,short_name,base_length,used);
+        retValue = false;
+        for(n = 1;(retValue == false) && (n <= FAT_SHORT_NAME_TAILS);n++)
+        {
+            if((used[n / 8] & (1U << (n % 8))) == 0)
+            {
+                tail_length = sprintf(tail,"~%u",n);
+                i = (base_length < (8 - tail_length)) ? base_length : (8 - tail_length);
+                memcpy(&short_name[i],tail,tail_length);
+                short_to_name(short_name,test_name);
+                /* a long name may still be the same as the candidate */
+                retValue = (dir_find(dir_cluster,test_name,&location) == false);
+            }
+        }
+        free(used);
+    }
+    if(short_name[0] == 0xE5)
+    {
+        short_name[0] = 0x05;
+    }
+    return retValue;
+}
+
+static void mark_used_tails(uint32_t dir_cluster,const uint8_t* short_name,uint8_t base_length,uint8_t* used)
+{
+    fat_dir_t dir;
+    uint8_t* p_slot = NULL;
+    uint8_t entry[11];
+    uint32_t index = 0;
+    uint32_t tilde = 0;
+    uint32_t n = 0;
+    uint32_t k = 0;
+
+    dir_open(dir_cluster,&dir);
+    p_slot = dir_slot(&dir,0,false);
+    while((p_slot != NULL) && (p_slot[0] != 0x00)) /* 0x00: end of directory */
+    {
+        if((p_slot[0] != 0xE5) && (p_slot[0x0B] != 0x0F) && ((p_slot[0x0B] & 0x08) == 0) &&
+           (memcmp(&p_slot[8],&short_name[8],3) == 0))
+        {
+            memcpy(entry,p_slot,11);
+            if(entry[0] == 0x05)
+            {
+                entry[0] = 0xE5;
+            }
+            for(tilde = 1;(tilde < 8) && (entry[tilde] != '~');tilde++)
+            {
+                /* just check, don't do anything */
+            }
+            for(k = tilde + 1,n = 0;(k < 8) && (entry[k] >= '0') && (entry[k] <= '9');k++)
+            {
+                n = n * 10 + (entry[k] - '0');
+            }
+            /* "~N" ends the name, N has no leading zero and the characters before it are the same */
+            if((tilde < 8) && (k > (tilde + 1)) && (entry[tilde + 1] != '0') && ((k == 8) || (entry[k] == ' ')) &&
+               (tilde == ((base_length < (8 - (k - tilde))) ? base_length : (8 - (k - tilde)))) &&
+               (memcmp(entry,short_name,tilde) == 0))
+            {
+                used[n / 8] |= (uint8_t)(1U << (n % 8));
+            }
+        }
+        index += 1;
+        p_slot = dir_slot(&dir,index,false);
+    }
+    dir_close(&dir);
+}
+
+static void set_entry_time(uint8_t* entry,bool created)
+{
+    time_t now = time(NULL);
+    struct tm* local = localtime(&now);
+    uint16_t fat_time = 0;
+    uint16_t fat_date = 0;
+
+    if(local != NULL)
+    {
+        fat_time = (local->tm_hour << 11) | (local->tm_min << 5) | (local->tm_sec / 2);
+        fat_date = ((local->tm_year - 80) << 9) | ((local->tm_mon + 1) << 5) | local->tm_mday;
+    }
+    entry[0x16] = fat_time & 0xFF;
+    entry[0x17] = fat_time >> 8;
+    entry[0x18] = fat_date & 0xFF;
+    entry[0x19] = fat_date >> 8;
+    entry[0x12] = fat_date & 0xFF;
+    entry[0x13] = fat_date >> 8;
+    if(created == true)
+    {
+        entry[0x0D] = 0;
+        entry[0x0E] = fat_time & 0xFF;
+        entry[0x0F] = fat_time >> 8;
+        entry[0x10] = fat_date & 0xFF;
+        entry[0x11] = fat_date >> 8;
+    }
+}
+
+static bool dir_add(uint32_t dir_cluster,const uint8_t* name,uint8_t attribute,uint32_t first_cluster,fat_location_t* location)
+{
+    bool retValue = true;
+    fat_dir_t dir;
+    uint8_t short_name[11];
+    uint8_t* p_slot = NULL;
+    uint8_t checksum = 0;
+    bool lossy = false;
+    uint32_t name_length = strlen(name);
+    uint32_t lfn_count = 0;
+    uint32_t needed = 0;
+    uint32_t start = 0;
+    uint32_t run = 0;
+    uint32_t index = 0;
+    uint32_t order = 0;
+    uint32_t position = 0;
+    uint32_t k = 0;
+
+    retValue = make_short_name(dir_cluster,name,short_name,&lossy);
+    if(lossy == true)
+    {
+        lfn_count = (name_length + FAT_LFN_CHARS - 1) / FAT_LFN_CHARS;
+    }
+    needed = lfn_count + 1;
+
+    /* find "needed" free slots in a row, extending the directory when it is full */
+    dir_open(dir_cluster,&dir);
+    while((retValue == true) && (run < needed))
+    {
+        p_slot = dir_slot(&dir,index,false);
+        if(p_slot == NULL)
+        {
+            retValue = dir_extend(&dir);
+        }
+        else
+        {
+            if((p_slot[0] == 0x00) || (p_slot[0] == 0xE5))
+            {
+                if(run == 0)
+                {
+                    start = index;
+                }
+                run += 1;
+            }
+            else
+            {
+                run = 0;
+            }
+            index += 1;
+        }
+    }
+
+    if(retValue == true)
+    {
+        checksum = lfn_checksum(short_name);
+        for(k = 0;k < lfn_count;k++)
+        {
+            /* long filename entries are stored last part first */
+            order = lfn_count - k;
+            p_slot = dir_slot(&dir,start + k,true);
+            memset(p_slot,0,FAT_DIR_ENTRY_SIZE);
+            p_slot[0] = order | ((k == 0) ? 0x40 : 0x00);
+            p_slot[0x0B] = 0x0F;
+            p_slot[0x0D] = checksum;
+            for(index = 0;index < FAT_LFN_CHARS;index++)
+            {
+                position = (order - 1) * FAT_LFN_CHARS + index;
+                if(position < name_length)
+                {
+                    p_slot[g_lfn_offsets[index]] = name[position];
+                }
+                else if(position > name_length) /* padding after the terminating 0x0000 */
+                {
+                    p_slot[g_lfn_offsets[index]] = 0xFF;
+                    p_slot[g_lfn_offsets[index] + 1] = 0xFF;
+                }
+            }
+        }
+
+        p_slot = dir_slot(&dir,start + lfn_count,true);
+        memset(p_slot,0,FAT_DIR_ENTRY_SIZE);
+        memcpy(p_slot,short_name,11);
+        p_slot[0x0B] = attribute;
+        set_entry_time(p_slot,true);
+        p_slot[0x14] = (first_cluster >> 16) & 0xFF;
+        p_slot[0x15] = (first_cluster >> 24) & 0xFF;
+        p_slot[0x1A] = first_cluster & 0xFF;
+        p_slot[0x1B] = (first_cluster >> 8) & 0xFF;
+
+        location->dir_cluster = dir_cluster;
+        location->index = start + lfn_count;
+        location->lfn_count = lfn_count;
+        location->attribute = attribute;
+        location->first_cluster = first_cluster;
+        location->size = 0;
+    }
+    dir_close(&dir);
+    return retValue;
+}
+
+static void dir_update(const fat_location_t* location)
+{
+    fat_dir_t dir;
+    uint8_t* p_slot = NULL;
+
+    dir_open(location->dir_cluster,&dir);
+    p_slot = dir_slot(&dir,location->index,true);
+    if(p_slot != NULL)
+    {
+        p_slot[0x14] = (location->first_cluster >> 16) & 0xFF;
+        p_slot[0x15] = (location->first_cluster >> 24) & 0xFF;
+        p_slot[0x1A] = location->first_cluster & 0xFF;
+        p_slot[0x1B] = (location->first_cluster >> 8) & 0xFF;
+        p_slot[0x1C] = location->size & 0xFF;
+        p_slot[0x1D] = (location->size >> 8) & 0xFF;
+        p_slot[0x1E] = (location->size >> 16) & 0xFF;
+        p_slot[0x1F] = (location->size >> 24) & 0xFF;
+        set_entry_time(p_slot,false);
+    }
+    dir_close(&dir);
+}
+
+static bool write_range(fat_location_t* location,uint32_t offset,const uint8_t* buff,uint32_t size)
+{
+    bool retValue = true;
+    uint32_t cluster_bytes = fat.bytes_per_sector * fat.sectors_per_cluster;
+    uint32_t have = 0;
+    uint32_t need = 0;
+    uint32_t last_cluster = 0;
+    uint32_t new_cluster = 0;
+    uint32_t current_cluster = 0;
+    uint32_t index = 0;
+    uint32_t position = 0;
+    uint32_t done = 0;
+    uint32_t n = 0;
+    uint8_t* p_block = NULL;
+
+    if((size == 0) || ((offset + size) < offset)) /* nothing to do or beyond 4 GiB */
+    {
+        return (size == 0);
+    }
+
+    /* the chain of the last write is known, only walk a chain seen for the first time */
+    if((g_cursor.clusters == 0) || (g_cursor.first_cluster != location->first_cluster))
+    {
+        fat_count_fragments(location->first_cluster,&have);
+        g_cursor.first_cluster = location->first_cluster;
+        g_cursor.clusters = have;
+        g_cursor.last_cluster = (have > 0) ? chain_cluster(location->first_cluster,have - 1) : 0;
+        g_cursor.index = 0;
+        g_cursor.cluster = location->first_cluster;
+    }
+    have = g_cursor.clusters;
+    last_cluster = g_cursor.last_cluster;
+
+    need = (offset + size + cluster_bytes - 1) / cluster_bytes;
+    if(need > have)
+    {
+        new_cluster = alloc_chain(need - have,(last_cluster != 0) ? (last_cluster + 1) : g_next_free,&last_cluster);
+        if(new_cluster == 0)
+        {
+            retValue = false;
+        }
+        else if(g_cursor.last_cluster != 0)
+        {
+            set_fat_entry(g_cursor.last_cluster,new_cluster);
+        }
+        else
+        {
+            location->first_cluster = new_cluster;
+            g_cursor.first_cluster = new_cluster;
+            g_cursor.cluster = new_cluster;
+        }
+        if(retValue == true)
+        {
+            g_cursor.clusters = need;
+            g_cursor.last_cluster = last_cluster;
+        }
+    }
+
+    if(retValue == true)
+    {
+        index = offset / cluster_bytes;
+        position = offset % cluster_bytes;
+        if(index >= g_cursor.index)
+        {
+            current_cluster = chain_cluster(g_cursor.cluster,index - g_cursor.index);
+        }
+        else
+        {
+            current_cluster = chain_cluster(location->first_cluster,index);
+        }
+        while(done < size)
+        {
+            n = cluster_bytes - position;
+            if(n > (size - done))
+            {
+                n = size - done;
+            }
+            /* new clusters and whole cluster writes don't need the old data */
+            p_block = cache_get(cluster_to_sector(current_cluster),fat.sectors_per_cluster,false,\
+                                (index < have) && (n != cluster_bytes),true);
+            if(buff != NULL)
+            {
+                memcpy(p_block + position,buff + done,n);
+            }
+            else
+            {
+                memset(p_block + position,0,n);
+            }
+            done += n;
+            position = 0;
+            index += 1;
+            if(done < size)
+            {
+                current_cluster = read_fat_entry(current_cluster);
+            }
+        }
+        g_cursor.index = index - 1;
+        g_cursor.cluster = current_cluster;
+    }
+    return retValue;
+}
+
+bool fat_create(const uint8_t* path)
+{
+    bool retValue = false;
+    uint8_t name[256];
+    uint32_t dir_cluster = 0;
+    fat_location_t location;
+
+    if((prepare_write() == true) && (path_lookup(path,&location) == false) &&\
+       (path_parent(path,&dir_cluster,name) == true))
+    {
+        retValue = dir_add(dir_cluster,name,0x20,0,&location);
+    }
+    return retValue;
+}
+
+bool fat_mkdir(const uint8_t* path)
+{
+    bool retValue = false;
+    uint8_t name[256];
+    uint8_t* p_block = NULL;
+    uint32_t dir_cluster = 0;
+    uint32_t new_cluster = 0;
+    fat_location_t location;
+
+    if((prepare_write() == true) && (path_lookup(path,&location) == false) &&\
+       (path_parent(path,&dir_cluster,name) == true))
+    {
+        new_cluster = alloc_chain(1,g_next_free,NULL);
+        if(new_cluster != 0)
+        {
+            /* "." and ".." entries, ".." of a root sub directory is 0 */
+            p_block = cache_get(cluster_to_sector(new_cluster),fat.sectors_per_cluster,true,false,true);
+            memcpy(p_block,".          ",11);
+            p_block[0x0B] = 0x10;
+            set_entry_time(p_block,true);
+            p_block[0x14] = (new_cluster >> 16) & 0xFF;
+            p_block[0x15] = (new_cluster >> 24) & 0xFF;
+            p_block[0x1A] = new_cluster & 0xFF;
+            p_block[0x1B] = (new_cluster >> 8) & 0xFF;
+
+            memcpy(p_block + FAT_DIR_ENTRY_SIZE,"..         ",11);
+            p_block[FAT_DIR_ENTRY_SIZE + 0x0B] = 0x10;
+            set_entry_time(p_block + FAT_DIR_ENTRY_SIZE,true);
+            p_block[FAT_DIR_ENTRY_SIZE + 0x14] = (dir_cluster >> 16) & 0xFF;
+            p_block[FAT_DIR_ENTRY_SIZE + 0x15] = (dir_cluster >> 24) & 0xFF;
+            p_block[FAT_DIR_ENTRY_SIZE + 0x1A] = dir_cluster & 0xFF;
+            p_block[FAT_DIR_ENTRY_SIZE + 0x1B] = (dir_cluster >> 8) & 0xFF;
+
+            retValue = dir_add(dir_cluster,name,0x10,new_cluster,&location);
+            if(retValue == false)
+            {
+                free_chain(new_cluster);
+            }
+        }
+    }
+    return retValue;
+}
+
+bool fat_write_file(const uint8_t* path,uint32_t offset,const uint8_t* buff,uint32_t size)
+{
+    bool retValue = false;
+    bool found = false;
+    fat_location_t location;
+
+    if((prepare_write() == true))
+    {
+        /* the next chunk of the file written last needs no path lookup */
+        if((g_cursor.path[0] != '\0') && (strcmp(g_cursor.path,path) == 0))
+        {
+            location = g_cursor.location;
+            found = true;
+        }
+        else
+        {
+            g_cursor.path[0] = '\0';
+            found = path_lookup(path,&location);
+        }
+    }
+    if((found == true) && ((location.attribute & 0x10) == 0))
+    {
+        retValue = true;
+        if(offset > location.size) /* zero fill the hole */
+        {
+            retValue = write_range(&location,location.size,NULL,offset - location.size);
+            if(retValue == true)
+            {
+                location.size = offset;
+            }
+        }
+        if(retValue == true)
+        {
+            retValue = write_range(&location,offset,buff,size);
+        }
+        if((retValue == true) && ((offset + size) > location.size))
+        {
+            location.size = offset + size;
+        }
+        dir_update(&location);
+        if(strlen(path) < FAT_MAX_PATH)
+        {
+            strcpy(g_cursor.path,path);
+            g_cursor.location = location;
+        }
+    }
+    return retValue;
+}
+
+bool fat_truncate(const uint8_t* path,uint32_t size)
+{
+    bool retValue = false;
+    uint32_t cluster_bytes = fat.bytes_per_sector * fat.sectors_per_cluster;
+    uint32_t keep = 0;
+    uint32_t last_cluster = 0;
+    uint32_t next_cluster = 0;
+    fat_location_t location;
+
+    /* the entry changes, the next write looks it up again */
+    g_cursor.path[0] = '\0';
+    if((prepare_write() == true) && (path_lookup(path,&location) == true) &&\
+       ((location.attribute & 0x10) == 0))
+    {
+        retValue = true;
+        if(size < location.size)
+        {
+            keep = (size + cluster_bytes - 1) / cluster_bytes;
+            if(keep == 0)
+            {
+                free_chain(location.first_cluster);
+                location.first_cluster = 0;
+            }
+            else
+            {
+                last_cluster = chain_cluster(location.first_cluster,keep - 1);
+                if(last_cluster != 0)
+                {
+                    next_cluster = read_fat_entry(last_cluster);
+                    set_fat_entry(last_cluster,g_end_of_file + 7);
+                    free_chain(next_cluster);
+                }
+            }
+            location.size = size;
+        }
+        else if(size > location.size)
+        {
+            retValue = write_range(&location,location.size,NULL,size - location.size);
+            if(retValue == true)
+            {
+                location.size = size;
+            }
+        }
+        dir_update(&location);
+    }
+    return retValue;
+}
+
+bool fat_delete(const uint8_t* path)
+{
+    bool retValue = false;
+    fat_dir_t dir;
+    uint8_t* p_slot = NULL;
+    uint32_t index = 0;
+    fat_location_t location;
+
+    /* the entry changes, the next write looks it up again */
+    g_cursor.path[0] = '\0';
+    if((prepare_write() == true) && (path_lookup(path,&location) == true) &&\
+       (((location.attribute & 0x10) == 0) || (location.first_cluster != 0))) /* not the root directory */
+    {
+        retValue = true;
+        if((location.attribute & 0x10) != 0)
+        {
+            /* only empty directories ("." and ".." only) can be deleted */
+            dir_open(location.first_cluster,&dir);
+            p_slot = dir_slot(&dir,0,false);
+            while((retValue == true) && (p_slot != NULL) && (p_slot[0] != 0x00))
+            {
+                if((p_slot[0] != 0xE5) && (p_slot[0] != '.') && (p_slot[0x0B] != 0x0F))
+                {
+                    retValue = false;
+                }
+                index += 1;
+                p_slot = dir_slot(&dir,index,false);
+            }
+            dir_close(&dir);
+        }
+
+        if(retValue == true)
+        {
+            free_chain(location.first_cluster);
+            dir_open(location.dir_cluster,&dir);
+            for(index = location.index - location.lfn_count;index <= location.index;index++)
+            {
+                p_slot = dir_slot(&dir,index,true);
+                p_slot[0] = 0xE5;
+            }
+            dir_close(&dir);
+        }
+    }
+    return retValue;
+}
+
+bool fat_sync(void)
+{
+    bool retValue = true;
+    uint8_t* p_buff = NULL;
+    uint16_t info_sector = 0;
+
+    if(g_writable == true)
+    {
+        /* the snapshot and name index describe the volume before this write, drop them */
+        if(g_sidecars_removed == false)
+        {
+            fat_remove_sidecars(g_image_path);
+            g_sidecars_removed = true;
+        }
+        /*
+         * data first, then every FAT copy, then the directory entries that point to them,
+         * each phase on the disk before the next one starts.
+         */
+        retValue = cache_flush(false);
+        if(kmc_sync() == false)
+        {
+            retValue = false;
+        }
+        if((flush_fat() == false) || (g_fat_lost == true))
+        {
+            retValue = false;
+        }
+        if(kmc_sync() == false)
+        {
+            retValue = false;
+        }
+        if(cache_flush(true) == false)
+        {
+            retValue = false;
+        }
+
+        /* FAT32 keeps a free cluster count and a next free hint in the FS info sector */
+        info_sector = READ_16_BITS(g_boot_info[0x30],g_boot_info[0x31]);
+        if((g_fat_changed == true) && (g_end_of_file == FAT_EOF_32) && (info_sector != 0) && (info_sector < fat.size_of_reserved_area))
+        {
+            p_buff = (uint8_t*)malloc(sizeof(uint8_t)*fat.bytes_per_sector);
+            check_null(p_buff);
+            if((kmc_read_sector(info_sector,p_buff) == fat.bytes_per_sector) && (p_buff[0] == 0x52) && (p_buff[1] == 0x52) &&\
+               (p_buff[2] == 0x61) && (p_buff[3] == 0x41))
+            {
+                p_buff[488] = g_free_clusters & 0xFF;
+                p_buff[489] = (g_free_clusters >> 8) & 0xFF;
+                p_buff[490] = (g_free_clusters >> 16) & 0xFF;
+                p_buff[491] = (g_free_clusters >> 24) & 0xFF;
+                p_buff[492] = g_next_free & 0xFF;
+                p_buff[493] = (g_next_free >> 8) & 0xFF;
+                p_buff[494] = (g_next_free >> 16) & 0xFF;
+                p_buff[495] = (g_next_free >> 24) & 0xFF;
+                if(kmc_write_sector(info_sector,p_buff) != fat.bytes_per_sector)
+                {
+                    retValue = false;
+                }
+            }
+            free(p_buff);
+            p_buff = NULL;
+        }
+        g_fat_changed = false;
+
+        if(kmc_sync() == false)
+        {
+            retValue = false;
+        }
+    }
+    return retValue;
+}
+
+static void free_entries(fat_entry** head_temp)
+{
+    fat_entry* current = *head_temp;
+    fat_entry* next = NULL;
+
+    while(current != NULL)
+    {
+        next = current->next;
+        free(current);
+        current = next;
+    }
+
+    *head_temp = NULL;
+}
+
+static void check_null(void* ptr)
+{
+    if(ptr == NULL)
+    {
+        exit(1);
+    }
+}
+
+bool fat_deinit(uint8_t* file_path)
+{
+    bool retValue = true;
+
+    if(fat_sync() == false)
+    {
+        retValue = false;
+    }
+    cache_free();
+    free_fat_table();
+    free_snapshot();
+    free_windows();
+    g_writable = false;
     if(!kmc_close_file(file_path))
     {
         retValue = false;
@@ -14,6 +14,7 @@
 #define DATE_DAY(a)                 ((a) & 0x001F)
 #define DATE_MONTH(a)               (((a) & 0x01E0) >> 5)
 #define DATE_YEAR(a)                ((((a) & 0xFE00) >> 9) + 1980)
+#define FAT_MAX_PATH                (1024U)
 
 enum Fat_Read_Result
 {
@@ -31,12 +32,12 @@ typedef struct
     uint16_t size_of_reserved_area;             /* 0x0E-0x0F (14-15)                        */
     uint32_t numbers_of_fats;                   /* 0x10 (16)                                */
     uint16_t max_root_entries;                  /* 0x11-0x12 (17-18), 0 for 32              */
-    uint32_t total_sectors;                     /* 0x13-0x14 (19-20), 0 for 32 (0x20-0x23)  */
+    uint32_t total_sectors;                     /* 0x13-0x14 (19-20), 0: 0x20-0x23 (32-35)  */
     uint8_t media_type;                         /* 0x15 (21)                                */
     uint32_t fat_size;                          /* 0x16-0x17 (22-23), 0 for 32 (0x24-0x27)  */
     uint16_t track_size;                        /* 0x18-0x19 (24-25)                        */
     uint16_t number_of_heads;                   /* 0x1A-0x1B (26-27)                        */
-    uint16_t number_of_hidden_sectors;          /* 0x1C-0x1D (28-29)                        */
+    uint32_t number_of_hidden_sectors;          /* 0x1C-0x1F (28-31)                        */
     uint8_t signature[2];                       /* 0x1FE-0x1FF (510-511)                    */
 } fat_boot_info_struct_t;
 
@@ -59,6 +60,86 @@ typedef struct entry
     struct entry* next;
 } fat_entry;
 
+typedef struct
+{
+    uint32_t bytes_per_cluster;                 /* cluster size (bytes)                     */
+    uint32_t total_clusters;                    /* data clusters, numbered 2..total+1       */
+    uint32_t free_clusters;                     /* FAT entry == 0                           */
+    uint32_t used_clusters;                     /* allocated, not bad                       */
+    uint32_t bad_clusters;                      /* FAT entry == bad cluster marker          */
+    uint32_t eoc_clusters;                      /* FAT entry >= EOC, one per chain          */
+    uint32_t free_runs;                         /* number of separate free extents          */
+    uint32_t largest_free_run;                  /* longest run of contiguous free clusters  */
+    uint32_t largest_free_run_start;            /* first cluster of that run                */
+} fat_volume_stat_struct_t;
+
+typedef struct
+{
+    uint32_t parent;                            /* node of the parent directory, root = 0   */
+    uint32_t first_child;                       /* children of a directory are contiguous   */
+    uint32_t child_count;
+    uint32_t name;                              /* offset of the name in the name table     */
+    uint32_t first_cluster;
+    uint32_t size;
+    uint16_t modified_time;
+    uint16_t modified_date;
+    uint8_t attribute;
+    uint8_t short_name[11];                     /* NAME    EXT (space padded)               */
+} fat_node_struct_t;
+
+typedef struct
+{
+    uint32_t bytes_per_sector;
+    uint32_t sectors_per_cluster;
+    uint32_t data_first_sector;                 /* first sector of cluster 2                */
+    uint32_t total_clusters;                    /* data clusters, numbered 2..total+1       */
+    uint32_t fat_bits;                          /* 12, 16 or 32                             */
+    uint32_t fat_count;                         /* number of FAT copies                     */
+    uint64_t volume_offset;                     /* byte offset of the volume in the image   */
+    uint32_t fat_first_sector;                  /* first sector of FAT table 1              */
+    uint32_t fat_sectors;                       /* sectors per FAT table                    */
+    uint32_t fat_entries;                       /* see fat_entry_count()                    */
+} fat_geometry_struct_t;
+
+typedef struct
+{
+    uint64_t image_size;                        /* size of the image (bytes)                */
+    int64_t image_mtime;                        /* modified time of the image (seconds)     */
+    int64_t image_mtime_ns;                     /* and its nanoseconds                      */
+    int64_t image_ctime;                        /* status change time of the image          */
+    int64_t image_ctime_ns;
+    uint64_t image_inode;                       /* replaced files get a new inode           */
+    uint64_t hash;                              /* FNV-1a of boot sector and FAT table 1    */
+} fat_volume_key_struct_t;
+
+/** @brief Callback used by fat_walk() for every file and directory of the volume.
+ * @param path - full path of the entry ("/DIR/FILE.TXT").
+ * @param entry - directory entry of the file or directory.
+ * @param arg - user pointer passed to fat_walk().
+ */
+typedef void (*fat_walk_callback_t)(const uint8_t* path,const fat_entry* entry,void* arg);
+
+typedef struct
+{
+    uint8_t name[256];                          /* recovered long name or "NAME.EXT"        */
+    uint8_t short_name[11];                     /* 8.3 name, lost first character is '_'    */
+    uint8_t lfn_parts;                          /* long name entries recovered (0 = none)   */
+    bool first_char_known;                      /* first character found from the checksum  */
+    bool in_deleted_dir;                        /* found inside a deleted directory         */
+    uint8_t attribute;                          /* attribute byte                           */
+    uint32_t first_cluster;                     /* first cluster (high word kept by FAT32)  */
+    uint32_t size;                              /* size (bytes)                             */
+    uint16_t modified_time;                     /* raw FAT time                             */
+    uint16_t modified_date;                     /* raw FAT date                             */
+} fat_deleted_struct_t;
+
+/** @brief Callback of fat_walk_deleted().
+ * @param dir_path - path of the directory that holds the entry ("" for root).
+ * @param entry - recovered entry.
+ * @param arg - user pointer passed to fat_walk_deleted().
+ */
+typedef void (*fat_deleted_callback_t)(const uint8_t* dir_path,const fat_deleted_struct_t* entry,void* arg);
+
 /*******************************************************************************
 * API
 ******************************************************************************/
@@ -73,6 +154,33 @@ typedef struct entry
 bool fat_init(uint8_t* file_path,fat_entry** head_temp,uint8_t* boot_info);
 
 
+/** @brief Same as fat_init() but the file is opened for writing, so that
+ * fat_create(), fat_write_file(), fat_truncate(), fat_delete() and fat_mkdir() can be used.
+ * Changes are kept in a write-back cache until fat_sync() or fat_deinit(), FAT entries
+ * are changed in the windows lookups use, so the FAT is never decoded as a whole.
+ * @param file_path - file path from user.
+ * @param head_temp - a pointer to the linked list in fat.c for first time reading root.
+ * @param boot_info - store boot info data for further uses.
+ * @return - Return 1 if file was opened successfully or 0 if failed to open file.
+ */
+bool fat_init_rw(uint8_t* file_path,fat_entry** head_temp,uint8_t* boot_info);
+
+
+/** @brief This function makes the next mounts read and write the image with O_DIRECT
+ * (no page cache), falling back to buffered I/O where it is not supported.
+ * @param enable - 1 to bypass the page cache.
+ */
+void fat_set_direct_io(bool enable);
+
+
+/** @brief This function makes the next mounts use the volume that starts at a byte
+ * offset of the image (a partition of a disk image, see partition.h). Snapshots of
+ * such a volume are saved as "<image>@<offset>.snap".
+ * @param offset - byte offset of the volume, 0 for an image of one volume.
+ */
+void fat_set_volume_offset(uint64_t offset);
+
+
 /** @brief This function store data into a linked list pointer and an array.
  * @param option - user choice to open a directory or a file.
  * @param head_temp - a pointer to the linked list in fat.c.
@@ -82,7 +190,293 @@ bool fat_init(uint8_t* file_path,fat_entry** head_temp,uint8_t* boot_info);
 uint8_t fat_read(uint32_t option,fat_entry** head_temp,uint8_t** buff_file);
 
 
-/** @brief This function will call a function in HAL.c to close a file.
+/** @brief This function scans the whole FAT once and counts free, used, bad and
+ * EOC entries as well as the free extents of the volume.
+ * @param stat - structure to store the result.
+ * @return - Return 1 if the FAT was scanned or 0 if it could not be loaded.
+ */
+bool fat_get_volume_stat(fat_volume_stat_struct_t* stat);
+
+
+/** @brief This function returns the FAT entry of a cluster (next cluster of a chain).
+ * @param cluster - cluster number.
+ * @return - Return the FAT entry or 0 if the cluster is out of range.
+ */
+uint32_t fat_next_cluster(uint32_t cluster);
+
+
+/** @brief This function returns the decoded FAT (entry i is the FAT entry of cluster i).
+ * The table has total clusters + 2 entries, so EOC and bad markers are always
+ * larger than the last index. It is valid until the volume is unmounted or written.
+ * The whole FAT is read and decoded (4 bytes per cluster) unless a snapshot is attached;
+ * other functions read the FAT in windows, use fat_get_entries() to scan it in parts.
+ * @param entries - stores the number of entries.
+ * @return - Return the table or NULL if the FAT could not be loaded.
+ */
+const uint32_t* fat_get_table(uint32_t* entries);
+
+
+/** @brief This function returns the number of FAT entries (total clusters + 2, limited
+ * to what FAT table 1 can hold) without reading the FAT.
+ * @return - Return the number of entries, 0 if no volume is mounted.
+ */
+uint32_t fat_entry_count(void);
+
+
+/** @brief This function compares FAT table 1 with the other FAT copies, a few
+ * sectors at a time.
+ * @return - Return the number of sectors of the other copies that differ from
+ * FAT table 1 (or could not be read), 0 if every copy matches.
+ */
+uint32_t fat_compare_copies(void);
+
+
+/** @brief This function copies part of the FAT, read on demand in windows, so that
+ * a large volume can be scanned in constant memory. It can be called from several threads.
+ * @param first - first cluster.
+ * @param count - number of entries.
+ * @param table - an array of at least count entries.
+ * @return - Return the number of entries copied (less than count at the end of the FAT).
+ */
+uint32_t fat_get_entries(uint32_t first,uint32_t count,uint32_t* table);
+
+
+/** @brief This function reads part of the FAT of a volume that may no longer be mounted,
+ * through a handle of kmc_open_handle() and the layout copied by fat_get_geometry().
+ * It keeps no state, so it can be called from several threads with their own handles.
+ * @param handle - open handle of the image.
+ * @param geometry - layout of the volume.
+ * @param first - first cluster.
+ * @param count - number of entries.
+ * @param table - an array of at least count entries.
+ * @return - Return the number of entries read (0 if the FAT could not be read).
+ */
+uint32_t fat_read_handle_entries(FILE* handle,const fat_geometry_struct_t* geometry,uint32_t first,uint32_t count,uint32_t* table);
+
+
+/** @brief This function checks if a FAT entry marks the end of a cluster chain.
+ * @param value - FAT entry.
+ * @return - Return 1 if the value is an EOC (or bad cluster) marker.
+ */
+bool fat_is_eoc(uint32_t value);
+
+
+/** @brief This function follows a cluster chain and counts its fragments
+ * (runs of contiguous clusters).
+ * @param first_cluster - first cluster of the chain.
+ * @param clusters - if not NULL, stores the number of clusters in the chain.
+ * @return - Return the number of fragments (0 for an empty chain).
+ */
+uint32_t fat_count_fragments(uint32_t first_cluster,uint32_t* clusters);
+
+
+/** @brief This function returns the size of a cluster in bytes.
+ * @return - Return bytes per cluster.
+ */
+uint32_t fat_cluster_size(void);
+
+
+/** @brief This function returns the first cluster of the root directory.
+ * @return - Return the root cluster (FAT32) or 0 if the root is not in the data region.
+ */
+uint32_t fat_root_cluster(void);
+
+
+/** @brief This function copies the layout of the mounted volume, so that clusters can
+ * still be located after fat_deinit() (e.g. by a reader with its own file handle).
+ * @param geometry - stores sector size, cluster size and start of the data region.
+ */
+void fat_get_geometry(fat_geometry_struct_t* geometry);
+
+
+/** @brief This function reads the next part of a cluster chain, contiguous clusters
+ * are read with one request. It can be called from several threads at once on a
+ * read only volume.
+ * @param cluster - cluster to start from, updated to the cluster that follows
+ * the part that was read (0 at the end of the chain).
+ * @param buff - an array of at least max_clusters * fat_cluster_size() bytes.
+ * @param max_clusters - maximum number of clusters to read.
+ * @return - Return a number of total bytes read.
+ */
+uint32_t fat_read_clusters(uint32_t* cluster,uint8_t* buff,uint32_t max_clusters);
+
+
+/** @brief This function visits every file and directory of the volume (depth first)
+ * without changing the entry list used by fat_read(). The attached snapshot is used
+ * when there is one.
+ * @param callback - function called for each entry.
+ * @param arg - user pointer passed to the callback.
+ * @return - Return 1 if the whole tree was visited.
+ */
+bool fat_walk(fat_walk_callback_t callback,void* arg);
+
+
+/** @brief This function visits every deleted (0xE5) entry of the volume. Directories
+ * are searched depth first; deleted directories are searched too if their first cluster
+ * is still free and still looks like a directory.
+ * @param callback - function called for each deleted entry.
+ * @param arg - user pointer passed to the callback.
+ * @return - Return 1 if every directory was read.
+ */
+bool fat_walk_deleted(fat_deleted_callback_t callback,void* arg);
+
+
+/** @brief This function reads clusters without following the FAT (deleted or free data).
+ * @param cluster - first cluster.
+ * @param count - number of contiguous clusters.
+ * @param buff - an array of at least count * fat_cluster_size() bytes.
+ * @return - Return a number of total bytes read (0 if the range is outside the volume).
+ */
+uint32_t fat_read_raw_clusters(uint32_t cluster,uint32_t count,uint8_t* buff);
+
+
+/** @brief This function tells if clusters lie in a hole of a sparse image (never written,
+ * they read as zeros), so scans of free space can skip them.
+ * @param cluster - first cluster.
+ * @param count - number of contiguous clusters.
+ * @param run - stores how many clusters from cluster (at most count) are all hole, or hold data.
+ * @return - Return 1 if the first cluster is all hole.
+ */
+bool fat_cluster_hole(uint32_t cluster,uint32_t count,uint32_t* run);
+
+
+/** @brief This function builds the display name of an entry (long name or "NAME.EXT").
+ * @param entry - directory entry.
+ * @param name - an array (at least 256 bytes) to store the name.
+ */
+void fat_entry_name(const fat_entry* entry,uint8_t* name);
+
+
+/** @brief This function returns the first cluster of an entry.
+ * @param entry - directory entry.
+ * @return - Return the first cluster (0 for an empty file).
+ */
+uint32_t fat_entry_cluster(const fat_entry* entry);
+
+
+/** @brief This function reads the entries of one directory, not of its sub directories.
+ * It keeps no state, so several threads can list directories of the mounted volume at once.
+ * @param cluster - first cluster of the directory, 0 = root.
+ * @param head_temp - stores the linked list (release it with fat_free_entries()).
+ * @return - Return the number of bytes of the directory that were read.
+ */
+uint32_t fat_list_dir(uint32_t cluster,fat_entry** head_temp);
+
+
+/** @brief This function releases a list of fat_list_dir().
+ * @param head_temp - head of the list, set to NULL.
+ */
+void fat_free_entries(fat_entry** head_temp);
+
+
+/** @brief This function computes what files saved next to an image are keyed on (the
+ * snapshot, the find index): size, inode, modified and change times (nanoseconds) of
+ * the image and a hash of the boot sector and FAT table 1 of the mounted volume.
+ * @param file_path - file path from user (same as fat_init()).
+ * @param key - stores the key.
+ * @return - Return 1 if the image and its FAT could be read.
+ */
+bool fat_volume_key(uint8_t* file_path,fat_volume_key_struct_t* key);
+
+
+/** @brief This function names a file saved next to the image for the mounted volume:
+ * "<file_path><extension>", or "<file_path>@<offset><extension>" for a partition.
+ * @param file_path - file path from user (same as fat_init()).
+ * @param extension - e.g. ".snap".
+ * @param path - an array of FAT_MAX_PATH bytes to store the result.
+ * @return - Return 1 if the name fits.
+ */
+bool fat_sidecar_path(uint8_t* file_path,const uint8_t* extension,uint8_t* path);
+
+
+/** @brief This function deletes the files saved next to the image for the mounted
+ * volume (".snap", ".find"). fat_sync() calls it before the first write of a volume
+ * opened with fat_init_rw().
+ * @param file_path - file path from user (same as fat_init()).
+ */
+void fat_remove_sidecars(uint8_t* file_path);
+
+
+/** @brief This function attaches a metadata snapshot ("<file_path>.snap") to the volume:
+ * the decoded FAT and the whole directory tree in one flat file that is mapped into memory.
+ * The snapshot is used only if image size, modified time and a hash of the boot sector
+ * and FAT match, otherwise it is rebuilt (if create is 1). fat_walk() and every FAT
+ * lookup then use the snapshot instead of reading the disk. Not used on writable volumes.
+ * @param file_path - file path from user (same as fat_init()).
+ * @param create - build and save the snapshot when it is missing or out of date.
+ * @return - Return 1 if a snapshot is attached.
+ */
+bool fat_snapshot_attach(uint8_t* file_path,bool create);
+
+
+/** @brief This function returns the directory tree of the attached snapshot.
+ * Node 0 is the root directory.
+ * @param count - stores the number of nodes.
+ * @param names - stores the name table (node.name is an offset in it).
+ * @return - Return the node array or NULL if no snapshot is attached.
+ */
+const fat_node_struct_t* fat_get_nodes(uint32_t* count,const uint8_t** names);
+
+
+/** @brief This function builds the display name of a snapshot node (long name or "NAME.EXT").
+ * @param node - node of the tree.
+ * @param names - name table the node belongs to.
+ * @param name - an array (at least 256 bytes) to store the name.
+ */
+void fat_node_name(const fat_node_struct_t* node,const uint8_t* names,uint8_t* name);
+
+
+/** @brief This function creates an empty file ("/DIR/NEW FILE.TXT").
+ * Long filename entries are added when the name is not a valid 8.3 name.
+ * @param path - full path of the new file, its directory must exist.
+ * @return - Return 1 if the file was created or 0 if it exists or there is no space.
+ */
+bool fat_create(const uint8_t* path);
+
+
+/** @brief This function creates an empty directory.
+ * @param path - full path of the new directory, its parent must exist.
+ * @return - Return 1 if the directory was created.
+ */
+bool fat_mkdir(const uint8_t* path);
+
+
+/** @brief This function writes data into a file, the file grows when needed
+ * (bytes between the old end and offset are zero).
+ * New clusters are taken from a contiguous free run when possible.
+ * @param path - full path of an existing file.
+ * @param offset - first byte to write.
+ * @param buff - an array that stores data.
+ * @param size - number of bytes.
+ * @return - Return 1 if data was written (into the cache).
+ */
+bool fat_write_file(const uint8_t* path,uint32_t offset,const uint8_t* buff,uint32_t size);
+
+
+/** @brief This function changes the size of a file, freeing or zero filling clusters.
+ * @param path - full path of an existing file.
+ * @param size - new size (bytes).
+ * @return - Return 1 if the size was changed.
+ */
+bool fat_truncate(const uint8_t* path,uint32_t size);
+
+
+/** @brief This function deletes a file or an empty directory.
+ * @param path - full path of the entry.
+ * @return - Return 1 if the entry was deleted.
+ */
+bool fat_delete(const uint8_t* path);
+
+
+/** @brief This function writes every pending change in one ordered pass:
+ * data clusters, then all FAT copies, then directory sectors (and the FAT32 FS info sector).
+ * @return - Return 1 if everything was written.
+ */
+bool fat_sync(void);
+
+
+/** @brief This function will call a function in HAL.c to close a file,
+ * pending changes of a writable volume are written first.
  * @param file_path - file path from user.
  * @return - Return 1 if file was closed successfully or 0 if failed to close file.
  */
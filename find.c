@@ -0,0 +1,1299 @@
+/*******************************************************************************
+* Includes
+******************************************************************************/
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include "fat.h"
+#include "pool.h"
+#include "find.h"
+
+/*******************************************************************************
+* Definitions
+******************************************************************************/
+#define FIND_MAGIC                  "KMCFIND2"
+#define FIND_MAX_DEPTH              (64U)       /* deepest directory level listed (looped directories) */
+#define FIND_GROW                   (4096U)     /* entries added to a list per realloc()               */
+#define FIND_CHUNK                  (4096U)     /* entries per trigram task                            */
+#define FIND_MAX_QUERY_TRIGRAMS     (64U)       /* trigrams of a pattern used to pick candidates       */
+#define FIND_NAME_TRIGRAMS          (280U)      /* trigrams of a long name plus its 8.3 name           */
+#define FIND_NONE                   (0xFFFFFFFFU)
+#define FIND_ALIGN(a)               (((a) + 7) & ~(uint64_t)7)
+
+typedef struct
+{
+    uint8_t magic[8];                           /* FIND_MAGIC                               */
+    fat_volume_key_struct_t key;                /* volume the index was saved from          */
+    uint32_t count;                             /* entries                                  */
+    uint32_t trigram_count;
+    uint32_t posting_count;
+    uint32_t text_size;
+    uint64_t entries_offset;                    /* offsets from the start of the file       */
+    uint64_t trigrams_offset;
+    uint64_t postings_offset;
+    uint64_t text_offset;
+    uint64_t size;                              /* size of the file                         */
+} find_header_t;
+
+typedef struct
+{
+    find_entry_struct_t* entries;               /* parents before children while building   */
+    uint32_t* first_child;                      /* children of an entry are contiguous      */
+    uint32_t* child_count;
+    uint32_t count;
+    uint32_t capacity;
+    uint8_t* text;
+    uint32_t text_size;
+    uint32_t text_capacity;
+} find_tree_struct_t;
+
+typedef struct
+{
+    const uint32_t* clusters;                   /* directories of one level of the tree     */
+    fat_entry** lists;                          /* their entries                            */
+} find_level_struct_t;
+
+typedef struct
+{
+    const find_entry_struct_t* entries;         /* entries in pre-order                     */
+    const uint8_t* text;
+    uint32_t count;
+    uint64_t** pairs;                           /* per chunk: trigram << 32 | entry, sorted */
+    uint32_t* pair_count;
+    uint32_t chunks;
+    uint32_t step;                              /* merge round: chunk 2*i*step and the next */
+} find_trigram_job_struct_t;
+
+/*******************************************************************************
+* Prototypes
+******************************************************************************/
+
+/** @brief This function adds an entry under a directory of the tree being built.
+ * @param tree - tree.
+ * @param parent - entry of the directory.
+ * @param name - long name (or 8.3 name if it has none).
+ * @param short_name - 8.3 name as "NAME.EXT".
+ * @param first_cluster - first cluster.
+ * @param size - size (bytes).
+ * @param attribute - attribute byte.
+ * @return - Return 1 if the entry was added, 0 if its path is too long.
+ */
+static bool add_entry(find_tree_struct_t* tree,uint32_t parent,const uint8_t* name,const uint8_t* short_name,
+                      uint32_t first_cluster,uint32_t size,uint8_t attribute);
+
+
+/** @brief This function lists the tree level by level, the directories of a level are
+ * read by a pool of threads.
+ * @param tree - tree that holds the root.
+ * @param threads - number of threads.
+ * @return - Return 1 if every directory could be read.
+ */
+static bool build_from_disk(find_tree_struct_t* tree,uint32_t threads);
+
+
+/** @brief This function lists one directory of a level (pool task).
+ * @param index - directory number in the level.
+ * @param worker - thread number (not used).
+ * @param arg - pointer to a find_level_struct_t.
+ */
+static void list_level(uint32_t index,uint32_t worker,void* arg);
+
+
+/** @brief This function copies the tree of the attached snapshot.
+ * @param tree - tree that holds the root.
+ * @param nodes - nodes of the snapshot.
+ * @param count - number of nodes.
+ * @param names - name table of the snapshot.
+ * @return - Return 1 if every entry was added.
+ */
+static bool build_from_snapshot(find_tree_struct_t* tree,const fat_node_struct_t* nodes,uint32_t count,const uint8_t* names);
+
+
+/** @brief This function converts a space padded 8.3 name into "NAME.EXT".
+ * @param raw - 11 bytes, name then extension.
+ * @param name - an array of 13 bytes to store the result.
+ */
+static void short_display(const uint8_t* raw,uint8_t* name);
+
+
+/** @brief This function renumbers the tree in pre-order (a sub tree is a range of
+ * entries), collects the trigrams and packs the index into one block.
+ * @param tree - tree built by build_from_disk() or build_from_snapshot().
+ * @param threads - number of threads.
+ * @param index - stores the index.
+ */
+static void pack_index(find_tree_struct_t* tree,uint32_t threads,find_index_struct_t* index);
+
+
+/** @brief This function collects the trigrams of one chunk of entries and sorts them (pool task).
+ * @param index - chunk number.
+ * @param worker - thread number (not used).
+ * @param arg - pointer to a find_trigram_job_struct_t.
+ */
+static void collect_trigrams(uint32_t index,uint32_t worker,void* arg);
+
+
+/** @brief This function merges two sorted chunks of trigrams (pool task).
+ * @param index - merge number in the round.
+ * @param worker - thread number (not used).
+ * @param arg - pointer to a find_trigram_job_struct_t.
+ */
+static void merge_trigrams(uint32_t index,uint32_t worker,void* arg);
+
+
+/** @brief This function appends the trigrams of a name, lower case.
+ * @param name - name.
+ * @param length - number of bytes of the name to use.
+ * @param trigrams - where to append.
+ * @return - Return the number of trigrams appended.
+ */
+static uint32_t name_trigrams(const uint8_t* name,uint32_t length,uint32_t* trigrams);
+
+
+/** @brief This function finds the postings of a trigram.
+ * @param index - index.
+ * @param trigram - trigram.
+ * @return - Return the trigram entry (its postings end at the next one) or NULL.
+ */
+static const find_trigram_struct_t* lookup_trigram(const find_index_struct_t* index,uint32_t trigram);
+
+
+/** @brief This function checks if a text contains a substring.
+ * @param text - text.
+ * @param sub - substring.
+ * @param ignore_case - 1 to ignore the case of ASCII letters.
+ * @return - Return 1 if sub is found.
+ */
+static bool contains(const uint8_t* text,const uint8_t* sub,bool ignore_case);
+
+
+/** @brief This function matches a text against a glob, '*' and '?' don't match '/', "**" does.
+ * @param pattern - glob.
+ * @param text - text.
+ * @param ignore_case - 1 to ignore the case of ASCII letters.
+ * @return - Return 1 if the whole text matches.
+ */
+static bool glob_match(const uint8_t* pattern,const uint8_t* text,bool ignore_case);
+
+
+/** @brief This function matches a full path against a glob, a pattern that doesn't start
+ * with '/' may match the end of the path from any directory on.
+ * @param pattern - glob.
+ * @param path - full path.
+ * @param ignore_case - 1 to ignore the case of ASCII letters.
+ * @return - Return 1 if the path matches.
+ */
+static bool glob_path(const uint8_t* pattern,const uint8_t* path,bool ignore_case);
+
+
+/** @brief This function compares two texts of the same length.
+ * @param a - first text.
+ * @param b - second text.
+ * @param length - number of bytes.
+ * @param ignore_case - 1 to ignore the case of ASCII letters.
+ * @return - Return 1 if they are the same.
+ */
+static bool same_text(const uint8_t* a,const uint8_t* b,uint32_t length,bool ignore_case);
+
+
+/** @brief This function matches one character against one element of a glob
+ * (literal, '?' or bracket expression) and moves the pattern past it.
+ * @param pattern - pointer to the pattern, moved past the element.
+ * @param c - character of the text.
+ * @param ignore_case - 1 to ignore the case of ASCII letters.
+ * @return - Return 1 if the character matches.
+ */
+static bool glob_one(const uint8_t** pattern,uint8_t c,bool ignore_case);
+
+
+/** @brief qsort() helpers. */
+static int compare_pair(const void* a,const void* b);
+static int compare_trigram(const void* a,const void* b);
+
+
+/** @brief This function checks a loaded index, so that a damaged file can't make
+ * find_query() read outside of it.
+ * @param index - index read by find_load().
+ * @return - Return 1 if every offset and entry number is inside the index.
+ */
+static bool check_index(const find_index_struct_t* index);
+
+
+/** @brief This function checks the malloc value.
+ * @param ptr - pointer of malloc.
+ */
+static void check_null(void* ptr);
+
+/*******************************************************************************
+* Code
+******************************************************************************/
+bool find_build(find_index_struct_t* index,uint32_t threads)
+{
+    bool retValue = true;
+    find_tree_struct_t tree;
+    const fat_node_struct_t* nodes = NULL;
+    const uint8_t* names = NULL;
+    uint32_t node_count = 0;
+
+    memset(index,0,sizeof(find_index_struct_t));
+    memset(&tree,0,sizeof(tree));
+    if(threads == 0)
+    {
+        threads = pool_default_threads();
+    }
+
+    /* root: empty path, entry 0 */
+    tree.capacity = FIND_GROW;
+    tree.entries = (find_entry_struct_t*)malloc(sizeof(find_entry_struct_t)*tree.capacity);
+    check_null(tree.entries);
+    tree.first_child = (uint32_t*)malloc(sizeof(uint32_t)*tree.capacity);
+    check_null(tree.first_child);
+    tree.child_count = (uint32_t*)malloc(sizeof(uint32_t)*tree.capacity);
+    check_null(tree.child_count);
+    tree.text_capacity = FIND_GROW * 16;
+    tree.text = (uint8_t*)malloc(sizeof(uint8_t)*tree.text_capacity);
+    check_null(tree.text);
+    memset(&tree.entries[0],0,sizeof(find_entry_struct_t));
+    tree.entries[0].attribute = 0x10;
+    tree.first_child[0] = 0;
+    tree.child_count[0] = 0;
+    tree.text[0] = '\0';
+    tree.text_size = 1;
+    tree.count = 1;
+
+    /* an attached snapshot already holds the tree, no directory has to be read */
+    nodes = fat_get_nodes(&node_count,&names);
+    if((nodes != NULL) && (node_count > 0))
+    {
+        retValue = build_from_snapshot(&tree,nodes,node_count,names);
+    }
+    else
+    {
+        retValue = build_from_disk(&tree,threads);
+    }
+    pack_index(&tree,threads,index);
+
+    free(tree.entries);
+    free(tree.first_child);
+    free(tree.child_count);
+    free(tree.text);
+    return retValue;
+}
+
+static bool add_entry(find_tree_struct_t* tree,uint32_t parent,const uint8_t* name,const uint8_t* short_name,
+                      uint32_t first_cluster,uint32_t size,uint8_t attribute)
+{
+    bool retValue = true;
+    find_entry_struct_t* entry = NULL;
+    uint32_t parent_length = strlen((const char*)(tree->text + tree->entries[parent].path));
+    uint32_t parent_short_length = strlen((const char*)(tree->text + tree->entries[parent].short_path));
+    uint32_t name_length = strlen((const char*)name);
+    uint32_t short_length = strlen((const char*)short_name);
+    uint32_t id = tree->count;
+
+    if(((parent_length + 1 + name_length) >= FAT_MAX_PATH) || ((parent_short_length + 1 + short_length) >= FAT_MAX_PATH))
+    {
+        retValue = false;
+    }
+    else
+    {
+        if(tree->count == tree->capacity)
+        {
+            tree->capacity += FIND_GROW;
+            tree->entries = (find_entry_struct_t*)realloc(tree->entries,sizeof(find_entry_struct_t)*tree->capacity);
+            check_null(tree->entries);
+            tree->first_child = (uint32_t*)realloc(tree->first_child,sizeof(uint32_t)*tree->capacity);
+            check_null(tree->first_child);
+            tree->child_count = (uint32_t*)realloc(tree->child_count,sizeof(uint32_t)*tree->capacity);
+            check_null(tree->child_count);
+        }
+        while((tree->text_size + parent_length + name_length + parent_short_length + short_length + 4) > tree->text_capacity)
+        {
+            tree->text_capacity *= 2;
+            tree->text = (uint8_t*)realloc(tree->text,sizeof(uint8_t)*tree->text_capacity);
+            check_null(tree->text);
+        }
+
+        entry = &tree->entries[id];
+        entry->parent = parent;
+        entry->end = 0;
+        entry->first_cluster = first_cluster;
+        entry->size = size;
+        entry->attribute = attribute;
+        /* "<parent path>/<name>", for the long and the 8.3 names */
+        entry->path = tree->text_size;
+        memcpy(tree->text + tree->text_size,tree->text + tree->entries[parent].path,parent_length);
+        tree->text[tree->text_size + parent_length] = '/';
+        memcpy(tree->text + tree->text_size + parent_length + 1,name,name_length + 1);
+        entry->name = parent_length + 1;
+        tree->text_size += parent_length + name_length + 2;
+        entry->short_path = tree->text_size;
+        memcpy(tree->text + tree->text_size,tree->text + tree->entries[parent].short_path,parent_short_length);
+        tree->text[tree->text_size + parent_short_length] = '/';
+        memcpy(tree->text + tree->text_size + parent_short_length + 1,short_name,short_length + 1);
+        entry->short_name = parent_short_length + 1;
+        tree->text_size += parent_short_length + short_length + 2;
+
+        /* children of a directory are added one after the other */
+        if(tree->child_count[parent] == 0)
+        {
+            tree->first_child[parent] = id;
+        }
+        tree->child_count[parent] += 1;
+        tree->first_child[id] = 0;
+        tree->child_count[id] = 0;
+        tree->count += 1;
+    }
+    return retValue;
+}
+
+static bool build_from_disk(find_tree_struct_t* tree,uint32_t threads)
+{
+    bool retValue = true;
+    find_level_struct_t level;
+    uint32_t* p_level = NULL;                   /* entries of the directories of the level  */
+    uint32_t* p_clusters = NULL;
+    uint32_t* p_next = NULL;
+    uint32_t* p_next_clusters = NULL;
+    uint32_t* p_swap = NULL;
+    uint32_t level_count = 1;
+    uint32_t next_count = 0;
+    uint32_t capacity = FIND_GROW;
+    uint32_t entries = fat_entry_count();
+    uint8_t* p_visited = NULL;                  /* one bit per cluster of a listed directory */
+    uint32_t depth = 0;
+    uint32_t i = 0;
+    uint32_t cluster = 0;
+    fat_entry* temp = NULL;
+    uint8_t name[256];
+    uint8_t raw[11];
+    uint8_t short_name[13];
+
+    p_level = (uint32_t*)malloc(sizeof(uint32_t)*capacity);
+    check_null(p_level);
+    p_clusters = (uint32_t*)malloc(sizeof(uint32_t)*capacity);
+    check_null(p_clusters);
+    p_next = (uint32_t*)malloc(sizeof(uint32_t)*capacity);
+    check_null(p_next);
+    p_next_clusters = (uint32_t*)malloc(sizeof(uint32_t)*capacity);
+    check_null(p_next_clusters);
+    p_visited = (uint8_t*)calloc((entries / 8) + 1,sizeof(uint8_t));
+    check_null(p_visited);
+    if((fat_root_cluster() != 0) && (fat_root_cluster() < entries))
+    {
+        p_visited[fat_root_cluster() / 8] |= (1U << (fat_root_cluster() % 8));
+    }
+    p_level[0] = 0;
+    p_clusters[0] = 0;
+
+    while(level_count > 0)
+    {
+        level.clusters = p_clusters;
+        level.lists = (fat_entry**)calloc(level_count,sizeof(fat_entry*));
+        check_null(level.lists);
+        pool_run(level_count,threads,list_level,&level);
+
+        next_count = 0;
+        for(i = 0;i < level_count;i++)
+        {
+            for(temp = level.lists[i];temp != NULL;temp = temp->next)
+            {
+                if(((temp->attribute & 0x08) != 0) || (temp->SFN[0] == '.')) /* volume label, "." and ".." */
+                {
+                    continue;
+                }
+                fat_entry_name(temp,name);
+                memset(raw,' ',sizeof(raw));
+                memcpy(raw,temp->SFN,strlen((const char*)temp->SFN));
+                memcpy(raw + 8,temp->extension,strlen((const char*)temp->extension));
+                short_display(raw,short_name);
+                cluster = fat_entry_cluster(temp);
+                if(add_entry(tree,p_level[i],name,short_name,cluster,
+                             READ_32_BITS((uint32_t)temp->size[0],(uint32_t)temp->size[1],(uint32_t)temp->size[2],(uint32_t)temp->size[3]),
+                             temp->attribute) == false)
+                {
+                    retValue = false;
+                }
+                else if(((temp->attribute & 0x10) != 0) && (cluster >= 2) && (cluster < entries) &&
+                        ((p_visited[cluster / 8] & (1U << (cluster % 8))) == 0))
+                {
+                    if((depth + 1) >= FIND_MAX_DEPTH) /* looped directories on a damaged volume */
+                    {
+                        retValue = false;
+                        continue;
+                    }
+                    p_visited[cluster / 8] |= (1U << (cluster % 8));
+                    if(next_count == capacity)
+                    {
+                        capacity += FIND_GROW;
+                        p_level = (uint32_t*)realloc(p_level,sizeof(uint32_t)*capacity);
+                        check_null(p_level);
+                        p_clusters = (uint32_t*)realloc(p_clusters,sizeof(uint32_t)*capacity);
+                        check_null(p_clusters);
+                        p_next = (uint32_t*)realloc(p_next,sizeof(uint32_t)*capacity);
+                        check_null(p_next);
+                        p_next_clusters = (uint32_t*)realloc(p_next_clusters,sizeof(uint32_t)*capacity);
+                        check_null(p_next_clusters);
+                    }
+                    p_next[next_count] = tree->count - 1;
+                    p_next_clusters[next_count] = cluster;
+                    next_count += 1;
+                }
+            }
+            fat_free_entries(&level.lists[i]);
+        }
+        free(level.lists);
+
+        p_swap = p_level;
+        p_level = p_next;
+        p_next = p_swap;
+        p_swap = p_clusters;
+        p_clusters = p_next_clusters;
+        p_next_clusters = p_swap;
+        level_count = next_count;
+        depth += 1;
+    }
+
+    free(p_level);
+    free(p_clusters);
+    free(p_next);
+    free(p_next_clusters);
+    free(p_visited);
+    return retValue;
+}
+
+static void list_level(uint32_t index,uint32_t worker,void* arg)
+{
+    find_level_struct_t* level = (find_level_struct_t*)arg;
+
+    fat_list_dir(level->clusters[index],&level->lists[index]);
+}
+
+static bool build_from_snapshot(find_tree_struct_t* tree,const fat_node_struct_t* nodes,uint32_t count,const uint8_t* names)
+{
+    bool retValue = true;
+    uint32_t* p_map = NULL;                     /* node -> entry, FIND_NONE if left out     */
+    uint32_t i = 0;
+    uint8_t name[256];
+    uint8_t short_name[13];
+
+    p_map = (uint32_t*)malloc(sizeof(uint32_t)*count);
+    check_null(p_map);
+    p_map[0] = 0;
+    /* nodes are stored parents first and the children of a node are contiguous */
+    for(i = 1;i < count;i++)
+    {
+        p_map[i] = FIND_NONE;
+        if((nodes[i].parent < i) && (p_map[nodes[i].parent] != FIND_NONE))
+        {
+            fat_node_name(&nodes[i],names,name);
+            short_display(nodes[i].short_name,short_name);
+            if(add_entry(tree,p_map[nodes[i].parent],name,short_name,nodes[i].first_cluster,nodes[i].size,nodes[i].attribute) == true)
+            {
+                p_map[i] = tree->count - 1;
+            }
+            else
+            {
+                retValue = false;
+            }
+        }
+    }
+    free(p_map);
+    return retValue;
+}
+
+static void short_display(const uint8_t* raw,uint8_t* name)
+{
+    uint32_t length = 0;
+    uint32_t i = 0;
+
+    for(i = 0;(i < 8) && (raw[i] != ' ');i++)
+    {
+        name[length] = raw[i];
+        length += 1;
+    }
+    if((length > 0) && (name[0] == 0x05)) /* 0xE5 as first character is stored as 0x05 */
+    {
+        name[0] = 0xE5;
+    }
+    if(raw[8] != ' ')
+    {
+        name[length] = '.';
+        length += 1;
+        for(i = 8;(i < 11) && (raw[i] != ' ');i++)
+        {
+            name[length] = raw[i];
+            length += 1;
+        }
+    }
+    name[length] = '\0';
+}
+
+static void pack_index(find_tree_struct_t* tree,uint32_t threads,find_index_struct_t* index)
+{
+    find_trigram_job_struct_t job;
+    find_header_t* header = NULL;
+    find_entry_struct_t* p_entries = NULL;
+    uint32_t* p_order = NULL;                   /* pre-order number of every tree entry     */
+    uint32_t* p_subtree = NULL;                 /* entries in the sub tree of every entry   */
+    uint32_t* p_stack = NULL;
+    const uint64_t* p_pairs = NULL;
+    uint32_t pair_count = 0;
+    uint32_t stack_size = 0;
+    uint32_t count = tree->count;
+    uint32_t id = 0;
+    uint32_t n = 0;
+    uint32_t i = 0;
+    uint32_t trigram = 0;
+
+    /* sub tree sizes bottom up, parents always come before their children */
+    p_subtree = (uint32_t*)malloc(sizeof(uint32_t)*count);
+    check_null(p_subtree);
+    for(i = 0;i < count;i++)
+    {
+        p_subtree[i] = 1;
+    }
+    for(i = count - 1;i > 0;i--)
+    {
+        p_subtree[tree->entries[i].parent] += p_subtree[i];
+    }
+    /* pre-order numbers, first child on top of the stack */
+    p_order = (uint32_t*)malloc(sizeof(uint32_t)*count);
+    check_null(p_order);
+    p_stack = (uint32_t*)malloc(sizeof(uint32_t)*count);
+    check_null(p_stack);
+    p_stack[0] = 0;
+    stack_size = 1;
+    while(stack_size > 0)
+    {
+        stack_size -= 1;
+        id = p_stack[stack_size];
+        p_order[id] = n;
+        n += 1;
+        for(i = tree->child_count[id];i > 0;i--)
+        {
+            p_stack[stack_size] = tree->first_child[id] + i - 1;
+            stack_size += 1;
+        }
+    }
+    p_entries = (find_entry_struct_t*)malloc(sizeof(find_entry_struct_t)*count);
+    check_null(p_entries);
+    for(id = 0;id < count;id++)
+    {
+        p_entries[p_order[id]] = tree->entries[id];
+        p_entries[p_order[id]].parent = p_order[tree->entries[id].parent];
+        p_entries[p_order[id]].end = p_order[id] + p_subtree[id];
+    }
+    free(p_subtree);
+    free(p_order);
+    free(p_stack);
+
+    /* trigrams of every chunk in parallel, then sorted chunks merged two by two */
+    memset(&job,0,sizeof(job));
+    job.entries = p_entries;
+    job.text = tree->text;
+    job.count = count;
+    job.chunks = (count + FIND_CHUNK - 1) / FIND_CHUNK;
+    job.pairs = (uint64_t**)calloc(job.chunks,sizeof(uint64_t*));
+    check_null(job.pairs);
+    job.pair_count = (uint32_t*)calloc(job.chunks,sizeof(uint32_t));
+    check_null(job.pair_count);
+    pool_run(job.chunks,threads,collect_trigrams,&job);
+    for(job.step = 1;job.step < job.chunks;job.step *= 2)
+    {
+        pool_run((job.chunks + 2 * job.step - 1) / (2 * job.step),threads,merge_trigrams,&job);
+    }
+    p_pairs = job.pairs[0];
+    pair_count = job.pair_count[0];
+
+    memset(index,0,sizeof(find_index_struct_t));
+    index->count = count;
+    index->text_size = tree->text_size;
+    index->posting_count = pair_count;
+    for(i = 0;i < pair_count;i++)
+    {
+        if((i == 0) || ((p_pairs[i] >> 32) != (p_pairs[i - 1] >> 32)))
+        {
+            index->trigram_count += 1;
+        }
+    }
+
+    /* one block: header, entries, trigrams (plus end marker), postings, text */
+    index->storage_size = FIND_ALIGN(sizeof(find_header_t));
+    index->storage_size += FIND_ALIGN((uint64_t)sizeof(find_entry_struct_t) * count);
+    index->storage_size += FIND_ALIGN((uint64_t)sizeof(find_trigram_struct_t) * (index->trigram_count + 1));
+    index->storage_size += FIND_ALIGN((uint64_t)sizeof(uint32_t) * pair_count);
+    index->storage_size += FIND_ALIGN(index->text_size);
+    index->storage = (uint8_t*)calloc(index->storage_size,sizeof(uint8_t));
+    check_null(index->storage);
+    header = (find_header_t*)index->storage;
+    memcpy(header->magic,FIND_MAGIC,8);
+    header->count = count;
+    header->trigram_count = index->trigram_count;
+    header->posting_count = pair_count;
+    header->text_size = index->text_size;
+    header->entries_offset = FIND_ALIGN(sizeof(find_header_t));
+    header->trigrams_offset = header->entries_offset + FIND_ALIGN((uint64_t)sizeof(find_entry_struct_t) * count);
+    header->postings_offset = header->trigrams_offset + FIND_ALIGN((uint64_t)sizeof(find_trigram_struct_t) * (index->trigram_count + 1));
+    header->text_offset = header->postings_offset + FIND_ALIGN((uint64_t)sizeof(uint32_t) * pair_count);
+    header->size = index->storage_size;
+    index->entries = (find_entry_struct_t*)(index->storage + header->entries_offset);
+    index->trigrams = (find_trigram_struct_t*)(index->storage + header->trigrams_offset);
+    index->postings = (uint32_t*)(index->storage + header->postings_offset);
+    index->text = index->storage + header->text_offset;
+
+    memcpy(index->entries,p_entries,sizeof(find_entry_struct_t) * count);
+    memcpy(index->text,tree->text,tree->text_size);
+    n = 0;
+    for(i = 0;i < pair_count;i++)
+    {
+        trigram = (uint32_t)(p_pairs[i] >> 32);
+        if((i == 0) || (trigram != (uint32_t)(p_pairs[i - 1] >> 32)))
+        {
+            index->trigrams[n].trigram = trigram;
+            index->trigrams[n].first = i;
+            n += 1;
+        }
+        index->postings[i] = (uint32_t)p_pairs[i];
+    }
+    index->trigrams[n].trigram = FIND_NONE;
+    index->trigrams[n].first = pair_count;
+
+    for(i = 0;i < job.chunks;i++)
+    {
+        free(job.pairs[i]);
+    }
+    free(job.pairs);
+    free(job.pair_count);
+    free(p_entries);
+}
+
+static void collect_trigrams(uint32_t index,uint32_t worker,void* arg)
+{
+    find_trigram_job_struct_t* job = (find_trigram_job_struct_t*)arg;
+    const find_entry_struct_t* entry = NULL;
+    uint32_t first = index * FIND_CHUNK;
+    uint32_t last = first + FIND_CHUNK;
+    uint32_t capacity = FIND_GROW;
+    uint32_t count = 0;
+    uint32_t trigrams[FIND_NAME_TRIGRAMS];
+    uint32_t n = 0;
+    uint32_t id = 0;
+    uint32_t i = 0;
+    uint64_t* p_pairs = NULL;
+    const uint8_t* name = NULL;
+    const uint8_t* short_name = NULL;
+
+    if(last > job->count)
+    {
+        last = job->count;
+    }
+    p_pairs = (uint64_t*)malloc(sizeof(uint64_t)*capacity);
+    check_null(p_pairs);
+    for(id = (first == 0) ? 1 : first;id < last;id++) /* the root has no name */
+    {
+        entry = &job->entries[id];
+        name = job->text + entry->path + entry->name;
+        short_name = job->text + entry->short_path + entry->short_name;
+        n = name_trigrams(name,strlen((const char*)name),trigrams);
+        n += name_trigrams(short_name,strlen((const char*)short_name),trigrams + n);
+        qsort(trigrams,n,sizeof(uint32_t),compare_trigram);
+        while((count + n) > capacity)
+        {
+            capacity *= 2;
+            p_pairs = (uint64_t*)realloc(p_pairs,sizeof(uint64_t)*capacity);
+            check_null(p_pairs);
+        }
+        for(i = 0;i < n;i++)
+        {
+            if((i == 0) || (trigrams[i] != trigrams[i - 1])) /* once per entry */
+            {
+                p_pairs[count] = ((uint64_t)trigrams[i] << 32) | id;
+                count += 1;
+            }
+        }
+    }
+    qsort(p_pairs,count,sizeof(uint64_t),compare_pair);
+    job->pairs[index] = p_pairs;
+    job->pair_count[index] = count;
+}
+
+static void merge_trigrams(uint32_t index,uint32_t worker,void* arg)
+{
+    find_trigram_job_struct_t* job = (find_trigram_job_struct_t*)arg;
+    uint32_t a = index * 2 * job->step;
+    uint32_t b = a + job->step;
+    uint64_t* p_merged = NULL;
+    uint32_t i = 0;
+    uint32_t k = 0;
+    uint32_t n = 0;
+
+    if(b < job->chunks)
+    {
+        p_merged = (uint64_t*)malloc(sizeof(uint64_t)*(job->pair_count[a] + job->pair_count[b] + 1));
+        check_null(p_merged);
+        while((i < job->pair_count[a]) || (k < job->pair_count[b]))
+        {
+            if((k == job->pair_count[b]) || ((i < job->pair_count[a]) && (job->pairs[a][i] < job->pairs[b][k])))
+            {
+                p_merged[n] = job->pairs[a][i];
+                i += 1;
+            }
+            else
+            {
+                p_merged[n] = job->pairs[b][k];
+                k += 1;
+            }
+            n += 1;
+        }
+        free(job->pairs[a]);
+        free(job->pairs[b]);
+        job->pairs[a] = p_merged;
+        job->pairs[b] = NULL;
+        job->pair_count[a] = n;
+        job->pair_count[b] = 0;
+    }
+}
+
+static uint32_t name_trigrams(const uint8_t* name,uint32_t length,uint32_t* trigrams)
+{
+    uint32_t count = 0;
+    uint32_t i = 0;
+
+    for(i = 0;(i + 3) <= length;i++)
+    {
+        trigrams[count] = ((uint32_t)tolower(name[i]) << 16) | ((uint32_t)tolower(name[i + 1]) << 8) | (uint32_t)tolower(name[i + 2]);
+        count += 1;
+    }
+    return count;
+}
+
+bool find_save(const find_index_struct_t* index,uint8_t* file_path)
+{
+    bool retValue = false;
+    find_header_t header;
+    uint8_t index_path[FAT_MAX_PATH];
+    uint8_t temp_path[FAT_MAX_PATH];
+    FILE* file = NULL;
+
+    memcpy(&header,index->storage,sizeof(header));
+    if((fat_sidecar_path(file_path,".find",index_path) == true) && (fat_volume_key(file_path,&header.key) == true))
+    {
+        /* a temporary file renamed at the end, readers never load half an index */
+        strcpy(temp_path,index_path);
+        strcat(temp_path,".tmp");
+        file = fopen(temp_path,"wb");
+        if(file != NULL)
+        {
+            retValue = (fwrite(&header,sizeof(header),1,file) == 1) &&
+                       (fwrite(index->storage + sizeof(header),sizeof(uint8_t),index->storage_size - sizeof(header),file) ==
+                        (index->storage_size - sizeof(header)));
+            retValue = (fclose(file) == 0) && retValue;
+            if(retValue == true)
+            {
+                remove(index_path);
+                retValue = (rename(temp_path,index_path) == 0);
+            }
+            else
+            {
+                remove(temp_path);
+            }
+        }
+    }
+    return retValue;
+}
+
+bool find_load(find_index_struct_t* index,uint8_t* file_path)
+{
+    bool retValue = false;
+    find_header_t header;
+    fat_volume_key_struct_t key;
+    uint8_t index_path[FAT_MAX_PATH];
+    uint64_t file_size = 0;
+    FILE* file = NULL;
+
+    memset(index,0,sizeof(find_index_struct_t));
+    if((fat_sidecar_path(file_path,".find",index_path) == true) && (fat_volume_key(file_path,&key) == true))
+    {
+        file = fopen(index_path,"rb");
+    }
+    if(file != NULL)
+    {
+        fseek(file,0,SEEK_END);
+        file_size = ftell(file);
+        fseek(file,0,SEEK_SET);
+        /* the regions follow each other in the file, aligned, in this order */
+        if((fread(&header,sizeof(header),1,file) == 1) && (memcmp(header.magic,FIND_MAGIC,8) == 0) &&
+           (memcmp(&header.key,&key,sizeof(key)) == 0) && (header.count > 0) && (header.size == file_size) &&
+           (((header.entries_offset | header.trigrams_offset | header.postings_offset | header.text_offset) % 8) == 0) &&
+           (header.entries_offset >= sizeof(header)) &&
+           (header.entries_offset + (uint64_t)sizeof(find_entry_struct_t) * header.count <= header.trigrams_offset) &&
+           (header.trigrams_offset + (uint64_t)sizeof(find_trigram_struct_t) * ((uint64_t)header.trigram_count + 1) <= header.postings_offset) &&
+           (header.postings_offset + (uint64_t)sizeof(uint32_t) * header.posting_count <= header.text_offset) &&
+           (header.text_offset + header.text_size <= header.size))
+        {
+            index->storage = (uint8_t*)malloc(header.size);
+            check_null(index->storage);
+            memcpy(index->storage,&header,sizeof(header));
+            if(fread(index->storage + sizeof(header),sizeof(uint8_t),header.size - sizeof(header),file) == (header.size - sizeof(header)))
+            {
+                index->storage_size = header.size;
+                index->count = header.count;
+                index->trigram_count = header.trigram_count;
+                index->posting_count = header.posting_count;
+                index->text_size = header.text_size;
+                index->entries = (find_entry_struct_t*)(index->storage + header.entries_offset);
+                index->trigrams = (find_trigram_struct_t*)(index->storage + header.trigrams_offset);
+                index->postings = (uint32_t*)(index->storage + header.postings_offset);
+                index->text = index->storage + header.text_offset;
+                retValue = check_index(index);
+            }
+            if(retValue == false)
+            {
+                find_free(index);
+            }
+        }
+        fclose(file);
+    }
+    return retValue;
+}
+
+static bool check_index(const find_index_struct_t* index)
+{
+    bool retValue = (index->text_size > 0) && (index->text[index->text_size - 1] == '\0');
+    const find_entry_struct_t* entry = NULL;
+    uint32_t i = 0;
+
+    /* paths start inside the text (which ends with '\0'), sub trees stay inside the tree */
+    for(i = 0;(retValue == true) && (i < index->count);i++)
+    {
+        entry = &index->entries[i];
+        retValue = (((uint64_t)entry->path + entry->name) < index->text_size) &&
+                   (((uint64_t)entry->short_path + entry->short_name) < index->text_size) &&
+                   (entry->parent < index->count) && (entry->end > i) && (entry->end <= index->count);
+    }
+    /* trigrams sorted for lookup_trigram(), their postings in order and inside the list */
+    for(i = 0;(retValue == true) && (i < index->trigram_count);i++)
+    {
+        retValue = (index->trigrams[i].first <= index->trigrams[i + 1].first) &&
+                   ((i == 0) || (index->trigrams[i - 1].trigram < index->trigrams[i].trigram));
+    }
+    retValue = retValue && (index->trigrams[0].first == 0) && (index->trigrams[index->trigram_count].first == index->posting_count);
+    for(i = 0;(retValue == true) && (i < index->posting_count);i++)
+    {
+        retValue = (index->postings[i] < index->count);
+    }
+    return retValue;
+}
+
+uint32_t find_query(const find_index_struct_t* index,const uint8_t* pattern,uint32_t flags,uint32_t** results)
+{
+    bool glob = ((flags & FIND_GLOB) != 0);
+    bool ignore_case = ((flags & FIND_IGNORE_CASE) != 0);
+    bool full_path = (strchr((const char*)pattern,'/') != NULL);
+    const uint8_t* segment = pattern;
+    const uint8_t* run = NULL;
+    const find_trigram_struct_t* p_trigram = NULL;
+    const find_entry_struct_t* entry = NULL;
+    const uint32_t* p_list = NULL;              /* postings of the rarest trigram           */
+    uint32_t* p_candidates = NULL;
+    uint32_t candidate_count = 0;
+    uint32_t trigrams[FIND_MAX_QUERY_TRIGRAMS];
+    uint32_t trigram_count = 0;
+    uint32_t capacity = FIND_GROW;
+    uint32_t count = 0;
+    uint32_t covered = 0;                       /* end of the last sub tree found           */
+    uint32_t length = 0;
+    uint32_t i = 0;
+    uint32_t k = 0;
+    uint32_t n = 0;
+    uint32_t id = 0;
+    uint32_t first = 0;
+    uint32_t last = 0;
+    bool match = false;
+
+    /*
+     * every entry that matches has the literal text of the last component of the
+     * pattern in its own name (the rest of the path belongs to its parents)
+     */
+    if(full_path == true)
+    {
+        segment = (const uint8_t*)strrchr((const char*)pattern,'/') + 1;
+    }
+    if((glob == true) && (strstr((const char*)segment,"**") != NULL))
+    {
+        segment = (const uint8_t*)strstr((const char*)segment,"**");
+        while(strstr((const char*)segment + 2,"**") != NULL)
+        {
+            segment = (const uint8_t*)strstr((const char*)segment + 2,"**");
+        }
+    }
+    run = segment;
+    while(*run != '\0')
+    {
+        length = (glob == true) ? strcspn((const char*)run,"*?[") : strlen((const char*)run);
+        if(length >= 3)
+        {
+            n = length - 2;
+            if(n > (FIND_MAX_QUERY_TRIGRAMS - trigram_count))
+            {
+                n = FIND_MAX_QUERY_TRIGRAMS - trigram_count;
+            }
+            for(i = 0;i < n;i++)
+            {
+                name_trigrams(run + i,3,&trigrams[trigram_count]);
+                trigram_count += 1;
+            }
+        }
+        run += length;
+        if(*run == '[') /* skip the bracket expression */
+        {
+            run += 1;
+            run += (*run == ']') ? 1 : 0;
+            while((*run != '\0') && (*run != ']'))
+            {
+                run += 1;
+            }
+        }
+        if(*run != '\0')
+        {
+            run += 1;
+        }
+    }
+
+    /* candidates: entries that have all of the trigrams, the rarest list first */
+    for(i = 0;i < trigram_count;i++)
+    {
+        p_trigram = lookup_trigram(index,trigrams[i]);
+        if(p_trigram == NULL)
+        {
+            candidate_count = 0;
+            p_list = NULL;
+            break;
+        }
+        if((p_list == NULL) || ((p_trigram[1].first - p_trigram[0].first) < candidate_count))
+        {
+            p_list = &index->postings[p_trigram[0].first];
+            candidate_count = p_trigram[1].first - p_trigram[0].first;
+        }
+    }
+    if(p_list != NULL)
+    {
+        p_candidates = (uint32_t*)malloc(sizeof(uint32_t)*(candidate_count + 1));
+        check_null(p_candidates);
+        memcpy(p_candidates,p_list,sizeof(uint32_t)*candidate_count);
+        for(i = 0;(i < trigram_count) && (candidate_count > 0);i++)
+        {
+            p_trigram = lookup_trigram(index,trigrams[i]);
+            first = p_trigram[0].first;
+            last = p_trigram[1].first;
+            n = 0;
+            for(k = 0;k < candidate_count;k++)
+            {
+                while((first < last) && (index->postings[first] < p_candidates[k]))
+                {
+                    first += 1;
+                }
+                if((first < last) && (index->postings[first] == p_candidates[k]))
+                {
+                    p_candidates[n] = p_candidates[k];
+                    n += 1;
+                }
+            }
+            candidate_count = n;
+        }
+    }
+    else if(trigram_count == 0)
+    {
+        candidate_count = index->count - 1; /* no literal to use, every entry but the root */
+    }
+
+    *results = (uint32_t*)malloc(sizeof(uint32_t)*capacity);
+    check_null(*results);
+    for(i = 0;i < candidate_count;i++)
+    {
+        id = (p_candidates != NULL) ? p_candidates[i] : (i + 1);
+        entry = &index->entries[id];
+        if(glob == true)
+        {
+            first = id;
+            last = id + 1;
+            if(full_path == true)
+            {
+                match = (glob_path(pattern,index->text + entry->path,ignore_case) == true) ||
+                        (glob_path(pattern,index->text + entry->short_path,ignore_case) == true);
+            }
+            else
+            {
+                match = (glob_match(pattern,index->text + entry->path + entry->name,ignore_case) == true) ||
+                        (glob_match(pattern,index->text + entry->short_path + entry->short_name,ignore_case) == true);
+            }
+        }
+        else
+        {
+            /* the paths of a sub tree start with the path of its directory */
+            first = id;
+            last = entry->end;
+            match = (id >= covered) &&
+                    ((contains(index->text + entry->path,pattern,ignore_case) == true) ||
+                     (contains(index->text + entry->short_path,pattern,ignore_case) == true));
+            if(match == true)
+            {
+                covered = last;
+            }
+        }
+        if(match == true)
+        {
+            while((count + (last - first)) > capacity)
+            {
+                capacity *= 2;
+                *results = (uint32_t*)realloc(*results,sizeof(uint32_t)*capacity);
+                check_null(*results);
+            }
+            for(k = first;k < last;k++)
+            {
+                (*results)[count] = k;
+                count += 1;
+            }
+        }
+    }
+    free(p_candidates);
+    return count;
+}
+
+static const find_trigram_struct_t* lookup_trigram(const find_index_struct_t* index,uint32_t trigram)
+{
+    const find_trigram_struct_t* retValue = NULL;
+    uint32_t low = 0;
+    uint32_t high = index->trigram_count;
+    uint32_t middle = 0;
+
+    while(low < high)
+    {
+        middle = low + (high - low) / 2;
+        if(index->trigrams[middle].trigram < trigram)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    if((low < index->trigram_count) && (index->trigrams[low].trigram == trigram))
+    {
+        retValue = &index->trigrams[low];
+    }
+    return retValue;
+}
+
+static bool contains(const uint8_t* text,const uint8_t* sub,bool ignore_case)
+{
+    bool retValue = false;
+    uint32_t i = 0;
+
+    if(ignore_case == false)
+    {
+        retValue = (strstr((const char*)text,(const char*)sub) != NULL);
+    }
+    else
+    {
+        for(;(retValue == false) && (*text != '\0');text++)
+        {
+            for(i = 0;(sub[i] != '\0') && (tolower(text[i]) == tolower(sub[i]));i++)
+            {
+                /* just check, don't do anything */
+            }
+            retValue = (sub[i] == '\0');
+        }
+        retValue = retValue || (*sub == '\0');
+    }
+    return retValue;
+}
+
+static bool glob_path(const uint8_t* pattern,const uint8_t* path,bool ignore_case)
+{
+    bool retValue = false;
+
+    if(pattern[0] == '/')
+    {
+        retValue = glob_match(pattern,path,ignore_case);
+    }
+    else
+    {
+        for(;(retValue == false) && (path != NULL);path = (const uint8_t*)strchr((const char*)path + 1,'/'))
+        {
+            retValue = glob_match(pattern,path + 1,ignore_case);
+        }
+    }
+    return retValue;
+}
+
+static bool glob_match(const uint8_t* pattern,const uint8_t* text,bool ignore_case)
+{
+    bool retValue = false;
+    bool done = false;
+    bool any = false;
+    const uint8_t* tail = NULL;
+    uint32_t length = 0;
+    uint32_t text_length = 0;
+
+    while(done == false)
+    {
+        if(*pattern == '\0')
+        {
+            retValue = (*text == '\0');
+            done = true;
+        }
+        else if(*pattern == '*')
+        {
+            any = (pattern[1] == '*');
+            while(*pattern == '*')
+            {
+                pattern += 1;
+            }
+            /* the literal text after the last wildcard has to end the text, checked first */
+            tail = pattern + strlen((const char*)pattern);
+            while((tail > pattern) && (strchr("*?[]",tail[-1]) == NULL))
+            {
+                tail -= 1;
+            }
+            length = strlen((const char*)tail);
+            text_length = strlen((const char*)text);
+            if((text_length < length) || (same_text(tail,text + text_length - length,length,ignore_case) == false))
+            {
+                retValue = false;
+            }
+            else if(tail == pattern) /* only literal text left ("*.txt") */
+            {
+                retValue = (any == true) || (memchr(text,'/',text_length - length) == NULL);
+            }
+            else
+            {
+                /* every length the star can take, '/' only for "**" */
+                while(((retValue = glob_match(pattern,text,ignore_case)) == false) && (*text != '\0') && ((any == true) || (*text != '/')))
+                {
+                    text += 1;
+                }
+            }
+            done = true;
+        }
+        else if((*text == '\0') || (glob_one(&pattern,*text,ignore_case) == false))
+        {
+            done = true;
+        }
+        else
+        {
+            text += 1;
+        }
+    }
+    return retValue;
+}
+
+static bool glob_one(const uint8_t** pattern,uint8_t c,bool ignore_case)
+{
+    bool retValue = false;
+    const uint8_t* p = *pattern;
+    const uint8_t* end = NULL;
+    bool negate = false;
+    uint8_t low = 0;
+    uint8_t high = 0;
+    uint8_t folded = ignore_case ? tolower(c) : c;
+
+    if(*p == '?')
+    {
+        retValue = (c != '/');
+        *pattern = p + 1;
+    }
+    else if(*p == '[')
+    {
+        /* find the closing bracket, a ']' right after "[" or "[!" is a member */
+        end = p + 1;
+        if((*end == '!') || (*end == '^'))
+        {
+            negate = true;
+            end += 1;
+        }
+        end += (*end == ']') ? 1 : 0;
+        while((*end != '\0') && (*end != ']'))
+        {
+            end += 1;
+        }
+        if(*end == '\0') /* no closing bracket, '[' is a literal */
+        {
+            retValue = ignore_case ? (tolower('[') == folded) : (c == '[');
+            *pattern = p + 1;
+        }
+        else
+        {
+            p += (negate == true) ? 2 : 1;
+            do
+            {
+                low = ignore_case ? tolower(*p) : *p;
+                high = low;
+                if((p[1] == '-') && ((p + 2) < end))
+                {
+                    high = ignore_case ? tolower(p[2]) : p[2];
+                    p += 2;
+                }
+                if((folded >= low) && (folded <= high))
+                {
+                    retValue = true;
+                }
+                p += 1;
+            } while(p < end);
+            retValue = (retValue != negate) && (c != '/');
+            *pattern = end + 1;
+        }
+    }
+    else
+    {
+        retValue = ignore_case ? (tolower(*p) == folded) : (*p == c);
+        *pattern = p + 1;
+    }
+    return retValue;
+}
+
+static bool same_text(const uint8_t* a,const uint8_t* b,uint32_t length,bool ignore_case)
+{
+    uint32_t i = 0;
+
+    for(i = 0;(i < length) && ((a[i] == b[i]) || ((ignore_case == true) && (tolower(a[i]) == tolower(b[i]))));i++)
+    {
+        /* just check, don't do anything */
+    }
+    return (i == length);
+}
+
+static int compare_pair(const void* a,const void* b)
+{
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+
+    return (x > y) - (x < y);
+}
+
+static int compare_trigram(const void* a,const void* b)
+{
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+
+    return (x > y) - (x < y);
+}
+
+void find_free(find_index_struct_t* index)
+{
+    free(index->storage);
+    memset(index,0,sizeof(find_index_struct_t));
+}
+
+static void check_null(void* ptr)
+{
+    if(ptr == NULL)
+    {
+        exit(1);
+    }
+}
@@ -0,0 +1,94 @@
+#ifndef _FIND_H_
+#define _FIND_H_
+
+/*******************************************************************************
+* Definitions
+******************************************************************************/
+#define FIND_GLOB                   (0x01U)     /* pattern is a glob, not a substring       */
+#define FIND_IGNORE_CASE            (0x02U)     /* ASCII letters match either case          */
+
+typedef struct
+{
+    uint32_t parent;                            /* entry of the parent directory, root = 0  */
+    uint32_t end;                               /* entries id+1 .. end-1 are its sub tree   */
+    uint32_t path;                              /* offset of the full path in the text      */
+    uint32_t short_path;                        /* offset of the full 8.3 path in the text  */
+    uint16_t name;                              /* offset of the name in the full path      */
+    uint16_t short_name;                        /* offset of the 8.3 name in the 8.3 path   */
+    uint32_t first_cluster;
+    uint32_t size;
+    uint8_t attribute;
+} find_entry_struct_t;
+
+typedef struct
+{
+    uint32_t trigram;                           /* 3 lower case bytes of a name             */
+    uint32_t first;                             /* first of its postings                    */
+} find_trigram_struct_t;
+
+typedef struct
+{
+    find_entry_struct_t* entries;               /* tree in pre-order, entry 0 is the root   */
+    uint32_t count;
+    find_trigram_struct_t* trigrams;            /* sorted, plus an end marker               */
+    uint32_t trigram_count;
+    uint32_t* postings;                         /* entries of every trigram, ascending      */
+    uint32_t posting_count;
+    uint8_t* text;                              /* paths, '\0' terminated                   */
+    uint32_t text_size;
+    uint8_t* storage;                           /* one block that holds all of the above    */
+    uint64_t storage_size;
+} find_index_struct_t;
+
+/*******************************************************************************
+* API
+******************************************************************************/
+
+/** @brief This function builds the name index of the mounted volume in one traversal:
+ * every level of the tree is listed by a pool of threads (or taken from an attached
+ * snapshot), then the trigrams of the long and 8.3 names are sorted in parallel.
+ * @param index - structure to store the index (release it with find_free()).
+ * @param threads - number of threads (0 = one per CPU).
+ * @return - Return 1 if every directory could be read.
+ */
+bool find_build(find_index_struct_t* index,uint32_t threads);
+
+
+/** @brief This function saves an index next to the image ("<file_path>.find").
+ * @param index - index of find_build().
+ * @param file_path - file path from user (same as fat_init()).
+ * @return - Return 1 if the file was written.
+ */
+bool find_save(const find_index_struct_t* index,uint8_t* file_path);
+
+
+/** @brief This function loads the saved index of the mounted volume, if it was built
+ * from the same image (see fat_volume_key()) and every offset in it is valid.
+ * @param index - structure to store the index (release it with find_free()).
+ * @param file_path - file path from user (same as fat_init()).
+ * @return - Return 1 if an up to date index was loaded.
+ */
+bool find_load(find_index_struct_t* index,uint8_t* file_path);
+
+
+/** @brief This function finds entries by name. A substring matches every entry whose
+ * full path (long or 8.3 names) contains it, so a match in a directory name returns
+ * its whole sub tree. A glob ('*', '?', "[a-z]", "[!a]", none of them matches '/', "**"
+ * does) matches the name, or the full path if the pattern holds a '/' (the end of it,
+ * from any directory on, if the pattern doesn't start with '/'). Only entries that
+ * have every trigram of the pattern's last component in their name are compared.
+ * @param index - index.
+ * @param pattern - substring or glob.
+ * @param flags - FIND_GLOB, FIND_IGNORE_CASE.
+ * @param results - stores a new array of entry numbers in tree order (free() it).
+ * @return - Return the number of entries found.
+ */
+uint32_t find_query(const find_index_struct_t* index,const uint8_t* pattern,uint32_t flags,uint32_t** results);
+
+
+/** @brief This function releases an index.
+ * @param index - index of find_build() or find_load().
+ */
+void find_free(find_index_struct_t* index);
+
+#endif /* _FIND_H_ */
@@ -0,0 +1,323 @@
+/*******************************************************************************
+* Includes
+******************************************************************************/
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdarg.h>
+#include "fat.h"
+#include "fsck.h"
+
+/*******************************************************************************
+* Definitions
+******************************************************************************/
+#define FSCK_CHUNK                  (65536U)    /* FAT entries compared per read while looking for lost clusters */
+
+typedef struct
+{
+    fsck_struct_t* report;
+    uint8_t* owned;                             /* one bit per cluster used by a chain      */
+    uint32_t entries;                           /* FAT entries (total clusters + 2)         */
+    uint32_t cluster_size;                      /* bytes                                    */
+    uint32_t eoc;                               /* first end of chain value                 */
+    uint32_t bad;                               /* bad cluster marker                       */
+} fsck_job_struct_t;
+
+/*******************************************************************************
+* Prototypes
+******************************************************************************/
+
+/** @brief This function checks one file or directory found by fat_walk().
+ * @param path - full path of the entry.
+ * @param entry - directory entry.
+ * @param arg - pointer to a fsck_job_struct_t.
+ */
+static void check_entry(const uint8_t* path,const fat_entry* entry,void* arg);
+
+
+/** @brief This function follows a chain, marks its clusters as used and reports
+ * clusters that are free, bad, outside of the volume, already used by another
+ * chain or already part of this chain.
+ * @param job - fsck job.
+ * @param path - path of the owner (for the messages).
+ * @param first_cluster - first cluster of the chain.
+ * @param length - stores the number of clusters of the chain.
+ * @return - Return 1 if the chain ends with an end of chain mark.
+ */
+static bool check_chain(fsck_job_struct_t* job,const uint8_t* path,uint32_t first_cluster,uint32_t* length);
+
+
+/** @brief This function counts the allocated clusters that no chain uses.
+ * @param job - fsck job.
+ */
+static void find_lost(fsck_job_struct_t* job);
+
+
+/** @brief This function keeps the description of a problem while there is room.
+ * @param report - report.
+ * @param format - printf() format of the description.
+ */
+static void add_message(fsck_struct_t* report,const char* format,...);
+
+
+/** @brief This function checks the malloc value.
+ * @param ptr - pointer of malloc.
+ */
+static void check_null(void* ptr);
+
+/*******************************************************************************
+* Code
+******************************************************************************/
+bool fsck_run(fsck_struct_t* report)
+{
+    fsck_job_struct_t job;
+    fat_geometry_struct_t geometry;
+    uint32_t media = 0;
+    uint32_t length = 0;
+
+    memset(report,0,sizeof(fsck_struct_t));
+    report->messages = (uint8_t*)malloc(sizeof(uint8_t)*FSCK_MAX_MESSAGES*FSCK_MESSAGE_SIZE);
+    check_null(report->messages);
+
+    fat_get_geometry(&geometry);
+    memset(&job,0,sizeof(job));
+    job.report = report;
+    job.entries = fat_entry_count();
+    job.cluster_size = geometry.bytes_per_sector * geometry.sectors_per_cluster;
+    job.eoc = (geometry.fat_bits == 12) ? 0xFF8 : ((geometry.fat_bits == 16) ? 0xFFF8 : 0x0FFFFFF8);
+    job.bad = job.eoc - 1;
+    job.owned = (uint8_t*)calloc((job.entries / 8) + 1,sizeof(uint8_t));
+    check_null(job.owned);
+
+    if(job.entries < (geometry.total_clusters + 2))
+    {
+        report->layout_errors += 1;
+        add_message(report,"FAT holds %u entries, the volume has %u clusters",job.entries,geometry.total_clusters);
+    }
+    if((fat_get_entries(0,1,&media) != 1) || ((media & 0xFF) < 0xF0))
+    {
+        report->layout_errors += 1;
+        add_message(report,"FAT entry 0 (0x%X) is not a media descriptor",media);
+    }
+
+    report->fat_mismatch = fat_compare_copies();
+    if(report->fat_mismatch != 0)
+    {
+        add_message(report,"%u sectors of the FAT copies differ from FAT table 1",report->fat_mismatch);
+    }
+
+    /* the FAT32 root directory is a chain like any other */
+    if(fat_root_cluster() != 0)
+    {
+        report->directories += 1;
+        check_chain(&job,(const uint8_t*)"/",fat_root_cluster(),&length);
+    }
+    report->walked = fat_walk(check_entry,&job);
+    if(report->walked == false)
+    {
+        add_message(report,"some directories could not be read");
+    }
+    find_lost(&job);
+    if(report->lost_clusters != 0)
+    {
+        add_message(report,"%u allocated clusters are not used by any chain (first at cluster %u)",
+                    report->lost_clusters,report->first_lost);
+    }
+
+    report->problems = report->layout_errors + report->fat_mismatch + report->bad_entries + report->broken_chains +
+                       report->cross_links + report->loops + report->size_mismatch + report->lost_clusters;
+    free(job.owned);
+    return (report->problems == 0) && (report->walked == true);
+}
+
+static void check_entry(const uint8_t* path,const fat_entry* entry,void* arg)
+{
+    fsck_job_struct_t* job = (fsck_job_struct_t*)arg;
+    fsck_struct_t* report = job->report;
+    uint32_t cluster = fat_entry_cluster(entry);
+    uint32_t size = READ_32_BITS((uint32_t)entry->size[0],(uint32_t)entry->size[1],(uint32_t)entry->size[2],(uint32_t)entry->size[3]);
+    bool directory = ((entry->attribute & 0x10) != 0);
+    uint32_t length = 0;
+    uint32_t needed = 0;
+
+    if(directory == true)
+    {
+        report->directories += 1;
+    }
+    else
+    {
+        report->files += 1;
+    }
+
+    if(cluster == 0)
+    {
+        if(directory == true)
+        {
+            report->bad_entries += 1;
+            add_message(report,"%s: directory without clusters",path);
+        }
+        else if(size != 0)
+        {
+            report->size_mismatch += 1;
+            add_message(report,"%s: size %u but no clusters",path,size);
+        }
+    }
+    else if((cluster == 1) || (cluster >= job->entries))
+    {
+        report->bad_entries += 1;
+        add_message(report,"%s: first cluster %u is outside of the volume",path,cluster);
+    }
+    else if(check_chain(job,path,cluster,&length) == true)
+    {
+        /* the length only means something for a chain that ends properly */
+        needed = (uint32_t)(((uint64_t)size + job->cluster_size - 1) / job->cluster_size);
+        if((directory == false) && (length != needed))
+        {
+            report->size_mismatch += 1;
+            add_message(report,"%s: %u clusters in the chain, size %u needs %u",path,length,size,needed);
+        }
+    }
+}
+
+static bool check_chain(fsck_job_struct_t* job,const uint8_t* path,uint32_t first_cluster,uint32_t* length)
+{
+    fsck_struct_t* report = job->report;
+    bool retValue = false;
+    bool done = false;
+    uint32_t cluster = first_cluster;
+    uint32_t next = 0;
+    uint32_t walk = 0;
+    uint32_t i = 0;
+
+    *length = 0;
+    while(done == false)
+    {
+        if((job->owned[cluster / 8] & (1U << (cluster % 8))) != 0)
+        {
+            /* rare: tell a loop from a cross-link by walking the chain again */
+            walk = first_cluster;
+            for(i = 0;(i < *length) && (walk != cluster);i++)
+            {
+                walk = fat_next_cluster(walk);
+            }
+            if(i < *length)
+            {
+                report->loops += 1;
+                add_message(report,"%s: chain loops back to cluster %u",path,cluster);
+            }
+            else
+            {
+                report->cross_links += 1;
+                add_message(report,"%s: cluster %u is also used by another chain",path,cluster);
+            }
+            done = true;
+        }
+        else
+        {
+            job->owned[cluster / 8] |= (1U << (cluster % 8));
+            report->clusters += 1;
+            *length += 1;
+            next = fat_next_cluster(cluster);
+            done = true;
+            if(next >= job->eoc)
+            {
+                retValue = true;
+            }
+            else if(next == job->bad)
+            {
+                report->broken_chains += 1;
+                add_message(report,"%s: cluster %u of the chain is marked bad",path,cluster);
+            }
+            else if(next == 0)
+            {
+                report->broken_chains += 1;
+                add_message(report,"%s: cluster %u of the chain is marked free",path,cluster);
+            }
+            else if((next == 1) || (next >= job->entries))
+            {
+                report->broken_chains += 1;
+                add_message(report,"%s: cluster %u points outside of the volume (0x%X)",path,cluster,next);
+            }
+            else
+            {
+                cluster = next;
+                done = false;
+            }
+        }
+    }
+    return retValue;
+}
+
+static void find_lost(fsck_job_struct_t* job)
+{
+    fsck_struct_t* report = job->report;
+    uint32_t* p_table = NULL;
+    uint32_t first = 0;
+    uint32_t count = 0;
+    uint32_t i = 0;
+    uint32_t cluster = 0;
+
+    p_table = (uint32_t*)malloc(sizeof(uint32_t)*FSCK_CHUNK);
+    check_null(p_table);
+    for(first = 2;first < job->entries;first += count)
+    {
+        count = job->entries - first;
+        if(count > FSCK_CHUNK)
+        {
+            count = FSCK_CHUNK;
+        }
+        count = fat_get_entries(first,count,p_table);
+        if(count == 0)
+        {
+            break;
+        }
+        for(i = 0;i < count;i++)
+        {
+            cluster = first + i;
+            if((p_table[i] != 0) && (p_table[i] != job->bad) && ((job->owned[cluster / 8] & (1U << (cluster % 8))) == 0))
+            {
+                if(report->lost_clusters == 0)
+                {
+                    report->first_lost = cluster;
+                }
+                report->lost_clusters += 1;
+            }
+        }
+    }
+    free(p_table);
+}
+
+static void add_message(fsck_struct_t* report,const char* format,...)
+{
+    va_list args;
+
+    if(report->message_count < FSCK_MAX_MESSAGES)
+    {
+        va_start(args,format);
+        vsnprintf((char*)report->messages + report->message_count * FSCK_MESSAGE_SIZE,FSCK_MESSAGE_SIZE,format,args);
+        va_end(args);
+        report->message_count += 1;
+    }
+}
+
+const uint8_t* fsck_message(const fsck_struct_t* report,uint32_t index)
+{
+    return report->messages + index * FSCK_MESSAGE_SIZE;
+}
+
+void fsck_free(fsck_struct_t* report)
+{
+    free(report->messages);
+    report->messages = NULL;
+    report->message_count = 0;
+}
+
+static void check_null(void* ptr)
+{
+    if(ptr == NULL)
+    {
+        exit(1);
+    }
+}
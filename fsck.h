@@ -0,0 +1,56 @@
+#ifndef _FSCK_H_
+#define _FSCK_H_
+
+/*******************************************************************************
+* Definitions
+******************************************************************************/
+#define FSCK_MAX_MESSAGES           (100U)      /* problems described one by one, the rest are only counted */
+#define FSCK_MESSAGE_SIZE           (FAT_MAX_PATH + 128U)
+
+typedef struct
+{
+    uint32_t files;                             /* files checked                            */
+    uint32_t directories;                       /* directories checked                      */
+    uint32_t clusters;                          /* clusters used by files and directories   */
+    uint32_t layout_errors;                     /* FAT too small, bad media descriptor      */
+    uint32_t fat_mismatch;                      /* sectors of the FAT copies that differ    */
+    uint32_t bad_entries;                       /* entries with an impossible first cluster */
+    uint32_t broken_chains;                     /* chains through free, bad or outside ones */
+    uint32_t cross_links;                       /* clusters used by more than one chain     */
+    uint32_t loops;                             /* chains that come back to themselves      */
+    uint32_t size_mismatch;                     /* file size and chain length disagree      */
+    uint32_t lost_clusters;                     /* allocated clusters that no chain uses    */
+    uint32_t first_lost;                        /* first of them                            */
+    uint32_t problems;                          /* sum of the problem counters              */
+    bool walked;                                /* every directory could be read            */
+    uint8_t* messages;                          /* FSCK_MESSAGE_SIZE bytes per message      */
+    uint32_t message_count;
+} fsck_struct_t;
+
+/*******************************************************************************
+* API
+******************************************************************************/
+
+/** @brief This function checks the mounted volume without changing it: FAT copies,
+ * the chain of every file and directory (broken chains, loops, cross-linked clusters,
+ * chain length against the file size) and allocated clusters that no chain uses.
+ * @param report - structure to store the result (release it with fsck_free()).
+ * @return - Return 1 if no problem was found.
+ */
+bool fsck_run(fsck_struct_t* report);
+
+
+/** @brief This function returns one problem description of a report.
+ * @param report - report filled by fsck_run().
+ * @param index - message number (< report->message_count).
+ * @return - Return the message.
+ */
+const uint8_t* fsck_message(const fsck_struct_t* report,uint32_t index);
+
+
+/** @brief This function releases a report.
+ * @param report - report filled by fsck_run().
+ */
+void fsck_free(fsck_struct_t* report);
+
+#endif /* _FSCK_H_ */
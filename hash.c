@@ -0,0 +1,326 @@
+/*******************************************************************************
+* Includes
+******************************************************************************/
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include "hash.h"
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <nmmintrin.h>
+#define HASH_CRC32C_SSE42
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define HASH_CRC32C_ARM
+#endif
+
+/*******************************************************************************
+* Definitions
+******************************************************************************/
+#define HASH_CRC32C_POLY            (0x82F63B78U)   /* reflected Castagnoli polynomial */
+#define ROTR(x,n)                   (((x) >> (n)) | ((x) << (32 - (n))))
+
+/*******************************************************************************
+* Prototypes
+******************************************************************************/
+
+/** @brief This function builds the slicing-by-8 tables and detects CPU support.
+ * It runs once (pthread_once).
+ */
+static void hash_setup(void);
+
+
+/** @brief This function computes CRC32C with 8 table lookups per 8 bytes.
+ * @param crc - inverted running checksum.
+ * @param buff - data to add.
+ * @param size - number of bytes.
+ * @return - Return the inverted running checksum.
+ */
+static uint32_t crc32c_software(uint32_t crc,const uint8_t* buff,uint32_t size);
+
+
+/** @brief This function processes one 64 byte block of SHA-256.
+ * @param ctx - context.
+ * @param block - 64 bytes of data.
+ */
+static void sha256_block(hash_sha256_struct_t* ctx,const uint8_t* block);
+
+/*******************************************************************************
+* Variables
+******************************************************************************/
+static pthread_once_t g_hash_once = PTHREAD_ONCE_INIT;
+static uint32_t g_crc_table[8][256];
+static bool g_crc_hardware = false;
+
+static const uint32_t g_sha256_k[64] =
+{
+    0x428A2F98,0x71374491,0xB5C0FBCF,0xE9B5DBA5,0x3956C25B,0x59F111F1,0x923F82A4,0xAB1C5ED5,
+    0xD807AA98,0x12835B01,0x243185BE,0x550C7DC3,0x72BE5D74,0x80DEB1FE,0x9BDC06A7,0xC19BF174,
+    0xE49B69C1,0xEFBE4786,0x0FC19DC6,0x240CA1CC,0x2DE92C6F,0x4A7484AA,0x5CB0A9DC,0x76F988DA,
+    0x983E5152,0xA831C66D,0xB00327C8,0xBF597FC7,0xC6E00BF3,0xD5A79147,0x06CA6351,0x14292967,
+    0x27B70A85,0x2E1B2138,0x4D2C6DFC,0x53380D13,0x650A7354,0x766A0ABB,0x81C2C92E,0x92722C85,
+    0xA2BFE8A1,0xA81A664B,0xC24B8B70,0xC76C51A3,0xD192E819,0xD6990624,0xF40E3585,0x106AA070,
+    0x19A4C116,0x1E376C08,0x2748774C,0x34B0BCB5,0x391C0CB3,0x4ED8AA4A,0x5B9CCA4F,0x682E6FF3,
+    0x748F82EE,0x78A5636F,0x84C87814,0x8CC70208,0x90BEFFFA,0xA4506CEB,0xBEF9A3F7,0xC67178F2
+};
+
+/*******************************************************************************
+* Code
+******************************************************************************/
+static void hash_setup(void)
+{
+    uint32_t i = 0;
+    uint32_t j = 0;
+    uint32_t crc = 0;
+
+    for(i = 0;i < 256;i++)
+    {
+        crc = i;
+        for(j = 0;j < 8;j++)
+        {
+            crc = (crc >> 1) ^ ((crc & 1) ? HASH_CRC32C_POLY : 0);
+        }
+        g_crc_table[0][i] = crc;
+    }
+    for(i = 0;i < 256;i++)
+    {
+        for(j = 1;j < 8;j++)
+        {
+            g_crc_table[j][i] = (g_crc_table[j - 1][i] >> 8) ^ g_crc_table[0][g_crc_table[j - 1][i] & 0xFF];
+        }
+    }
+
+#if defined(HASH_CRC32C_SSE42)
+    __builtin_cpu_init();
+    g_crc_hardware = (__builtin_cpu_supports("sse4.2") != 0);
+#elif defined(HASH_CRC32C_ARM)
+    g_crc_hardware = true;
+#endif
+}
+
+void hash_init(void)
+{
+    pthread_once(&g_hash_once,hash_setup);
+}
+
+bool hash_crc32c_hardware(void)
+{
+    hash_init();
+    return g_crc_hardware;
+}
+
+static uint32_t crc32c_software(uint32_t crc,const uint8_t* buff,uint32_t size)
+{
+    uint32_t low = 0;
+    uint32_t high = 0;
+
+    while(size >= 8)
+    {
+        low = crc ^ ((uint32_t)buff[0] | ((uint32_t)buff[1] << 8) | ((uint32_t)buff[2] << 16) | ((uint32_t)buff[3] << 24));
+        high = (uint32_t)buff[4] | ((uint32_t)buff[5] << 8) | ((uint32_t)buff[6] << 16) | ((uint32_t)buff[7] << 24);
+        crc = g_crc_table[7][low & 0xFF] ^ g_crc_table[6][(low >> 8) & 0xFF] ^
+              g_crc_table[5][(low >> 16) & 0xFF] ^ g_crc_table[4][low >> 24] ^
+              g_crc_table[3][high & 0xFF] ^ g_crc_table[2][(high >> 8) & 0xFF] ^
+              g_crc_table[1][(high >> 16) & 0xFF] ^ g_crc_table[0][high >> 24];
+        buff += 8;
+        size -= 8;
+    }
+    while(size > 0)
+    {
+        crc = (crc >> 8) ^ g_crc_table[0][(crc ^ *buff) & 0xFF];
+        buff++;
+        size--;
+    }
+    return crc;
+}
+
+#if defined(HASH_CRC32C_SSE42)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hardware(uint32_t crc,const uint8_t* buff,uint32_t size)
+{
+#if defined(__x86_64__)
+    uint64_t value = 0;
+    uint64_t crc64 = crc;
+
+    while(size >= 8)
+    {
+        memcpy(&value,buff,8);
+        crc64 = _mm_crc32_u64(crc64,value);
+        buff += 8;
+        size -= 8;
+    }
+    crc = (uint32_t)crc64;
+#endif
+    while(size > 0)
+    {
+        crc = _mm_crc32_u8(crc,*buff);
+        buff++;
+        size--;
+    }
+    return crc;
+}
+#elif defined(HASH_CRC32C_ARM)
+static uint32_t crc32c_hardware(uint32_t crc,const uint8_t* buff,uint32_t size)
+{
+    uint64_t value = 0;
+
+    while(size >= 8)
+    {
+        memcpy(&value,buff,8);
+        crc = __crc32cd(crc,value);
+        buff += 8;
+        size -= 8;
+    }
+    while(size > 0)
+    {
+        crc = __crc32cb(crc,*buff);
+        buff++;
+        size--;
+    }
+    return crc;
+}
+#endif
+
+uint32_t hash_crc32c(uint32_t crc,const uint8_t* buff,uint32_t size)
+{
+    hash_init();
+    crc = ~crc;
+#if defined(HASH_CRC32C_SSE42) || defined(HASH_CRC32C_ARM)
+    if(g_crc_hardware == true)
+    {
+        crc = crc32c_hardware(crc,buff,size);
+    }
+    else
+#endif
+    {
+        crc = crc32c_software(crc,buff,size);
+    }
+    return ~crc;
+}
+
+void hash_sha256_init(hash_sha256_struct_t* ctx)
+{
+    ctx->state[0] = 0x6A09E667;
+    ctx->state[1] = 0xBB67AE85;
+    ctx->state[2] = 0x3C6EF372;
+    ctx->state[3] = 0xA54FF53A;
+    ctx->state[4] = 0x510E527F;
+    ctx->state[5] = 0x9B05688C;
+    ctx->state[6] = 0x1F83D9AB;
+    ctx->state[7] = 0x5BE0CD19;
+    ctx->length = 0;
+    ctx->used = 0;
+}
+
+static void sha256_block(hash_sha256_struct_t* ctx,const uint8_t* block)
+{
+    uint32_t w[64];
+    uint32_t a = ctx->state[0];
+    uint32_t b = ctx->state[1];
+    uint32_t c = ctx->state[2];
+    uint32_t d = ctx->state[3];
+    uint32_t e = ctx->state[4];
+    uint32_t f = ctx->state[5];
+    uint32_t g = ctx->state[6];
+    uint32_t h = ctx->state[7];
+    uint32_t t1 = 0;
+    uint32_t t2 = 0;
+    uint8_t i = 0;
+
+    for(i = 0;i < 16;i++)
+    {
+        w[i] = ((uint32_t)block[i * 4] << 24) | ((uint32_t)block[i * 4 + 1] << 16) |
+               ((uint32_t)block[i * 4 + 2] << 8) | (uint32_t)block[i * 4 + 3];
+    }
+    for(i = 16;i < 64;i++)
+    {
+        w[i] = (ROTR(w[i - 2],17) ^ ROTR(w[i - 2],19) ^ (w[i - 2] >> 10)) + w[i - 7] +
+               (ROTR(w[i - 15],7) ^ ROTR(w[i - 15],18) ^ (w[i - 15] >> 3)) + w[i - 16];
+    }
+    for(i = 0;i < 64;i++)
+    {
+        t1 = h + (ROTR(e,6) ^ ROTR(e,11) ^ ROTR(e,25)) + ((e & f) ^ (~e & g)) + g_sha256_k[i] + w[i];
+        t2 = (ROTR(a,2) ^ ROTR(a,13) ^ ROTR(a,22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    ctx->state[0] += a;
+    ctx->state[1] += b;
+    ctx->state[2] += c;
+    ctx->state[3] += d;
+    ctx->state[4] += e;
+    ctx->state[5] += f;
+    ctx->state[6] += g;
+    ctx->state[7] += h;
+}
+
+void hash_sha256_update(hash_sha256_struct_t* ctx,const uint8_t* buff,uint32_t size)
+{
+    uint32_t n = 0;
+
+    ctx->length += size;
+    if(ctx->used > 0)
+    {
+        n = 64 - ctx->used;
+        if(n > size)
+        {
+            n = size;
+        }
+        memcpy(&ctx->block[ctx->used],buff,n);
+        ctx->used += n;
+        buff += n;
+        size -= n;
+        if(ctx->used == 64)
+        {
+            sha256_block(ctx,ctx->block);
+            ctx->used = 0;
+        }
+    }
+    /* full blocks are hashed straight from the caller's buffer */
+    while(size >= 64)
+    {
+        sha256_block(ctx,buff);
+        buff += 64;
+        size -= 64;
+    }
+    if(size > 0)
+    {
+        memcpy(ctx->block,buff,size);
+        ctx->used = size;
+    }
+}
+
+void hash_sha256_final(hash_sha256_struct_t* ctx,uint8_t* digest)
+{
+    uint64_t bits = ctx->length * 8;
+    uint8_t i = 0;
+
+    ctx->block[ctx->used++] = 0x80;
+    if(ctx->used > 56)
+    {
+        memset(&ctx->block[ctx->used],0,64 - ctx->used);
+        sha256_block(ctx,ctx->block);
+        ctx->used = 0;
+    }
+    memset(&ctx->block[ctx->used],0,56 - ctx->used);
+    for(i = 0;i < 8;i++)
+    {
+        ctx->block[63 - i] = (bits >> (i * 8)) & 0xFF;
+    }
+    sha256_block(ctx,ctx->block);
+
+    for(i = 0;i < 8;i++)
+    {
+        digest[i * 4] = (ctx->state[i] >> 24) & 0xFF;
+        digest[i * 4 + 1] = (ctx->state[i] >> 16) & 0xFF;
+        digest[i * 4 + 2] = (ctx->state[i] >> 8) & 0xFF;
+        digest[i * 4 + 3] = ctx->state[i] & 0xFF;
+    }
+}
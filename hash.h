@@ -0,0 +1,62 @@
+#ifndef _HASH_H_
+#define _HASH_H_
+
+/*******************************************************************************
+* Definitions
+******************************************************************************/
+#define HASH_SHA256_SIZE            (32U)
+
+typedef struct
+{
+    uint32_t state[8];                          /* intermediate hash value                  */
+    uint64_t length;                            /* total bytes hashed                       */
+    uint8_t block[64];                          /* bytes waiting for a full block           */
+    uint32_t used;                              /* number of bytes in block                 */
+} hash_sha256_struct_t;
+
+/*******************************************************************************
+* API
+******************************************************************************/
+
+/** @brief This function prepares the CRC32C tables and checks if the CPU has CRC32C
+ * instructions (SSE4.2 or ARMv8 CRC). It is safe to call it more than once.
+ */
+void hash_init(void);
+
+
+/** @brief This function updates a CRC32C (Castagnoli) checksum.
+ * @param crc - previous value, 0 for the first call.
+ * @param buff - data to add.
+ * @param size - number of bytes.
+ * @return - Return the new checksum.
+ */
+uint32_t hash_crc32c(uint32_t crc,const uint8_t* buff,uint32_t size);
+
+
+/** @brief This function tells if hash_crc32c() uses CPU instructions.
+ * @return - Return 1 if CRC32C is computed by the CPU.
+ */
+bool hash_crc32c_hardware(void);
+
+
+/** @brief This function starts a SHA-256 computation.
+ * @param ctx - context to initialize.
+ */
+void hash_sha256_init(hash_sha256_struct_t* ctx);
+
+
+/** @brief This function adds data to a SHA-256 computation.
+ * @param ctx - context.
+ * @param buff - data to add.
+ * @param size - number of bytes.
+ */
+void hash_sha256_update(hash_sha256_struct_t* ctx,const uint8_t* buff,uint32_t size);
+
+
+/** @brief This function finishes a SHA-256 computation.
+ * @param ctx - context.
+ * @param digest - an array of HASH_SHA256_SIZE bytes to store the result.
+ */
+void hash_sha256_final(hash_sha256_struct_t* ctx,uint8_t* digest);
+
+#endif /* _HASH_H_ */
@@ -1,13 +1,119 @@
 /*******************************************************************************
 * Includes
 ******************************************************************************/
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
 #include "app.h"
 
 /*******************************************************************************
 * Code
 ******************************************************************************/
-int main(void)
+int main(int argc,char* argv[])
 {
-    menu();
-    return 0;
+    uint32_t partition = 0;
+    bool ok = true;
+
+    /*
+     * in front of any command: "--direct" bypasses the page cache,
+     * "--partition <n>" uses partition n of a disk image
+     */
+    while(argc >= 2)
+    {
+        if(strcmp(argv[1],"--direct") == 0)
+        {
+            app_set_direct_io(true);
+            argv[1] = argv[0];
+            argv += 1;
+            argc -= 1;
+        }
+        else if((argc >= 3) && (strcmp(argv[1],"--partition") == 0))
+        {
+            partition = strtoul(argv[2],NULL,10);
+            argv[2] = argv[0];
+            argv += 2;
+            argc -= 2;
+        }
+        else
+        {
+            break;
+        }
+    }
+    /* the daemon mounts many images, its requests name the partition ("<disk image>@<n>") */
+    if((partition != 0) && (argc >= 2) && ((strcmp(argv[1],"serve") == 0) || (strcmp(argv[1],"query") == 0)))
+    {
+        printf("--partition can't be used with %s, name the image as <disk image>@%u in the request!\n",argv[1],partition);
+        return 1;
+    }
+    if((partition != 0) && ((argc < 3) || (app_set_partition((uint8_t*)argv[2],partition) == false)))
+    {
+        return 1;
+    }
+    if((argc >= 3) && (strcmp(argv[1],"df") == 0))
+    {
+        ok = app_df((uint8_t*)argv[2]);
+    }
+    else if((argc >= 3) && (strcmp(argv[1],"snapshot") == 0))
+    {
+        ok = app_snapshot((uint8_t*)argv[2]);
+    }
+    else if((argc >= 4) && (strcmp(argv[1],"manifest") == 0))
+    {
+        ok = app_manifest((uint8_t*)argv[2],(uint8_t*)argv[3],(argc >= 5) ? strtoul(argv[4],NULL,10) : 0);
+    }
+    else if((argc >= 4) && (strcmp(argv[1],"diff") == 0))
+    {
+        ok = app_diff((uint8_t*)argv[2],(uint8_t*)argv[3],(argc >= 5) ? strtoul(argv[4],NULL,10) : 0);
+    }
+    else if((argc >= 3) && (strcmp(argv[1],"undelete") == 0))
+    {
+        ok = app_undelete((uint8_t*)argv[2],(argc >= 4) ? (uint8_t*)argv[3] : NULL);
+    }
+    else if((argc >= 3) && (strcmp(argv[1],"carve") == 0))
+    {
+        ok = app_carve((uint8_t*)argv[2],(argc >= 4) ? (uint8_t*)argv[3] : NULL,(argc >= 5) ? strtoul(argv[4],NULL,10) : 0);
+    }
+    else if((argc >= 3) && (strcmp(argv[1],"parts") == 0))
+    {
+        ok = app_parts((uint8_t*)argv[2]);
+    }
+    else if((argc >= 4) && (strcmp(argv[1],"scan") == 0))
+    {
+        ok = app_scan((uint8_t*)argv[2],(uint8_t*)argv[3],(argc >= 5) ? strtoul(argv[4],NULL,10) : 0);
+    }
+    else if((argc >= 4) && (strcmp(argv[1],"find") == 0))
+    {
+        ok = app_find((uint8_t*)argv[2],argc - 3,(uint8_t**)&argv[3]);
+    }
+    else if((argc >= 3) && (strcmp(argv[1],"serve") == 0))
+    {
+        ok = app_serve((uint8_t*)argv[2],(argc >= 4) ? strtoul(argv[3],NULL,10) : 0);
+    }
+    else if((argc >= 4) && (strcmp(argv[1],"query") == 0))
+    {
+        ok = app_query((uint8_t*)argv[2],argc - 3,(uint8_t**)&argv[3]);
+    }
+    else if((argc >= 5) && (strcmp(argv[1],"put") == 0))
+    {
+        ok = app_put((uint8_t*)argv[2],(uint8_t*)argv[3],(uint8_t*)argv[4]);
+    }
+    else if((argc >= 4) && (strcmp(argv[1],"mkdir") == 0))
+    {
+        ok = app_mkdir((uint8_t*)argv[2],(uint8_t*)argv[3]);
+    }
+    else if((argc >= 4) && (strcmp(argv[1],"rm") == 0))
+    {
+        ok = app_rm((uint8_t*)argv[2],(uint8_t*)argv[3]);
+    }
+    else if((argc >= 5) && (strcmp(argv[1],"truncate") == 0))
+    {
+        ok = app_truncate((uint8_t*)argv[2],(uint8_t*)argv[3],strtoul(argv[4],NULL,10));
+    }
+    else
+    {
+        menu();
+    }
+    return (ok == true) ? 0 : 1;
 }
\ No newline at end of file
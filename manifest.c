@@ -0,0 +1,349 @@
+/*******************************************************************************
+* Includes
+******************************************************************************/
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include "fat.h"
+#include "hash.h"
+#include "pool.h"
+#include "manifest.h"
+
+/*******************************************************************************
+* Definitions
+******************************************************************************/
+#define MANIFEST_CHUNK              (1048576U)  /* bytes read per request while streaming a file */
+#define MANIFEST_GROW               (256U)      /* files added to the list per realloc()          */
+
+typedef struct
+{
+    manifest_struct_t* manifest;
+    uint32_t capacity;                          /* allocated entries of manifest->files     */
+    uint32_t* order;                            /* files sorted by size, largest first      */
+    uint8_t** buffers;                          /* one read buffer per thread               */
+    uint32_t chunk_clusters;                    /* clusters per read buffer                 */
+} manifest_job_struct_t;
+
+/*******************************************************************************
+* Prototypes
+******************************************************************************/
+
+/** @brief This function adds a file found by fat_walk() to the manifest.
+ * @param path - full path of the entry.
+ * @param entry - directory entry.
+ * @param arg - pointer to a manifest_job_struct_t.
+ */
+static void collect_file(const uint8_t* path,const fat_entry* entry,void* arg);
+
+
+/** @brief This function hashes one file (pool task).
+ * @param index - position in job->order.
+ * @param worker - thread number, selects the read buffer.
+ * @param arg - pointer to a manifest_job_struct_t.
+ */
+static void hash_file(uint32_t index,uint32_t worker,void* arg);
+
+
+/** @brief This function finds groups of files with the same size and SHA-256.
+ * @param manifest - manifest with hashed files.
+ */
+static void find_duplicates(manifest_struct_t* manifest);
+
+
+/** @brief qsort() helpers. */
+static int compare_size(const void* a,const void* b);
+static int compare_content(const void* a,const void* b);
+
+
+/** @brief This function checks the malloc value.
+ * @param ptr - pointer of malloc.
+ */
+static void check_null(void* ptr);
+
+/*******************************************************************************
+* Variables
+******************************************************************************/
+/* qsort() has no user pointer */
+static const manifest_file_struct_t* g_sort_files = NULL;
+
+/*******************************************************************************
+* Code
+******************************************************************************/
+static void collect_file(const uint8_t* path,const fat_entry* entry,void* arg)
+{
+    manifest_job_struct_t* job = (manifest_job_struct_t*)arg;
+    manifest_struct_t* manifest = job->manifest;
+    manifest_file_struct_t* file = NULL;
+    uint32_t length = strlen((const char*)path);
+
+    /* directories and the volume label have no content of their own */
+    if((entry->attribute & 0x18) == 0)
+    {
+        if(manifest->count == job->capacity)
+        {
+            job->capacity += MANIFEST_GROW;
+            manifest->files = (manifest_file_struct_t*)realloc(manifest->files,job->capacity * sizeof(manifest_file_struct_t));
+            check_null(manifest->files);
+        }
+        file = &manifest->files[manifest->count];
+        memset(file,0,sizeof(manifest_file_struct_t));
+        file->path = (uint8_t*)malloc(length + 1);
+        check_null(file->path);
+        memcpy(file->path,path,length + 1);
+        file->first_cluster = fat_entry_cluster(entry);
+        file->size = READ_32_BITS((uint32_t)entry->size[0],(uint32_t)entry->size[1],(uint32_t)entry->size[2],(uint32_t)entry->size[3]);
+        manifest->count += 1;
+        manifest->bytes += file->size;
+    }
+}
+
+static void hash_file(uint32_t index,uint32_t worker,void* arg)
+{
+    manifest_job_struct_t* job = (manifest_job_struct_t*)arg;
+    manifest_file_struct_t* file = &job->manifest->files[job->order[index]];
+    uint8_t* buff = job->buffers[worker];
+    hash_sha256_struct_t sha;
+    uint32_t cluster = file->first_cluster;
+    uint32_t remaining = file->size;
+    uint32_t cluster_size = fat_cluster_size();
+    uint32_t max_clusters = 0;
+    uint32_t bytes = 0;
+    uint32_t crc = 0;
+
+    hash_sha256_init(&sha);
+    while((remaining > 0) && (cluster != 0))
+    {
+        /* don't read past the last cluster the size needs */
+        max_clusters = (remaining + cluster_size - 1) / cluster_size;
+        if(max_clusters > job->chunk_clusters)
+        {
+            max_clusters = job->chunk_clusters;
+        }
+        bytes = fat_read_clusters(&cluster,buff,max_clusters);
+        if(bytes == 0)
+        {
+            break;
+        }
+        if(bytes > remaining)
+        {
+            bytes = remaining;
+        }
+        crc = hash_crc32c(crc,buff,bytes);
+        hash_sha256_update(&sha,buff,bytes);
+        remaining -= bytes;
+    }
+    file->crc32c = crc;
+    hash_sha256_final(&sha,file->sha256);
+    file->damaged = (remaining > 0);
+}
+
+static int compare_size(const void* a,const void* b)
+{
+    uint32_t size_a = g_sort_files[*(const uint32_t*)a].size;
+    uint32_t size_b = g_sort_files[*(const uint32_t*)b].size;
+
+    return (size_a < size_b) - (size_a > size_b);
+}
+
+static int compare_content(const void* a,const void* b)
+{
+    const manifest_file_struct_t* file_a = &g_sort_files[*(const uint32_t*)a];
+    const manifest_file_struct_t* file_b = &g_sort_files[*(const uint32_t*)b];
+    int retValue = (file_a->size > file_b->size) - (file_a->size < file_b->size);
+
+    if(retValue == 0)
+    {
+        retValue = memcmp(file_a->sha256,file_b->sha256,HASH_SHA256_SIZE);
+    }
+    if(retValue == 0)
+    {
+        /* keeps tree order inside a group */
+        retValue = (*(const uint32_t*)a > *(const uint32_t*)b) - (*(const uint32_t*)a < *(const uint32_t*)b);
+    }
+    return retValue;
+}
+
+static void find_duplicates(manifest_struct_t* manifest)
+{
+    uint32_t* order = NULL;
+    uint32_t count = 0;
+    uint32_t i = 0;
+    uint32_t j = 0;
+
+    order = (uint32_t*)malloc((manifest->count + 1) * sizeof(uint32_t));
+    check_null(order);
+    /* empty and damaged files are never reported as duplicates */
+    for(i = 0;i < manifest->count;i++)
+    {
+        if((manifest->files[i].size > 0) && (manifest->files[i].damaged == false))
+        {
+            order[count] = i;
+            count += 1;
+        }
+    }
+    g_sort_files = manifest->files;
+    qsort(order,count,sizeof(uint32_t),compare_content);
+
+    i = 0;
+    while(i < count)
+    {
+        j = i + 1;
+        while((j < count) && (manifest->files[order[i]].size == manifest->files[order[j]].size) &&
+              (memcmp(manifest->files[order[i]].sha256,manifest->files[order[j]].sha256,HASH_SHA256_SIZE) == 0))
+        {
+            j += 1;
+        }
+        if((j - i) > 1)
+        {
+            manifest->duplicate_groups += 1;
+            manifest->duplicate_files += j - i;
+            for(;i < j;i++)
+            {
+                manifest->files[order[i]].duplicate = manifest->duplicate_groups;
+            }
+        }
+        i = j;
+    }
+    free(order);
+}
+
+bool manifest_build(manifest_struct_t* manifest,uint32_t threads)
+{
+    bool retValue = true;
+    manifest_job_struct_t job;
+    uint32_t i = 0;
+
+    memset(manifest,0,sizeof(manifest_struct_t));
+    memset(&job,0,sizeof(job));
+    job.manifest = manifest;
+    hash_init();
+
+    /* the walk also loads the FAT, reads from the pool threads only look it up */
+    retValue = fat_walk(collect_file,&job);
+    if(threads == 0)
+    {
+        threads = pool_default_threads();
+    }
+    if(threads > POOL_MAX_THREADS)
+    {
+        threads = POOL_MAX_THREADS;
+    }
+
+    job.chunk_clusters = MANIFEST_CHUNK / fat_cluster_size();
+    if(job.chunk_clusters == 0)
+    {
+        job.chunk_clusters = 1;
+    }
+    job.buffers = (uint8_t**)calloc(threads,sizeof(uint8_t*));
+    check_null(job.buffers);
+    for(i = 0;i < threads;i++)
+    {
+        job.buffers[i] = (uint8_t*)malloc(job.chunk_clusters * fat_cluster_size());
+        check_null(job.buffers[i]);
+    }
+
+    /* largest files first, a big file started last would leave the other threads idle */
+    job.order = (uint32_t*)malloc((manifest->count + 1) * sizeof(uint32_t));
+    check_null(job.order);
+    for(i = 0;i < manifest->count;i++)
+    {
+        job.order[i] = i;
+    }
+    g_sort_files = manifest->files;
+    qsort(job.order,manifest->count,sizeof(uint32_t),compare_size);
+
+    if(pool_run(manifest->count,threads,hash_file,&job) == false)
+    {
+        retValue = false;
+    }
+    for(i = 0;i < manifest->count;i++)
+    {
+        if(manifest->files[i].damaged == true)
+        {
+            manifest->damaged += 1;
+        }
+    }
+    find_duplicates(manifest);
+
+    for(i = 0;i < threads;i++)
+    {
+        free(job.buffers[i]);
+    }
+    free(job.buffers);
+    free(job.order);
+    return retValue;
+}
+
+bool manifest_save(const manifest_struct_t* manifest,uint8_t* file_path)
+{
+    bool retValue = true;
+    FILE* file = NULL;
+
+    file = fopen((const char*)file_path,"w");
+    if(file == NULL)
+    {
+        retValue = false;
+    }
+    else
+    {
+        manifest_write(manifest,file);
+        if(fclose(file) != 0)
+        {
+            retValue = false;
+        }
+    }
+    return retValue;
+}
+
+void manifest_write(const manifest_struct_t* manifest,FILE* file)
+{
+    const manifest_file_struct_t* temp = NULL;
+    uint8_t flag[16];
+    uint32_t i = 0;
+    uint8_t k = 0;
+
+    fprintf(file,"# sha256 crc32c size flag path\n");
+    for(i = 0;i < manifest->count;i++)
+    {
+        temp = &manifest->files[i];
+        if(temp->damaged == true)
+        {
+            strcpy((char*)flag,"!");
+        }
+        else if(temp->duplicate != 0)
+        {
+            sprintf((char*)flag,"=%u",temp->duplicate);
+        }
+        else
+        {
+            strcpy((char*)flag,"-");
+        }
+        for(k = 0;k < HASH_SHA256_SIZE;k++)
+        {
+            fprintf(file,"%02x",temp->sha256[k]);
+        }
+        fprintf(file," %08x %u %s %s\n",temp->crc32c,temp->size,flag,temp->path);
+    }
+}
+
+void manifest_free(manifest_struct_t* manifest)
+{
+    uint32_t i = 0;
+
+    for(i = 0;i < manifest->count;i++)
+    {
+        free(manifest->files[i].path);
+    }
+    free(manifest->files);
+    memset(manifest,0,sizeof(manifest_struct_t));
+}
+
+static void check_null(void* ptr)
+{
+    if(ptr == NULL)
+    {
+        exit(1);
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef _MANIFEST_H_
+#define _MANIFEST_H_
+
+/*******************************************************************************
+* Definitions
+******************************************************************************/
+typedef struct
+{
+    uint8_t* path;                              /* full path in the volume                  */
+    uint32_t first_cluster;                     /* first cluster of the data                */
+    uint32_t size;                              /* size from the directory entry (bytes)    */
+    uint32_t crc32c;                            /* CRC32C of the content                    */
+    uint8_t sha256[HASH_SHA256_SIZE];           /* SHA-256 of the content                   */
+    uint32_t duplicate;                         /* group of identical files, 0 = unique     */
+    bool damaged;                               /* chain is shorter than the size           */
+} manifest_file_struct_t;
+
+typedef struct
+{
+    manifest_file_struct_t* files;              /* files in tree order                      */
+    uint32_t count;                             /* number of files                          */
+    uint64_t bytes;                             /* sum of file sizes                        */
+    uint32_t duplicate_groups;                  /* groups of files with identical content   */
+    uint32_t duplicate_files;                   /* files that belong to a group             */
+    uint32_t damaged;                           /* files with a short chain                 */
+} manifest_struct_t;
+
+/*******************************************************************************
+* API
+******************************************************************************/
+
+/** @brief This function hashes every file of the mounted volume (CRC32C and SHA-256)
+ * on a pool of threads and groups files with identical content. File data is
+ * streamed cluster run by cluster run, whole files are never loaded.
+ * @param manifest - structure to store the result (release it with manifest_free()).
+ * @param threads - number of threads (0 = one per CPU).
+ * @return - Return 1 if the tree was walked and every file was hashed.
+ */
+bool manifest_build(manifest_struct_t* manifest,uint32_t threads);
+
+
+/** @brief This function writes a manifest as text, one line per file:
+ * "<sha256> <crc32c> <size> <flag> <path>", flag is "-", "=N" for the
+ * duplicate group N or "!" for a damaged file.
+ * @param manifest - manifest built by manifest_build().
+ * @param file_path - output file.
+ * @return - Return 1 if the file was written.
+ */
+bool manifest_save(const manifest_struct_t* manifest,uint8_t* file_path);
+
+
+/** @brief This function writes a manifest in the format of manifest_save() to an open stream.
+ * @param manifest - manifest built by manifest_build().
+ * @param file - output stream.
+ */
+void manifest_write(const manifest_struct_t* manifest,FILE* file);
+
+
+/** @brief This function releases a manifest.
+ * @param manifest - manifest built by manifest_build().
+ */
+void manifest_free(manifest_struct_t* manifest);
+
+#endif /* _MANIFEST_H_ */
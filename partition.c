@@ -0,0 +1,610 @@
+/*******************************************************************************
+* Includes
+******************************************************************************/
+#define _FILE_OFFSET_BITS 64                    /* disk images > 2 GiB */
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "HAL.h"
+#include "pool.h"
+#include "partition.h"
+
+#if defined(__linux__) || defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#define PARTITION_FORK_SUPPORTED
+#endif
+
+/*******************************************************************************
+* Definitions
+******************************************************************************/
+#define PARTITION_MBR_TABLE         (0x1BEU)    /* first of the 4 MBR entries               */
+#define PARTITION_MBR_ENTRY         (16U)       /* bytes per MBR entry                      */
+#define PARTITION_GPT_MAX_ENTRIES   (1024U)     /* larger GPT entry arrays are not trusted  */
+#define PARTITION_GPT_HEADER_SIZE   (92U)       /* bytes of a GPT header covered by its CRC */
+#define PARTITION_CRC32_POLY        (0xEDB88320U) /* CRC32 of GPT (reflected 0x04C11DB7)    */
+#define PARTITION_COPY_CHUNK        (65536U)    /* bytes copied per read of a report        */
+#define READ_LE32(p)                ((uint32_t)(p)[0] | ((uint32_t)(p)[1] << 8) | ((uint32_t)(p)[2] << 16) | ((uint32_t)(p)[3] << 24))
+#define READ_LE64(p)                ((uint64_t)READ_LE32(p) | ((uint64_t)READ_LE32((p) + 4) << 32))
+
+enum Partition_Scan_State
+{
+    PARTITION_WAITING = 0,
+    PARTITION_RUNNING = 1,
+    PARTITION_DONE = 2
+};
+
+/*******************************************************************************
+* Prototypes
+******************************************************************************/
+
+/** @brief This function checks if a sector looks like a FAT boot sector.
+ * @param sector - 512 bytes.
+ * @return - Return 1 if the BPB fields have legal values.
+ */
+static bool is_fat_boot_sector(const uint8_t* sector);
+
+
+/** @brief This function reads the GPT for one sector size. The backup header in the last
+ * sector is used when the primary header or its entries fail their CRC.
+ * @param handle - open image.
+ * @param sector_size - logical sector size to try (512 or 4096).
+ * @param disk_size - size of the image (bytes), 0 if unknown.
+ * @param table - stores the partitions.
+ * @return - Return 1 if a valid GPT header was found.
+ */
+static bool read_gpt(FILE* handle,uint32_t sector_size,uint64_t disk_size,partition_table_struct_t* table);
+
+
+/** @brief This function reads one GPT header and its entry array and checks both CRCs.
+ * @param handle - open image.
+ * @param sector_size - logical sector size.
+ * @param lba - sector of the header (1 for the primary, the last sector for the backup).
+ * @param header - an array of sector_size bytes, stores the header.
+ * @return - Return the entry array (malloc) or NULL if the header is not valid.
+ */
+static uint8_t* read_gpt_header(FILE* handle,uint32_t sector_size,uint64_t lba,uint8_t* header);
+
+
+/** @brief This function computes the CRC32 used by GPT.
+ * @param buff - data.
+ * @param size - number of bytes.
+ * @return - Return the CRC32.
+ */
+static uint32_t gpt_crc32(const uint8_t* buff,uint32_t size);
+
+
+/** @brief This function reads the 4 entries of an MBR and follows extended partitions.
+ * @param handle - open image.
+ * @param mbr - sector 0.
+ * @param table - stores the partitions.
+ */
+static void read_mbr(FILE* handle,const uint8_t* mbr,partition_table_struct_t* table);
+
+
+/** @brief This function follows the chain of extended boot records of an extended
+ * partition, every record holds one logical partition and the link to the next one.
+ * @param handle - open image.
+ * @param first_sector - first sector of the extended partition.
+ * @param table - stores the logical partitions (numbered from 5).
+ */
+static void read_ebr_chain(FILE* handle,uint32_t first_sector,partition_table_struct_t* table);
+
+
+/** @brief This function adds a partition to the table and checks its first sector.
+ * @param handle - open image.
+ * @param table - table.
+ * @param number - partition number.
+ * @param offset - first byte.
+ * @param size - size (bytes).
+ * @return - Return the new partition (name and type are left empty) or NULL if the table is full.
+ */
+static partition_struct_t* add_partition(FILE* handle,partition_table_struct_t* table,uint32_t number,uint64_t offset,uint64_t size);
+
+
+/** @brief This function copies a report to stdout.
+ * @param file - report, read from the start.
+ */
+static void print_report(FILE* file);
+
+
+/** @brief This function checks the malloc value.
+ * @param ptr - pointer of malloc.
+ */
+static void check_null(void* ptr);
+
+#if defined(PARTITION_FORK_SUPPORTED)
+/** @brief This function tells how a scan process ended and notes a signal in its report.
+ * @param status - status of waitpid().
+ * @param report - report of the scan.
+ * @return - Return 1 if the scan exited with success.
+ */
+static bool scan_status(int status,FILE* report);
+#endif
+
+/*******************************************************************************
+* Code
+******************************************************************************/
+bool partition_read(uint8_t* file_path,partition_table_struct_t* table)
+{
+    bool retValue = false;
+    FILE* handle = NULL;
+    uint8_t sector[512];
+    struct stat info;
+    uint64_t disk_size = 0;
+    uint32_t i = 0;
+    bool protective = false;
+
+    memset(table,0,sizeof(partition_table_struct_t));
+    table->sector_size = 512;
+    disk_size = (stat(file_path,&info) == 0) ? (uint64_t)info.st_size : 0;
+    handle = kmc_open_handle(file_path);
+    if((handle != NULL) && (kmc_read_handle(handle,0,512,sector) == 512))
+    {
+        if(is_fat_boot_sector(sector) == true)
+        {
+            /* a volume image, no partition table */
+            table->scheme = PARTITION_NONE;
+            add_partition(handle,table,1,0,disk_size);
+            retValue = true;
+        }
+        else if((sector[510] == 0x55) && (sector[511] == 0xAA))
+        {
+            for(i = 0;i < 4;i++)
+            {
+                if(sector[PARTITION_MBR_TABLE + i * PARTITION_MBR_ENTRY + 4] == 0xEE)
+                {
+                    protective = true;
+                }
+            }
+            if((protective == true) && ((read_gpt(handle,512,disk_size,table) == true) ||
+                                       (read_gpt(handle,4096,disk_size,table) == true)))
+            {
+                table->scheme = PARTITION_GPT;
+            }
+            else
+            {
+                table->scheme = PARTITION_MBR;
+                read_mbr(handle,sector,table);
+            }
+            retValue = true;
+        }
+    }
+    if(handle != NULL)
+    {
+        kmc_close_handle(handle);
+    }
+    return retValue;
+}
+
+static bool is_fat_boot_sector(const uint8_t* sector)
+{
+    uint32_t bytes_per_sector = sector[0x0B] | (sector[0x0C] << 8);
+    uint32_t sectors_per_cluster = sector[0x0D];
+    uint32_t reserved = sector[0x0E] | (sector[0x0F] << 8);
+    uint32_t fats = sector[0x10];
+    uint32_t fat_size_16 = sector[0x16] | (sector[0x17] << 8);
+    uint32_t fat_size_32 = READ_LE32(&sector[0x24]);
+
+    return ((sector[0] == 0xEB) || (sector[0] == 0xE9)) &&
+           (sector[510] == 0x55) && (sector[511] == 0xAA) &&
+           ((bytes_per_sector == 512) || (bytes_per_sector == 1024) || (bytes_per_sector == 2048) || (bytes_per_sector == 4096)) &&
+           (sectors_per_cluster != 0) && ((sectors_per_cluster & (sectors_per_cluster - 1)) == 0) &&
+           (reserved != 0) && (fats >= 1) && (fats <= 4) && (sector[0x15] >= 0xF0) &&
+           ((fat_size_16 != 0) || (fat_size_32 != 0));
+}
+
+static bool read_gpt(FILE* handle,uint32_t sector_size,uint64_t disk_size,partition_table_struct_t* table)
+{
+    bool retValue = false;
+    uint8_t header[4096];
+    uint8_t* p_entries = NULL;
+    const uint8_t* p_entry = NULL;
+    partition_struct_t* partition = NULL;
+    uint32_t entry_size = 0;
+    uint64_t first_lba = 0;
+    uint64_t last_lba = 0;
+    uint32_t bytes = 0;
+    uint32_t i = 0;
+    uint32_t k = 0;
+    uint32_t empty = 0;
+
+    p_entries = read_gpt_header(handle,sector_size,1,header);
+    if((p_entries == NULL) && (disk_size >= (3ULL * sector_size)))
+    {
+        /* the primary header or its entries are damaged, the backup has its own copy */
+        p_entries = read_gpt_header(handle,sector_size,(disk_size / sector_size) - 1,header);
+    }
+    if(p_entries != NULL)
+    {
+        retValue = true;
+        table->sector_size = sector_size;
+        entry_size = READ_LE32(&header[84]);
+        bytes = READ_LE32(&header[80]) * entry_size;
+        for(i = 0;((i + 1) * entry_size) <= bytes;i++)
+        {
+            p_entry = p_entries + i * entry_size;
+            for(k = 0,empty = 0;k < 16;k++)
+            {
+                empty += (p_entry[k] == 0);
+            }
+            first_lba = READ_LE64(p_entry + 32);
+            last_lba = READ_LE64(p_entry + 40);
+            if((empty == 16) || (last_lba < first_lba))
+            {
+                continue; /* unused entry */
+            }
+            partition = add_partition(handle,table,i + 1,first_lba * sector_size,(last_lba - first_lba + 1) * sector_size);
+            if(partition == NULL)
+            {
+                break;
+            }
+            /* the first three fields of a GUID are little endian */
+            sprintf((char*)partition->type_guid,"%08X-%04X-%04X-%02X%02X-%02X%02X%02X%02X%02X%02X",
+                    READ_LE32(p_entry),p_entry[4] | (p_entry[5] << 8),p_entry[6] | (p_entry[7] << 8),
+                    p_entry[8],p_entry[9],p_entry[10],p_entry[11],p_entry[12],p_entry[13],p_entry[14],p_entry[15]);
+            /* UTF-16LE name, kept as ASCII */
+            for(k = 0;(k < 36) && (k < (sizeof(partition->name) - 1));k++)
+            {
+                if((p_entry[56 + 2 * k] == 0) && (p_entry[57 + 2 * k] == 0))
+                {
+                    break;
+                }
+                partition->name[k] = ((p_entry[57 + 2 * k] == 0) && (p_entry[56 + 2 * k] >= 0x20) && (p_entry[56 + 2 * k] < 0x7F)) ?
+                                     p_entry[56 + 2 * k] : '?';
+            }
+            partition->name[k] = '\0';
+        }
+        free(p_entries);
+    }
+    return retValue;
+}
+
+static uint8_t* read_gpt_header(FILE* handle,uint32_t sector_size,uint64_t lba,uint8_t* header)
+{
+    uint8_t* retValue = NULL;
+    uint32_t header_size = 0;
+    uint32_t header_crc = 0;
+    uint32_t entry_count = 0;
+    uint32_t entry_size = 0;
+    uint32_t bytes = 0;
+
+    if((kmc_read_handle(handle,lba * sector_size,sector_size,header) == (int32_t)sector_size) &&
+       (memcmp(header,"EFI PART",8) == 0))
+    {
+        header_size = READ_LE32(&header[12]);
+        header_crc = READ_LE32(&header[16]);
+        entry_count = READ_LE32(&header[80]);
+        entry_size = READ_LE32(&header[84]);
+        if((header_size >= PARTITION_GPT_HEADER_SIZE) && (header_size <= sector_size) && (READ_LE64(&header[24]) == lba) &&
+           (entry_size >= 128) && (entry_size <= 4096) && (entry_count != 0) && (entry_count <= PARTITION_GPT_MAX_ENTRIES))
+        {
+            /* the header CRC is computed with its own field set to 0 */
+            memset(&header[16],0,4);
+            if(gpt_crc32(header,header_size) == header_crc)
+            {
+                bytes = entry_count * entry_size;
+                retValue = (uint8_t*)malloc(sizeof(uint8_t)*bytes);
+                check_null(retValue);
+                if((kmc_read_handle(handle,READ_LE64(&header[72]) * sector_size,bytes,retValue) != (int32_t)bytes) ||
+                   (gpt_crc32(retValue,bytes) != READ_LE32(&header[88])))
+                {
+                    free(retValue);
+                    retValue = NULL;
+                }
+            }
+        }
+    }
+    return retValue;
+}
+
+static uint32_t gpt_crc32(const uint8_t* buff,uint32_t size)
+{
+    uint32_t crc = 0xFFFFFFFFU;
+    uint32_t i = 0;
+    uint32_t k = 0;
+
+    for(i = 0;i < size;i++)
+    {
+        crc ^= buff[i];
+        for(k = 0;k < 8;k++)
+        {
+            crc = (crc >> 1) ^ (PARTITION_CRC32_POLY & (0U - (crc & 1U)));
+        }
+    }
+    return crc ^ 0xFFFFFFFFU;
+}
+
+static void read_mbr(FILE* handle,const uint8_t* mbr,partition_table_struct_t* table)
+{
+    const uint8_t* p_entry = NULL;
+    partition_struct_t* partition = NULL;
+    uint32_t first_sector = 0;
+    uint32_t sectors = 0;
+    uint32_t i = 0;
+
+    for(i = 0;i < 4;i++)
+    {
+        p_entry = mbr + PARTITION_MBR_TABLE + i * PARTITION_MBR_ENTRY;
+        first_sector = READ_LE32(p_entry + 8);
+        sectors = READ_LE32(p_entry + 12);
+        if((p_entry[4] == 0) || (sectors == 0))
+        {
+            /* just check, don't do anything */
+        }
+        else if((p_entry[4] == 0x05) || (p_entry[4] == 0x0F) || (p_entry[4] == 0x85)) /* extended (CHS, LBA, Linux) */
+        {
+            read_ebr_chain(handle,first_sector,table);
+        }
+        else
+        {
+            partition = add_partition(handle,table,i + 1,(uint64_t)first_sector * 512,(uint64_t)sectors * 512);
+            if(partition != NULL)
+            {
+                partition->type = p_entry[4];
+            }
+        }
+    }
+}
+
+static void read_ebr_chain(FILE* handle,uint32_t first_sector,partition_table_struct_t* table)
+{
+    uint8_t ebr[512];
+    const uint8_t* p_entry = NULL;
+    partition_struct_t* partition = NULL;
+    uint32_t ebr_sector = first_sector;
+    uint32_t number = 5;
+    uint32_t i = 0;
+
+    /* a looped chain stops after PARTITION_MAX records */
+    for(i = 0;i < PARTITION_MAX;i++)
+    {
+        if((kmc_read_handle(handle,(uint64_t)ebr_sector * 512,512,ebr) != 512) || (ebr[510] != 0x55) || (ebr[511] != 0xAA))
+        {
+            break;
+        }
+        /* entry 1: the logical partition, relative to this record */
+        p_entry = ebr + PARTITION_MBR_TABLE;
+        if((p_entry[4] != 0) && (READ_LE32(p_entry + 12) != 0))
+        {
+            partition = add_partition(handle,table,number,((uint64_t)ebr_sector + READ_LE32(p_entry + 8)) * 512,
+                                      (uint64_t)READ_LE32(p_entry + 12) * 512);
+            if(partition == NULL)
+            {
+                break;
+            }
+            partition->type = p_entry[4];
+            number += 1;
+        }
+        /* entry 2: the next record, relative to the extended partition */
+        p_entry = ebr + PARTITION_MBR_TABLE + PARTITION_MBR_ENTRY;
+        if((p_entry[4] == 0) || (READ_LE32(p_entry + 8) == 0))
+        {
+            break;
+        }
+        ebr_sector = first_sector + READ_LE32(p_entry + 8);
+    }
+}
+
+static partition_struct_t* add_partition(FILE* handle,partition_table_struct_t* table,uint32_t number,uint64_t offset,uint64_t size)
+{
+    partition_struct_t* retValue = NULL;
+    uint8_t sector[512];
+
+    if(table->count < PARTITION_MAX)
+    {
+        retValue = &table->partitions[table->count];
+        memset(retValue,0,sizeof(partition_struct_t));
+        retValue->number = number;
+        retValue->offset = offset;
+        retValue->size = size;
+        /* trust the boot sector, not the type: FAT volumes often sit in partitions of another type */
+        retValue->fat = (kmc_read_handle(handle,offset,512,sector) == 512) && (is_fat_boot_sector(sector) == true);
+        table->count += 1;
+    }
+    return retValue;
+}
+
+const partition_struct_t* partition_find(const partition_table_struct_t* table,uint32_t number)
+{
+    const partition_struct_t* retValue = NULL;
+    uint32_t i = 0;
+
+    for(i = 0;(i < table->count) && (retValue == NULL);i++)
+    {
+        if(table->partitions[i].number == number)
+        {
+            retValue = &table->partitions[i];
+        }
+    }
+    return retValue;
+}
+
+const uint8_t* partition_scheme_name(uint8_t scheme)
+{
+    const uint8_t* retValue = (const uint8_t*)"none";
+
+    if(scheme == PARTITION_MBR)
+    {
+        retValue = (const uint8_t*)"MBR";
+    }
+    else if(scheme == PARTITION_GPT)
+    {
+        retValue = (const uint8_t*)"GPT";
+    }
+    return retValue;
+}
+
+static void print_report(FILE* file)
+{
+    uint8_t buff[PARTITION_COPY_CHUNK];
+    size_t bytes = 0;
+
+    rewind(file);
+    while((bytes = fread(buff,sizeof(uint8_t),sizeof(buff),file)) > 0)
+    {
+        fwrite(buff,sizeof(uint8_t),bytes,stdout);
+    }
+    fflush(stdout);
+}
+
+static void check_null(void* ptr)
+{
+    if(ptr == NULL)
+    {
+        exit(1);
+    }
+}
+
+#if defined(PARTITION_FORK_SUPPORTED)
+static bool scan_status(int status,FILE* report)
+{
+    if(WIFSIGNALED(status))
+    {
+        /* the child wrote up to the end of the file, the note goes behind it */
+        fprintf(report,"scan stopped by signal %d\n",WTERMSIG(status));
+    }
+    return WIFEXITED(status) && (WEXITSTATUS(status) == 0);
+}
+
+bool partition_scan(const partition_table_struct_t* table,uint32_t jobs,partition_scan_callback_t callback,void* arg)
+{
+    bool retValue = true;
+    uint32_t order[PARTITION_MAX];             /* FAT partitions, indexes in the table     */
+    FILE* reports[PARTITION_MAX];
+    pid_t pids[PARTITION_MAX];
+    uint8_t state[PARTITION_MAX];
+    bool ok[PARTITION_MAX];
+    uint32_t count = 0;
+    uint32_t next_start = 0;
+    uint32_t next_print = 0;
+    uint32_t running = 0;
+    uint32_t i = 0;
+    pid_t pid = 0;
+    int status = 0;
+
+    if(jobs == 0)
+    {
+        jobs = pool_default_threads();
+    }
+    for(i = 0;i < table->count;i++)
+    {
+        if(table->partitions[i].fat == true)
+        {
+            order[count] = i;
+            state[count] = PARTITION_WAITING;
+            reports[count] = NULL;
+            ok[count] = false;
+            count += 1;
+        }
+    }
+
+    while(next_print < count)
+    {
+        while((running < jobs) && (next_start < count))
+        {
+            reports[next_start] = tmpfile();
+            state[next_start] = PARTITION_DONE;
+            if(reports[next_start] != NULL)
+            {
+                fflush(stdout);
+                pid = fork();
+                if(pid == 0)
+                {
+                    /* child: scan, leave the report in the temporary file */
+                    ok[next_start] = callback(&table->partitions[order[next_start]],reports[next_start],arg);
+                    fflush(reports[next_start]);
+                    fflush(stdout);
+                    _exit((ok[next_start] == true) ? 0 : 1);
+                }
+                else if(pid > 0)
+                {
+                    pids[next_start] = pid;
+                    state[next_start] = PARTITION_RUNNING;
+                    running += 1;
+                }
+                else
+                {
+                    /* no process left: scan here, the report still waits for its turn */
+                    ok[next_start] = callback(&table->partitions[order[next_start]],reports[next_start],arg);
+                }
+            }
+            next_start += 1;
+        }
+
+        /* print every report whose partitions before it are done */
+        while((next_print < count) && (state[next_print] == PARTITION_DONE))
+        {
+            if(reports[next_print] != NULL)
+            {
+                print_report(reports[next_print]);
+                fclose(reports[next_print]);
+                reports[next_print] = NULL;
+            }
+            retValue = retValue && ok[next_print];
+            next_print += 1;
+        }
+
+        if(running > 0)
+        {
+            pid = waitpid(-1,&status,0);
+            if((pid < 0) && (errno == EINTR))
+            {
+                continue;
+            }
+            if(pid < 0)
+            {
+                /* waiting for any child failed: wait for each one by itself so none is left
+                 * running, a child that can't be waited for counts as failed */
+                retValue = false;
+            }
+            for(i = 0;i < count;i++)
+            {
+                if((state[i] == PARTITION_RUNNING) && (pid < 0))
+                {
+                    while(((pids[i] = waitpid(pids[i],&status,0)) < 0) && (errno == EINTR))
+                    {
+                        /* just retry */
+                    }
+                    state[i] = PARTITION_DONE;
+                    ok[i] = (pids[i] > 0) && (scan_status(status,reports[i]) == true);
+                    running -= 1;
+                    if(pids[i] < 0)
+                    {
+                        fprintf(reports[i],"scan lost: %s\n",strerror(errno));
+                    }
+                }
+                else if((state[i] == PARTITION_RUNNING) && (pids[i] == pid))
+                {
+                    state[i] = PARTITION_DONE;
+                    ok[i] = scan_status(status,reports[i]);
+                    running -= 1;
+                }
+            }
+        }
+    }
+    return retValue;
+}
+#else
+/* no fork() on this system: one partition after the other */
+bool partition_scan(const partition_table_struct_t* table,uint32_t jobs,partition_scan_callback_t callback,void* arg)
+{
+    bool retValue = true;
+    uint32_t i = 0;
+
+    for(i = 0;i < table->count;i++)
+    {
+        if(table->partitions[i].fat == true)
+        {
+            retValue = (callback(&table->partitions[i],stdout,arg) == true) && retValue;
+            fflush(stdout);
+        }
+    }
+    return retValue;
+}
+#endif
@@ -0,0 +1,87 @@
+#ifndef _PARTITION_H_
+#define _PARTITION_H_
+
+/*******************************************************************************
+* Definitions
+******************************************************************************/
+#define PARTITION_MAX               (128U)      /* partitions read from one table           */
+
+enum Partition_Scheme
+{
+    PARTITION_NONE = 0,                         /* no table, the image is one FAT volume    */
+    PARTITION_MBR = 1,                          /* MBR, primary and logical partitions      */
+    PARTITION_GPT = 2                           /* GUID partition table                     */
+};
+
+typedef struct
+{
+    uint32_t number;                            /* MBR: 1-4 primary, 5.. logical; GPT: 1..  */
+    uint8_t type;                               /* MBR partition type, 0 for GPT            */
+    uint8_t type_guid[40];                      /* GPT type GUID as text, "" for MBR        */
+    uint8_t name[40];                           /* GPT partition name, "" for MBR           */
+    uint64_t offset;                            /* first byte of the volume in the image    */
+    uint64_t size;                              /* size (bytes)                             */
+    bool fat;                                   /* starts with a FAT boot sector            */
+} partition_struct_t;
+
+typedef struct
+{
+    uint8_t scheme;                             /* Partition_Scheme                         */
+    uint32_t sector_size;                       /* logical sector size of the table         */
+    uint32_t count;
+    partition_struct_t partitions[PARTITION_MAX];
+} partition_table_struct_t;
+
+/** @brief Callback of partition_scan(), called for every FAT partition. It runs in its
+ * own process where fork() exists, so it can mount the partition (fat_set_volume_offset()
+ * and fat_init()) next to the other ones.
+ * @param partition - partition to scan.
+ * @param out - where the callback prints its report.
+ * @param arg - user pointer passed to partition_scan().
+ * @return - Return 1 if the scan succeeded.
+ */
+typedef bool (*partition_scan_callback_t)(const partition_struct_t* partition,FILE* out,void* arg);
+
+/*******************************************************************************
+* API
+******************************************************************************/
+
+/** @brief This function reads the partition table of a disk image: GPT (behind a
+ * protective MBR, 512 or 4096 byte sectors) or MBR with its chain of extended boot
+ * records. An image that starts with a FAT boot sector is one volume at offset 0.
+ * @param file_path - disk image.
+ * @param table - stores the partitions in table order.
+ * @return - Return 1 if the image could be read and has a partition table or a FAT volume.
+ */
+bool partition_read(uint8_t* file_path,partition_table_struct_t* table);
+
+
+/** @brief This function finds a partition by its number.
+ * @param table - table of partition_read().
+ * @param number - partition number.
+ * @return - Return the partition or NULL.
+ */
+const partition_struct_t* partition_find(const partition_table_struct_t* table,uint32_t number);
+
+
+/** @brief This function returns the name of a partition scheme.
+ * @param scheme - Partition_Scheme.
+ * @return - Return "none", "MBR" or "GPT".
+ */
+const uint8_t* partition_scheme_name(uint8_t scheme);
+
+
+/** @brief This function runs a callback for every FAT partition of a table, up to
+ * jobs partitions at once, each one in a child process (the mounted volume of fat.c
+ * is global, processes keep the volumes apart). The reports are printed to stdout
+ * in table order as soon as the partitions before them are done. Without fork()
+ * the partitions are scanned one after the other.
+ * @param table - table of partition_read().
+ * @param jobs - partitions scanned at once (0 = one per CPU).
+ * @param callback - scan of one partition.
+ * @param arg - user pointer passed to the callback.
+ * @return - Return 1 if every callback succeeded.
+ */
+bool partition_scan(const partition_table_struct_t* table,uint32_t jobs,partition_scan_callback_t callback,void* arg);
+
+#endif /* _PARTITION_H_ */
@@ -0,0 +1,144 @@
+/*******************************************************************************
+* Includes
+******************************************************************************/
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "pool.h"
+
+#if defined(__linux__) || defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#endif
+
+/*******************************************************************************
+* Definitions
+******************************************************************************/
+typedef struct
+{
+    pool_task_t task;                           /* work function                            */
+    void* arg;                                  /* user pointer                             */
+    uint32_t count;                             /* number of items                          */
+    uint32_t next;                              /* next item to hand out                    */
+    pthread_mutex_t lock;                       /* protects next                            */
+} pool_job_struct_t;
+
+typedef struct
+{
+    pool_job_struct_t* job;
+    uint32_t worker;
+} pool_worker_struct_t;
+
+/*******************************************************************************
+* Prototypes
+******************************************************************************/
+
+/** @brief This function is the body of a pool thread: it runs items until none are left.
+ * @param arg - pointer to a pool_worker_struct_t.
+ * @return - Return NULL.
+ */
+static void* pool_worker(void* arg);
+
+/*******************************************************************************
+* Code
+******************************************************************************/
+uint32_t pool_default_threads(void)
+{
+    long count = 1;
+
+#if defined(__linux__) || defined(__unix__) || defined(__APPLE__)
+    count = sysconf(_SC_NPROCESSORS_ONLN);
+#elif defined(_WIN32)
+    SYSTEM_INFO info;
+
+    GetSystemInfo(&info);
+    count = info.dwNumberOfProcessors;
+#endif
+    if(count < 1)
+    {
+        count = 1;
+    }
+    if(count > POOL_MAX_THREADS)
+    {
+        count = POOL_MAX_THREADS;
+    }
+    return (uint32_t)count;
+}
+
+static void* pool_worker(void* arg)
+{
+    pool_worker_struct_t* worker = (pool_worker_struct_t*)arg;
+    pool_job_struct_t* job = worker->job;
+    uint32_t index = 0;
+
+    while(true)
+    {
+        pthread_mutex_lock(&job->lock);
+        index = job->next;
+        if(index < job->count)
+        {
+            job->next += 1;
+        }
+        pthread_mutex_unlock(&job->lock);
+        if(index >= job->count)
+        {
+            break;
+        }
+        job->task(index,worker->worker,job->arg);
+    }
+    return NULL;
+}
+
+bool pool_run(uint32_t count,uint32_t threads,pool_task_t task,void* arg)
+{
+    bool retValue = true;
+    pool_job_struct_t job;
+    pool_worker_struct_t workers[POOL_MAX_THREADS];
+    pthread_t handles[POOL_MAX_THREADS];
+    bool started[POOL_MAX_THREADS];
+    uint32_t i = 0;
+
+    if(threads == 0)
+    {
+        threads = pool_default_threads();
+    }
+    if(threads > POOL_MAX_THREADS)
+    {
+        threads = POOL_MAX_THREADS;
+    }
+    if(threads > count)
+    {
+        threads = count;
+    }
+    job.task = task;
+    job.arg = arg;
+    job.count = count;
+    job.next = 0;
+    pthread_mutex_init(&job.lock,NULL);
+
+    /* thread 0 is the caller, a pool of one runs everything inline */
+    for(i = 1;i < threads;i++)
+    {
+        workers[i].job = &job;
+        workers[i].worker = i;
+        started[i] = (pthread_create(&handles[i],NULL,pool_worker,&workers[i]) == 0);
+    }
+    if(count > 0)
+    {
+        workers[0].job = &job;
+        workers[0].worker = 0;
+        pool_worker(&workers[0]);
+    }
+    for(i = 1;i < threads;i++)
+    {
+        if(started[i] == true)
+        {
+            pthread_join(handles[i],NULL);
+        }
+    }
+    /* the caller's loop only ends when every index has been handed out */
+    retValue = (job.next == count);
+    pthread_mutex_destroy(&job.lock);
+    return retValue;
+}
@@ -0,0 +1,33 @@
+#ifndef _POOL_H_
+#define _POOL_H_
+
+/*******************************************************************************
+* Definitions
+******************************************************************************/
+#define POOL_MAX_THREADS            (64U)
+
+/* work function: index of the item and number (0 .. threads - 1) of the thread running it */
+typedef void (*pool_task_t)(uint32_t index,uint32_t worker,void* arg);
+
+/*******************************************************************************
+* API
+******************************************************************************/
+
+/** @brief This function returns the number of threads to use (online CPUs).
+ * @return - Return a value between 1 and POOL_MAX_THREADS.
+ */
+uint32_t pool_default_threads(void);
+
+
+/** @brief This function runs a task for every index 0 .. count - 1 on a pool of threads
+ * and waits for all of them. Threads take the next index when they are done, so slow
+ * items don't hold back the others.
+ * @param count - number of items.
+ * @param threads - number of threads (0 = pool_default_threads()).
+ * @param task - work function.
+ * @param arg - user pointer passed to the task.
+ * @return - Return 1 if every item was processed.
+ */
+bool pool_run(uint32_t count,uint32_t threads,pool_task_t task,void* arg);
+
+#endif /* _POOL_H_ */
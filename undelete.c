@@ -0,0 +1,624 @@
+/*******************************************************************************
+* Includes
+******************************************************************************/
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include "fat.h"
+#include "pool.h"
+#include "undelete.h"
+
+/*******************************************************************************
+* Definitions
+******************************************************************************/
+#define UNDELETE_CHUNK              (1048576U)  /* bytes read per request                        */
+#define UNDELETE_RANGE              (16384U)    /* clusters per carving task                     */
+#define UNDELETE_GROW               (256U)      /* entries added to a list per realloc()         */
+#define UNDELETE_MAGIC_SIZE         (16U)
+#define UNDELETE_TRAILER_SIZE       (8U)
+#define UNDELETE_MB(n)              ((n) * 1048576U)
+
+typedef struct
+{
+    uint8_t magic[UNDELETE_MAGIC_SIZE];         /* bytes at the start of the file           */
+    uint8_t length;                             /* bytes of magic to compare                */
+    const uint8_t* extension;                   /* extension of carved files                */
+    uint32_t max_size;                          /* largest file carved (bytes)              */
+    uint8_t trailer[UNDELETE_TRAILER_SIZE];     /* bytes that end the file                  */
+    uint8_t trailer_length;                     /* 0 = the format has no end marker         */
+    uint8_t trailer_extra;                      /* bytes of the file after the end marker   */
+    bool trailer_last;                          /* the file ends at the last end marker     */
+} undelete_signature_struct_t;
+
+typedef struct
+{
+    undelete_carve_struct_t* carve;
+    uint32_t entries;                           /* FAT entries (total clusters + 2)         */
+    uint32_t chunk_clusters;                    /* clusters per read buffer                 */
+    uint8_t** buffers;                          /* one read buffer per thread               */
+    uint32_t** tables;                          /* FAT entries of the range, one per thread */
+    pthread_mutex_t lock;                       /* protects carve                           */
+} undelete_job_struct_t;
+
+/*******************************************************************************
+* Prototypes
+******************************************************************************/
+
+/** @brief This function adds a deleted entry found by fat_walk_deleted() to the list.
+ * @param dir_path - path of the directory of the entry.
+ * @param entry - recovered entry.
+ * @param arg - pointer to an undelete_struct_t.
+ */
+static void collect_deleted(const uint8_t* dir_path,const fat_deleted_struct_t* entry,void* arg);
+
+
+/** @brief This function guesses the chain of a deleted entry from the free clusters.
+ * @param file - deleted entry.
+ * @param entries - FAT entries (total clusters + 2).
+ */
+static void guess_chain(undelete_file_struct_t* file,uint32_t entries);
+
+
+/** @brief This function scans one range of clusters for signatures (pool task).
+ * @param index - range number.
+ * @param worker - thread number, selects the read buffer.
+ * @param arg - pointer to an undelete_job_struct_t.
+ */
+static void carve_range(uint32_t index,uint32_t worker,void* arg);
+
+
+/** @brief This function finds where a carving hit ends (pool task): at the end marker
+ * of its format, at its maximum size, or before a used, zero-filled or hole cluster.
+ * @param index - hit number.
+ * @param worker - thread number, selects the read buffer.
+ * @param arg - pointer to an undelete_job_struct_t.
+ */
+static void extend_hit(uint32_t index,uint32_t worker,void* arg);
+
+
+/** @brief This function finds bytes in a buffer.
+ * @param buff - buffer.
+ * @param size - size of the buffer.
+ * @param bytes - bytes to find.
+ * @param length - number of bytes to find.
+ * @return - Return the first occurrence or NULL.
+ */
+static const uint8_t* find_bytes(const uint8_t* buff,uint32_t size,const uint8_t* bytes,uint32_t length);
+
+
+/** @brief This function writes clusters of the volume to a host file.
+ * @param runs - runs of clusters.
+ * @param run_count - number of runs.
+ * @param size - bytes to write.
+ * @param host_path - file to create.
+ * @return - Return 1 if the file was written.
+ */
+static bool save_runs(const undelete_run_struct_t* runs,uint32_t run_count,uint32_t size,uint8_t* host_path);
+
+
+/** @brief qsort() helper, sorts hits by cluster. */
+static int compare_hit(const void* a,const void* b);
+
+
+/** @brief This function checks the malloc value.
+ * @param ptr - pointer of malloc.
+ */
+static void check_null(void* ptr);
+
+/*******************************************************************************
+* Variables
+******************************************************************************/
+/* the end markers: JPEG EOI, PNG IEND chunk (with its fixed CRC), GIF last block and
+ * trailer, PDF "%%EOF", ZIP end of central directory (22 bytes, comment not counted).
+ * Every incremental update of a PDF appends a new "%%EOF", so the last one is used */
+static const undelete_signature_struct_t g_signatures[] =
+{
+    {{0xFF,0xD8,0xFF},3,(const uint8_t*)"jpg",UNDELETE_MB(64),{0xFF,0xD9},2,0,false},
+    {{0x89,'P','N','G',0x0D,0x0A,0x1A,0x0A},8,(const uint8_t*)"png",UNDELETE_MB(64),{'I','E','N','D',0xAE,0x42,0x60,0x82},8,0,false},
+    {{'G','I','F','8','7','a'},6,(const uint8_t*)"gif",UNDELETE_MB(16),{0x00,0x3B},2,0,false},
+    {{'G','I','F','8','9','a'},6,(const uint8_t*)"gif",UNDELETE_MB(16),{0x00,0x3B},2,0,false},
+    {{'%','P','D','F','-'},5,(const uint8_t*)"pdf",UNDELETE_MB(256),{'%','%','E','O','F'},5,0,true},
+    {{'P','K',0x03,0x04},4,(const uint8_t*)"zip",UNDELETE_MB(1024),{'P','K',0x05,0x06},4,18,false},
+    {{0x1F,0x8B,0x08},3,(const uint8_t*)"gz",UNDELETE_MB(1024),{0},0,0,false},
+    {{'7','z',0xBC,0xAF,0x27,0x1C},6,(const uint8_t*)"7z",UNDELETE_MB(1024),{0},0,0,false},
+    {{'R','a','r','!',0x1A,0x07},6,(const uint8_t*)"rar",UNDELETE_MB(1024),{0},0,0,false},
+    {{0xD0,0xCF,0x11,0xE0,0xA1,0xB1,0x1A,0xE1},8,(const uint8_t*)"doc",UNDELETE_MB(256),{0},0,0,false},
+    {{0x7F,'E','L','F'},4,(const uint8_t*)"elf",UNDELETE_MB(256),{0},0,0,false},
+    {{'I','D','3'},3,(const uint8_t*)"mp3",UNDELETE_MB(64),{0},0,0,false},
+    {{'R','I','F','F'},4,(const uint8_t*)"riff",UNDELETE_MB(1024),{0},0,0,false},
+    {{'S','Q','L','i','t','e',' ','f','o','r','m','a','t',' ','3',0x00},16,(const uint8_t*)"sqlite",UNDELETE_MB(1024),{0},0,0,false}
+};
+
+#define UNDELETE_SIGNATURES         (sizeof(g_signatures) / sizeof(g_signatures[0]))
+
+/*******************************************************************************
+* Code
+******************************************************************************/
+static void collect_deleted(const uint8_t* dir_path,const fat_deleted_struct_t* entry,void* arg)
+{
+    undelete_struct_t* list = (undelete_struct_t*)arg;
+    undelete_file_struct_t* file = NULL;
+    uint32_t length = strlen((const char*)dir_path) + 1 + strlen((const char*)entry->name);
+
+    if(list->count == list->capacity)
+    {
+        list->capacity += UNDELETE_GROW;
+        list->files = (undelete_file_struct_t*)realloc(list->files,list->capacity * sizeof(undelete_file_struct_t));
+        check_null(list->files);
+    }
+    file = &list->files[list->count];
+    memset(file,0,sizeof(undelete_file_struct_t));
+    file->path = (uint8_t*)malloc(length + 1);
+    check_null(file->path);
+    sprintf((char*)file->path,"%s/%s",dir_path,entry->name);
+    memcpy(&file->entry,entry,sizeof(fat_deleted_struct_t));
+    list->count += 1;
+}
+
+static void guess_chain(undelete_file_struct_t* file,uint32_t entries)
+{
+    uint32_t cluster_size = fat_cluster_size();
+    uint32_t cluster = file->entry.first_cluster;
+    bool skipped = false;
+
+    if((file->entry.attribute & 0x10) != 0)
+    {
+        /* the size of a directory is unknown, its first cluster is all we can trust */
+        file->clusters = 1;
+    }
+    else
+    {
+        file->clusters = (uint32_t)(((uint64_t)file->entry.size + cluster_size - 1) / cluster_size);
+    }
+    /* a damaged size can't ask for more clusters than the volume has */
+    if(file->clusters > (entries - 2))
+    {
+        file->clusters = entries - 2;
+    }
+
+    if(file->clusters == 0)
+    {
+        file->status = UNDELETE_EMPTY;
+    }
+    else if((cluster < 2) || (cluster >= entries) || (fat_next_cluster(cluster) != 0))
+    {
+        file->status = UNDELETE_OVERWRITTEN;
+    }
+    else
+    {
+        file->runs = (undelete_run_struct_t*)malloc(file->clusters * sizeof(undelete_run_struct_t));
+        check_null(file->runs);
+        while((file->found < file->clusters) && (cluster < entries))
+        {
+            if(fat_next_cluster(cluster) != 0)
+            {
+                skipped = true;
+            }
+            else
+            {
+                if((file->run_count == 0) || ((file->runs[file->run_count - 1].start + file->runs[file->run_count - 1].count) != cluster))
+                {
+                    file->runs[file->run_count].start = cluster;
+                    file->runs[file->run_count].count = 0;
+                    file->run_count += 1;
+                }
+                file->runs[file->run_count - 1].count += 1;
+                file->found += 1;
+            }
+            cluster += 1;
+        }
+        if(file->found < file->clusters)
+        {
+            file->status = UNDELETE_PARTIAL;
+        }
+        else if(skipped == true)
+        {
+            file->status = UNDELETE_GUESSED;
+        }
+        else
+        {
+            file->status = UNDELETE_CONTIGUOUS;
+        }
+    }
+}
+
+bool undelete_scan(undelete_struct_t* list)
+{
+    bool retValue = true;
+    uint32_t entries = fat_entry_count();
+    uint32_t i = 0;
+
+    memset(list,0,sizeof(undelete_struct_t));
+    retValue = fat_walk_deleted(collect_deleted,list);
+    if(entries == 0)
+    {
+        retValue = false;
+    }
+    else
+    {
+        /* the FAT is read in windows, guessed chains are short scans of free clusters */
+        for(i = 0;i < list->count;i++)
+        {
+            guess_chain(&list->files[i],entries);
+        }
+    }
+    return retValue;
+}
+
+static bool save_runs(const undelete_run_struct_t* runs,uint32_t run_count,uint32_t size,uint8_t* host_path)
+{
+    bool retValue = true;
+    FILE* host = NULL;
+    uint8_t* buff = NULL;
+    uint32_t cluster_size = fat_cluster_size();
+    uint32_t chunk_clusters = UNDELETE_CHUNK / cluster_size;
+    uint32_t cluster = 0;
+    uint32_t left = 0;
+    uint32_t n = 0;
+    uint32_t bytes = 0;
+    uint32_t i = 0;
+
+    if(chunk_clusters == 0)
+    {
+        chunk_clusters = 1;
+    }
+    host = fopen((const char*)host_path,"wb");
+    if(host == NULL)
+    {
+        retValue = false;
+    }
+    else
+    {
+        buff = (uint8_t*)malloc(chunk_clusters * cluster_size);
+        check_null(buff);
+        for(i = 0;(i < run_count) && (size > 0) && (retValue == true);i++)
+        {
+            cluster = runs[i].start;
+            left = runs[i].count;
+            while((left > 0) && (size > 0) && (retValue == true))
+            {
+                n = (left < chunk_clusters) ? left : chunk_clusters;
+                bytes = fat_read_raw_clusters(cluster,n,buff);
+                if(bytes > size)
+                {
+                    bytes = size;
+                }
+                if((bytes == 0) || (fwrite(buff,sizeof(uint8_t),bytes,host) != bytes))
+                {
+                    retValue = false;
+                }
+                size -= bytes;
+                cluster += n;
+                left -= n;
+            }
+        }
+        free(buff);
+        if(fclose(host) != 0)
+        {
+            retValue = false;
+        }
+    }
+    return retValue;
+}
+
+bool undelete_recover(const undelete_file_struct_t* file,uint8_t* host_path)
+{
+    uint32_t size = file->entry.size;
+
+    if((file->entry.attribute & 0x10) != 0)
+    {
+        size = file->clusters * fat_cluster_size();
+    }
+    return save_runs(file->runs,file->run_count,size,host_path);
+}
+
+void undelete_free(undelete_struct_t* list)
+{
+    uint32_t i = 0;
+
+    for(i = 0;i < list->count;i++)
+    {
+        free(list->files[i].path);
+        free(list->files[i].runs);
+    }
+    free(list->files);
+    memset(list,0,sizeof(undelete_struct_t));
+}
+
+static void carve_range(uint32_t index,uint32_t worker,void* arg)
+{
+    undelete_job_struct_t* job = (undelete_job_struct_t*)arg;
+    uint8_t* buff = job->buffers[worker];
+    uint32_t* table = job->tables[worker];
+    undelete_hit_struct_t* hits = NULL;
+    uint32_t hit_count = 0;
+    uint32_t cluster_size = fat_cluster_size();
+    uint32_t first = 2 + index * UNDELETE_RANGE;
+    uint32_t last = first + UNDELETE_RANGE;
+    uint32_t cluster = first;
+    uint32_t run = 0;
+    uint32_t scanned = 0;
+    uint32_t skipped = 0;
+    uint32_t same = 0;
+    uint32_t i = 0;
+    uint8_t k = 0;
+
+    if(last > job->entries)
+    {
+        last = job->entries;
+    }
+    /* table[i] is the FAT entry of cluster first + i */
+    last = first + fat_get_entries(first,last - first,table);
+    hits = (undelete_hit_struct_t*)malloc(UNDELETE_RANGE * sizeof(undelete_hit_struct_t));
+    check_null(hits);
+    while(cluster < last)
+    {
+        /* only free clusters are read, as large contiguous requests */
+        if(table[cluster - first] != 0)
+        {
+            cluster += 1;
+            continue;
+        }
+        run = 1;
+        while(((cluster + run) < last) && (run < job->chunk_clusters) && (table[cluster + run - first] == 0))
+        {
+            run += 1;
+        }
+        /* holes of a sparse image read as zeros, no signature starts there */
+        if(fat_cluster_hole(cluster,run,&same) == true)
+        {
+            skipped += same;
+            cluster += same;
+            continue;
+        }
+        run = same;
+        if(fat_read_raw_clusters(cluster,run,buff) == (run * cluster_size))
+        {
+            for(i = 0;i < run;i++)
+            {
+                for(k = 0;k < UNDELETE_SIGNATURES;k++)
+                {
+                    if(memcmp(&buff[i * cluster_size],g_signatures[k].magic,g_signatures[k].length) == 0)
+                    {
+                        hits[hit_count].cluster = cluster + i;
+                        hits[hit_count].clusters = 0;
+                        hits[hit_count].type = k;
+                        hit_count += 1;
+                        break;
+                    }
+                }
+            }
+            scanned += run;
+        }
+        cluster += run;
+    }
+
+    pthread_mutex_lock(&job->lock);
+    if((job->carve->count + hit_count) > job->carve->capacity)
+    {
+        job->carve->capacity = job->carve->count + hit_count + UNDELETE_GROW;
+        job->carve->hits = (undelete_hit_struct_t*)realloc(job->carve->hits,job->carve->capacity * sizeof(undelete_hit_struct_t));
+        check_null(job->carve->hits);
+    }
+    if(hit_count != 0)
+    {
+        memcpy(&job->carve->hits[job->carve->count],hits,hit_count * sizeof(undelete_hit_struct_t));
+        job->carve->count += hit_count;
+    }
+    job->carve->clusters_scanned += scanned;
+    job->carve->clusters_skipped += skipped;
+    pthread_mutex_unlock(&job->lock);
+    free(hits);
+}
+
+static int compare_hit(const void* a,const void* b)
+{
+    uint32_t cluster_a = ((const undelete_hit_struct_t*)a)->cluster;
+    uint32_t cluster_b = ((const undelete_hit_struct_t*)b)->cluster;
+
+    return (cluster_a > cluster_b) - (cluster_a < cluster_b);
+}
+
+bool undelete_carve(undelete_carve_struct_t* carve,uint32_t threads)
+{
+    bool retValue = false;
+    undelete_job_struct_t job;
+    uint32_t ranges = 0;
+    uint32_t i = 0;
+
+    memset(carve,0,sizeof(undelete_carve_struct_t));
+    job.carve = carve;
+    job.entries = fat_entry_count();
+    if(job.entries != 0)
+    {
+        if(threads == 0)
+        {
+            threads = pool_default_threads();
+        }
+        if(threads > POOL_MAX_THREADS)
+        {
+            threads = POOL_MAX_THREADS;
+        }
+        job.chunk_clusters = UNDELETE_CHUNK / fat_cluster_size();
+        if(job.chunk_clusters == 0)
+        {
+            job.chunk_clusters = 1;
+        }
+        job.buffers = (uint8_t**)calloc(threads,sizeof(uint8_t*));
+        check_null(job.buffers);
+        job.tables = (uint32_t**)calloc(threads,sizeof(uint32_t*));
+        check_null(job.tables);
+        for(i = 0;i < threads;i++)
+        {
+            job.buffers[i] = (uint8_t*)malloc(job.chunk_clusters * fat_cluster_size() + UNDELETE_MAGIC_SIZE);
+            check_null(job.buffers[i]);
+            job.tables[i] = (uint32_t*)malloc(UNDELETE_RANGE * sizeof(uint32_t));
+            check_null(job.tables[i]);
+        }
+        pthread_mutex_init(&job.lock,NULL);
+
+        ranges = (job.entries > 2) ? ((job.entries - 2 + UNDELETE_RANGE - 1) / UNDELETE_RANGE) : 0;
+        retValue = pool_run(ranges,threads,carve_range,&job);
+
+        /* a carved file runs over free clusters up to its end, never into the next hit */
+        if(carve->count != 0)
+        {
+            qsort(carve->hits,carve->count,sizeof(undelete_hit_struct_t),compare_hit);
+            pool_run(carve->count,threads,extend_hit,&job);
+        }
+
+        pthread_mutex_destroy(&job.lock);
+        for(i = 0;i < threads;i++)
+        {
+            free(job.buffers[i]);
+            free(job.tables[i]);
+        }
+        free(job.buffers);
+        free(job.tables);
+    }
+    return retValue;
+}
+
+static void extend_hit(uint32_t index,uint32_t worker,void* arg)
+{
+    undelete_job_struct_t* job = (undelete_job_struct_t*)arg;
+    undelete_hit_struct_t* hit = &job->carve->hits[index];
+    const undelete_signature_struct_t* signature = &g_signatures[hit->type];
+    uint8_t* data = job->buffers[worker] + UNDELETE_MAGIC_SIZE; /* the end of the cluster before is kept in front */
+    const uint8_t* found = NULL;
+    uint32_t cluster_size = fat_cluster_size();
+    uint32_t max_clusters = (signature->max_size + cluster_size - 1) / cluster_size;
+    uint32_t end = ((index + 1) < job->carve->count) ? job->carve->hits[index + 1].cluster : job->entries;
+    uint32_t cluster = hit->cluster;
+    uint32_t carry = 0;                         /* bytes of the cluster before in front of data */
+    uint32_t run = 0;
+    uint32_t i = 0;
+    uint64_t size = 0;                          /* bytes of the clusters before this one        */
+    uint64_t end_size = 0;                      /* bytes up to the last end marker, 0 = none    */
+    uint32_t end_clusters = 0;                  /* clusters up to the last end marker           */
+    bool done = false;
+
+    hit->clusters = 0;
+    while((done == false) && (cluster < end) && (hit->clusters < max_clusters))
+    {
+        if((fat_next_cluster(cluster) != 0) || (fat_read_raw_clusters(cluster,1,data) != cluster_size))
+        {
+            done = true;
+        }
+        else if((cluster != hit->cluster) && (fat_cluster_hole(cluster,1,&run) == true))
+        {
+            done = true;
+        }
+        else
+        {
+            for(i = 0;(cluster != hit->cluster) && (i < cluster_size) && (data[i] == 0);i++)
+            {
+                /* just check, don't do anything */
+            }
+            if(i == cluster_size) /* never written since it was freed */
+            {
+                done = true;
+                continue;
+            }
+            hit->clusters += 1;
+            if(signature->trailer_length > 0)
+            {
+                found = find_bytes(data - carry,carry + cluster_size,signature->trailer,signature->trailer_length);
+            }
+            while(found != NULL)
+            {
+                end_size = size + (uint64_t)(found - data + signature->trailer_length + signature->trailer_extra);
+                end_clusters = hit->clusters;
+                if(signature->trailer_last == false)
+                {
+                    done = true;
+                    found = NULL;
+                }
+                else
+                {
+                    found += signature->trailer_length;
+                    found = find_bytes(found,(uint32_t)(data + cluster_size - found),signature->trailer,signature->trailer_length);
+                }
+            }
+            size += cluster_size;
+            if((done == false) && (signature->trailer_length > 1))
+            {
+                carry = signature->trailer_length - 1;
+                memcpy(data - carry,data + cluster_size - carry,carry);
+            }
+            cluster += 1;
+        }
+    }
+    /* without an end marker the file is the clusters that were taken */
+    if(end_size > 0)
+    {
+        size = end_size;
+        hit->clusters = end_clusters;
+    }
+    if(size > ((uint64_t)hit->clusters * cluster_size))
+    {
+        size = (uint64_t)hit->clusters * cluster_size;
+    }
+    if(size > signature->max_size)
+    {
+        size = signature->max_size;
+    }
+    hit->size = (uint32_t)size;
+}
+
+static const uint8_t* find_bytes(const uint8_t* buff,uint32_t size,const uint8_t* bytes,uint32_t length)
+{
+    const uint8_t* retValue = NULL;
+    const uint8_t* last = (size >= length) ? (buff + size - length) : buff;
+
+    for(;(retValue == NULL) && (size >= length) && (buff <= last);buff++)
+    {
+        buff = (const uint8_t*)memchr(buff,bytes[0],last - buff + 1);
+        if(buff == NULL)
+        {
+            break;
+        }
+        if(memcmp(buff,bytes,length) == 0)
+        {
+            retValue = buff;
+        }
+    }
+    return retValue;
+}
+
+const uint8_t* undelete_carve_type(uint8_t type)
+{
+    const uint8_t* retValue = (const uint8_t*)"bin";
+
+    if(type < UNDELETE_SIGNATURES)
+    {
+        retValue = g_signatures[type].extension;
+    }
+    return retValue;
+}
+
+bool undelete_carve_save(const undelete_hit_struct_t* hit,uint8_t* host_path)
+{
+    undelete_run_struct_t run;
+
+    run.start = hit->cluster;
+    run.count = hit->clusters;
+    return save_runs(&run,1,hit->size,host_path);
+}
+
+void undelete_carve_free(undelete_carve_struct_t* carve)
+{
+    free(carve->hits);
+    memset(carve,0,sizeof(undelete_carve_struct_t));
+}
+
+static void check_null(void* ptr)
+{
+    if(ptr == NULL)
+    {
+        exit(1);
+    }
+}
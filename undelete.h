@@ -0,0 +1,115 @@
+#ifndef _UNDELETE_H_
+#define _UNDELETE_H_
+
+/*******************************************************************************
+* Definitions
+******************************************************************************/
+enum Undelete_Status
+{
+    UNDELETE_EMPTY = 0,                         /* no data (size 0)                         */
+    UNDELETE_CONTIGUOUS = 1,                    /* all clusters free right after the first  */
+    UNDELETE_GUESSED = 2,                       /* used clusters had to be skipped          */
+    UNDELETE_PARTIAL = 3,                       /* not enough free clusters left            */
+    UNDELETE_OVERWRITTEN = 4                    /* first cluster is in use again            */
+};
+
+typedef struct
+{
+    uint32_t start;                             /* first cluster                            */
+    uint32_t count;                             /* number of clusters                       */
+} undelete_run_struct_t;
+
+typedef struct
+{
+    uint8_t* path;                              /* full path of the deleted entry           */
+    fat_deleted_struct_t entry;                 /* recovered directory entry                */
+    uint8_t status;                             /* Undelete_Status                          */
+    uint32_t clusters;                          /* clusters the size needs                  */
+    uint32_t found;                             /* clusters in the guessed chain            */
+    undelete_run_struct_t* runs;                /* guessed chain                            */
+    uint32_t run_count;
+} undelete_file_struct_t;
+
+typedef struct
+{
+    undelete_file_struct_t* files;              /* entries in directory order               */
+    uint32_t count;
+    uint32_t capacity;
+} undelete_struct_t;
+
+typedef struct
+{
+    uint32_t cluster;                           /* cluster where the signature starts       */
+    uint32_t clusters;                          /* free clusters of the carved file         */
+    uint32_t size;                              /* bytes of the carved file                 */
+    uint8_t type;                               /* index in the signature table             */
+} undelete_hit_struct_t;
+
+typedef struct
+{
+    undelete_hit_struct_t* hits;                /* hits sorted by cluster                   */
+    uint32_t count;
+    uint32_t capacity;
+    uint64_t clusters_scanned;                  /* free clusters read                       */
+    uint64_t clusters_skipped;                  /* free clusters in holes of a sparse image */
+} undelete_carve_struct_t;
+
+/*******************************************************************************
+* API
+******************************************************************************/
+
+/** @brief This function finds the deleted entries of the mounted volume and guesses
+ * their chains: the FAT entries of a deleted file are cleared, so its clusters are
+ * taken as the free clusters that follow its first cluster.
+ * @param list - structure to store the result (release it with undelete_free()).
+ * @return - Return 1 if every directory was read.
+ */
+bool undelete_scan(undelete_struct_t* list);
+
+
+/** @brief This function writes the guessed data of a deleted file to a host file.
+ * @param file - entry found by undelete_scan().
+ * @param host_path - file to create.
+ * @return - Return 1 if the file was written.
+ */
+bool undelete_recover(const undelete_file_struct_t* file,uint8_t* host_path);
+
+
+/** @brief This function releases the result of undelete_scan().
+ * @param list - list to release.
+ */
+void undelete_free(undelete_struct_t* list);
+
+
+/** @brief This function scans the free clusters of the mounted volume for known file
+ * signatures at cluster boundaries. Cluster ranges are read in parallel. A hit runs
+ * over the free clusters after it up to the end marker of its format, its maximum
+ * size, the next hit, or a used, zero-filled or hole cluster.
+ * @param carve - structure to store the result (release it with undelete_carve_free()).
+ * @param threads - number of threads (0 = one per CPU).
+ * @return - Return 1 if every range was scanned.
+ */
+bool undelete_carve(undelete_carve_struct_t* carve,uint32_t threads);
+
+
+/** @brief This function returns the file extension of a signature type.
+ * @param type - type of a hit.
+ * @return - Return the extension ("jpg", "png", ...).
+ */
+const uint8_t* undelete_carve_type(uint8_t type);
+
+
+/** @brief This function writes the clusters of a carving hit to a host file.
+ * @param hit - hit found by undelete_carve().
+ * @param host_path - file to create.
+ * @return - Return 1 if the file was written.
+ */
+bool undelete_carve_save(const undelete_hit_struct_t* hit,uint8_t* host_path);
+
+
+/** @brief This function releases the result of undelete_carve().
+ * @param carve - result to release.
+ */
+void undelete_carve_free(undelete_carve_struct_t* carve);
+
+#endif /* _UNDELETE_H_ */